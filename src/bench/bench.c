@@ -0,0 +1,655 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2026 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Micro-benchmarks for the message handling hot paths, run by
+ * `zig build bench`. Every corpus is generated from a fixed seed so
+ * that numbers from different releases can be compared directly.
+ *
+ * usage: bench [-b baseline] [-t percent] [name ...]
+ *
+ * The output of one run can be saved and passed back with -b; any
+ * benchmark that got slower than the baseline by more than -t percent
+ * (default 10) is reported and makes the run exit with status 1.
+ *
+ * This is experimental: it has not been built or run yet, and is not
+ * part of the default build or the tests.
+ */
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "folder.h"
+#include "procheader.h"
+#include "procmsg.h"
+#include "procmime.h"
+#include "msgcache.h"
+#include "unmime.h"
+#include "utils.h"
+#include "fence.h"
+
+#define BENCH_SEED		0x7a11045
+#define BENCH_MSGS		2000
+#define BENCH_HEADERS		4096
+#define BENCH_DOMAINS		8192
+#define BENCH_PART_SIZE		(256 * 1024)
+#define BENCH_ROUNDS		5
+#define BENCH_ROUND_USEC	(200 * 1000)
+
+typedef struct _Bench Bench;
+
+struct _Bench {
+	const gchar *name;
+	/* runs once over the corpus and returns the number of items done */
+	guint (*func)(void);
+};
+
+/* main.c is not linked in, so provide what the rest of the code
+ * expects from it. */
+gchar *prog_version = "bench";
+
+void app_will_exit(GtkWidget *widget, gpointer data)
+{
+}
+
+gboolean clean_quit(gpointer data)
+{
+	return FALSE;
+}
+
+gboolean claws_is_exiting(void)
+{
+	return FALSE;
+}
+
+gboolean claws_is_starting(void)
+{
+	return FALSE;
+}
+
+gchar *claws_get_socket_name(void)
+{
+	return "";
+}
+
+static const gchar *words[] = {
+	"meeting", "report", "draft", "review", "patch", "release", "build",
+	"schedule", "invoice", "holiday", "question", "update", "minutes",
+	"agenda", "budget", "proposal", "summary", "notes", "feedback", "plan",
+	"café", "naïve", "Grüße", "résumé", "Ærø", "日本語", "привет", "ελληνικά",
+};
+
+static const gchar *names[] = {
+	"Alice Example", "Bob Sample", "Carol Tester", "Dave Müller",
+	"Eve Ñúñez", "Frank O'Neil", "Grace Hopper", "Heidi Klum",
+};
+
+static const gchar *hosts[] = {
+	"example.com", "example.org", "mail.example.net", "lists.example.de",
+	"post.example.co.uk", "example.jp",
+};
+
+static const gchar *tlds[] = {
+	"com", "org", "net", "de", "uk", "jp", "io", "xn--p1ai", "museum",
+	"example", "invalid", "localdomain", "zz", "c", "comx", "", "travel",
+	"ninja", "photography", "co",
+};
+
+static gchar *bench_dir;
+static GRand *bench_rand;
+
+static gchar **msg_files;
+static GSList *msg_list;
+static FolderItem *bench_item;
+static gchar *cache_file;
+static gchar *mark_file;
+static MsgCache *write_cache;
+static MsgThreadTree *thread_tree;
+static gchar **headers;
+static gchar **domains;
+static gchar *b64_file;
+static glong b64_len;
+static gchar *qp_file;
+static glong qp_len;
+
+static const gchar *pick(const gchar **list, guint len)
+{
+	return list[g_rand_int_range(bench_rand, 0, len)];
+}
+
+static void write_file(const gchar *file, const gchar *data, gsize len)
+{
+	GError *error = NULL;
+
+	if (!g_file_set_contents(file, data, len, &error)) {
+		g_printerr("bench: %s\n", error->message);
+		exit(2);
+	}
+}
+
+static void append_words(GString *str, gint n)
+{
+	gint i;
+
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			g_string_append_c(str, ' ');
+		g_string_append(str, pick(words, G_N_ELEMENTS(words)));
+	}
+}
+
+static void append_encoded_word(GString *str, const gchar *text, gboolean b)
+{
+	const guchar *p;
+
+	if (b) {
+		gchar *enc = g_base64_encode((const guchar *)text, strlen(text));
+		g_string_append_printf(str, "=?UTF-8?B?%s?=", enc);
+		g_free(enc);
+		return;
+	}
+
+	g_string_append(str, "=?UTF-8?Q?");
+	for (p = (const guchar *)text; *p != '\0'; p++) {
+		if (*p == ' ')
+			g_string_append_c(str, '_');
+		else if (*p < 0x21 || *p > 0x7e || *p == '=' || *p == '?' || *p == '_')
+			g_string_append_printf(str, "=%02X", *p);
+		else
+			g_string_append_c(str, *p);
+	}
+	g_string_append(str, "?=");
+}
+
+/* A mailbox of BENCH_MSGS messages with a realistic header block and
+ * threads of varying depth built from In-Reply-To and References. */
+static void make_messages(void)
+{
+	gchar *dir;
+	GString *msg = g_string_sized_new(8192);
+	MsgFlags flags = { MSG_NEW | MSG_UNREAD, 0 };
+	gint *parent = g_new(gint, BENCH_MSGS);
+	time_t base = 1700000000;
+	gint i, j, n;
+
+	dir = g_build_filename(bench_dir, "mh", NULL);
+	if (make_dir_hier(dir) < 0)
+		exit(2);
+
+	msg_files = g_new0(gchar *, BENCH_MSGS + 1);
+	for (i = 0; i < BENCH_MSGS; i++) {
+		gchar date[64];
+		time_t t = base + i * 600;
+		struct tm tm;
+		const gchar *host = pick(hosts, G_N_ELEMENTS(hosts));
+
+		parent[i] = -1;
+		if (i > 0 && g_rand_int_range(bench_rand, 0, 10) < 6)
+			parent[i] = MAX(0, i - g_rand_int_range(bench_rand, 1, 50));
+
+		g_string_truncate(msg, 0);
+		g_string_append_printf(msg,
+			"Return-Path: <list-bounces@%s>\n"
+			"Received: from mx%d.%s (mx%d.%s [192.0.2.%d])\n"
+			"\tby mail.example.org with ESMTPS id %08x\n"
+			"\tfor <user@example.org>; Tue, 14 Nov 2023 12:00:00 +0000\n",
+			host, i % 7, host, i % 7, host, i % 250, g_rand_int(bench_rand));
+		gmtime_r(&t, &tm);
+		strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S +0000", &tm);
+		g_string_append_printf(msg, "Date: %s\n", date);
+		g_string_append_printf(msg, "From: %s <user%d@%s>\n",
+			pick(names, G_N_ELEMENTS(names)), i % 97, host);
+		g_string_append_printf(msg, "To: %s <list@example.org>\n",
+			pick(names, G_N_ELEMENTS(names)));
+		g_string_append(msg, "Subject: ");
+		if (parent[i] >= 0)
+			g_string_append(msg, "Re: ");
+		if (i % 3 == 0) {
+			GString *text = g_string_new(NULL);
+			append_words(text, 4);
+			append_encoded_word(msg, text->str, i % 2);
+			g_string_free(text, TRUE);
+		} else {
+			append_words(msg, 5);
+		}
+		g_string_append_printf(msg, "\nMessage-ID: <%d.%x@bench.example.org>\n",
+			i, BENCH_SEED);
+		if (parent[i] >= 0) {
+			g_string_append_printf(msg, "In-Reply-To: <%d.%x@bench.example.org>\n",
+				parent[i], BENCH_SEED);
+			g_string_append(msg, "References:");
+			for (j = parent[i], n = 0; j >= 0 && n < 10; j = parent[j], n++)
+				g_string_append_printf(msg, " <%d.%x@bench.example.org>",
+					j, BENCH_SEED);
+			g_string_append_c(msg, '\n');
+		}
+		g_string_append(msg,
+			"MIME-Version: 1.0\n"
+			"Content-Type: text/plain; charset=UTF-8\n"
+			"Content-Transfer-Encoding: 8bit\n"
+			"List-Id: Benchmark list <bench.example.org>\n"
+			"X-Mailer: bench\n"
+			"\n");
+		for (j = g_rand_int_range(bench_rand, 10, 60); j > 0; j--) {
+			append_words(msg, 10);
+			g_string_append_c(msg, '\n');
+		}
+
+		msg_files[i] = g_strdup_printf("%s%c%d", dir, G_DIR_SEPARATOR, i + 1);
+		write_file(msg_files[i], msg->str, msg->len);
+	}
+
+	bench_item = g_new0(FolderItem, 1);
+	bench_item->stype = F_NORMAL;
+	bench_item->parent_stype = F_NORMAL;
+
+	write_cache = msgcache_new();
+	for (i = 0; i < BENCH_MSGS; i++) {
+		MsgInfo *msginfo = procheader_parse_file(msg_files[i], flags, FALSE, FALSE);
+
+		if (msginfo == NULL)
+			exit(2);
+		msginfo->msgnum = i + 1;
+		msginfo->folder = bench_item;
+		msg_list = g_slist_prepend(msg_list, msginfo);
+		msgcache_add_msg(write_cache, msginfo);
+	}
+	msg_list = g_slist_reverse(msg_list);
+
+	cache_file = g_build_filename(bench_dir, ".talons_cache", NULL);
+	mark_file = g_build_filename(bench_dir, ".talons_mark", NULL);
+	if (msgcache_write(cache_file, mark_file, NULL, write_cache) < 0)
+		exit(2);
+
+	g_free(parent);
+	g_string_free(msg, TRUE);
+	g_free(dir);
+}
+
+static void make_headers(void)
+{
+	GString *str = g_string_new(NULL);
+	GString *text = g_string_new(NULL);
+	gint i;
+
+	headers = g_new0(gchar *, BENCH_HEADERS + 1);
+	for (i = 0; i < BENCH_HEADERS; i++) {
+		g_string_truncate(str, 0);
+		g_string_truncate(text, 0);
+		append_words(text, g_rand_int_range(bench_rand, 2, 8));
+		switch (i % 4) {
+		case 0:
+			g_string_append(str, text->str);
+			break;
+		case 1:
+			append_encoded_word(str, text->str, TRUE);
+			break;
+		case 2:
+			g_string_append(str, "Re: ");
+			append_encoded_word(str, text->str, FALSE);
+			break;
+		case 3:
+			/* two adjacent encoded words, joined on decoding */
+			append_encoded_word(str, text->str, TRUE);
+			g_string_append(str, "\n ");
+			append_encoded_word(str, pick(words, G_N_ELEMENTS(words)), FALSE);
+			g_string_append(str, " <user@example.org>");
+			break;
+		}
+		headers[i] = g_strdup(str->str);
+	}
+	g_string_free(text, TRUE);
+	g_string_free(str, TRUE);
+}
+
+static void make_domains(void)
+{
+	gint i;
+
+	domains = g_new0(gchar *, BENCH_DOMAINS + 1);
+	for (i = 0; i < BENCH_DOMAINS; i++)
+		domains[i] = g_strdup(pick(tlds, G_N_ELEMENTS(tlds)));
+}
+
+static void make_parts(void)
+{
+	guchar *raw = g_malloc(BENCH_PART_SIZE);
+	gchar *enc;
+	GString *str;
+	gsize i;
+
+	for (i = 0; i < BENCH_PART_SIZE; i++)
+		raw[i] = g_rand_int(bench_rand) & 0xff;
+
+	/* base64 wrapped at 76 columns as a MUA would send it */
+	enc = g_base64_encode(raw, BENCH_PART_SIZE);
+	str = g_string_sized_new(BENCH_PART_SIZE * 2);
+	for (i = 0; enc[i] != '\0'; i += 76) {
+		g_string_append_len(str, enc + i, MIN(76, strlen(enc + i)));
+		g_string_append_c(str, '\n');
+	}
+	b64_file = g_build_filename(bench_dir, "part.b64", NULL);
+	b64_len = str->len;
+	write_file(b64_file, str->str, str->len);
+	g_free(enc);
+
+	g_string_truncate(str, 0);
+	while (str->len < BENCH_PART_SIZE) {
+		GString *line = g_string_new(NULL);
+		const guchar *p;
+		gint col = 0;
+
+		append_words(line, 14);
+		for (p = (const guchar *)line->str; *p != '\0'; p++) {
+			if (col >= 72) {
+				g_string_append(str, "=\n");
+				col = 0;
+			}
+			if (*p > 0x7e || *p == '=') {
+				g_string_append_printf(str, "=%02X", *p);
+				col += 3;
+			} else {
+				g_string_append_c(str, *p);
+				col++;
+			}
+		}
+		g_string_append_c(str, '\n');
+		g_string_free(line, TRUE);
+	}
+	qp_file = g_build_filename(bench_dir, "part.qp", NULL);
+	qp_len = str->len;
+	write_file(qp_file, str->str, str->len);
+
+	g_string_free(str, TRUE);
+	g_free(raw);
+}
+
+static guint bench_procheader_parse_file(void)
+{
+	MsgFlags flags = { MSG_NEW | MSG_UNREAD, 0 };
+	gint i;
+
+	for (i = 0; i < BENCH_MSGS; i++) {
+		MsgInfo *msginfo = procheader_parse_file(msg_files[i], flags, FALSE, FALSE);
+		procmsg_msginfo_free(&msginfo);
+	}
+	return BENCH_MSGS;
+}
+
+static guint bench_msgcache_read_cache(void)
+{
+	MsgCache *cache = msgcache_read_cache(bench_item, cache_file);
+
+	if (cache == NULL)
+		exit(2);
+	msgcache_read_mark(cache, mark_file);
+	msgcache_destroy(cache);
+	return BENCH_MSGS;
+}
+
+static guint bench_msgcache_write(void)
+{
+	if (msgcache_write(cache_file, mark_file, NULL, write_cache) < 0)
+		exit(2);
+	return BENCH_MSGS;
+}
+
+static guint bench_procmsg_get_thread_tree(void)
+{
+	GNode *root = procmsg_get_thread_tree(msg_list);
+
+	g_node_destroy(root);
+	return BENCH_MSGS;
+}
+
+/* A refresh of the threaded summary after one message is gone and
+ * again after it is back, against the folder's whole list */
+static guint bench_procmsg_thread_tree_update(void)
+{
+	if (thread_tree == NULL) {
+		thread_tree = procmsg_thread_tree_new();
+		procmsg_thread_tree_update(thread_tree, msg_list);
+	}
+	procmsg_thread_tree_update(thread_tree, msg_list->next);
+	procmsg_thread_tree_update(thread_tree, msg_list);
+	return BENCH_MSGS;
+}
+
+static guint bench_msgcache_get_msg_descendants(void)
+{
+	GSList *cur, *children;
+
+	for (cur = msg_list; cur != NULL; cur = cur->next) {
+		children = msgcache_get_msg_descendants(write_cache, cur->data);
+		procmsg_msg_list_free(children);
+	}
+	return BENCH_MSGS;
+}
+
+static guint decode_part(const gchar *file, glong len, EncodingType encoding)
+{
+	MimeInfo *mimeinfo = procmime_mimeinfo_new();
+
+	mimeinfo->content = MIMECONTENT_FILE;
+	mimeinfo->data.filename = g_strdup(file);
+	mimeinfo->offset = 0;
+	mimeinfo->length = len;
+	mimeinfo->encoding_type = encoding;
+	mimeinfo->type = MIMETYPE_APPLICATION;
+	mimeinfo->subtype = g_strdup("octet-stream");
+	if (!procmime_decode_content(mimeinfo))
+		exit(2);
+	procmime_mimeinfo_free_all(&mimeinfo);
+	return len / 1024;
+}
+
+static guint bench_procmime_decode_base64(void)
+{
+	return decode_part(b64_file, b64_len, ENC_BASE64);
+}
+
+static guint bench_procmime_decode_qp(void)
+{
+	return decode_part(qp_file, qp_len, ENC_QUOTED_PRINTABLE);
+}
+
+static guint bench_unmime_header(void)
+{
+	gint i;
+
+	for (i = 0; i < BENCH_HEADERS; i++)
+		g_free(unmime_header(headers[i], i % 4 == 3));
+	return BENCH_HEADERS;
+}
+
+static guint bench_fence_is_top_level_domain(void)
+{
+	volatile gint found = 0;
+	gint i;
+
+	for (i = 0; i < BENCH_DOMAINS; i++)
+		found += fence_is_top_level_domain(domains[i]);
+	return BENCH_DOMAINS;
+}
+
+/* Per item costs; the decode benchmarks count kilobytes of input. */
+static const Bench benches[] = {
+	{ "procheader_parse_file",		bench_procheader_parse_file },
+	{ "msgcache_read_cache",		bench_msgcache_read_cache },
+	{ "msgcache_write",			bench_msgcache_write },
+	{ "procmsg_get_thread_tree",		bench_procmsg_get_thread_tree },
+	{ "procmsg_thread_tree_update",		bench_procmsg_thread_tree_update },
+	{ "msgcache_get_msg_descendants",	bench_msgcache_get_msg_descendants },
+	{ "procmime_decode_content/base64",	bench_procmime_decode_base64 },
+	{ "procmime_decode_content/qp",		bench_procmime_decode_qp },
+	{ "unmime_header",			bench_unmime_header },
+	{ "fence_is_top_level_domain",		bench_fence_is_top_level_domain },
+};
+
+/* Runs the benchmark for BENCH_ROUNDS rounds of at least
+ * BENCH_ROUND_USEC each, keeping the fastest round as the least
+ * disturbed by the rest of the system. */
+static gdouble run_bench(const Bench *bench, guint64 *iterations)
+{
+	gdouble best = -1;
+	gint round;
+
+	bench->func();
+	*iterations = 0;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		gint64 start = g_get_monotonic_time();
+		gint64 elapsed;
+		guint64 items = 0;
+
+		do {
+			items += bench->func();
+			(*iterations)++;
+			elapsed = g_get_monotonic_time() - start;
+		} while (elapsed < BENCH_ROUND_USEC);
+
+		if (best < 0 || elapsed * 1000.0 / items < best)
+			best = elapsed * 1000.0 / items;
+	}
+	return best;
+}
+
+static GHashTable *read_baseline(const gchar *file)
+{
+	GHashTable *table;
+	FILE *fp;
+	gchar buf[BUFFSIZE];
+
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		g_printerr("bench: %s: %s\n", file, g_strerror(errno));
+		exit(2);
+	}
+	table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		gchar name[128];
+		gdouble *nsop = g_new(gdouble, 1);
+
+		if (sscanf(buf, "%127s %*u %lf", name, nsop) != 2) {
+			g_free(nsop);
+			continue;
+		}
+		g_hash_table_insert(table, g_strdup(name), nsop);
+	}
+	fclose(fp);
+	return table;
+}
+
+static gboolean selected(const gchar *name, gint argc, gchar **argv)
+{
+	gint i;
+
+	if (argc == 0)
+		return TRUE;
+	for (i = 0; i < argc; i++)
+		if (strstr(name, argv[i]) != NULL)
+			return TRUE;
+	return FALSE;
+}
+
+int main(int argc, char *argv[])
+{
+	GHashTable *baseline = NULL;
+	gdouble tolerance = 10;
+	gboolean regressed = FALSE;
+	GError *error = NULL;
+	gint c;
+	guint i;
+
+	while ((c = getopt(argc, argv, "b:t:")) != -1) {
+		switch (c) {
+		case 'b':
+			baseline = read_baseline(optarg);
+			break;
+		case 't':
+			tolerance = g_ascii_strtod(optarg, NULL);
+			break;
+		default:
+			g_printerr("usage: bench [-b baseline] [-t percent] [name ...]\n");
+			return 2;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	bench_dir = g_dir_make_tmp("talons-bench-XXXXXX", &error);
+	if (bench_dir == NULL) {
+		g_printerr("bench: %s\n", error->message);
+		return 2;
+	}
+	set_rc_dir(bench_dir);
+	if (make_dir_hier(get_mime_tmp_dir()) < 0)
+		return 2;
+
+	bench_rand = g_rand_new_with_seed(BENCH_SEED);
+	make_messages();
+	make_headers();
+	make_domains();
+	make_parts();
+
+	for (i = 0; i < G_N_ELEMENTS(benches); i++) {
+		const Bench *bench = &benches[i];
+		guint64 iterations;
+		gdouble nsop, *base;
+
+		if (!selected(bench->name, argc, argv))
+			continue;
+
+		nsop = run_bench(bench, &iterations);
+		printf("%-32s %10" G_GUINT64_FORMAT " %12.1f ns/op", bench->name,
+			iterations, nsop);
+		if (baseline != NULL &&
+		    (base = g_hash_table_lookup(baseline, bench->name)) != NULL) {
+			gdouble delta = (nsop - *base) * 100 / *base;
+
+			printf(" %+7.1f%%", delta);
+			if (delta > tolerance) {
+				printf(" REGRESSION");
+				regressed = TRUE;
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	msgcache_destroy(write_cache);
+	procmsg_thread_tree_free(thread_tree);
+	procmsg_msg_list_free(msg_list);
+	g_strfreev(msg_files);
+	g_strfreev(headers);
+	g_strfreev(domains);
+	g_free(bench_item);
+	g_rand_free(bench_rand);
+	remove_dir_recursive(bench_dir);
+	if (baseline != NULL)
+		g_hash_table_destroy(baseline);
+
+	return regressed ? 1 : 0;
+}
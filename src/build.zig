@@ -16,16 +16,32 @@ fn cFiles(name: []const u8) ![][]const u8 {
     return files.toOwnedSlice(dba);
 }
 
+// The application sources without main.c, for executables such as the
+// benchmarks that bring their own main().
+fn appFiles(extra: []const []const u8) ![][]const u8 {
+    const dba = alloc.allocator();
+    var files = std.ArrayList([]const u8).empty;
+    for (try cFiles(".")) |f| {
+        if (!std.mem.eql(u8, std.fs.path.basename(f), "main.c")) {
+            try files.append(dba, f);
+        }
+    }
+    try files.appendSlice(dba, extra);
+    return files.toOwnedSlice(dba);
+}
+
 pub fn build(b: *std.Build) void {
     // Standard target options allows the person running `zig build` to choose
     // what target to build for. Here we do not override the defaults, which
     // means any target is allowed, and the default is native. Other options
     // for restricting supported target set are available.
     const target = b.standardTargetOptions(.{});
+    const optimize = b.standardOptimizeOption(.{});
 
     const fence_mod = b.createModule(.{
         .root_source_file = b.path("fence/root.zig"),
         .target = target,
+        .optimize = optimize,
     });
     const fence = b.addLibrary(.{
         .name = "fence",
@@ -44,6 +60,7 @@ pub fn build(b: *std.Build) void {
 
     const common_mod = b.createModule(.{
         .target = target,
+        .optimize = optimize,
         .link_libc = true,
     });
     common_mod.linkLibrary(fence);
@@ -62,6 +79,7 @@ pub fn build(b: *std.Build) void {
 
     const gtk_mod = b.createModule(.{
         .target = target,
+        .optimize = optimize,
         .link_libc = true,
     });
     for (extlibs) |l| {
@@ -81,6 +99,7 @@ pub fn build(b: *std.Build) void {
 
     const etpan_mod = b.createModule(.{
         .target = target,
+        .optimize = optimize,
         .link_libc = true,
     });
     for (extlibs) |l| {
@@ -102,7 +121,7 @@ pub fn build(b: *std.Build) void {
 
     const exe_mod = b.createModule(.{
         .target = target,
-        .optimize = b.standardOptimizeOption(.{}),
+        .optimize = optimize,
         .link_libc = true,
     });
     exe_mod.linkLibrary(fence);
@@ -119,15 +138,16 @@ pub fn build(b: *std.Build) void {
         .name = "talons",
         .root_module = exe_mod,
     });
+    const app_flags = [_][]const u8{
+        "-Wall",
+        "-DGTK_DISABLE_DEPRECATION_WARNINGS",
+        "-DGDK_DISABLE_DEPRECATION_WARNINGS",
+        "-g",
+        "-std=c17",
+    };
     exe.addCSourceFiles(.{
         .files = cFiles(".") catch unreachable,
-        .flags = &.{
-            "-Wall",
-            "-DGTK_DISABLE_DEPRECATION_WARNINGS",
-            "-DGDK_DISABLE_DEPRECATION_WARNINGS",
-            "-g",
-            "-std=c17",
-        },
+        .flags = &app_flags,
     });
     exe.addIncludePath(b.path(".."));
     exe.addIncludePath(b.path("."));
@@ -172,4 +192,45 @@ pub fn build(b: *std.Build) void {
     // running the unit tests.
     const test_step = b.step("test", "Run unit tests");
     test_step.dependOn(&run_exe_unit_tests.step);
+
+    const bench_mod = b.createModule(.{
+        .target = target,
+        .optimize = optimize,
+        .link_libc = true,
+    });
+    bench_mod.linkLibrary(fence);
+    bench_mod.linkLibrary(common);
+    bench_mod.linkLibrary(gtk);
+    bench_mod.linkLibrary(etpan);
+    for (extlibs) |l| {
+        bench_mod.linkSystemLibrary(l, .{});
+    }
+    const bench = b.addExecutable(.{
+        .name = "bench",
+        .root_module = bench_mod,
+    });
+    bench.addCSourceFiles(.{
+        .files = appFiles(&.{"bench/bench.c"}) catch unreachable,
+        .flags = &app_flags,
+    });
+    bench.addIncludePath(b.path(".."));
+    bench.addIncludePath(b.path("."));
+    bench.addIncludePath(b.path("etpan"));
+    bench.addIncludePath(b.path("gtk"));
+    bench.addIncludePath(b.path("common"));
+    bench.addIncludePath(b.path("zig-out/include"));
+    bench.addSystemIncludePath(b.path("../../../../../usr/local/include/atk-1.0"));
+
+    // Experimental: the benchmarks have not been built or run with this
+    // build script yet, so the step may need fixing before it works.
+    // Numbers are only comparable between builds with the same -Doptimize;
+    // use ReleaseFast when recording a baseline. Arguments after `--` are
+    // passed through, e.g. `zig build bench -Doptimize=ReleaseFast -- -b
+    // baseline.txt`.
+    const run_bench = b.addRunArtifact(bench);
+    if (b.args) |args| {
+        run_bench.addArgs(args);
+    }
+    const bench_step = b.step("bench", "Run micro-benchmarks (experimental)");
+    bench_step.dependOn(&run_bench.step);
 }
@@ -484,32 +484,31 @@ static gint conv_sjistoutf8(gchar *outbuf, gint outlen, const gchar *inbuf)
 
 static gint conv_euctoutf8(gchar *outbuf, gint outlen, const gchar *inbuf)
 {
+	static GMutex mutex;
 	static iconv_t cd = (iconv_t)-1;
 	static gboolean iconv_ok = TRUE;
-	gchar *tmpstr;
+	gchar *tmpstr = NULL;
 
 	cm_return_val_if_fail(inbuf != NULL, 0);
 	cm_return_val_if_fail(outbuf != NULL, 0);
 
-	if (cd == (iconv_t)-1) {
-		if (!iconv_ok) {
-			strncpy2(outbuf, inbuf, outlen);
-			return -1;
-		}
+	/* headers may be decoded from several threads at once, and an
+	   iconv descriptor carries shift state between calls */
+	g_mutex_lock(&mutex);
+	if (cd == (iconv_t)-1 && iconv_ok) {
 		cd = iconv_open(CS_UTF_8, CS_EUC_JP_MS);
-		if (cd == (iconv_t)-1) {
+		if (cd == (iconv_t)-1)
 			cd = iconv_open(CS_UTF_8, CS_EUC_JP);
-			if (cd == (iconv_t)-1) {
-				g_warning("conv_euctoutf8(): %s",
-					  g_strerror(errno));
-				iconv_ok = FALSE;
-				strncpy2(outbuf, inbuf, outlen);
-				return -1;
-			}
+		if (cd == (iconv_t)-1) {
+			g_warning("conv_euctoutf8(): %s",
+				  g_strerror(errno));
+			iconv_ok = FALSE;
 		}
 	}
+	if (cd != (iconv_t)-1)
+		tmpstr = conv_iconv_strdup_with_cd(inbuf, cd);
+	g_mutex_unlock(&mutex);
 
-	tmpstr = conv_iconv_strdup_with_cd(inbuf, cd);
 	if (tmpstr) {
 		strncpy2(outbuf, tmpstr, outlen);
 		g_free(tmpstr);
@@ -548,32 +547,30 @@ static gint conv_anytoutf8(gchar *outbuf, gint outlen, const gchar *inbuf)
 
 static gint conv_utf8toeuc(gchar *outbuf, gint outlen, const gchar *inbuf)
 {
+	static GMutex mutex;
 	static iconv_t cd = (iconv_t)-1;
 	static gboolean iconv_ok = TRUE;
-	gchar *tmpstr;
+	gchar *tmpstr = NULL;
 
 	cm_return_val_if_fail(inbuf != NULL, 0);
 	cm_return_val_if_fail(outbuf != NULL, 0);
 
-	if (cd == (iconv_t)-1) {
-		if (!iconv_ok) {
-			strncpy2(outbuf, inbuf, outlen);
-			return -1;
-		}
+	/* see conv_euctoutf8() */
+	g_mutex_lock(&mutex);
+	if (cd == (iconv_t)-1 && iconv_ok) {
 		cd = iconv_open(CS_EUC_JP_MS, CS_UTF_8);
-		if (cd == (iconv_t)-1) {
+		if (cd == (iconv_t)-1)
 			cd = iconv_open(CS_EUC_JP, CS_UTF_8);
-			if (cd == (iconv_t)-1) {
-				g_warning("conv_utf8toeuc(): %s",
-					  g_strerror(errno));
-				iconv_ok = FALSE;
-				strncpy2(outbuf, inbuf, outlen);
-				return -1;
-			}
+		if (cd == (iconv_t)-1) {
+			g_warning("conv_utf8toeuc(): %s",
+				  g_strerror(errno));
+			iconv_ok = FALSE;
 		}
 	}
+	if (cd != (iconv_t)-1)
+		tmpstr = conv_iconv_strdup_with_cd(inbuf, cd);
+	g_mutex_unlock(&mutex);
 
-	tmpstr = conv_iconv_strdup_with_cd(inbuf, cd);
 	if (tmpstr) {
 		strncpy2(outbuf, tmpstr, outlen);
 		g_free(tmpstr);
@@ -40,7 +40,7 @@
 #define DONATE_URI		"https://www.claws-mail.org/donations.php"
 #define RELEASE_NOTES_FILE	"RELEASE_NOTES"
 #define FOLDER_LIST		"folderlist.xml"
-#define CACHE_VERSION		24
+#define CACHE_VERSION		25
 #define MARK_VERSION		2
 
 #define ACTIONS_RC		"actionsrc"
@@ -123,3 +123,17 @@ gboolean hooks_invoke(const gchar *hooklist_name,
 
 	return marshal_data.abort;
 }
+
+/* Whether anything is registered on hooklist_name, for callers that can
+ * skip preparing the source otherwise. */
+gboolean hooks_has_hooks(const gchar *hooklist_name)
+{
+	GHookList *hooklist;
+
+	cm_return_val_if_fail(hooklist_name != NULL, FALSE);
+
+	hooklist = hooks_get_hooklist(hooklist_name);
+	cm_return_val_if_fail(hooklist != NULL, FALSE);
+
+	return g_hook_first_valid(hooklist, TRUE) != NULL;
+}
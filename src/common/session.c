@@ -41,10 +41,14 @@ static gboolean session_timeout_cb	(gpointer	 data);
 
 static gboolean session_recv_msg_idle_cb	(gpointer	 data);
 static gboolean session_recv_data_idle_cb	(gpointer	 data);
+static gboolean session_recv_stream_idle_cb	(gpointer	 data);
 
 static gboolean session_read_msg_cb	(SockInfo	*source,
 					 GIOCondition	 condition,
 					 gpointer	 data);
+static gboolean session_read_stream_cb	(SockInfo	*source,
+					 GIOCondition	 condition,
+					 gpointer	 data);
 static gboolean session_read_data_cb	(SockInfo	*source,
 					 GIOCondition	 condition,
 					 gpointer	 data);
@@ -510,6 +514,44 @@ gint session_recv_data(Session *session, guint size, const gchar *terminator)
 	return 0;
 }
 
+/*!
+ *\brief	Receive data of unknown length without buffering all of it:
+ *		what arrives is handed to the recv_stream method as it
+ *		comes, until that reports the end of the data.
+ *		recv_data_finished is then called with no data.
+ */
+gint session_recv_stream(Session *session)
+{
+	cm_return_val_if_fail(session->recv_stream != NULL, -1);
+
+	session->state = SESSION_RECV;
+	session->read_stream_len = 0;
+	g_date_time_unref(session->tv_prev);
+	session->tv_prev = g_date_time_new_now_local();
+
+	if (session->read_buf_len > 0)
+		g_idle_add(session_recv_stream_idle_cb, session);
+	else
+		session->io_tag = sock_add_watch(session->sock, G_IO_IN,
+						 session_read_stream_cb, session);
+
+	return 0;
+}
+
+static gboolean session_recv_stream_idle_cb(gpointer data)
+{
+	Session *session = SESSION(data);
+	gboolean ret;
+
+	ret = session_read_stream_cb(session->sock, G_IO_IN, session);
+
+	if (ret == TRUE)
+		session->io_tag = sock_add_watch(session->sock, G_IO_IN,
+						 session_read_stream_cb, session);
+
+	return FALSE;
+}
+
 static gboolean session_recv_data_idle_cb(gpointer data)
 {
 	Session *session = SESSION(data);
@@ -620,6 +662,126 @@ static gboolean session_read_msg_cb(SockInfo *source, GIOCondition condition,
 	return FALSE;
 }
 
+static gboolean session_read_stream_cb(SockInfo *source, GIOCondition condition,
+				       gpointer data)
+{
+	Session *session = SESSION(data);
+	gboolean done = FALSE;
+	gint used;
+	gint ret;
+
+	cm_return_val_if_fail(condition == G_IO_IN, FALSE);
+
+	session_set_timeout(session, session->timeout_interval);
+
+	if (session->read_buf_len == 0) {
+		gint read_len;
+
+		read_len = sock_read(session->sock, session->read_buf,
+				     SESSION_BUFFSIZE);
+
+		if (read_len == 0) {
+			g_warning("sock_read: received EOF");
+			session->state = SESSION_EOF;
+			return FALSE;
+		}
+
+		if (read_len < 0) {
+			switch (errno) {
+			case EAGAIN:
+				return TRUE;
+			default:
+				g_warning("sock_read: %s", g_strerror(errno));
+				session->state = SESSION_ERROR;
+				return FALSE;
+			}
+		}
+
+		session->read_buf_p = session->read_buf;
+		session->read_buf_len = read_len;
+	}
+
+	used = session->recv_stream(session, session->read_buf_p,
+				    session->read_buf_len, &done);
+	if (used < 0) {
+		if (session->io_tag > 0) {
+			g_source_remove(session->io_tag);
+			session->io_tag = 0;
+		}
+		session->state = SESSION_ERROR;
+		return FALSE;
+	}
+
+	session->read_stream_len += used;
+	session->read_buf_len -= used;
+	if (session->read_buf_len == 0)
+		session->read_buf_p = session->read_buf;
+	else
+		session->read_buf_p += used;
+
+	/* incomplete read */
+	if (!done) {
+		GDateTime *tv_cur = g_date_time_new_now_local();
+
+		GTimeSpan ts = g_date_time_difference(tv_cur, session->tv_prev);
+		if (1000 - ts < 0 || ts > UI_REFRESH_INTERVAL) {
+			session->recv_data_progressive_notify
+				(session, session->read_stream_len, 0,
+				 session->recv_data_progressive_notify_data);
+			g_date_time_unref(session->tv_prev);
+			session->tv_prev = g_date_time_new_now_local();
+		}
+		g_date_time_unref(tv_cur);
+		return TRUE;
+	}
+
+	/* complete */
+	if (session->io_tag > 0) {
+		g_source_remove(session->io_tag);
+		session->io_tag = 0;
+	}
+
+	/* callback */
+	ret = session->recv_data_finished(session, NULL,
+					  session->read_stream_len);
+
+	session->recv_data_notify(session, session->read_stream_len,
+				  session->recv_data_notify_data);
+
+	if (ret < 0)
+		session->state = SESSION_ERROR;
+
+	return FALSE;
+}
+
+/* Returns the length of data up to and including the terminator, which
+ * must start a line, or 0 if it has not arrived yet. Terminators starting
+ * before from have already been looked for. */
+static guint session_find_data_terminator(GByteArray *data_buf, guint from,
+					  const gchar *terminator)
+{
+	const guchar *data = data_buf->data;
+	const guchar *p;
+	guint len = strlen(terminator);
+	guint i;
+
+	if (data_buf->len < len)
+		return 0;
+	if (from == 0 && memcmp(data, terminator, len) == 0)
+		return len;
+
+	for (i = MAX(from, 2); i + len <= data_buf->len; i = p - data + 1) {
+		p = memchr(data + i, terminator[0], data_buf->len - len + 1 - i);
+		if (p == NULL)
+			break;
+		if (p[-2] == '\r' && p[-1] == '\n' &&
+		    memcmp(p, terminator, len) == 0)
+			return p - data + len;
+	}
+
+	return 0;
+}
+
 static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 				     gpointer data)
 {
@@ -627,7 +789,7 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	GByteArray *data_buf;
 	gint terminator_len;
 	gboolean complete = FALSE;
-	guint data_len;
+	guint data_len, search_from, end;
 	gint ret;
 
 	cm_return_val_if_fail(condition == G_IO_IN, FALSE);
@@ -666,25 +828,27 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	if (session->read_buf_len == 0)
 		return TRUE;
 
+	/* the terminator may have started in the previous read */
+	search_from = MAX((gint)data_buf->len - terminator_len - 1, 0);
 	g_byte_array_append(data_buf, session->read_buf_p,
 			    session->read_buf_len);
 
-	session->read_buf_len = 0;
-	session->read_buf_p = session->read_buf;
-
-	/* check if data is terminated */
-	if (data_buf->len >= terminator_len) {
-		if (memcmp(data_buf->data, session->read_data_terminator,
-			   terminator_len) == 0)
-			complete = TRUE;
-		else if (data_buf->len >= terminator_len + 2 &&
-			 memcmp(data_buf->data + data_buf->len -
-				(terminator_len + 2), "\r\n", 2) == 0 &&
-			 memcmp(data_buf->data + data_buf->len -
-				terminator_len, session->read_data_terminator,
-				terminator_len) == 0)
-			complete = TRUE;
-	}
+	/* check if data is terminated; anything after the terminator is
+	 * the server's reply to a pipelined command and is left in
+	 * read_buf for the next read */
+	end = session_find_data_terminator(data_buf, search_from,
+					   session->read_data_terminator);
+	if (end > 0) {
+		guint rest = data_buf->len - end;
+
+		session->read_buf_p += session->read_buf_len - rest;
+		session->read_buf_len = rest;
+		g_byte_array_set_size(data_buf, end);
+		complete = TRUE;
+	} else
+		session->read_buf_len = 0;
+	if (session->read_buf_len == 0)
+		session->read_buf_p = session->read_buf;
 
 	/* incomplete read */
 	if (!complete) {
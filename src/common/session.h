@@ -95,6 +95,7 @@ struct _Session
 	GString *read_msg_buf;
 	GByteArray *read_data_buf;
 	gchar *read_data_terminator;
+	guint read_stream_len;
 
 	/* buffer for short messages */
 	gchar *write_buf;
@@ -122,6 +123,12 @@ struct _Session
 	gint (*recv_data_finished)	(Session	*session,
 					 guchar		*data,
 					 guint		 len);
+	/* consumes data received with session_recv_stream(); returns the
+	 * number of bytes used, setting *done at the end of the data */
+	gint (*recv_stream)		(Session	*session,
+					 const gchar	*data,
+					 guint		 len,
+					 gboolean	*done);
 
 	void (*destroy)			(Session	*session);
 
@@ -193,6 +200,7 @@ gint session_send_data	(Session	*session,
 gint session_recv_data	(Session	*session,
 			 guint		 size,
 			 const gchar	*terminator);
+gint session_recv_stream	(Session	*session);
 void session_register_ping(Session *session, gboolean (*ping_cb)(gpointer data));
 
 #endif /* __SESSION_H__ */
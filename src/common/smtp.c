@@ -17,6 +17,8 @@
  *
  */
 
+#include "defs.h"
+
 #include <glib.h>
 #ifdef ENABLE_NLS
 #include <glib/gi18n.h>
@@ -46,6 +48,7 @@ static gint smtp_helo(SMTPSession *session);
 static gint smtp_rcpt(SMTPSession *session);
 static gint smtp_data(SMTPSession *session);
 static gint smtp_send_data(SMTPSession *session);
+static gint smtp_bdat(SMTPSession *session);
 static gint smtp_make_ready(SMTPSession *session);
 static gint smtp_eom(SMTPSession *session);
 
@@ -81,8 +84,10 @@ Session *smtp_session_new(void *prefs_account)
 	session->to_list                   = NULL;
 	session->cur_to                    = NULL;
 
+	session->send_fp                   = NULL;
 	session->send_data                 = NULL;
 	session->send_data_len             = 0;
+	session->send_data_sent            = 0;
 
 	session->avail_auth_type           = 0;
 	session->forced_auth_type          = 0;
@@ -109,6 +114,89 @@ static void smtp_session_destroy(Session *session)
 	g_free(smtp_session->error_msg);
 }
 
+/* Sets up fp, positioned at the start of the message, to be sent by
+ * the next transaction.  The message is measured here for SIZE and
+ * then read again chunk by chunk while it is sent. */
+gint smtp_set_message(SMTPSession *session, FILE *fp)
+{
+	GString *str;
+	gboolean in_body = FALSE;
+	gboolean more;
+	goffset len = 0;
+	long pos;
+
+	cm_return_val_if_fail(fp != NULL, -1);
+
+	if ((pos = ftell(fp)) < 0) {
+		FILE_OP_ERROR("smtp", "ftell");
+		return -1;
+	}
+
+	str = g_string_sized_new(SMTP_SEND_CHUNK + BUFFSIZE);
+	do {
+		g_string_truncate(str, 0);
+		more = get_outgoing_rfc2822_part(fp, &in_body, TRUE, str,
+						 SMTP_SEND_CHUNK);
+		len += str->len;
+	} while (more);
+	g_string_free(str, TRUE);
+
+	if (ferror(fp) || len > G_MAXUINT) {
+		g_warning("couldn't read message to send");
+		return -1;
+	}
+	if (fseek(fp, pos, SEEK_SET) < 0) {
+		FILE_OP_ERROR("smtp", "fseek");
+		return -1;
+	}
+
+	g_free(session->send_data);
+	session->send_data = NULL;
+	session->send_fp = fp;
+	session->send_in_body = FALSE;
+	session->send_eof = FALSE;
+	session->send_data_len = len;
+	session->send_data_sent = 0;
+
+	return 0;
+}
+
+static void smtp_rcpt_cmd(gchar *buf, gsize len, const gchar *to)
+{
+	if (strchr(to, '<'))
+		g_snprintf(buf, len, "RCPT TO:%s", to);
+	else
+		g_snprintf(buf, len, "RCPT TO:<%s>", to);
+}
+
+/* With PIPELINING (RFC 2920), MAIL FROM, every RCPT TO and DATA go out
+ * in one write and their replies are read back in order. */
+static gint smtp_from_pipelined(SMTPSession *session, const gchar *from_cmd)
+{
+	gchar buf[MESSAGEBUFSIZE];
+	GString *cmds;
+	GSList *cur;
+	gint ret;
+
+	cmds = g_string_new(from_cmd);
+	log_print(LOG_PROTOCOL, "ESMTP> %s\n", from_cmd);
+
+	for (cur = session->to_list; cur != NULL; cur = cur->next) {
+		smtp_rcpt_cmd(buf, sizeof(buf), (gchar *)cur->data);
+		g_string_append_printf(cmds, "\r\n%s", buf);
+		log_print(LOG_PROTOCOL, "ESMTP> %s\n", buf);
+	}
+	if (!session->chunking) {
+		g_string_append(cmds, "\r\nDATA");
+		log_print(LOG_PROTOCOL, "ESMTP> DATA\n");
+	}
+
+	ret = session_send_msg(SESSION(session), cmds->str);
+	g_string_free(cmds, TRUE);
+
+	return ret < 0 ? SM_ERROR : SM_OK;
+}
+
 gint smtp_from(SMTPSession *session)
 {
 	gchar buf[MESSAGEBUFSIZE];
@@ -117,6 +205,12 @@ gint smtp_from(SMTPSession *session)
 	cm_return_val_if_fail(session->from != NULL, SM_ERROR);
 
 	session->state = SMTP_FROM;
+	session->pipelining = session->is_esmtp &&
+		(session->esmtp_flags & ESMTP_PIPELINING) != 0 &&
+		session->to_list != NULL;
+	session->chunking = session->is_esmtp &&
+		(session->esmtp_flags & ESMTP_CHUNKING) != 0;
+	session->cur_to = session->to_list;
 
 	if (session->is_esmtp && (session->esmtp_flags & ESMTP_SIZE)!=0)
 		mail_size = g_strdup_printf(" SIZE=%d", session->send_data_len);
@@ -133,6 +227,9 @@ gint smtp_from(SMTPSession *session)
 
 	g_free(mail_size);
 
+	if (session->pipelining)
+		return smtp_from_pipelined(session, buf);
+
 	if (session_send_msg(SESSION(session), buf) < 0)
 		return SM_ERROR;
 	log_print(LOG_PROTOCOL, "%sSMTP> %s\n", (session->is_esmtp?"E":""), buf);
@@ -237,6 +334,7 @@ static gint smtp_ehlo(SMTPSession *session)
 	session->state = SMTP_EHLO;
 
 	session->avail_auth_type = 0;
+	session->esmtp_flags = 0;
 
 	g_snprintf(buf, sizeof(buf), "EHLO %s",
 		   session->hostname ? session->hostname : get_domain_name());
@@ -271,6 +369,12 @@ static gint smtp_ehlo_recv(SMTPSession *session, const gchar *msg)
 			p += 9;
 			session->avail_auth_type |= SMTPAUTH_TLS_AVAILABLE;
 		}
+		if (g_ascii_strncasecmp(p, "PIPELINING", 10) == 0 &&
+		    (p[10] == '\0' || p[10] == ' '))
+			session->esmtp_flags |= ESMTP_PIPELINING;
+		if (g_ascii_strncasecmp(p, "CHUNKING", 8) == 0 &&
+		    (p[8] == '\0' || p[8] == ' '))
+			session->esmtp_flags |= ESMTP_CHUNKING;
 		return SM_OK;
 	} else if ((msg[0] == '1' || msg[0] == '2' || msg[0] == '3') &&
 	    (msg[3] == ' ' || msg[3] == '\0'))
@@ -388,10 +492,7 @@ static gint smtp_rcpt(SMTPSession *session)
 
 	to = (gchar *)session->cur_to->data;
 
-	if (strchr(to, '<'))
-		g_snprintf(buf, sizeof(buf), "RCPT TO:%s", to);
-	else
-		g_snprintf(buf, sizeof(buf), "RCPT TO:<%s>", to);
+	smtp_rcpt_cmd(buf, sizeof(buf), to);
 	if (session_send_msg(SESSION(session), buf) < 0)
 		return SM_ERROR;
 	log_print(LOG_PROTOCOL, "SMTP> %s\n", buf);
@@ -412,14 +513,80 @@ static gint smtp_data(SMTPSession *session)
 	return SM_OK;
 }
 
+/* Reads the next chunk of the message; *last is set when nothing of
+ * it is left in the file afterwards. */
+static GString *smtp_read_chunk(SMTPSession *session, gboolean dot_stuff,
+				gboolean *last)
+{
+	GString *str;
+
+	cm_return_val_if_fail(session->send_fp != NULL, NULL);
+
+	str = g_string_sized_new(SMTP_SEND_CHUNK + BUFFSIZE);
+	*last = !get_outgoing_rfc2822_part(session->send_fp,
+					   &session->send_in_body, dot_stuff,
+					   str, SMTP_SEND_CHUNK);
+	if (ferror(session->send_fp)) {
+		g_warning("couldn't read message to send");
+		g_string_free(str, TRUE);
+		return NULL;
+	}
+	session->send_eof = *last;
+
+	return str;
+}
+
+static gint smtp_send_chunk(SMTPSession *session, GString *str)
+{
+	gsize len = str->len;
+
+	g_free(session->send_data);
+	session->send_data = (guchar *)g_string_free(str, FALSE);
+
+	if (session_send_data(SESSION(session), session->send_data, len) < 0)
+		return SM_ERROR;
+
+	return SM_OK;
+}
+
 static gint smtp_send_data(SMTPSession *session)
 {
+	GString *str;
+	gboolean last;
+
 	session->state = SMTP_SEND_DATA;
 
-	session_send_data(SESSION(session), session->send_data,
-			  session->send_data_len);
+	if ((str = smtp_read_chunk(session, TRUE, &last)) == NULL)
+		return SM_ERROR;
+	if (str->len == 0) {
+		g_string_free(str, TRUE);
+		return smtp_eom(session);
+	}
 
-	return SM_OK;
+	return smtp_send_chunk(session, str);
+}
+
+/* With CHUNKING (RFC 3030) each chunk goes out raw, without dot
+ * stuffing, behind a BDAT command giving its size.  The reply to the
+ * LAST chunk ends the transaction like the one to "." does. */
+static gint smtp_bdat(SMTPSession *session)
+{
+	gchar buf[MESSAGEBUFSIZE];
+	GString *str;
+	gboolean last;
+
+	if ((str = smtp_read_chunk(session, FALSE, &last)) == NULL)
+		return SM_ERROR;
+
+	g_snprintf(buf, sizeof(buf), "BDAT %" G_GSIZE_FORMAT "%s",
+		   str->len, last ? " LAST" : "");
+	log_print(LOG_PROTOCOL, "ESMTP> %s\n", buf);
+	g_string_prepend(str, "\r\n");
+	g_string_prepend(str, buf);
+
+	session->state = last ? SMTP_EOM : SMTP_BDAT;
+
+	return smtp_send_chunk(session, str);
 }
 
 static gint smtp_make_ready(SMTPSession *session)
@@ -579,19 +746,42 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 	case SMTP_AUTH_PLAIN:
 	case SMTP_AUTH_LOGIN_PASS:
         case SMTP_AUTH_OAUTH2:
+		ret = smtp_from(smtp_session);
+		break;
 	case SMTP_FROM:
-		if (smtp_session->cur_to)
+		if (smtp_session->pipelining) {
+			/* RCPT replies follow */
+			smtp_session->state = SMTP_RCPT;
+			cont = TRUE;
+		} else if (smtp_session->cur_to)
 			ret = smtp_rcpt(smtp_session);
 		break;
 	case SMTP_RCPT:
-		if (smtp_session->cur_to)
+		if (smtp_session->pipelining) {
+			smtp_session->cur_to = smtp_session->cur_to ?
+				smtp_session->cur_to->next : NULL;
+			if (smtp_session->cur_to)
+				cont = TRUE;
+			else if (smtp_session->chunking)
+				ret = smtp_bdat(smtp_session);
+			else {
+				/* the DATA reply is next */
+				smtp_session->state = SMTP_DATA;
+				cont = TRUE;
+			}
+		} else if (smtp_session->cur_to)
 			ret = smtp_rcpt(smtp_session);
+		else if (smtp_session->chunking)
+			ret = smtp_bdat(smtp_session);
 		else
 			ret = smtp_data(smtp_session);
 		break;
 	case SMTP_DATA:
 		ret = smtp_send_data(smtp_session);
 		break;
+	case SMTP_BDAT:
+		ret = smtp_bdat(smtp_session);
+		break;
 	case SMTP_EOM:
 		smtp_make_ready(smtp_session);
 		break;
@@ -616,5 +806,16 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 
 static gint smtp_session_send_data_finished(Session *session, guint len)
 {
-	return smtp_eom(SMTP_SESSION(session));
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+
+	smtp_session->send_data_sent += len;
+
+	/* each BDAT chunk is acknowledged before the next one goes */
+	if (smtp_session->chunking)
+		return session_recv_msg(session);
+
+	if (!smtp_session->send_eof)
+		return smtp_send_data(smtp_session);
+
+	return smtp_eom(smtp_session);
 }
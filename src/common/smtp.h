@@ -21,6 +21,7 @@
 #define __SMTP_H__
 
 #include <glib.h>
+#include <stdio.h>
 
 #include "session.h"
 
@@ -30,6 +31,9 @@ typedef struct _SMTPSession	SMTPSession;
 
 #define MESSAGEBUFSIZE		8192
 
+/* how much of the message is read from the file and sent at a time */
+#define SMTP_SEND_CHUNK		(256 * 1024)
+
 typedef enum
 {
 	SM_OK			= 0,
@@ -42,7 +46,9 @@ typedef enum
 {
 	ESMTP_8BITMIME	= 1 << 0,
 	ESMTP_SIZE	= 1 << 1,
-	ESMTP_ETRN	= 1 << 2
+	ESMTP_ETRN	= 1 << 2,
+	ESMTP_PIPELINING = 1 << 3,
+	ESMTP_CHUNKING	= 1 << 4
 } ESMTPFlag;
 
 typedef enum
@@ -71,6 +77,7 @@ typedef enum
 	SMTP_RCPT,
 	SMTP_DATA,
 	SMTP_SEND_DATA,
+	SMTP_BDAT,
 	SMTP_EOM,
 	SMTP_RSET,
 	SMTP_QUIT,
@@ -96,8 +103,17 @@ struct _SMTPSession
 	GSList *to_list;
 	GSList *cur_to;
 
-	guchar *send_data;
-	guint send_data_len;
+	/* the message is streamed from send_fp one chunk at a time */
+	FILE *send_fp;
+	gboolean send_in_body;
+	gboolean send_eof;
+	guchar *send_data;	/* chunk being sent */
+	guint send_data_len;	/* size of the whole message */
+	guint send_data_sent;
+
+	/* extensions used for the current message */
+	gboolean pipelining;
+	gboolean chunking;
 
 	guint max_message_size;
 
@@ -115,6 +131,7 @@ struct _SMTPSession
 };
 
 Session *smtp_session_new	(void *prefs_account);
+gint smtp_set_message(SMTPSession *session, FILE *fp);
 gint smtp_from(SMTPSession *session);
 gint smtp_quit(SMTPSession *session);
 
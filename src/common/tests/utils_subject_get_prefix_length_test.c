@@ -0,0 +1,99 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "utils.h"
+
+#include "mock_prefs_common_get_use_shred.h"
+#include "mock_prefs_common_get_flush_metadata.h"
+
+struct td_prefix_length {
+	const gchar *subject;
+	gint length;
+};
+
+/* lengths as matched by the regular expression this replaced */
+static const struct td_prefix_length td_prefix_lengths[] = {
+	{ "Hello", 0 },
+	{ "Re: Hello", 4 },
+	{ "RE:Hello", 3 },
+	{ "  Re: Hello", 6 },
+	{ "Re:  Hello", 4 },
+	{ "Re: Fwd: AW: Hello", 13 },
+	{ "Re[2]: Hello", 7 },
+	{ "Re[10]:Hello", 7 },
+	{ "Re[0]: Hello", 0 },
+	{ "Re[2] : Hello", 0 },
+	{ "Re : Hello", 5 },
+	{ "Réf. : Hello", 8 },
+	{ "RÉF. : Hello", 8 },
+	{ "答复: Hello", 8 },
+	{ "Antwort: Hello", 9 },
+	{ "Rex: Hello", 0 },
+	{ "[list] Re: Hello", 0 },
+	{ "Fwd Re: Hello", 0 },
+	{ "Re:", 3 },
+	{ "", 0 },
+};
+
+static void
+test_subject_get_prefix_length(void)
+{
+	gint i;
+
+	for (i = 0; i < G_N_ELEMENTS(td_prefix_lengths); i++)
+		g_assert_cmpint(subject_get_prefix_length(td_prefix_lengths[i].subject),
+				==, td_prefix_lengths[i].length);
+	g_assert_cmpint(subject_get_prefix_length(NULL), ==, 0);
+}
+
+static void
+test_subject_compare_for_sort_prefixed(void)
+{
+	gint i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(td_prefix_lengths); i++) {
+		const gchar *s1 = td_prefix_lengths[i].subject;
+		gint p1 = subject_get_prefix_length(s1);
+
+		for (j = 0; j < G_N_ELEMENTS(td_prefix_lengths); j++) {
+			const gchar *s2 = td_prefix_lengths[j].subject;
+			gint p2 = subject_get_prefix_length(s2);
+
+			g_assert_cmpint(subject_compare_for_sort_prefixed(s1, p1, s2, p2),
+					==, subject_compare_for_sort(s1, s2));
+		}
+	}
+}
+
+static void
+test_subject_strip_for_sort(void)
+{
+	gint i;
+
+	for (i = 0; i < G_N_ELEMENTS(td_prefix_lengths); i++) {
+		const gchar *s = td_prefix_lengths[i].subject;
+		gchar *known = subject_strip_for_sort(s, subject_get_prefix_length(s));
+		gchar *unknown = subject_strip_for_sort(s, -1);
+
+		g_assert_cmpstr(known, ==, unknown);
+		g_free(known);
+		g_free(unknown);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/common/utils/subject_get_prefix_length",
+			test_subject_get_prefix_length);
+	g_test_add_func("/common/utils/subject_compare_for_sort_prefixed",
+			test_subject_compare_for_sort_prefixed);
+	g_test_add_func("/common/utils/subject_strip_for_sort",
+			test_subject_strip_for_sort);
+
+	return g_test_run();
+}
@@ -52,7 +52,6 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
-#include <regex.h>
 
 #include <fcntl.h>
 
@@ -383,17 +382,41 @@ gint subject_compare(const gchar *s1, const gchar *s2)
 	return strcmp(str1, str2);
 }
 
+/* Copies s to str with the prefix and surrounding white space taken
+ * off. prefix_len is subject_get_prefix_length(s), or -1 if not known;
+ * it only holds for the trimmed subject if s does not start with white
+ * space, as trailing white space cannot change where a prefix ends. */
+#define TRIM_SUBJECT_FOR_SORT(str, s, prefix_len, fail)		\
+{									\
+	if ((prefix_len) < 0 || g_ascii_isspace(*(s))) {		\
+		Xstrdup_a(str, s, fail);				\
+		trim_subject_for_sort(str);				\
+	} else {							\
+		Xstrdup_a(str, (s) + (prefix_len), fail);		\
+		g_strchomp(str);					\
+	}								\
+}
+
 gint subject_compare_for_sort(const gchar *s1, const gchar *s2)
+{
+	return subject_compare_for_sort_prefixed(s1, -1, s2, -1);
+}
+
+/*!
+ *\brief	subject_compare_for_sort() for subjects whose prefix lengths
+ *		are already known, e.g. from
+ *		procmsg_msginfo_get_subject_prefix_length(); pass -1 for one
+ *		that is not
+ */
+gint subject_compare_for_sort_prefixed(const gchar *s1, gint prefix1,
+				       const gchar *s2, gint prefix2)
 {
 	gchar *str1, *str2;
 
 	if (!s1 || !s2) return -1;
 
-	Xstrdup_a(str1, s1, return -1);
-	Xstrdup_a(str2, s2, return -1);
-
-	trim_subject_for_sort(str1);
-	trim_subject_for_sort(str2);
+	TRIM_SUBJECT_FOR_SORT(str1, s1, prefix1, return -1);
+	TRIM_SUBJECT_FOR_SORT(str2, s2, prefix2, return -1);
 
 	if (!g_utf8_validate(str1, -1, NULL)) {
 		g_warning("message subject \"%s\" failed UTF-8 validation", str1);
@@ -405,6 +428,31 @@ gint subject_compare_for_sort(const gchar *s1, const gchar *s2)
 
 	return g_utf8_collate(str1, str2);
 }
+#undef TRIM_SUBJECT_FOR_SORT
+
+/*!
+ *\brief	The part of a subject that subject_compare_for_sort()
+ *		collates, for callers that make collation keys of it
+ *
+ *\param	prefix_len subject_get_prefix_length(subject), or -1
+ *
+ *\return	Newly allocated string
+ */
+gchar *subject_strip_for_sort(const gchar *subject, gint prefix_len)
+{
+	gchar *str;
+
+	cm_return_val_if_fail(subject != NULL, NULL);
+
+	if (prefix_len < 0 || g_ascii_isspace(*subject)) {
+		str = g_strdup(subject);
+		trim_subject_for_sort(str);
+	} else {
+		str = g_strchomp(g_strdup(subject + prefix_len));
+	}
+
+	return str;
+}
 
 void trim_subject(gchar *str)
 {
@@ -1979,17 +2027,32 @@ gchar *normalize_newlines(const gchar *str)
 	return out;
 }
 
-gchar *get_outgoing_rfc2822_str(FILE *fp)
+/*
+ * Appends the next lines of an outgoing message to str, with Bcc:
+ * dropped and CRLF line endings, until at least len bytes were added.
+ * Lines of the body starting with '.' are doubled when dot_stuff is
+ * set, as DATA needs.  *in_body must start out FALSE and is carried
+ * over between calls.  Returns FALSE once the file is used up.
+ */
+gboolean get_outgoing_rfc2822_part(FILE *fp, gboolean *in_body,
+				   gboolean dot_stuff, GString *str,
+				   gsize len)
 {
 	gchar buf[BUFFSIZE];
-	GString *str;
-
-	str = g_string_new(NULL);
+	gsize start = str->len;
+	gint c;
 
-	/* output header part */
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
+	while (str->len - start < len) {
+		if (fgets(buf, sizeof(buf), fp) == NULL)
+			return FALSE;
 		strretchomp(buf);
-		if (!g_ascii_strncasecmp(buf, "Bcc:", 4)) {
+
+		if (*in_body) {
+			if (dot_stuff && buf[0] == '.')
+				g_string_append_c(str, '.');
+			g_string_append(str, buf);
+			g_string_append(str, "\r\n");
+		} else if (!g_ascii_strncasecmp(buf, "Bcc:", 4)) {
 			gint next;
 
 			for (;;) {
@@ -2007,18 +2070,24 @@ gchar *get_outgoing_rfc2822_str(FILE *fp)
 			g_string_append(str, buf);
 			g_string_append(str, "\r\n");
 			if (buf[0] == '\0')
-				break;
+				*in_body = TRUE;
 		}
 	}
 
-	/* output body part */
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		strretchomp(buf);
-		if (buf[0] == '.')
-			g_string_append_c(str, '.');
-		g_string_append(str, buf);
-		g_string_append(str, "\r\n");
-	}
+	if ((c = fgetc(fp)) == EOF)
+		return FALSE;
+	ungetc(c, fp);
+
+	return TRUE;
+}
+
+gchar *get_outgoing_rfc2822_str(FILE *fp)
+{
+	GString *str;
+	gboolean in_body = FALSE;
+
+	str = g_string_new(NULL);
+	get_outgoing_rfc2822_part(fp, &in_body, TRUE, str, G_MAXSIZE);
 
 	return g_string_free(str, FALSE);
 }
@@ -2513,15 +2582,58 @@ void subject_table_remove(GHashTable *subject_table, gchar * subject)
 	g_hash_table_remove(subject_table, subject);
 }
 
-static regex_t u_regex;
-static gboolean u_init_;
-
-void utils_free_regex(void)
+/*!< Allowable reply and forward prefixes, matched case-insensitively.
+ *   "Re[XXX]:" is matched in subject_prefix_match() */
+static const struct {
+	const gchar *str;
+	gsize len;
+} subject_prefixes[] = {
+#define SUBJECT_PREFIX(s)	{ s, sizeof(s) - 1 }
+	SUBJECT_PREFIX("Re:"),			/* "Re:" */
+	SUBJECT_PREFIX("Antw:"),		/* "Antw:" (Dutch / German Outlook) */
+	SUBJECT_PREFIX("Aw:"),			/* "Aw:"   (German) */
+	SUBJECT_PREFIX("Antwort:"),		/* "Antwort:" (German Lotus Notes) */
+	SUBJECT_PREFIX("Res:"),			/* "Res:" (Spanish/Brazilian Outlook) */
+	SUBJECT_PREFIX("Fw:"),			/* "Fw:" Forward */
+	SUBJECT_PREFIX("Fwd:"),			/* "Fwd:" Forward */
+	SUBJECT_PREFIX("Enc:"),			/* "Enc:" Forward (Brazilian Outlook) */
+	SUBJECT_PREFIX("Odp:"),			/* "Odp:" Re (Polish Outlook) */
+	SUBJECT_PREFIX("Rif:"),			/* "Rif:" (Italian Outlook) */
+	SUBJECT_PREFIX("Sv:"),			/* "Sv" (Norwegian) */
+	SUBJECT_PREFIX("Vs:"),			/* "Vs" (Norwegian) */
+	SUBJECT_PREFIX("Ad:"),			/* "Ad" (Norwegian) */
+	SUBJECT_PREFIX("\347\255\224\345\244\215:"),	/* "Re" (Chinese, UTF-8) */
+	SUBJECT_PREFIX("R\303\251f. :"),	/* "Réf. :" (French Lotus Notes) */
+	SUBJECT_PREFIX("R\303\211f. :"),	/* "RÉf. :", as REG_ICASE folded it */
+	SUBJECT_PREFIX("Re :"),			/* "Re :" (French Yahoo Mail) */
+	/* add more */
+#undef SUBJECT_PREFIX
+};
+
+/* Length of the prefix str starts with, or 0 */
+static gsize subject_prefix_match(const gchar *str)
 {
-	if (u_init_) {
-		regfree(&u_regex);
-		u_init_ = FALSE;
+	const gchar *p;
+	gint i;
+
+	for (i = 0; i < G_N_ELEMENTS(subject_prefixes); i++) {
+		if (g_ascii_tolower(*str) ==
+		    g_ascii_tolower(subject_prefixes[i].str[0]) &&
+		    !g_ascii_strncasecmp(str, subject_prefixes[i].str,
+					 subject_prefixes[i].len))
+			return subject_prefixes[i].len;
 	}
+
+	/* "Re[XXX]:" (non-conforming news mail clients) */
+	if (!g_ascii_strncasecmp(str, "Re[", 3) &&
+	    str[3] >= '1' && str[3] <= '9') {
+		for (p = str + 4; g_ascii_isdigit(*p); p++)
+			;
+		if (p[0] == ']' && p[1] == ':')
+			return p + 2 - str;
+	}
+
+	return 0;
 }
 
 /*!
@@ -2537,66 +2649,25 @@ void utils_free_regex(void)
  */
 int subject_get_prefix_length(const gchar *subject)
 {
-	/*!< Array with allowable reply prefixes regexps. */
-	static const gchar * const prefixes[] = {
-		"Re\\:",			/* "Re:" */
-		"Re\\[[1-9][0-9]*\\]\\:",	/* "Re[XXX]:" (non-conforming news mail clients) */
-		"Antw\\:",			/* "Antw:" (Dutch / German Outlook) */
-		"Aw\\:",			/* "Aw:"   (German) */
-		"Antwort\\:",			/* "Antwort:" (German Lotus Notes) */
-		"Res\\:",			/* "Res:" (Spanish/Brazilian Outlook) */
-		"Fw\\:",			/* "Fw:" Forward */
-		"Fwd\\:",			/* "Fwd:" Forward */
-		"Enc\\:",			/* "Enc:" Forward (Brazilian Outlook) */
-		"Odp\\:",			/* "Odp:" Re (Polish Outlook) */
-		"Rif\\:",			/* "Rif:" (Italian Outlook) */
-		"Sv\\:",			/* "Sv" (Norwegian) */
-		"Vs\\:",			/* "Vs" (Norwegian) */
-		"Ad\\:",			/* "Ad" (Norwegian) */
-		"\347\255\224\345\244\215\\:",	/* "Re" (Chinese, UTF-8) */
-		"R\303\251f\\. \\:",		/* "R�f. :" (French Lotus Notes) */
-		"Re \\:",			/* "Re :" (French Yahoo Mail) */
-		/* add more */
-	};
-	const int PREFIXES = sizeof prefixes / sizeof prefixes[0];
-	int n;
-	regmatch_t pos;
+	const gchar *p;
+	gsize len;
+	gint prefix_len = 0;
 
 	if (!subject) return 0;
-	if (!*subject) return 0;
-
-	if (!u_init_) {
-		GString *s = g_string_new("");
-
-		for (n = 0; n < PREFIXES; n++)
-			/* Terminate each prefix regexpression by a
-			 * "\ ?" (zero or ONE space), and OR them */
-			g_string_append_printf(s, "(%s\\ ?)%s",
-					  prefixes[n],
-					  n < PREFIXES - 1 ?
-					  "|" : "");
-
-		g_string_prepend(s, "(");
-		g_string_append(s, ")+");	/* match at least once */
-		g_string_prepend(s, "^\\ *");	/* from beginning of line */
 
-
-		/* We now have something like "^\ *((PREFIX1\ ?)|(PREFIX2\ ?))+"
-		 * TODO: Should this be       "^\ *(((PREFIX1)|(PREFIX2))\ ?)+" ??? */
-		if (regcomp(&u_regex, s->str, REG_EXTENDED | REG_ICASE)) {
-			debug_print("Error compiling regexp %s\n", s->str);
-			g_string_free(s, TRUE);
-			return 0;
-		} else {
-			u_init_ = TRUE;
-			g_string_free(s, TRUE);
-		}
+	/* like "^ *((PREFIX1 ?)|(PREFIX2 ?))+": no prefix starts with or
+	 * could be cut short by a space, so taking each prefix and its
+	 * space as they come finds the longest match */
+	for (p = subject; *p == ' '; p++)
+		;
+	while ((len = subject_prefix_match(p)) > 0) {
+		p += len;
+		if (*p == ' ')
+			p++;
+		prefix_len = p - subject;
 	}
 
-	if (!regexec(&u_regex, subject, 1, &pos, 0) && pos.rm_so != -1)
-		return pos.rm_eo;
-	else
-		return 0;
+	return prefix_len;
 }
 
 gint g_int_compare(gconstpointer a, gconstpointer b)
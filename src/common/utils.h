@@ -258,6 +258,12 @@ gint subject_compare			(const gchar	*s1,
 					 const gchar	*s2);
 gint subject_compare_for_sort		(const gchar	*s1,
 					 const gchar	*s2);
+gint subject_compare_for_sort_prefixed	(const gchar	*s1,
+					 gint		 prefix1,
+					 const gchar	*s2,
+					 gint		 prefix2);
+gchar *subject_strip_for_sort		(const gchar	*subject,
+					 gint		 prefix_len);
 void trim_subject			(gchar		*str);
 void eliminate_parenthesis		(gchar		*str,
 					 gchar		 op,
@@ -375,6 +381,11 @@ gchar *canonicalize_str		(const gchar	*str);
 gchar *normalize_newlines	(const gchar	*str);
 
 gchar *get_outgoing_rfc2822_str	(FILE		*fp);
+gboolean get_outgoing_rfc2822_part	(FILE		*fp,
+					 gboolean	*in_body,
+					 gboolean	 dot_stuff,
+					 GString	*str,
+					 gsize		 len);
 
 char *fgets_crlf(char *buf, int size, FILE *stream);
 
@@ -417,7 +428,6 @@ void * subject_table_lookup(GHashTable *subject_table, gchar * subject);
 void subject_table_insert(GHashTable *subject_table, gchar * subject,
 			  void * data);
 void subject_table_remove(GHashTable *subject_table, gchar * subject);
-void utils_free_regex(void);
 gint subject_get_prefix_length (const gchar *subject);
 
 /* quoting recognition */
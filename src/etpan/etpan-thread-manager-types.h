@@ -33,6 +33,15 @@ struct etpan_thread_manager {
   int unbound_count;
   
   int notify_fds[2];
+  
+  /* worker pool serving the queues; queue_lock covers everything
+     below and the queues' own fields */
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  carray * queue_ready;
+  int worker_count;
+  int worker_max;
+  int worker_idle;
 };
 
 struct etpan_thread {
@@ -46,12 +55,23 @@ struct etpan_thread {
   
   int bound_count;
   int terminate_state;
+  int is_worker;
   
   struct mailsem * start_sem;
   struct mailsem * stop_sem;
   struct mailsem * op_sem;
 };
 
+/* Ops scheduled on a queue run one at a time and in order, on whichever
+   pool worker is free; queues with work take turns, one op each. */
+struct etpan_thread_queue {
+  struct etpan_thread_manager * manager;
+  carray * op_list;
+  int running;
+  int ready;
+  int released;
+};
+
 struct etpan_thread_op {
   struct etpan_thread * thread;
   
@@ -31,6 +31,7 @@
 #include "utils.h"
 
 #define POOL_UNBOUND_MAX 4
+#define POOL_WORKER_DEFAULT 4
 
 #define POOL_INIT_SIZE 8
 #define OP_INIT_SIZE 8
@@ -81,12 +82,26 @@ struct etpan_thread_manager * etpan_thread_manager_new(void)
   manager->can_create_thread = 1;
   manager->unbound_count = 0;
 
+  manager->queue_ready = carray_new(POOL_INIT_SIZE);
+  if (manager->queue_ready == NULL)
+    goto free_pending;
+
+  pthread_mutex_init(&manager->queue_lock, NULL);
+  pthread_cond_init(&manager->queue_cond, NULL);
+  manager->worker_count = 0;
+  manager->worker_max = POOL_WORKER_DEFAULT;
+  manager->worker_idle = 0;
+
   r = pipe(manager->notify_fds);
   if (r < 0)
-    goto free_pending;
+    goto free_ready;
 
   return manager;
 
+ free_ready:
+  pthread_cond_destroy(&manager->queue_cond);
+  pthread_mutex_destroy(&manager->queue_lock);
+  carray_free(manager->queue_ready);
  free_pending:
   carray_free(manager->thread_pending);
  free_pool:
@@ -101,6 +116,9 @@ void etpan_thread_manager_free(struct etpan_thread_manager * manager)
 {
   close(manager->notify_fds[1]);
   close(manager->notify_fds[0]);
+  pthread_cond_destroy(&manager->queue_cond);
+  pthread_mutex_destroy(&manager->queue_lock);
+  carray_free(manager->queue_ready);
   carray_free(manager->thread_pending);
   carray_free(manager->thread_pool);
   free(manager);
@@ -142,6 +160,7 @@ static struct etpan_thread * etpan_thread_new(void)
   thread->manager = NULL;
   thread->bound_count = 0;
   thread->terminate_state = TERMINATE_STATE_NONE;
+  thread->is_worker = 0;
 
   return thread;
 
@@ -202,7 +221,8 @@ void etpan_thread_op_free(struct etpan_thread_op * op)
 }
 
 static struct etpan_thread *
-etpan_thread_manager_create_thread(struct etpan_thread_manager * manager)
+etpan_thread_manager_create_thread(struct etpan_thread_manager * manager,
+    int is_worker)
 {
   struct etpan_thread * thread;
   int r;
@@ -212,6 +232,7 @@ etpan_thread_manager_create_thread(struct etpan_thread_manager * manager)
     goto err;
 
   thread->manager = manager;
+  thread->is_worker = is_worker;
 
   r = etpan_thread_start(thread);
   if (r != NO_ERROR)
@@ -245,7 +266,12 @@ etpan_thread_manager_terminate_thread(struct etpan_thread_manager * manager,
     }
   }
 
-  if (!etpan_thread_is_bound(thread))
+  if (thread->is_worker) {
+    pthread_mutex_lock(&manager->queue_lock);
+    manager->worker_count --;
+    pthread_mutex_unlock(&manager->queue_lock);
+  }
+  else if (!etpan_thread_is_bound(thread))
     manager->unbound_count --;
 
   r = carray_add(manager->thread_pending, thread, NULL);
@@ -350,11 +376,104 @@ static void * thread_run(void * data)
   return NULL;
 }
 
+static int worker_stop_requested(struct etpan_thread * thread)
+{
+  int requested;
+
+  thread_lock(thread);
+  requested = (thread->terminate_state != TERMINATE_STATE_NONE);
+  thread_unlock(thread);
+
+  return requested;
+}
+
+static void etpan_thread_queue_free(struct etpan_thread_queue * queue)
+{
+  carray_free(queue->op_list);
+  free(queue);
+}
+
+/* A pool worker: takes the queue that has waited longest, runs its
+   first op and puts it back at the end if it has more. */
+static void * worker_run(void * data)
+{
+  struct etpan_thread * thread;
+  struct etpan_thread_manager * manager;
+  struct etpan_thread_queue * queue;
+  struct etpan_thread_op * op;
+  int r;
+
+  thread = data;
+  manager = thread->manager;
+
+  mailsem_up(thread->start_sem);
+
+  pthread_mutex_lock(&manager->queue_lock);
+  while (1) {
+    while (carray_count(manager->queue_ready) == 0 &&
+        !worker_stop_requested(thread)) {
+      manager->worker_idle ++;
+      pthread_cond_wait(&manager->queue_cond, &manager->queue_lock);
+      manager->worker_idle --;
+    }
+    if (carray_count(manager->queue_ready) == 0)
+      break;
+
+    queue = carray_get(manager->queue_ready, 0);
+    carray_delete_slow(manager->queue_ready, 0);
+    queue->ready = 0;
+    queue->running = 1;
+    op = carray_get(queue->op_list, 0);
+    carray_delete_slow(queue->op_list, 0);
+    op->thread = thread;
+    pthread_mutex_unlock(&manager->queue_lock);
+
+    if (!etpan_thread_op_cancelled(op)) {
+      if (op->run != NULL)
+        op->run(op);
+    }
+
+    thread_lock(thread);
+    r = carray_add(thread->op_done_list, op, NULL);
+    if (r < 0) {
+      g_warning("complete failure of thread due to lack of memory (op done)");
+    }
+    thread_unlock(thread);
+
+    thread_notify(thread);
+
+    pthread_mutex_lock(&manager->queue_lock);
+    queue->running = 0;
+    if (carray_count(queue->op_list) > 0) {
+      r = carray_add(manager->queue_ready, queue, NULL);
+      if (r < 0) {
+        g_warning("complete failure of thread due to lack of memory (queue)");
+      }
+      queue->ready = 1;
+    }
+    else if (queue->released) {
+      etpan_thread_queue_free(queue);
+    }
+  }
+  pthread_mutex_unlock(&manager->queue_lock);
+
+  thread_lock(thread);
+  thread->terminate_state = TERMINATE_STATE_DONE;
+  thread_unlock(thread);
+
+  thread_notify(thread);
+
+  mailsem_up(thread->stop_sem);
+
+  return NULL;
+}
+
 static int etpan_thread_start(struct etpan_thread * thread)
 {
   int r;
 
-  r = pthread_create(&thread->th_id, NULL, thread_run, thread);
+  r = pthread_create(&thread->th_id, NULL,
+      thread->is_worker ? worker_run : thread_run, thread);
   if (r != 0)
     return ERROR_MEMORY;
 
@@ -369,7 +488,14 @@ static void etpan_thread_stop(struct etpan_thread * thread)
   thread->terminate_state = TERMINATE_STATE_REQUESTED;
   thread_unlock(thread);
 
-  mailsem_up(thread->op_sem);
+  if (thread->is_worker) {
+    pthread_mutex_lock(&thread->manager->queue_lock);
+    pthread_cond_broadcast(&thread->manager->queue_cond);
+    pthread_mutex_unlock(&thread->manager->queue_lock);
+  }
+  else {
+    mailsem_up(thread->op_sem);
+  }
 
   /* this thread will be joined in the manager loop */
 }
@@ -406,7 +532,7 @@ etpan_thread_manager_get_thread(struct etpan_thread_manager * manager)
 
   for(i = 0 ; i < carray_count(manager->thread_pool) ; i ++) {
     thread = carray_get(manager->thread_pool, i);
-    if (etpan_thread_is_bound(thread))
+    if (etpan_thread_is_bound(thread) || thread->is_worker)
       continue;
 
     if (chosen_thread == NULL) {
@@ -439,7 +565,7 @@ etpan_thread_manager_get_thread(struct etpan_thread_manager * manager)
   if (chosen_thread != NULL)
     return chosen_thread;
 
-  thread = etpan_thread_manager_create_thread(manager);
+  thread = etpan_thread_manager_create_thread(manager, 0);
   if (thread == NULL)
     goto err;
 
@@ -453,6 +579,126 @@ etpan_thread_manager_get_thread(struct etpan_thread_manager * manager)
   return NULL;
 }
 
+/* A thread that is never handed out by etpan_thread_manager_get_thread(),
+   for ops that keep it busy for a long time. */
+struct etpan_thread *
+etpan_thread_manager_get_dedicated_thread(struct etpan_thread_manager * manager)
+{
+  struct etpan_thread * thread;
+
+  thread = etpan_thread_manager_create_thread(manager, 0);
+  if (thread == NULL)
+    return NULL;
+
+  thread->bound_count = 1;
+
+  return thread;
+}
+
+/* The pool grows up to this many workers as queues get busy; workers
+   already running are kept. */
+void etpan_thread_manager_set_max_workers(struct etpan_thread_manager * manager,
+    int count)
+{
+  if (count < 1)
+    count = 1;
+
+  pthread_mutex_lock(&manager->queue_lock);
+  manager->worker_max = count;
+  pthread_mutex_unlock(&manager->queue_lock);
+}
+
+struct etpan_thread_queue *
+etpan_thread_manager_get_queue(struct etpan_thread_manager * manager)
+{
+  struct etpan_thread_queue * queue;
+
+  queue = malloc(sizeof(* queue));
+  if (queue == NULL)
+    return NULL;
+
+  queue->op_list = carray_new(OP_INIT_SIZE);
+  if (queue->op_list == NULL) {
+    free(queue);
+    return NULL;
+  }
+  queue->manager = manager;
+  queue->running = 0;
+  queue->ready = 0;
+  queue->released = 0;
+
+  return queue;
+}
+
+/* The queue is freed once its pending ops have run. */
+void etpan_thread_queue_release(struct etpan_thread_queue * queue)
+{
+  struct etpan_thread_manager * manager;
+
+  manager = queue->manager;
+
+  pthread_mutex_lock(&manager->queue_lock);
+  queue->released = 1;
+  if (!queue->running && !queue->ready)
+    etpan_thread_queue_free(queue);
+  pthread_mutex_unlock(&manager->queue_lock);
+}
+
+int etpan_thread_queue_op_schedule(struct etpan_thread_queue * queue,
+    struct etpan_thread_op * op)
+{
+  struct etpan_thread_manager * manager;
+  int need_worker;
+  int r;
+
+  manager = queue->manager;
+
+  pthread_mutex_lock(&manager->queue_lock);
+  if (queue->released) {
+    pthread_mutex_unlock(&manager->queue_lock);
+    return ERROR_INVAL;
+  }
+  r = carray_add(queue->op_list, op, NULL);
+  if (r < 0) {
+    pthread_mutex_unlock(&manager->queue_lock);
+    return ERROR_MEMORY;
+  }
+  if (!queue->running && !queue->ready) {
+    r = carray_add(manager->queue_ready, queue, NULL);
+    if (r < 0) {
+      carray_delete_slow(queue->op_list, carray_count(queue->op_list) - 1);
+      pthread_mutex_unlock(&manager->queue_lock);
+      return ERROR_MEMORY;
+    }
+    queue->ready = 1;
+  }
+  need_worker = (manager->worker_idle == 0 &&
+      manager->worker_count < manager->worker_max);
+  if (need_worker)
+    manager->worker_count ++;
+  pthread_cond_signal(&manager->queue_cond);
+  pthread_mutex_unlock(&manager->queue_lock);
+
+  if (need_worker &&
+      etpan_thread_manager_create_thread(manager, 1) == NULL) {
+    pthread_mutex_lock(&manager->queue_lock);
+    manager->worker_count --;
+    pthread_mutex_unlock(&manager->queue_lock);
+    /* with no worker at all the op would never run */
+    if (manager->worker_count == 0)
+      g_warning("could not start an etpan worker thread");
+  }
+
+  return NO_ERROR;
+}
+
+/* The thread stops once its pending ops have run. */
+void etpan_thread_manager_release_thread(struct etpan_thread_manager * manager,
+    struct etpan_thread * thread)
+{
+  etpan_thread_manager_terminate_thread(manager, thread);
+}
+
 static unsigned int etpan_thread_get_load(struct etpan_thread * thread)
 {
   unsigned int load;
@@ -39,10 +39,26 @@ etpan_thread_manager_get_thread(struct etpan_thread_manager * manager);
 
 void etpan_thread_unbind(struct etpan_thread * thread);
 
+struct etpan_thread *
+etpan_thread_manager_get_dedicated_thread(struct etpan_thread_manager * manager);
+void etpan_thread_manager_release_thread(struct etpan_thread_manager * manager,
+    struct etpan_thread * thread);
+
+/* ** worker pool ** */
+
+void etpan_thread_manager_set_max_workers(struct etpan_thread_manager * manager,
+    int count);
+
+struct etpan_thread_queue *
+etpan_thread_manager_get_queue(struct etpan_thread_manager * manager);
+void etpan_thread_queue_release(struct etpan_thread_queue * queue);
+
 /* ** op schedule ** */
 
 int etpan_thread_op_schedule(struct etpan_thread * thread,
                              struct etpan_thread_op * op);
+int etpan_thread_queue_op_schedule(struct etpan_thread_queue * queue,
+    struct etpan_thread_op * op);
 
 
 
@@ -26,6 +26,9 @@
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
 #include <gtk/gtk.h>
 #include <log.h>
 #include "etpan-thread-manager.h"
@@ -47,6 +50,10 @@ static chash * imap_hash = NULL;
 static chash * session_hash = NULL;
 static guint thread_manager_signal = 0;
 static GIOChannel * io_channel = NULL;
+static GSList * idle_list = NULL;
+static gboolean idle_shutdown = FALSE;
+
+static void idle_wakeup(IMAPIdle * idle);
 
 static gboolean thread_manager_event(GIOChannel * source,
     GIOCondition condition,
@@ -255,9 +262,27 @@ void imap_main_set_timeout(int sec)
 	mailstream_network_delay.tv_usec = 0;
 }
 
+/* Number of threads the folders' operations share, IDLE connections
+ * aside, however many folders there are */
+void imap_main_set_max_workers(int count)
+{
+	etpan_thread_manager_set_max_workers(thread_manager, count);
+}
+
 void imap_main_done(gboolean have_connectivity)
 {
+	GSList * cur;
+
 	imap_disconnect_all(have_connectivity);
+	/* the IDLE loops would keep their threads from being joined */
+	idle_shutdown = TRUE;
+	for (cur = idle_list; cur != NULL; cur = cur->next) {
+		IMAPIdle * idle = cur->data;
+
+		idle->stopped = TRUE;
+		if (idle->imap != NULL)
+			idle_wakeup(idle);
+	}
 	etpan_thread_manager_stop(thread_manager);
 #if defined(__NetBSD__) || defined(__OpenBSD__) || defined(__FreeBSD__)
 	return;
@@ -274,17 +299,19 @@ void imap_main_done(gboolean have_connectivity)
 	chash_free(imap_hash);
 }
 
+/* Each folder gets a queue of its own: its operations run in order, on
+ * whichever thread of the shared pool is free. */
 void imap_init(Folder * folder)
 {
-	struct etpan_thread * thread;
+	struct etpan_thread_queue * queue;
 	chashdatum key;
 	chashdatum value;
 
-	thread = etpan_thread_manager_get_thread(thread_manager);
+	queue = etpan_thread_manager_get_queue(thread_manager);
 
 	key.data = &folder;
 	key.len = sizeof(folder);
-	value.data = thread;
+	value.data = queue;
 	value.len = 0;
 
 	chash_set(imap_hash, &key, &value, NULL);
@@ -292,7 +319,7 @@ void imap_init(Folder * folder)
 
 void imap_done(Folder * folder)
 {
-	struct etpan_thread * thread;
+	struct etpan_thread_queue * queue;
 	chashdatum key;
 	chashdatum value;
 	int r;
@@ -304,18 +331,18 @@ void imap_done(Folder * folder)
 	if (r < 0)
 		return;
 
-	thread = value.data;
+	queue = value.data;
 
-	etpan_thread_unbind(thread);
+	etpan_thread_queue_release(queue);
 
 	chash_delete(imap_hash, &key, NULL);
 
-	debug_print("remove thread\n");
+	debug_print("remove queue\n");
 }
 
-static struct etpan_thread * get_thread(Folder * folder)
+static struct etpan_thread_queue * get_queue(Folder * folder)
 {
-	struct etpan_thread * thread;
+	struct etpan_thread_queue * queue;
 	chashdatum key;
 	chashdatum value;
 	int r;
@@ -327,9 +354,9 @@ static struct etpan_thread * get_thread(Folder * folder)
 	if (r < 0)
 		return NULL;
 
-	thread = value.data;
+	queue = value.data;
 
-	return thread;
+	return queue;
 }
 
 static mailimap * get_imap(Folder * folder)
@@ -357,6 +384,16 @@ static gboolean cb_show_error(gpointer data)
 	return FALSE;
 }
 
+static void show_alert(mailimap * imap)
+{
+	if (imap && imap->imap_response_info &&
+	    imap->imap_response_info->rsp_alert) {
+		log_error(LOG_PROTOCOL, "IMAP< Alert: %s\n",
+			imap->imap_response_info->rsp_alert);
+		g_timeout_add(10, cb_show_error, NULL);
+	}
+}
+
 static void generic_cb(int cancelled, void * result, void * callback_data)
 {
 	struct etpan_thread_op * op;
@@ -364,56 +401,102 @@ static void generic_cb(int cancelled, void * result, void * callback_data)
 	op = (struct etpan_thread_op *) callback_data;
 
 	debug_print("generic_cb\n");
-	if (op->imap && op->imap->imap_response_info &&
-	    op->imap->imap_response_info->rsp_alert) {
-		log_error(LOG_PROTOCOL, "IMAP< Alert: %s\n",
-			op->imap->imap_response_info->rsp_alert);
-		g_timeout_add(10, cb_show_error, NULL);
-	}
+	show_alert(op->imap);
 	op->finished = 1;
 }
 
-/* Please do *not* blindly use imap pointers after this function returns,
- * someone may have deleted it while this function was waiting for completion.
- * Check return value to see if imap is still valid.
- * Run get_imap(folder) again to get a fresh and valid pointer.
- */
-static int threaded_run(Folder * folder, void * param, void * result,
-			void (* func)(struct etpan_thread_op * ))
+/* Continuation of threaded_run_async(), called from the main loop once
+ * the operation has run. stale is set if the folder's connection was
+ * replaced meanwhile; the imap pointer the operation used is then gone. */
+typedef void (* threaded_done_func)(Folder * folder, int stale,
+				    void * result, void * data);
+
+struct threaded_async {
+	Folder * folder;
+	mailimap * imap;
+	threaded_done_func done;
+	void * data;
+};
+
+static void threaded_async_cb(int cancelled, void * result,
+			      void * callback_data)
+{
+	struct threaded_async * async = callback_data;
+	Folder * folder = async->folder;
+	int stale;
+
+	stale = async->imap != get_imap(folder);
+	if (stale)
+		g_warning("returning from operation on a stale imap %p",
+			  async->imap);
+	else
+		show_alert(async->imap);
+
+	async->done(folder, stale, result, async->data);
+
+	imap_folder_unref(folder);
+	g_free(async);
+}
+
+/* Queues func on the folder's thread and returns at once. done is
+ * called from the thread manager's watch in the main loop when func has
+ * finished, so nothing waits for the network in the meantime; param and
+ * result must stay around until then. */
+static void threaded_run_async(Folder * folder, void * param, void * result,
+			       void (* func)(struct etpan_thread_op * ),
+			       threaded_done_func done, void * data)
 {
 	struct etpan_thread_op * op;
-	struct etpan_thread * thread;
-	struct mailimap * imap = get_imap(folder);
+	struct threaded_async * async;
+
+	async = g_new0(struct threaded_async, 1);
+	async->folder = folder;
+	async->imap = get_imap(folder);
+	async->done = done;
+	async->data = data;
 
 	imap_folder_ref(folder);
 
 	op = etpan_thread_op_new();
 
-	op->imap = imap;
+	op->imap = async->imap;
 	op->param = param;
 	op->result = result;
 
 	op->run = func;
-	op->callback = generic_cb;
-	op->callback_data = op;
+	op->callback = threaded_async_cb;
+	op->callback_data = async;
+	op->cleanup = etpan_thread_op_free;
 
-	thread = get_thread(folder);
-	etpan_thread_op_schedule(thread, op);
+	etpan_thread_queue_op_schedule(get_queue(folder), op);
+}
 
-	while (!op->finished) {
-		gtk_main_iteration();
-	}
+static void threaded_run_done(Folder * folder, int stale, void * result,
+			      void * data)
+{
+	* (int *) data = stale ? 2 : 1;
+}
 
-	etpan_thread_op_free(op);
+/* Please do *not* blindly use imap pointers after this function returns,
+ * someone may have deleted it while this function was waiting for completion.
+ * Check return value to see if imap is still valid.
+ * Run get_imap(folder) again to get a fresh and valid pointer.
+ */
+static int threaded_run(Folder * folder, void * param, void * result,
+			void (* func)(struct etpan_thread_op * ))
+{
+	int finished = 0;
 
-	imap_folder_unref(folder);
+	threaded_run_async(folder, param, result, func,
+			   threaded_run_done, &finished);
 
-	if (imap != get_imap(folder)) {
-		g_warning("returning from operation on a stale imap %p", imap);
-		return 1;
+	/* a nested main loop: other sources, the UI included, are
+	 * dispatched from in here until the operation is done */
+	while (!finished) {
+		gtk_main_iteration();
 	}
 
-	return 0;
+	return finished == 2;
 }
 
 
@@ -461,7 +544,7 @@ static void threaded_delete_imap(Folder *folder, mailimap *imap)
 	op->run = delete_imap_run;
 	op->cleanup = etpan_thread_op_free;
 
-	etpan_thread_op_schedule(get_thread(folder), op);
+	etpan_thread_queue_op_schedule(get_queue(folder), op);
 
 	debug_print("threaded delete imap posted\n");
 }
@@ -647,6 +730,86 @@ int imap_threaded_capability(Folder *folder, struct mailimap_capability_data **
 
 }
 
+struct enable_modseq_param {
+	mailimap * imap;
+};
+
+struct enable_modseq_result {
+	int error;
+	IMAPModSeqMode mode;
+};
+
+static void enable_modseq_run(struct etpan_thread_op * op)
+{
+	struct enable_modseq_param * param;
+	struct enable_modseq_result * result;
+	struct mailimap_capability_data * caps;
+	struct mailimap_capability_data * enabled = NULL;
+	struct mailimap_capability * cap;
+	clistiter * cur;
+	clist * cap_list;
+	int r;
+
+	param = op->param;
+	result = op->result;
+
+	CHECK_IMAP();
+
+	result->error = MAILIMAP_NO_ERROR;
+	result->mode = IMAP_MODSEQ_NONE;
+
+	if (mailimap_has_qresync(param->imap) && mailimap_has_enable(param->imap)) {
+		cap_list = clist_new();
+		cap = mailimap_capability_new(MAILIMAP_CAPABILITY_NAME, NULL,
+					      strdup("QRESYNC"));
+		clist_append(cap_list, cap);
+		caps = mailimap_capability_data_new(cap_list);
+
+		r = mailimap_enable(param->imap, caps, &enabled);
+		mailimap_capability_data_free(caps);
+
+		if (r == MAILIMAP_NO_ERROR && enabled != NULL) {
+			for (cur = clist_begin(enabled->cap_list); cur != NULL;
+			     cur = clist_next(cur)) {
+				cap = clist_content(cur);
+				if (cap->cap_type == MAILIMAP_CAPABILITY_NAME &&
+				    !strcasecmp(cap->cap_data.cap_name, "QRESYNC"))
+					result->mode = IMAP_MODSEQ_QRESYNC;
+			}
+		}
+		if (enabled != NULL)
+			mailimap_capability_data_free(enabled);
+		result->error = r;
+	}
+
+	/* CONDSTORE needs no ENABLE, the first SELECT (CONDSTORE) turns it on */
+	if (result->mode == IMAP_MODSEQ_NONE && mailimap_has_condstore(param->imap))
+		result->mode = IMAP_MODSEQ_CONDSTORE;
+
+	debug_print("imap enable_modseq run - end %i, mode %d\n",
+		    result->error, result->mode);
+}
+
+int imap_threaded_enable_modseq(Folder * folder, IMAPModSeqMode * mode)
+{
+	struct enable_modseq_param param;
+	struct enable_modseq_result result;
+
+	debug_print("imap enable_modseq - begin\n");
+
+	param.imap = get_imap(folder);
+
+	result.mode = IMAP_MODSEQ_NONE;
+	if (threaded_run(folder, &param, &result, enable_modseq_run))
+		return MAILIMAP_ERROR_INVAL;
+
+	* mode = result.mode;
+
+	debug_print("imap enable_modseq - end\n");
+
+	return result.error;
+}
+
 struct disconnect_param {
 	mailimap * imap;
 };
@@ -1294,10 +1457,12 @@ int imap_threaded_delete(Folder * folder, const char * mb)
 struct select_param {
 	mailimap * imap;
 	const char * mb;
+	gboolean condstore;
 };
 
 struct select_result {
 	int error;
+	uint64_t highestmodseq;
 };
 
 static void select_run(struct etpan_thread_op * op)
@@ -1311,7 +1476,12 @@ static void select_run(struct etpan_thread_op * op)
 
 	CHECK_IMAP();
 
-	r = mailimap_select(param->imap, param->mb);
+	result->highestmodseq = 0;
+	if (param->condstore)
+		r = mailimap_select_condstore(param->imap, param->mb,
+					      &result->highestmodseq);
+	else
+		r = mailimap_select(param->imap, param->mb);
 
 	result->error = r;
 	debug_print("imap select run - end %i\n", r);
@@ -1320,7 +1490,7 @@ static void select_run(struct etpan_thread_op * op)
 int imap_threaded_select(Folder * folder, const char * mb,
 			 gint * exists, gint * recent, gint * unseen,
 			 guint32 * uid_validity,gint *can_create_flags,
-			 GSList **ok_flags)
+			 GSList **ok_flags, guint64 * highestmodseq)
 {
 	struct select_param param;
 	struct select_result result;
@@ -1331,6 +1501,7 @@ int imap_threaded_select(Folder * folder, const char * mb,
 	imap = get_imap(folder);
 	param.imap = imap;
 	param.mb = mb;
+	param.condstore = (highestmodseq != NULL);
 
 	if (threaded_run(folder, &param, &result, select_run))
 		return MAILIMAP_ERROR_INVAL;
@@ -1346,6 +1517,8 @@ int imap_threaded_select(Folder * folder, const char * mb,
 	* unseen = imap->imap_selection_info->sel_unseen;
 	* uid_validity = imap->imap_selection_info->sel_uidvalidity;
 	* can_create_flags = FALSE;
+	if (highestmodseq)
+		* highestmodseq = result.highestmodseq;
 
 	if (imap->imap_selection_info->sel_perm_flags) {
 		GSList *t_flags = NULL;
@@ -1503,6 +1676,335 @@ int imap_threaded_examine(Folder * folder, const char * mb,
 	return result.error;
 }
 
+/* idle */
+
+/* RFC 2177 asks clients to leave IDLE before 30 minutes are up */
+#define IDLE_RESTART_SEC	(29 * 60)
+
+struct _IMAPIdle {
+	Folder * folder;
+	char * mb;
+	struct etpan_thread * thread;
+	mailimap * imap;
+	int wakeup_fds[2];
+	uint32_t exists;
+
+	IMAPIdleFunc func;
+	gpointer data;
+
+	/* the caller, the idle loop and each queued notification */
+	gint refcnt;
+	gint notify_pending;
+	gboolean stopped;
+	gboolean lost;
+};
+
+static void idle_unref(IMAPIdle * idle)
+{
+	if (!g_atomic_int_dec_and_test(&idle->refcnt))
+		return;
+
+	idle_list = g_slist_remove(idle_list, idle);
+	if (!idle_shutdown && idle->thread != NULL)
+		etpan_thread_manager_release_thread(thread_manager,
+						    idle->thread);
+	close(idle->wakeup_fds[0]);
+	close(idle->wakeup_fds[1]);
+	g_free(idle->mb);
+	g_free(idle);
+}
+
+static void idle_wakeup(IMAPIdle * idle)
+{
+	char ch = 1;
+
+	if (write(idle->wakeup_fds[1], &ch, 1) < 0)
+		g_warning("error waking up IMAP IDLE loop");
+}
+
+/* Runs an op on the IDLE connection's own thread and waits for it, the
+ * way threaded_run() does for the folder's connection. */
+static void idle_run(IMAPIdle * idle, void * param, void * result,
+		     void (* func)(struct etpan_thread_op * ))
+{
+	struct etpan_thread_op * op;
+
+	op = etpan_thread_op_new();
+
+	op->imap = idle->imap;
+	op->param = param;
+	op->result = result;
+
+	op->run = func;
+	op->callback = generic_cb;
+	op->callback_data = op;
+
+	etpan_thread_op_schedule(idle->thread, op);
+
+	while (!op->finished) {
+		gtk_main_iteration();
+	}
+
+	etpan_thread_op_free(op);
+}
+
+static gboolean idle_notify_cb(gpointer data)
+{
+	IMAPIdle * idle = data;
+	gboolean lost;
+
+	g_atomic_int_set(&idle->notify_pending, 0);
+	lost = idle->lost;
+	if (!idle->stopped && !lost)
+		idle->func(idle, TRUE, idle->data);
+	idle_unref(idle);
+
+	return FALSE;
+}
+
+/* Called from the IDLE thread; repeated changes collapse into one
+ * notification until the main loop has handled it. */
+static void idle_notify(IMAPIdle * idle)
+{
+	if (!g_atomic_int_compare_and_exchange(&idle->notify_pending, 0, 1))
+		return;
+	g_atomic_int_inc(&idle->refcnt);
+	g_idle_add(idle_notify_cb, idle);
+}
+
+static gboolean idle_changed(IMAPIdle * idle)
+{
+	mailimap * imap = idle->imap;
+	struct mailimap_response_info * info = imap->imap_response_info;
+	gboolean changed = FALSE;
+
+	if (imap->imap_selection_info != NULL &&
+	    imap->imap_selection_info->sel_exists != idle->exists) {
+		idle->exists = imap->imap_selection_info->sel_exists;
+		changed = TRUE;
+	}
+	if (info != NULL &&
+	    ((info->rsp_expunged != NULL &&
+	      clist_count(info->rsp_expunged) > 0) ||
+	     (info->rsp_fetch_list != NULL &&
+	      clist_count(info->rsp_fetch_list) > 0)))
+		changed = TRUE;
+
+	return changed;
+}
+
+static void idle_loop_run(struct etpan_thread_op * op)
+{
+	IMAPIdle * idle = op->param;
+	mailimap * imap = idle->imap;
+	struct pollfd fds[2];
+	char ch;
+	int r;
+
+	for (;;) {
+		r = mailimap_idle(imap);
+		if (r != MAILIMAP_NO_ERROR) {
+			debug_print("IDLE on %s failed: %d\n", idle->mb, r);
+			break;
+		}
+
+		fds[0].fd = mailimap_idle_get_fd(imap);
+		fds[0].events = POLLIN;
+		fds[1].fd = idle->wakeup_fds[0];
+		fds[1].events = POLLIN;
+		r = poll(fds, 2, IDLE_RESTART_SEC * 1000);
+		if (r < 0 && errno != EINTR)
+			break;
+
+		if (r > 0 && (fds[1].revents & POLLIN)) {
+			if (read(idle->wakeup_fds[0], &ch, 1) < 0)
+				g_warning("error reading IMAP IDLE wakeup");
+			mailimap_idle_done(imap);
+			break;
+		}
+
+		/* DONE makes the server finish off the untagged responses
+		 * it has, which libetpan then collects for us */
+		r = mailimap_idle_done(imap);
+		if (r != MAILIMAP_NO_ERROR) {
+			debug_print("IDLE DONE on %s failed: %d\n", idle->mb, r);
+			break;
+		}
+		if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+		    idle_changed(idle)) {
+			debug_print("IDLE: %s changed\n", idle->mb);
+			idle_notify(idle);
+		}
+	}
+
+	if (imap->imap_stream != NULL)
+		mailimap_logout(imap);
+	mailimap_free(imap);
+}
+
+static void idle_loop_cb(int cancelled, void * result, void * callback_data)
+{
+	IMAPIdle * idle = callback_data;
+
+	idle->imap = NULL;
+	if (!idle->stopped) {
+		idle->lost = TRUE;
+		idle->func(idle, FALSE, idle->data);
+	}
+	idle_unref(idle);
+}
+
+/*!
+ *\brief	Open a connection of its own to the folder's server, select
+ *		mb read-only on it and keep it in IDLE. func is called
+ *		in the main thread when the server reports EXISTS, EXPUNGE
+ *		or FETCH for mb, and once with alive FALSE if the connection
+ *		is lost.
+ *
+ *\return	NULL if the connection could not be set up or the server
+ *		does not support IDLE
+ */
+IMAPIdle * imap_threaded_idle_start(Folder * folder, int port,
+				    const char * mb,
+				    const char * login,
+				    const char * password,
+				    const char * type,
+				    IMAPIdleFunc func, gpointer data)
+{
+	PrefsAccount * account = folder->account;
+	struct etpan_thread_op * op;
+	struct connect_param cparam;
+	struct connect_result cresult;
+	struct starttls_result sresult;
+	struct login_param lparam;
+	struct login_result lresult;
+	struct capa_param capa_param;
+	struct capa_result capa_result;
+	struct examine_param eparam;
+	struct examine_result eresult;
+	IMAPIdle * idle;
+	int r;
+
+	idle = g_new0(IMAPIdle, 1);
+	idle->folder = folder;
+	idle->mb = g_strdup(mb);
+	idle->func = func;
+	idle->data = data;
+	idle->refcnt = 1;
+	if (pipe(idle->wakeup_fds) < 0) {
+		g_free(idle->mb);
+		g_free(idle);
+		return NULL;
+	}
+	idle->thread = etpan_thread_manager_get_dedicated_thread(thread_manager);
+	if (idle->thread == NULL) {
+		idle_unref(idle);
+		return NULL;
+	}
+	idle->imap = mailimap_new(0, NULL);
+	idle_list = g_slist_prepend(idle_list, idle);
+
+	imap_folder_ref(folder);
+
+	cparam.imap = idle->imap;
+	cparam.server = account->recv_server;
+	cparam.port = port;
+	cparam.account = account;
+
+	idle_run(idle, &cparam, &cresult, account->ssl_imap == SSL_TUNNEL ?
+		 connect_ssl_run : connect_run);
+	r = cresult.error;
+	if ((r == MAILIMAP_NO_ERROR_AUTHENTICATED ||
+	     r == MAILIMAP_NO_ERROR_NON_AUTHENTICATED) &&
+	    account->ssl_imap == SSL_TUNNEL && !etpan_skip_ssl_cert_check &&
+	    etpan_certificate_check(idle->imap->imap_stream,
+				    account->recv_server, port, TRUE) != TRUE)
+		r = MAILIMAP_ERROR_SSL;
+	if (r != MAILIMAP_NO_ERROR_AUTHENTICATED &&
+	    r != MAILIMAP_NO_ERROR_NON_AUTHENTICATED)
+		goto fail;
+
+	if (account->ssl_imap == SSL_STARTTLS) {
+		idle_run(idle, &cparam, &sresult, starttls_run);
+		if (sresult.error != MAILIMAP_NO_ERROR)
+			goto fail;
+		if (!etpan_skip_ssl_cert_check &&
+		    etpan_certificate_check(idle->imap->imap_stream,
+					    account->recv_server, port,
+					    TRUE) != TRUE)
+			goto fail;
+		r = MAILIMAP_NO_ERROR_NON_AUTHENTICATED;
+	}
+
+	if (r == MAILIMAP_NO_ERROR_NON_AUTHENTICATED) {
+		lparam.imap = idle->imap;
+		lparam.login = login;
+		lparam.password = password;
+		lparam.type = type;
+		lparam.server = account->recv_server;
+		idle_run(idle, &lparam, &lresult, login_run);
+		if (lresult.error != MAILIMAP_NO_ERROR)
+			goto fail;
+	}
+
+	capa_param.imap = idle->imap;
+	idle_run(idle, &capa_param, &capa_result, capability_run);
+	if (capa_result.error == MAILIMAP_NO_ERROR)
+		mailimap_capability_data_free(capa_result.caps);
+	if (!mailimap_has_idle(idle->imap)) {
+		debug_print("IDLE: not supported by %s\n", account->recv_server);
+		goto fail;
+	}
+
+	eparam.imap = idle->imap;
+	eparam.mb = mb;
+	idle_run(idle, &eparam, &eresult, examine_run);
+	if (eresult.error != MAILIMAP_NO_ERROR ||
+	    idle->imap->imap_selection_info == NULL)
+		goto fail;
+	idle->exists = idle->imap->imap_selection_info->sel_exists;
+
+	/* from here on the loop owns the connection */
+	g_atomic_int_inc(&idle->refcnt);
+	op = etpan_thread_op_new();
+	op->imap = idle->imap;
+	op->param = idle;
+	op->run = idle_loop_run;
+	op->callback = idle_loop_cb;
+	op->callback_data = idle;
+	op->cleanup = etpan_thread_op_free;
+	etpan_thread_op_schedule(idle->thread, op);
+
+	imap_folder_unref(folder);
+	debug_print("IDLE: watching %s\n", mb);
+	return idle;
+
+fail:
+	debug_print("IDLE: could not watch %s\n", mb);
+	op = etpan_thread_op_new();
+	op->imap = idle->imap;
+	op->run = delete_imap_run;
+	op->cleanup = etpan_thread_op_free;
+	etpan_thread_op_schedule(idle->thread, op);
+	idle->imap = NULL;
+	imap_folder_unref(folder);
+	idle_unref(idle);
+	return NULL;
+}
+
+/* Leaves IDLE, logs out and frees idle once the loop has wound down.
+ * func is not called after this. */
+void imap_threaded_idle_stop(IMAPIdle * idle)
+{
+	if (idle == NULL)
+		return;
+
+	idle->stopped = TRUE;
+	if (idle->imap != NULL)
+		idle_wakeup(idle);
+	idle_unref(idle);
+}
+
 
 
 
@@ -1948,11 +2450,14 @@ static int imap_get_messages_list(mailimap * imap,
 struct fetch_uid_param {
 	mailimap * imap;
 	uint32_t first_index;
+	uint64_t modseq;
+	gboolean qresync;
 };
 
 struct fetch_uid_result {
 	int error;
 	carray * fetch_result;
+	struct mailimap_set * vanished;
 };
 
 static void fetch_uid_run(struct etpan_thread_op * op)
@@ -2109,15 +2614,20 @@ result_to_uid_flags_list(clist * fetch_result, carray ** result)
 	return res;
 }
 
+/* With modseq set, only messages changed since then are returned; with
+ * p_vanished also set, the UIDs expunged since then come back there. */
 static int imap_get_messages_flags_list(mailimap * imap,
 					uint32_t first_index,
-					carray ** result)
+					uint64_t modseq,
+					carray ** result,
+					struct mailimap_set ** p_vanished)
 {
 	carray * env_list;
 	int r;
 	struct mailimap_fetch_att * fetch_att;
 	struct mailimap_fetch_type * fetch_type;
 	struct mailimap_set * set;
+	struct mailimap_qresync_vanished * vanished = NULL;
 	clist * fetch_result;
 	int res;
 
@@ -2161,8 +2671,15 @@ static int imap_get_messages_flags_list(mailimap * imap,
 
 	mailstream_logger = imap_logger_fetch;
 
-	r = mailimap_uid_fetch(imap, set,
-			       fetch_type, &fetch_result);
+	if (modseq == 0)
+		r = mailimap_uid_fetch(imap, set,
+				       fetch_type, &fetch_result);
+	else if (p_vanished != NULL)
+		r = mailimap_uid_fetch_qresync(imap, set, fetch_type, modseq,
+					       &fetch_result, &vanished);
+	else
+		r = mailimap_uid_fetch_changedsince(imap, set, fetch_type,
+						    modseq, &fetch_result);
 
 	mailstream_logger = imap_logger_cmd;
 	mailimap_fetch_type_free(fetch_type);
@@ -2178,6 +2695,14 @@ static int imap_get_messages_flags_list(mailimap * imap,
 	mailimap_fetch_list_free(fetch_result);
 
 	* result = env_list;
+	if (p_vanished != NULL) {
+		* p_vanished = NULL;
+		if (vanished != NULL) {
+			* p_vanished = vanished->qr_known_uids;
+			vanished->qr_known_uids = NULL;
+			mailimap_qresync_vanished_free(vanished);
+		}
+	}
 
 	return MAILIMAP_NO_ERROR;
 
@@ -2204,8 +2729,10 @@ static void fetch_uid_flags_run(struct etpan_thread_op * op)
 	CHECK_IMAP();
 
 	fetch_result = NULL;
+	result->vanished = NULL;
 	r = imap_get_messages_flags_list(param->imap, param->first_index,
-					 &fetch_result);
+					 param->modseq, &fetch_result,
+					 param->qresync ? &result->vanished : NULL);
 
 	result->error = r;
 	result->fetch_result = fetch_result;
@@ -2224,6 +2751,8 @@ int imap_threaded_fetch_uid_flags(Folder * folder, uint32_t first_index,
 	imap = get_imap(folder);
 	param.imap = imap;
 	param.first_index = first_index;
+	param.modseq = 0;
+	param.qresync = FALSE;
 
 	mailstream_logger = imap_logger_noop;
 	log_print(LOG_PROTOCOL, "IMAP- [fetching flags...]\n");
@@ -2243,6 +2772,44 @@ int imap_threaded_fetch_uid_flags(Folder * folder, uint32_t first_index,
 	return result.error;
 }
 
+int imap_threaded_fetch_uid_flags_changedsince(Folder * folder,
+					       guint64 modseq,
+					       gboolean qresync,
+					       carray ** fetch_result,
+					       struct mailimap_set ** vanished)
+{
+	struct fetch_uid_param param;
+	struct fetch_uid_result result;
+
+	debug_print("imap fetch_uid changedsince %" G_GUINT64_FORMAT " - begin\n",
+		    modseq);
+
+	param.imap = get_imap(folder);
+	param.first_index = 1;
+	param.modseq = modseq;
+	param.qresync = qresync;
+
+	mailstream_logger = imap_logger_noop;
+	log_print(LOG_PROTOCOL, "IMAP- [fetching changed flags...]\n");
+
+	threaded_run(folder, &param, &result, fetch_uid_flags_run);
+
+	mailstream_logger = imap_logger_cmd;
+
+	if (result.error != MAILIMAP_NO_ERROR)
+		return result.error;
+
+	debug_print("imap fetch_uid changedsince - end\n");
+
+	* fetch_result = result.fetch_result;
+	if (vanished != NULL)
+		* vanished = result.vanished;
+	else if (result.vanished != NULL)
+		mailimap_set_free(result.vanished);
+
+	return result.error;
+}
+
 
 void imap_fetch_uid_flags_list_free(carray * uid_flags_list)
 {
@@ -2485,8 +3052,37 @@ struct fetch_content_param {
 
 struct fetch_content_result {
 	int error;
+	size_t size;
 };
 
+/* Writes data with each CRLF turned into LF, as file_strip_crs() would
+ * do to the file afterwards. A CR that does not start a line break is
+ * kept, including one at the very end. */
+static int fwrite_strip_crs(const char * data, size_t len, FILE * f)
+{
+	const char * p = data;
+	const char * end = data + len;
+	const char * cr;
+
+	while (p < end) {
+		cr = memchr(p, '\r', end - p);
+		if (cr == NULL || cr + 1 == end)
+			break;
+		if (cr[1] != '\n') {
+			if (fwrite(p, 1, cr + 1 - p, f) < (size_t)(cr + 1 - p))
+				return -1;
+		} else if (cr > p &&
+			   fwrite(p, 1, cr - p, f) < (size_t)(cr - p)) {
+			return -1;
+		}
+		p = cr + 1;
+	}
+	if (p < end && fwrite(p, 1, end - p, f) < (size_t)(end - p))
+		return -1;
+
+	return 0;
+}
+
 static void fetch_content_run(struct etpan_thread_op * op)
 {
 	struct fetch_content_param * param;
@@ -2512,9 +3108,10 @@ static void fetch_content_run(struct etpan_thread_op * op)
 				      &content, &content_size);
 
 	result->error = r;
+	result->size = content_size;
 
 	if (r == MAILIMAP_NO_ERROR) {
-		fd = g_open(param->filename, O_RDWR | O_CREAT, 0600);
+		fd = g_open(param->filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 		if (fd < 0) {
 			result->error = MAILIMAP_ERROR_FETCH;
 			goto free;
@@ -2526,8 +3123,7 @@ static void fetch_content_run(struct etpan_thread_op * op)
 			goto close;
 		}
 
-		r = fwrite(content, 1, content_size, f);
-		if (r < content_size) {
+		if (fwrite_strip_crs(content, content_size, f) < 0) {
 			result->error = MAILIMAP_ERROR_FETCH;
 			goto do_fclose;
 		}
@@ -2557,9 +3153,12 @@ static void fetch_content_run(struct etpan_thread_op * op)
 	debug_print("imap fetch_content run - end %i\n", result->error);
 }
 
+/* Saves the message to filename with CRLFs already turned into LFs.
+ * *p_size gets the size as the server sent it. */
 int imap_threaded_fetch_content(Folder * folder, uint32_t msg_index,
 				int with_body,
-				const char * filename)
+				const char * filename,
+				size_t * p_size)
 {
 	struct fetch_content_param param;
 	struct fetch_content_result result;
@@ -2572,17 +3171,72 @@ int imap_threaded_fetch_content(Folder * folder, uint32_t msg_index,
 	param.msg_index = msg_index;
 	param.filename = filename;
 	param.with_body = with_body;
+	result.size = 0;
 
 	threaded_run(folder, &param, &result, fetch_content_run);
 
 	if (result.error != MAILIMAP_NO_ERROR)
 		return result.error;
 
+	if (p_size != NULL)
+		* p_size = result.size;
+
 	debug_print("imap fetch_content - end\n");
 
 	return result.error;
 }
 
+struct fetch_content_async {
+	struct fetch_content_param param;
+	struct fetch_content_result result;
+	char * filename;
+	IMAPFetchContentFunc func;
+	gpointer data;
+};
+
+static void fetch_content_async_done(Folder * folder, int stale,
+				     void * result, void * data)
+{
+	struct fetch_content_async * async = data;
+	int error = async->result.error;
+
+	if (stale && error == MAILIMAP_NO_ERROR)
+		error = MAILIMAP_ERROR_STREAM;
+	async->func(error, async->result.size, async->data);
+
+	g_free(async->filename);
+	g_free(async);
+}
+
+/*!
+ *\brief	Like imap_threaded_fetch_content(), but returns at once
+ *		and calls func from the main loop when the message has been
+ *		saved or the fetch has failed. Fetches queued one after
+ *		the other run back to back on the folder's thread.
+ */
+void imap_threaded_fetch_content_async(Folder * folder, uint32_t msg_index,
+				       int with_body,
+				       const char * filename,
+				       IMAPFetchContentFunc func,
+				       gpointer data)
+{
+	struct fetch_content_async * async;
+
+	debug_print("imap fetch_content async - %u\n", msg_index);
+
+	async = g_new0(struct fetch_content_async, 1);
+	async->filename = g_strdup(filename);
+	async->func = func;
+	async->data = data;
+	async->param.imap = get_imap(folder);
+	async->param.msg_index = msg_index;
+	async->param.filename = async->filename;
+	async->param.with_body = with_body;
+
+	threaded_run_async(folder, &async->param, &async->result,
+			   fetch_content_run, fetch_content_async_done, async);
+}
+
 
 
 static int imap_flags_to_flags(struct mailimap_msg_att_dynamic * att_dyn, GSList **s_tags)
@@ -2963,6 +3617,174 @@ int imap_threaded_fetch_env(Folder * folder, struct mailimap_set * set,
 	return result.error;
 }
 
+struct fetch_env_pipeline_param {
+	mailimap * imap;
+	struct mailimap_set * set;
+	gint * stop;
+};
+
+struct fetch_env_pipeline_result {
+	carray * fetch_env_result;
+	int error;
+	int skipped;
+	int finished;
+};
+
+static void fetch_env_pipeline_run(struct etpan_thread_op * op)
+{
+	struct fetch_env_pipeline_param * param;
+	struct fetch_env_pipeline_result * result;
+	carray * env_list;
+	int r;
+
+	param = op->param;
+	result = op->result;
+
+	CHECK_IMAP();
+
+	if (g_atomic_int_get(param->stop)) {
+		result->skipped = 1;
+		return;
+	}
+
+	env_list = NULL;
+	r = imap_get_envelopes_list(param->imap, param->set,
+				    &env_list);
+
+	result->error = r;
+	result->fetch_env_result = env_list;
+	/* let the main thread decide how to go on */
+	if (r != MAILIMAP_NO_ERROR)
+		g_atomic_int_set(param->stop, 1);
+
+	debug_print("imap fetch_env pipeline run - end %i\n", r);
+}
+
+static void fetch_env_pipeline_cb(int cancelled, void * result,
+				  void * callback_data)
+{
+	((struct fetch_env_pipeline_result *) result)->finished = 1;
+}
+
+/*!
+ *\brief	Fetch the envelopes of every set in set_list. All the
+ *		fetches are queued on the folder's thread at once, so that
+ *		it goes from one to the next without waiting for the main
+ *		loop, and func is called in the main thread with the
+ *		results in the order of set_list while later sets are
+ *		still being fetched. func owns the envelope list it gets
+ *		and returns FALSE to skip the rest.
+ *
+ *\return	The error func stopped on, if any
+ */
+int imap_threaded_fetch_env_pipelined(Folder * folder, GSList * set_list,
+				      IMAPFetchEnvFunc func, gpointer data)
+{
+	struct fetch_env_pipeline_param * params;
+	struct fetch_env_pipeline_result * results;
+	struct etpan_thread_op * op;
+	struct etpan_thread_queue * queue;
+	mailimap * imap;
+	gboolean retried = FALSE;
+	gboolean aborted = FALSE;
+	guint n, i, next, start;
+	int error = MAILIMAP_NO_ERROR;
+	gint stop;
+	GSList * cur;
+	chashdatum key;
+	chashdatum value;
+
+	debug_print("imap fetch_env pipeline - begin\n");
+
+	n = g_slist_length(set_list);
+	if (n == 0)
+		return MAILIMAP_NO_ERROR;
+
+	imap = get_imap(folder);
+	queue = get_queue(folder);
+	params = g_new0(struct fetch_env_pipeline_param, n);
+	results = g_new0(struct fetch_env_pipeline_result, n);
+	for (cur = set_list, i = 0; cur != NULL; cur = cur->next, i++) {
+		params[i].imap = imap;
+		params[i].set = cur->data;
+		params[i].stop = &stop;
+	}
+
+	imap_folder_ref(folder);
+
+	start = 0;
+	while (start < n && !aborted) {
+		stop = 0;
+		for (i = start; i < n; i++) {
+			memset(&results[i], 0, sizeof(results[i]));
+			op = etpan_thread_op_new();
+			op->imap = imap;
+			op->param = &params[i];
+			op->result = &results[i];
+			op->run = fetch_env_pipeline_run;
+			op->callback = fetch_env_pipeline_cb;
+			op->callback_data = op;
+			op->cleanup = etpan_thread_op_free;
+			etpan_thread_queue_op_schedule(queue, op);
+		}
+
+		for (next = start; next < n; next++) {
+			while (!results[next].finished)
+				gtk_main_iteration();
+			if (results[next].skipped)
+				break;
+
+			if (results[next].error != MAILIMAP_NO_ERROR &&
+			    !retried) {
+				/* some servers (Courier) can't send the
+				 * envelope, ask for the headers instead */
+				key.data = &imap;
+				key.len = sizeof(imap);
+				if (chash_get(courier_workaround_hash,
+					      &key, &value) < 0) {
+					value.data = NULL;
+					value.len = 0;
+					chash_set(courier_workaround_hash,
+						  &key, &value, NULL);
+					retried = TRUE;
+					break;
+				}
+			}
+
+			if (!func(results[next].error,
+				  results[next].fetch_env_result, data)) {
+				error = results[next].error;
+				g_atomic_int_set(&stop, 1);
+				aborted = TRUE;
+				next++;
+				break;
+			}
+		}
+
+		/* the rest refer to params and results, let them finish */
+		for (i = start; i < n; i++) {
+			while (!results[i].finished)
+				gtk_main_iteration();
+			if (i >= next && results[i].fetch_env_result != NULL)
+				imap_fetch_env_free(results[i].fetch_env_result);
+		}
+		start = next;
+	}
+
+	imap_folder_unref(folder);
+	g_free(results);
+	g_free(params);
+
+	if (imap != get_imap(folder)) {
+		g_warning("returning from operation on a stale imap %p", imap);
+		return MAILIMAP_ERROR_INVAL;
+	}
+
+	debug_print("imap fetch_env pipeline - end\n");
+
+	return error;
+}
+
 void imap_fetch_env_free(carray * env_list)
 {
 	unsigned int i;
@@ -36,7 +36,17 @@ typedef enum
 	IMAP_FLAG_HAM		= 1 << 7
 } IMAPFlags;
 
+/* how far the server lets us ask for changes since a mod-sequence
+ * (RFC 7162) */
+typedef enum
+{
+	IMAP_MODSEQ_NONE,
+	IMAP_MODSEQ_CONDSTORE,
+	IMAP_MODSEQ_QRESYNC
+} IMAPModSeqMode;
+
 void imap_main_set_timeout(int sec);
+void imap_main_set_max_workers(int count);
 void imap_main_init(gboolean skip_ssl_cert_check);
 void imap_main_done(gboolean have_connectivity);
 
@@ -46,6 +56,7 @@ void imap_done(Folder * folder);
 int imap_threaded_connect(Folder * folder, const char * server, int port);
 int imap_threaded_connect_ssl(Folder * folder, const char * server, int port);
 int imap_threaded_capability(Folder *folder, struct mailimap_capability_data ** caps);
+int imap_threaded_enable_modseq(Folder * folder, IMAPModSeqMode * mode);
 
 int imap_threaded_connect_cmd(Folder * folder, const char * command,
 			      const char * server, int port);
@@ -79,7 +90,7 @@ int imap_threaded_delete(Folder * folder, const char * mb);
 int imap_threaded_select(Folder * folder, const char * mb,
 			 gint * exists, gint * recent, gint * unseen,
 			 guint32 * uid_validity, gint * can_create_flags,
-			 GSList **ok_flags);
+			 GSList **ok_flags, guint64 * highestmodseq);
 int imap_threaded_examine(Folder * folder, const char * mb,
 			  gint * exists, gint * recent, gint * unseen,
 			  guint32 * uid_validity);
@@ -142,12 +153,27 @@ void imap_fetch_uid_list_free(carray * uid_list);
 
 int imap_threaded_fetch_uid_flags(Folder * folder, uint32_t first_index,
 				  carray ** fetch_result);
+int imap_threaded_fetch_uid_flags_changedsince(Folder * folder,
+					       guint64 modseq,
+					       gboolean qresync,
+					       carray ** fetch_result,
+					       struct mailimap_set ** vanished);
 
 void imap_fetch_uid_flags_list_free(carray * uid_flags_list);
 
 int imap_threaded_fetch_content(Folder * folder, uint32_t msg_index,
 				int with_body,
-				const char * filename);
+				const char * filename,
+				size_t * p_size);
+
+typedef void (* IMAPFetchContentFunc)(int error, size_t size,
+				      gpointer data);
+
+void imap_threaded_fetch_content_async(Folder * folder, uint32_t msg_index,
+				       int with_body,
+				       const char * filename,
+				       IMAPFetchContentFunc func,
+				       gpointer data);
 
 struct imap_fetch_env_info {
 	uint32_t uid;
@@ -159,6 +185,12 @@ struct imap_fetch_env_info {
 int imap_threaded_fetch_env(Folder * folder, struct mailimap_set * set,
 			    carray ** p_env_list);
 
+typedef gboolean (* IMAPFetchEnvFunc)(int error, carray * env_list,
+				      gpointer data);
+
+int imap_threaded_fetch_env_pipelined(Folder * folder, GSList * set_list,
+				      IMAPFetchEnvFunc func, gpointer data);
+
 void imap_fetch_env_free(carray * env_list);
 
 int imap_threaded_append(Folder * folder, const char * mailbox,
@@ -177,4 +209,16 @@ int imap_threaded_store(Folder * folder, struct mailimap_set * set,
 
 void imap_threaded_cancel(Folder * folder);
 
+/* RFC 2177 IDLE on a connection of its own */
+typedef struct _IMAPIdle IMAPIdle;
+typedef void (* IMAPIdleFunc)(IMAPIdle * idle, gboolean alive, gpointer data);
+
+IMAPIdle * imap_threaded_idle_start(Folder * folder, int port,
+				    const char * mb,
+				    const char * login,
+				    const char * password,
+				    const char * type,
+				    IMAPIdleFunc func, gpointer data);
+void imap_threaded_idle_stop(IMAPIdle * idle);
+
 #endif
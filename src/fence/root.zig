@@ -6,11 +6,56 @@ export fn fence_is_top_level_domain(dom: [*:0]const u8) bool {
     return isTopLevelDomain(std.mem.span(dom));
 }
 
-fn isTopLevelDomain(dom: []const u8) bool {
+// A trie of tlds.tab built at compile time. Children of a node are
+// chained through sibling, so a lookup steps through at most one
+// short sibling list per character of the label.
+const TrieNode = struct {
+    c: u8 = 0,
+    end: bool = false,
+    // Indices into trie; 0 means none, as the root is no one's child.
+    child: u16 = 0,
+    sibling: u16 = 0,
+};
+
+const trie_size = blk: {
+    var n: usize = 1;
+    for (tlds.tab) |tld| n += tld.len;
+    break :blk n;
+};
+
+const trie = blk: {
+    @setEvalBranchQuota(10_000_000);
+    var nodes: [trie_size]TrieNode = undefined;
+    nodes[0] = .{};
+    var n: usize = 1;
     for (tlds.tab) |tld| {
-        if (std.mem.eql(u8, dom, tld)) return true;
+        var cur: usize = 0;
+        for (tld) |c| {
+            var i: usize = nodes[cur].child;
+            while (i != 0 and nodes[i].c != c) i = nodes[i].sibling;
+            if (i == 0) {
+                i = n;
+                n += 1;
+                nodes[i] = .{ .c = c, .sibling = nodes[cur].child };
+                nodes[cur].child = i;
+            }
+            cur = i;
+        }
+        nodes[cur].end = true;
     }
-    return false;
+    const final = nodes[0..n].*;
+    break :blk final;
+};
+
+fn isTopLevelDomain(dom: []const u8) bool {
+    var cur: u16 = 0;
+    for (dom) |c| {
+        var i = trie[cur].child;
+        while (i != 0 and trie[i].c != c) i = trie[i].sibling;
+        if (i == 0) return false;
+        cur = i;
+    }
+    return cur != 0 and trie[cur].end;
 }
 
 fn isRfc822Char(c: u8) bool {
@@ -95,3 +140,28 @@ test "check domains" {
     const str = [_:0]u8{ 'c', 'o', 'm', 0 };
     try testing.expect(fence_is_top_level_domain(str[0..]));
 }
+
+fn isTopLevelDomainLinear(dom: []const u8) bool {
+    for (tlds.tab) |tld| {
+        if (std.mem.eql(u8, dom, tld)) return true;
+    }
+    return false;
+}
+
+test "domain trie matches linear scan" {
+    var buf: [64]u8 = undefined;
+    for (tlds.tab) |tld| {
+        errdefer std.debug.print("top level domain \"{s}\"\n", .{tld});
+        try testing.expect(isTopLevelDomain(tld));
+        for (0..tld.len) |i| {
+            const prefix = tld[0..i];
+            try testing.expectEqual(isTopLevelDomainLinear(prefix), isTopLevelDomain(prefix));
+        }
+        const longer = buf[0 .. tld.len + 1];
+        @memcpy(longer[0..tld.len], tld);
+        longer[tld.len] = 'x';
+        try testing.expectEqual(isTopLevelDomainLinear(longer), isTopLevelDomain(longer));
+        const upper = std.ascii.upperString(buf[0..tld.len], tld);
+        try testing.expectEqual(isTopLevelDomainLinear(upper), isTopLevelDomain(upper));
+    }
+}
@@ -69,6 +69,7 @@ void folder_init		(Folder		*folder,
 
 static gchar *folder_item_get_cache_file	(FolderItem	*item);
 static gchar *folder_item_get_mark_file	(FolderItem	*item);
+static gchar *folder_item_get_journal_file	(FolderItem	*item);
 static gchar *folder_item_get_tags_file	(FolderItem	*item);
 static GNode *folder_get_xml_node	(Folder 	*folder);
 static Folder *folder_get_from_xml	(GNode 		*node);
@@ -384,6 +385,15 @@ void folder_item_append(FolderItem *parent, FolderItem *item)
 	g_node_append(parent->node, item->node);
 }
 
+/* The thread tree holds the cache's messages, so it goes with it */
+static void folder_item_destroy_cache(FolderItem *item)
+{
+	msgcache_destroy(item->cache);
+	item->cache = NULL;
+	procmsg_thread_tree_free(item->thread_tree);
+	item->thread_tree = NULL;
+}
+
 void folder_item_remove(FolderItem *item)
 {
 	GNode *node, *start_node;
@@ -411,10 +421,8 @@ void folder_item_remove(FolderItem *item)
 	}
 
 	/* remove myself */
-	if (item->cache != NULL) {
-		msgcache_destroy(item->cache);
-		item->cache = NULL;
-	}
+	if (item->cache != NULL)
+		folder_item_destroy_cache(item);
 
 	tags_file = folder_item_get_tags_file(item);
 	if (tags_file) {
@@ -2015,6 +2023,7 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 	guint cache_max_num, folder_max_num, cache_cur_num, folder_cur_num;
 	gboolean update_flags = 0, old_uids_valid = FALSE;
 	GHashTable *subject_table = NULL;
+	MsgThreadIndex *thread_index;
 
 	cm_return_val_if_fail(item != NULL, -1);
 	if (item->path == NULL) return -1;
@@ -2045,7 +2054,7 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 		cache_list = msgcache_get_msg_list(item->cache);
 	} else {
 		if (item->cache)
-			msgcache_destroy(item->cache);
+			folder_item_destroy_cache(item);
 		item->cache = msgcache_new();
 		item->cache_dirty = TRUE;
 		item->mark_dirty = TRUE;
@@ -2238,17 +2247,21 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 		update_flags |= F_ITEM_UPDATE_MSGCNT | F_ITEM_UPDATE_CONTENT;
 	}
 
+	thread_index = procmsg_thread_index_new(exists_list);
+
 	folder_item_set_batch(item, TRUE);
 	for (elem = exists_list; elem != NULL; elem = g_slist_next(elem)) {
 		MsgInfo *msginfo, *parent_msginfo;
+		MsgPermFlags parent_flags;
 
 		msginfo = elem->data;
+		parent_flags = procmsg_thread_index_parent_flags(thread_index, msginfo);
 		if (MSG_IS_IGNORE_THREAD(msginfo->flags) && (MSG_IS_NEW(msginfo->flags) || MSG_IS_UNREAD(msginfo->flags)))
 			procmsg_msginfo_unset_flags(msginfo, MSG_NEW | MSG_UNREAD, 0);
-		if (!MSG_IS_IGNORE_THREAD(msginfo->flags) && procmsg_msg_has_flagged_parent(msginfo, MSG_IGNORE_THREAD)) {
+		if (!MSG_IS_IGNORE_THREAD(msginfo->flags) && (parent_flags & MSG_IGNORE_THREAD)) {
 			procmsg_msginfo_change_flags(msginfo, MSG_IGNORE_THREAD, 0, MSG_NEW | MSG_UNREAD, 0);
 		}
-		if (!MSG_IS_WATCH_THREAD(msginfo->flags) && procmsg_msg_has_flagged_parent(msginfo, MSG_WATCH_THREAD)) {
+		if (!MSG_IS_WATCH_THREAD(msginfo->flags) && (parent_flags & MSG_WATCH_THREAD)) {
 			procmsg_msginfo_set_flags(msginfo, MSG_WATCH_THREAD, 0);
 		}
 		if(prefs_common.thread_by_subject && !msginfo->inreplyto &&
@@ -2269,7 +2282,7 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			newcnt++;
 		if (MSG_IS_UNREAD(msginfo->flags))
 			unreadcnt++;
-		if (MSG_IS_UNREAD(msginfo->flags) && procmsg_msg_has_marked_parent(msginfo))
+		if (MSG_IS_UNREAD(msginfo->flags) && (parent_flags & MSG_MARKED))
 			unreadmarkedcnt++;
 		if (MSG_IS_MARKED(msginfo->flags))
 			markedcnt++;
@@ -2285,10 +2298,11 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			watchedcnt++;
 
 		totalcnt++;
-
-		procmsg_msginfo_free(&msginfo);
 	}
 	folder_item_set_batch(item, FALSE);
+	procmsg_thread_index_free(thread_index);
+	for (elem = exists_list; elem != NULL; elem = g_slist_next(elem))
+		procmsg_msginfo_free((MsgInfo **)&(elem->data));
 	g_slist_free(exists_list);
 
 	if(prefs_common.thread_by_subject) {
@@ -2379,8 +2393,7 @@ gboolean folder_item_free_cache(FolderItem *item, gboolean force)
 		return FALSE;
 
 	folder_item_write_cache(item);
-	msgcache_destroy(item->cache);
-	item->cache = NULL;
+	folder_item_destroy_cache(item);
 	return TRUE;
 }
 
@@ -2464,13 +2477,14 @@ static void folder_item_clean_local_files(FolderItem *item, gint days)
 
 static void folder_item_read_cache(FolderItem *item)
 {
-	gchar *cache_file, *mark_file, *tags_file;
+	gchar *cache_file, *mark_file, *tags_file, *journal_file;
 	cm_return_if_fail(item != NULL);
 
 	if (item->path != NULL) {
 	        cache_file = folder_item_get_cache_file(item);
 		mark_file = folder_item_get_mark_file(item);
 		tags_file = folder_item_get_tags_file(item);
+		journal_file = folder_item_get_journal_file(item);
 		item->cache = msgcache_read_cache(item, cache_file);
 		item->cache_dirty = FALSE;
 		item->mark_dirty = FALSE;
@@ -2526,12 +2540,15 @@ static void folder_item_read_cache(FolderItem *item)
 			item->ignored_msgs = ignoredcnt;
 			item->watched_msgs = watchedcnt;
 			procmsg_msg_list_free(list);
-		} else
+		} else {
 			msgcache_read_mark(item->cache, mark_file);
+			msgcache_read_journal(item->cache, item, journal_file);
+		}
 
 		g_free(cache_file);
 		g_free(mark_file);
 		g_free(tags_file);
+		g_free(journal_file);
 	} else {
 		item->cache = msgcache_new();
 		item->cache_dirty = TRUE;
@@ -2544,12 +2561,13 @@ static void folder_item_read_cache(FolderItem *item)
 
 void folder_item_write_cache(FolderItem *item)
 {
-	gchar *cache_file = NULL, *mark_file = NULL, *tags_file = NULL;
+	gchar *cache_file = NULL, *mark_file = NULL, *tags_file = NULL, *journal_file;
 	FolderItemPrefs *prefs;
 	gint filemode = 0;
 	gchar *id;
 	time_t last_mtime = (time_t)0;
 	gboolean need_scan = FALSE;
+	gboolean rewrite = FALSE;
 
 	if (!item || !item->path || !item->cache)
 		return;
@@ -2566,13 +2584,37 @@ void folder_item_write_cache(FolderItem *item)
 	debug_print("Save cache for folder %s\n", id);
 	g_free(id);
 
-	if (item->cache_dirty)
+	/* small changes only go to the journal; the cache and mark files
+	 * are rewritten when it is stale or has grown too big */
+	journal_file = folder_item_get_journal_file(item);
+	if (item->cache_dirty || item->mark_dirty) {
+		if (msgcache_write_journal(journal_file, item->cache) == 0) {
+			item->cache_dirty = FALSE;
+			item->mark_dirty = FALSE;
+		} else {
+			/* what was replayed from the journal is only in memory,
+			 * so everything is rewritten before it can go */
+			rewrite = TRUE;
+		}
+	}
+
+	if (rewrite) {
 		cache_file = folder_item_get_cache_file(item);
-	if (item->cache_dirty || item->mark_dirty)
 		mark_file = folder_item_get_mark_file(item);
-	if (item->cache_dirty || item->tags_dirty)
 		tags_file = folder_item_get_tags_file(item);
+	} else if (item->tags_dirty) {
+		tags_file = folder_item_get_tags_file(item);
+	} else {
+		g_free(journal_file);
+		goto out;
+	}
+
 	if (msgcache_write(cache_file, mark_file, tags_file, item->cache) == 0) {
+		if (rewrite)
+			unlink(journal_file);
+		item->cache_dirty = FALSE;
+		item->mark_dirty = FALSE;
+		item->tags_dirty = FALSE;
 		prefs = item->prefs;
 		if (prefs && prefs->enable_folder_chmod && prefs->folder_chmod) {
 			filemode = prefs->folder_chmod;
@@ -2592,7 +2634,9 @@ void folder_item_write_cache(FolderItem *item)
 		item->mark_dirty = TRUE;
 		item->tags_dirty = TRUE;
 	}
+	g_free(journal_file);
 
+out:
 	if (!need_scan && item->folder->klass->set_mtime) {
 		if (item->mtime == last_mtime) {
 			item->folder->klass->set_mtime(item->folder, item);
@@ -2658,6 +2702,22 @@ GSList *folder_item_get_msg_list(FolderItem *item)
 	return msgcache_get_msg_list(item->cache);
 }
 
+/* The replies to msginfo in item and their replies, with references */
+GSList *folder_item_get_msg_descendants(FolderItem *item, MsgInfo *msginfo)
+{
+	cm_return_val_if_fail(item != NULL, NULL);
+	cm_return_val_if_fail(msginfo != NULL, NULL);
+	if (item->no_select)
+		return NULL;
+
+	if (item->cache == 0)
+		folder_item_read_cache(item);
+
+	cm_return_val_if_fail(item->cache != NULL, NULL);
+
+	return msgcache_get_msg_descendants(item->cache, msginfo);
+}
+
 static void msginfo_set_mime_flags(GNode *node, gpointer data)
 {
 	MsgInfo *msginfo = data;
@@ -3722,6 +3782,8 @@ void folder_item_change_msg_flags(FolderItem *item, MsgInfo *msginfo, MsgPermFla
 	} else {
 		msginfo->flags.perm_flags = newflags;
 	}
+	if (item->cache != NULL)
+		msgcache_msg_flags_changed(item->cache, msginfo);
 }
 
 void folder_item_commit_tags(FolderItem *item, MsgInfo *msginfo, GSList *tags_set, GSList *tags_unset)
@@ -3770,10 +3832,8 @@ void folder_item_discard_cache(FolderItem *item)
 	if (!item)
 		return;
 
-	if (item->cache) {
-		msgcache_destroy(item->cache);
-		item->cache = NULL;
-	}
+	if (item->cache)
+		folder_item_destroy_cache(item);
 	dir = folder_item_get_path(item);
 	if (is_dir_exist(dir))
 		remove_all_numbered_files(dir);
@@ -3782,6 +3842,9 @@ void folder_item_discard_cache(FolderItem *item)
 	cache = folder_item_get_cache_file(item);
 	unlink(cache);
 	g_free(cache);
+	cache = folder_item_get_journal_file(item);
+	unlink(cache);
+	g_free(cache);
 
 }
 
@@ -3821,6 +3884,24 @@ static gchar *folder_item_get_mark_file(FolderItem *item)
 	return file;
 }
 
+static gchar *folder_item_get_journal_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	cm_return_val_if_fail(item != NULL, NULL);
+	cm_return_val_if_fail(item->path != NULL, NULL);
+
+	path = folder_item_get_path(item);
+	cm_return_val_if_fail(path != NULL, NULL);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+	file = g_strconcat(path, "/.claws_journal", NULL);
+	g_free(path);
+
+	return file;
+}
+
 const char *tags_dir = ".claws_tags";
 
 static gchar *folder_item_get_tags_file(FolderItem *item)
@@ -679,6 +679,8 @@ struct _FolderItem
 	gint last_num;
 
 	struct _MsgCache *cache;
+	/* threads of the cached messages, as the summary last showed them */
+	MsgThreadTree *thread_tree;
 	gboolean cache_dirty;
 	gboolean mark_dirty;
 	gboolean tags_dirty;
@@ -841,6 +843,8 @@ MsgInfo *folder_item_get_msginfo	(FolderItem 	*item,
 MsgInfo *folder_item_get_msginfo_by_msgid(FolderItem 	*item,
 					 const gchar 	*msgid);
 GSList *folder_item_get_msg_list	(FolderItem 	*item);
+GSList *folder_item_get_msg_descendants	(FolderItem	*item,
+					 MsgInfo	*msginfo);
 MsgNumberList *folder_item_get_number_list(FolderItem *item);
 
 /* return value is locale charset */
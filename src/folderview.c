@@ -43,6 +43,7 @@
 #include "prefs_folder_item.h"
 #include "account.h"
 #include "folder.h"
+#include "imap.h"
 #include "foldersel.h"
 #include "inc.h"
 #include "statusbar.h"
@@ -1128,10 +1129,13 @@ gint folderview_check_new(Folder *folder)
 			former_unread = item->unread_msgs;
 			former_total  = item->total_msgs;
 
+			/* folders kept in IMAP IDLE are scanned as the
+			 * server reports changes */
 			if (item->folder->klass->scan_required &&
 			    (item->folder->klass->scan_required(item->folder, item) ||
-			     item->folder->inbox == item ||
-			     item->opened == TRUE )) {
+			     ((item->folder->inbox == item ||
+			       item->opened == TRUE) &&
+			      !imap_item_is_idling(item)))) {
 				if (folder_item_scan(item) < 0) {
 					if (folder) {
 						if (FOLDER_TYPE(item->folder) == F_NEWS || FOLDER_IS_LOCAL(folder)) {
@@ -6363,6 +6363,7 @@ row_new (GtkCMCList *clist)
   clist_row->bg_set = FALSE;
   clist_row->style = NULL;
   clist_row->selectable = TRUE;
+  clist_row->pending = FALSE;
   clist_row->state = GTK_STATE_NORMAL;
   clist_row->data = NULL;
   clist_row->destroy = NULL;
@@ -345,6 +345,7 @@ struct _GtkCMCListRow
   guint fg_set     : 1;
   guint bg_set     : 1;
   guint selectable : 1;
+  guint pending    : 1;	/* cell text not built yet, see GtkSCTree */
 };
 
 /* Cell Structures */
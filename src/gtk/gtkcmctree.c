@@ -2562,6 +2562,7 @@ row_new (GtkCMCTree *ctree)
   ctree_row->row.bg_set     = FALSE;
   ctree_row->row.style      = NULL;
   ctree_row->row.selectable = TRUE;
+  ctree_row->row.pending    = FALSE;
   ctree_row->row.state      = GTK_STATE_NORMAL;
   ctree_row->row.data       = NULL;
   ctree_row->row.destroy    = NULL;
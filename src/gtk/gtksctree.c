@@ -82,6 +82,12 @@ static void gtk_sctree_drag_data_received (GtkWidget *widget, GdkDragContext *co
 
 static void gtk_sctree_clear (GtkCMCList *clist);
 static void gtk_sctree_real_unselect_all (GtkCMCList *clist);
+static void gtk_sctree_draw_row (GtkCMCList *clist, GdkRectangle *area,
+				 gint row, GtkCMCListRow *clist_row);
+static void gtk_sctree_cell_size_request (GtkCMCList *clist,
+					  GtkCMCListRow *clist_row,
+					  gint column,
+					  GtkRequisition *requisition);
 
 static void stree_sort (GtkCMCTree *ctree, GtkCMCTreeNode  *node, gpointer data);
 void gtk_sctree_sort_node (GtkCMCTree *ctree, GtkCMCTreeNode *node);
@@ -268,6 +274,8 @@ gtk_sctree_class_init (GtkSCTreeClass *klass)
 
 	clist_class->clear = gtk_sctree_clear;
 	clist_class->unselect_all = gtk_sctree_real_unselect_all;
+	clist_class->draw_row = gtk_sctree_draw_row;
+	clist_class->cell_size_request = gtk_sctree_cell_size_request;
         ctree_class->tree_collapse = gtk_sctree_real_tree_collapse;
 	ctree_class->tree_expand = gtk_sctree_real_tree_expand;
 	ctree_class->tree_move = sreal_tree_move;
@@ -998,6 +1006,67 @@ void gtk_sctree_set_use_markup		    (GtkSCTree		*sctree,
 	sctree->use_markup[column] = markup;
 }
 
+void gtk_sctree_set_fill_func(GtkSCTree *sctree, GtkSCTreeFillFunc func,
+			      gpointer data)
+{
+	cm_return_if_fail(GTK_IS_SCTREE(sctree));
+
+	sctree->fill_func = func;
+	sctree->fill_data = data;
+}
+
+/* The row's cells will be built by the fill func when first needed. */
+void gtk_sctree_node_set_pending(GtkSCTree *sctree, GtkCMCTreeNode *node)
+{
+	cm_return_if_fail(GTK_IS_SCTREE(sctree));
+	cm_return_if_fail(node != NULL);
+
+	GTK_CMCTREE_ROW(node)->row.pending = sctree->fill_func != NULL;
+}
+
+void gtk_sctree_fill_row(GtkSCTree *sctree, GtkCMCListRow *row)
+{
+	if (!row->pending)
+		return;
+
+	row->pending = FALSE;
+	sctree->fill_func(sctree, row, sctree->fill_data);
+}
+
+/* Like gtk_cmctree_node_set_text(), minus the redraw: meant for fill
+ * funcs, which run while the row is being drawn or measured. */
+void gtk_sctree_row_set_text(GtkSCTree *sctree, GtkCMCListRow *row,
+			     gint column, const gchar *text)
+{
+	GtkCMCList *clist = GTK_CMCLIST(sctree);
+
+	cm_return_if_fail(column >= 0 && column < clist->columns);
+	cm_return_if_fail(column != GTK_CMCTREE(sctree)->tree_column);
+
+	GTK_CMCLIST_GET_CLASS(clist)->set_cell_contents
+		(clist, row, column, GTK_CMCELL_TEXT, text, 0, NULL);
+}
+
+static void gtk_sctree_draw_row(GtkCMCList *clist, GdkRectangle *area,
+				gint row, GtkCMCListRow *clist_row)
+{
+	gtk_sctree_fill_row(GTK_SCTREE(clist), clist_row);
+	((GtkCMCListClass *)parent_class)->draw_row(clist, area, row, clist_row);
+}
+
+static void gtk_sctree_cell_size_request(GtkCMCList *clist,
+					 GtkCMCListRow *clist_row,
+					 gint column,
+					 GtkRequisition *requisition)
+{
+	/* the tree column is never deferred, so sizing it (e.g. for the
+	 * optimal column width) does not force every row to be filled */
+	if (column != GTK_CMCTREE(clist)->tree_column)
+		gtk_sctree_fill_row(GTK_SCTREE(clist), clist_row);
+	((GtkCMCListClass *)parent_class)->cell_size_request(clist, clist_row,
+							     column, requisition);
+}
+
 void gtk_sctree_select (GtkSCTree *sctree, GtkCMCTreeNode *node)
 {
 	select_row(sctree,
@@ -1044,50 +1113,32 @@ void gtk_sctree_set_recursive_expand(GtkSCTree  *sctree, gboolean rec_exp)
  *             Tree sorting functions                      *
  ***********************************************************/
 
-static void sink(GtkCMCList *clist, GPtrArray *numbers, gint root, gint bottom)
-{
-	gint j, k ;
-	GtkCMCTreeNode *temp;
-
-	j = 2 * root;
-	k = j + 1;
-
-	/* find the maximum element of numbers[root],
-	   numbers[2*root] and numbers[2*root+1] */
-	if (j <= bottom) {
-		if (clist->compare( clist, GTK_CMCTREE_ROW (g_ptr_array_index(numbers, root)),
-				    GTK_CMCTREE_ROW(g_ptr_array_index( numbers, j))) >= 0)
-			j = root;
-		if (k <= bottom)
-			if (clist->compare( clist, GTK_CMCTREE_ROW (g_ptr_array_index(numbers, k)),
-					    GTK_CMCTREE_ROW (g_ptr_array_index( numbers, j))) > 0)
-				j = k;
-		/* if numbers[root] wasn't the maximum element then
-		   sink again */
-		if (root != j) {
-			temp = g_ptr_array_index( numbers,root);
-			g_ptr_array_index( numbers, root) = g_ptr_array_index( numbers, j);
-			g_ptr_array_index( numbers, j) = temp;
-			sink( clist, numbers, j, bottom);
-		}
-	}
-}
+typedef struct _SortRow {
+	GtkCMCTreeNode *node;
+	gchar *key;
+} SortRow;
 
-static void heap_sort(GtkCMCList *clist, GPtrArray *numbers, gint array_size)
+static gint stree_sort_compare(gconstpointer a, gconstpointer b, gpointer data)
 {
-	gint i;
-	GtkCMCTreeNode *temp;
-
-	/* build the Heap */
-	for (i = (array_size / 2); i >= 1; i--)
-		sink( clist, numbers, i, array_size);
-	/* output the Heap */
-	for (i = array_size; i >= 2; i--) {
-		temp = g_ptr_array_index( numbers, 1);
-		g_ptr_array_index( numbers, 1) = g_ptr_array_index( numbers, i);
-		g_ptr_array_index( numbers, i) = temp;
-		sink( clist, numbers, 1, i-1);
-	}
+	const SortRow *r1 = a;
+	const SortRow *r2 = b;
+	GtkSCTree *sctree = data;
+	GtkCMCList *clist = GTK_CMCLIST(sctree);
+	gint res;
+
+	if (sctree->sort_key_func == NULL)
+		return clist->compare(clist, GTK_CMCTREE_ROW(r1->node),
+				      GTK_CMCTREE_ROW(r2->node));
+
+	/* no key sorts after any, as in the clist's compare funcs */
+	if (r1->key == NULL || r2->key == NULL)
+		res = (r1->key == NULL) - (r2->key == NULL);
+	else
+		res = strcmp(r1->key, r2->key);
+	if (res != 0 || sctree->sort_tie_func == NULL)
+		return res;
+	return sctree->sort_tie_func(clist, GTK_CMCTREE_ROW(r1->node),
+				     GTK_CMCTREE_ROW(r2->node));
 }
 
 static void
@@ -1095,9 +1146,12 @@ stree_sort (GtkCMCTree    *ctree,
 	   GtkCMCTreeNode *node,
 	   gpointer      data)
 {
+	GtkSCTree *sctree = GTK_SCTREE(ctree);
 	GtkCMCTreeNode *list_start, *work, *next;
-	GPtrArray *row_array, *viewable_array;
+	GArray *row_array;
+	GPtrArray *viewable_array;
 	GtkCMCList *clist;
+	SortRow row;
 	gint i;
 
 	clist = GTK_CMCLIST (ctree);
@@ -1107,53 +1161,70 @@ stree_sort (GtkCMCTree    *ctree,
 	else
 		work = GTK_CMCTREE_NODE (clist->row_list);
 
-	row_array = g_ptr_array_new();
+	if (!work)
+		return;
+
+	row_array = g_array_new(FALSE, FALSE, sizeof(SortRow));
 	viewable_array = g_ptr_array_new();
 
-	if (work) {
-		g_ptr_array_add( row_array, NULL);
-		while (work) {
-			/* add all rows to row_array */
-			g_ptr_array_add( row_array, work);
-			if (GTK_CMCTREE_ROW (work)->parent && gtk_cmctree_is_viewable( ctree, work))
-				g_ptr_array_add( viewable_array, GTK_CMCTREE_ROW (work)->parent);
-			next = GTK_CMCTREE_ROW (work)->sibling;
-			gtk_sctree_unlink( ctree, work, FALSE);
-			work = next;
-		}
+	while (work) {
+		/* add all rows to row_array, with their keys */
+		row.node = work;
+		row.key = sctree->sort_key_func != NULL ?
+			sctree->sort_key_func(sctree, &GTK_CMCTREE_ROW(work)->row,
+					      sctree->sort_key_data) : NULL;
+		g_array_append_val(row_array, row);
+		if (GTK_CMCTREE_ROW (work)->parent && gtk_cmctree_is_viewable( ctree, work))
+			g_ptr_array_add( viewable_array, GTK_CMCTREE_ROW (work)->parent);
+		next = GTK_CMCTREE_ROW (work)->sibling;
+		gtk_sctree_unlink( ctree, work, FALSE);
+		work = next;
+	}
 
-		heap_sort( clist, row_array, (row_array->len)-1);
+	/* a merge sort over the flat array, stable for equal rows */
+	g_qsort_with_data(row_array->data, row_array->len, sizeof(SortRow),
+			  stree_sort_compare, sctree);
 
-		if (node)
-			list_start = GTK_CMCTREE_ROW (node)->children;
-		else
-			list_start = GTK_CMCTREE_NODE (clist->row_list);
-
-		if (clist->sort_type == GTK_SORT_ASCENDING) {
-			for (i=(row_array->len)-1; i>=1; i--) {
-				work = g_ptr_array_index( row_array, i);
-				gtk_sctree_link( ctree, work, node, list_start, FALSE);
-				list_start = work;
-				/* insert work at the beginning of the list */
-			}
-		} else {
-			for (i=1; i<row_array->len; i++) {
-				work = g_ptr_array_index( row_array, i);
-				gtk_sctree_link( ctree, work, node, list_start, FALSE);
-				list_start = work;
-				/* insert work at the beginning of the list */
-			}
-		}
+	if (node)
+		list_start = GTK_CMCTREE_ROW (node)->children;
+	else
+		list_start = GTK_CMCTREE_NODE (clist->row_list);
 
-		for (i=0; i<viewable_array->len; i++) {
-			gtk_cmctree_expand( ctree, g_ptr_array_index( viewable_array, i));
-		}
+	/* insert each row at the beginning of the list */
+	for (i = 0; i < row_array->len; i++) {
+		if (clist->sort_type == GTK_SORT_ASCENDING)
+			work = g_array_index(row_array, SortRow, row_array->len - 1 - i).node;
+		else
+			work = g_array_index(row_array, SortRow, i).node;
+		gtk_sctree_link( ctree, work, node, list_start, FALSE);
+		list_start = work;
+	}
 
+	for (i=0; i<viewable_array->len; i++) {
+		gtk_cmctree_expand( ctree, g_ptr_array_index( viewable_array, i));
 	}
-	g_ptr_array_free( row_array, TRUE);
+
+	for (i = 0; i < row_array->len; i++)
+		g_free(g_array_index(row_array, SortRow, i).key);
+	g_array_free(row_array, TRUE);
 	g_ptr_array_free( viewable_array, TRUE);
 }
 
+/*!
+ *\brief	Sort by keys from func from now on, rows whose keys are equal
+ *		being ordered by tie_func. With func NULL, rows are compared
+ *		with the clist's compare func as before.
+ */
+void gtk_sctree_set_sort_key_func(GtkSCTree *sctree, GtkSCTreeSortKeyFunc func,
+				  GtkCMCListCompareFunc tie_func, gpointer data)
+{
+	cm_return_if_fail(GTK_IS_SCTREE(sctree));
+
+	sctree->sort_key_func = func;
+	sctree->sort_tie_func = tie_func;
+	sctree->sort_key_data = data;
+}
+
 void
 gtk_sctree_sort_recursive (GtkCMCTree     *ctree,
 			  GtkCMCTreeNode *node)
@@ -1580,6 +1651,7 @@ srow_new (GtkCMCTree *ctree)
   ctree_row->row.bg_set     = FALSE;
   ctree_row->row.style      = NULL;
   ctree_row->row.selectable = TRUE;
+  ctree_row->row.pending    = FALSE;
   ctree_row->row.state      = GTK_STATE_NORMAL;
   ctree_row->row.data       = NULL;
   ctree_row->row.destroy    = NULL;
@@ -18,6 +18,18 @@
 typedef struct _GtkSCTree GtkSCTree;
 typedef struct _GtkSCTreeClass GtkSCTreeClass;
 
+/* Builds the cell contents of a row inserted as pending, right before
+ * the row is first measured or drawn. */
+typedef void (*GtkSCTreeFillFunc) (GtkSCTree *sctree, GtkCMCListRow *row,
+				   gpointer data);
+
+/* Returns a newly allocated key that orders row by strcmp(), e.g. from
+ * g_utf8_collate_key(), or NULL to sort it last. Called once per row
+ * when sorting, instead of comparing rows with the clist's compare
+ * func. */
+typedef gchar *(*GtkSCTreeSortKeyFunc) (GtkSCTree *sctree, GtkCMCListRow *row,
+					gpointer data);
+
 struct _GtkSCTree {
 	GtkCMCTree ctree;
 
@@ -40,6 +52,15 @@ struct _GtkSCTree {
 	gboolean always_expand_recursively;
 	gboolean force_additive_sel;
 	gboolean *use_markup;
+
+	/* Fills in rows marked pending */
+	GtkSCTreeFillFunc fill_func;
+	gpointer fill_data;
+
+	/* Sorts by precomputed keys, ties going to sort_tie_func */
+	GtkSCTreeSortKeyFunc sort_key_func;
+	GtkCMCListCompareFunc sort_tie_func;
+	gpointer sort_key_data;
 };
 
 struct _GtkSCTreeClass {
@@ -88,6 +109,11 @@ void gtk_sctree_sort_node (GtkCMCTree *ctree, GtkCMCTreeNode *node);
 
 void gtk_sctree_sort_recursive (GtkCMCTree *ctree, GtkCMCTreeNode *node);
 
+void gtk_sctree_set_sort_key_func (GtkSCTree		 *sctree,
+				   GtkSCTreeSortKeyFunc	  func,
+				   GtkCMCListCompareFunc  tie_func,
+				   gpointer		  data);
+
 GtkCMCTreeNode* gtk_sctree_insert_node        (GtkCMCTree *ctree,
                                              GtkCMCTreeNode *parent,
                                              GtkCMCTreeNode *sibling,
@@ -120,6 +146,18 @@ void gtk_sctree_set_use_markup		    (GtkSCTree		*sctree,
 					     int		 column,
 					     gboolean		 markup);
 
+void gtk_sctree_set_fill_func		    (GtkSCTree		*sctree,
+					     GtkSCTreeFillFunc	 func,
+					     gpointer		 data);
+void gtk_sctree_node_set_pending	    (GtkSCTree		*sctree,
+					     GtkCMCTreeNode	*node);
+void gtk_sctree_fill_row		    (GtkSCTree		*sctree,
+					     GtkCMCListRow	*row);
+void gtk_sctree_row_set_text		    (GtkSCTree		*sctree,
+					     GtkCMCListRow	*row,
+					     gint		 column,
+					     const gchar	*text);
+
 /* This assumes that x and y coordinates are inside the clist_window.
  * Returns true if the coordinates are inside a tree expander on
  * one of the rows. */
@@ -58,6 +58,7 @@
 #include "main.h"
 #include "passwordstore.h"
 #include "file-utils.h"
+#include "packstore.h"
 
 typedef struct _IMAPFolder	IMAPFolder;
 typedef struct _IMAPSession	IMAPSession;
@@ -103,6 +104,11 @@ struct _IMAPSession
 	guint unseen;
 	guint uid_validity;
 	guint uid_next;
+	guint64 highestmodseq;
+	IMAPModSeqMode modseq_mode;
+
+	/* the mechanism the login went through, for the IDLE connections */
+	const gchar *login_type;
 
 	Folder * folder;
 	gboolean busy;
@@ -136,12 +142,23 @@ struct _IMAPNameSpace
 
 #define IMAP_CMD_LIMIT	1000
 
+/* how long to poll a folder again after its IDLE connection failed */
+#define IMAP_IDLE_RETRY	300
+
 enum {
 	ITEM_CAN_CREATE_FLAGS_UNKNOWN = 0,
 	ITEM_CAN_CREATE_FLAGS,
 	ITEM_CANNOT_CREATE_FLAGS
 };
 
+/* The pending start of an IDLE watch. item is cleared if the watch is
+ * dropped while it is connecting, which may mean the item is gone. */
+typedef struct _IMAPIdleWatch {
+	IMAPFolderItem *item;
+	guint id;
+	gboolean connecting;
+} IMAPIdleWatch;
+
 struct _IMAPFolderItem
 {
 	FolderItem item;
@@ -161,6 +178,22 @@ struct _IMAPFolderItem
 
 	GSList *ok_flags;
 
+	/* HIGHESTMODSEQ uid_list is in sync with, 0 if unknown */
+	guint64 highestmodseq;
+	/* HIGHESTMODSEQ the cached flags are in sync with, 0 if unknown */
+	guint64 flags_modseq;
+
+	/* IDLE connection watching this folder, the pending start of one,
+	 * and the pending scan it asked for */
+	IMAPIdle *idle;
+	IMAPIdleWatch *idle_watch;
+	guint idle_scan;
+	time_t idle_failure;
+
+	/* packed offline cache, when the account uses one */
+	PackStore *pack;
+	/* whether the files cached before it have been moved into it */
+	gboolean pack_migrated;
 };
 
 static XMLTag *imap_item_get_xml(Folder *folder, FolderItem *item);
@@ -309,6 +342,14 @@ static gchar *imap_get_real_path		(IMAPSession	*session,
 						 const gchar	*path,
 						 gint		*ok);
 static void imap_synchronise		(FolderItem	*item, gint days);
+static void imap_item_opened		(FolderItem	*item);
+static void imap_item_closed		(FolderItem	*item);
+static PackStore *imap_item_pack	(FolderItem	*item);
+static void imap_item_close_pack	(FolderItem	*item);
+static void imap_idle_watch		(IMAPFolderItem	*item);
+static void imap_idle_unwatch		(IMAPFolderItem	*item);
+static gboolean imap_idle_unwatch_func		(GNode		*node,
+						 gpointer	 data);
 static gboolean imap_is_busy		(Folder *folder);
 
 static void imap_free_capabilities	(IMAPSession 	*session);
@@ -328,6 +369,7 @@ static gint imap_cmd_select	(IMAPSession	*session,
 				 guint32	*uid_validity,
 				 gint		*can_create_flags,
 				 GSList		**ok_flags,
+				 guint64	*highestmodseq,
 				 gboolean	 block);
 static gint imap_cmd_close	(IMAPSession 	*session);
 static gint imap_cmd_examine	(IMAPSession	*session,
@@ -348,7 +390,8 @@ static gint imap_cmd_fetch	(IMAPSession	*sock,
 				 guint32	 uid,
 				 const gchar	*filename,
 				 gboolean	 headers,
-				 gboolean	 body);
+				 gboolean	 body,
+				 gsize		*wire_size);
 static gint imap_cmd_append	(IMAPSession	*session,
 				 IMAPFolderItem *item,
 				 const gchar	*destfolder,
@@ -467,6 +510,8 @@ FolderClass *imap_get_class(void)
 		imap_class.set_batch = imap_set_batch;
 		imap_class.synchronise = imap_synchronise;
 		imap_class.remove_cached_msg = imap_remove_cached_msg;
+		imap_class.item_opened = imap_item_opened;
+		imap_class.item_closed = imap_item_closed;
 	}
 
 	return &imap_class;
@@ -766,6 +811,8 @@ static void imap_folder_item_destroy(Folder *folder, FolderItem *_item)
 	IMAPFolderItem *item = (IMAPFolderItem *)_item;
 
 	g_return_if_fail(item != NULL);
+	imap_idle_unwatch(item);
+	imap_item_close_pack(_item);
 	g_slist_free(item->uid_list);
 
 	g_free(_item);
@@ -835,6 +882,21 @@ static gboolean imap_has_capability(IMAPSession *session, const gchar *cap)
 	return FALSE;
 }
 
+/* Turns on QRESYNC where offered so that rescans only fetch what changed
+ * since the HIGHESTMODSEQ we last synced with. */
+static void imap_enable_modseq(IMAPSession *session)
+{
+	int r;
+
+	r = imap_threaded_enable_modseq(session->folder, &session->modseq_mode);
+	if (r != MAILIMAP_NO_ERROR) {
+		debug_print("ENABLE QRESYNC failed: %d\n", r);
+		if (is_fatal(r))
+			imap_handle_error(SESSION(session), NULL, r);
+	}
+	debug_print("modseq mode %d\n", session->modseq_mode);
+}
+
 static gint imap_auth(IMAPSession *session, const gchar *user, const gchar *pass,
 		      IMAPAuthType type)
 {
@@ -1232,6 +1294,8 @@ static IMAPSession *imap_session_new(Folder * folder,
 
 	log_message(LOG_PROTOCOL, "IMAP connection is %s-authenticated\n",
 		    (session->authenticated) ? "pre" : "un");
+	if (session->authenticated)
+		imap_enable_modseq(session);
 
 	session_register_ping(SESSION(session), imap_ping);
 
@@ -1303,6 +1367,7 @@ try_again:
 	}
 	statusbar_pop_all();
 	session->authenticated = TRUE;
+	imap_enable_modseq(session);
 	return MAILIMAP_NO_ERROR;
 }
 
@@ -1374,9 +1439,11 @@ static void imap_remove_cached_msg(Folder *folder, FolderItem *item, MsgInfo *ms
 		warn("cannot get filename for message number %d", msginfo->msgnum);
 		return;
 	}
-	if (remove(name) < 0)
+	if (is_file_exist(name) && remove(name) < 0)
 		warn("remove %s", name);
 	free(name);
+	if (imap_item_pack(item) != NULL)
+		pack_store_remove(imap_item_pack(item), msginfo->msgnum);
 }
 
 static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
@@ -1384,6 +1451,8 @@ static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 {
 	gchar *path, *filename;
 	IMAPSession *session;
+	PackStore *pack;
+	gsize wire_size = 0;
 	gint ok;
 
 	g_return_val_if_fail(folder != NULL, NULL);
@@ -1403,6 +1472,14 @@ static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 	filename = imap_get_cached_filename(item, uid);
 	debug_print("trying to fetch cached %s\n", filename);
 
+	/* packed messages are written out again while they are in use */
+	pack = imap_item_pack(item);
+	if (pack != NULL && !is_file_exist(filename) &&
+	    pack_store_extract(pack, uid, filename) == 0) {
+		debug_print("...extracted from the pack\n");
+		return filename;
+	}
+
 	if (is_file_exist(filename)) {
 		/* see whether the local file represents the whole message
 		 * or not. As the IMAP server reports size with \r chars,
@@ -1469,7 +1546,8 @@ static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 	session_set_access_time(SESSION(session));
 
 	debug_print("getting message %d...\n", uid);
-	ok = imap_cmd_fetch(session, (guint32)uid, filename, headers, body);
+	ok = imap_cmd_fetch(session, (guint32)uid, filename, headers, body,
+			    &wire_size);
 
 	if (ok != MAILIMAP_NO_ERROR) {
 		g_warning("can't fetch message %d", uid);
@@ -1480,20 +1558,18 @@ static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 	session_set_access_time(SESSION(session));
 	unlock_session(session);
 
-	ok = file_strip_crs(filename);
-
-	if (ok == 0 && headers && body) {
+	/* the file was written without CRs; the size the server sent
+	 * still counts them, as cached->size does */
+	if (headers && body) {
 		MsgInfo *cached = msgcache_get_msg(item->cache,uid);
 		if (cached) {
+			if ((goffset)wire_size >= cached->size)
+				cached->total_size = cached->size;
 			procmsg_msginfo_set_flags(cached, MSG_FULLY_CACHED, 0);
 			procmsg_msginfo_free(&cached);
 		}
-	} else if (ok == -1) {
-		MsgInfo *cached = msgcache_get_msg(item->cache,uid);
-		if (cached) {
-			procmsg_msginfo_unset_flags(cached, MSG_FULLY_CACHED, 0);
-			procmsg_msginfo_free(&cached);
-		}
+		if (pack != NULL && pack_store_add_file(pack, uid, filename) < 0)
+			g_warning("can't add message %d to the pack", uid);
 	}
 	return filename;
 }
@@ -1512,6 +1588,13 @@ static gboolean imap_is_msg_fully_cached(Folder *folder, FolderItem *item, gint
 		return TRUE;
 	}
 
+	if (imap_item_pack(item) != NULL &&
+	    pack_store_has(imap_item_pack(item), uid)) {
+		procmsg_msginfo_set_flags(cached, MSG_FULLY_CACHED, 0);
+		procmsg_msginfo_free(&cached);
+		return TRUE;
+	}
+
 	filename = imap_get_cached_filename(item, uid);
 
 	if (is_file_exist(filename)) {
@@ -1547,10 +1630,181 @@ void imap_cache_msg(FolderItem *item, gint msgnum)
 	if (!imap_is_msg_fully_cached(folder, item, msgnum)) {
 		gchar *tmp = imap_fetch_msg_full(folder, item, msgnum, TRUE, TRUE);
 		debug_print("fetched %s\n", tmp);
+		/* it is in the pack now, no need to keep a file around */
+		if (tmp != NULL && imap_item_pack(item) != NULL &&
+		    pack_store_has(imap_item_pack(item), msgnum) &&
+		    unlink(tmp) < 0)
+			FILE_OP_ERROR(tmp, "unlink");
 		g_free(tmp);
 	}
 }
 
+typedef struct _cache_msgs_data {
+	FolderItem *item;
+	gint queued;
+	gint done;
+	gint error;
+	IMAPCacheMsgsFunc func;
+	gpointer data;
+} cache_msgs_data;
+
+typedef struct _cache_msg_data {
+	cache_msgs_data *batch;
+	gint uid;
+	gchar *filename;
+} cache_msg_data;
+
+/* Called once the whole batch is in, or at once if nothing was queued */
+static void imap_cache_msgs_done(cache_msgs_data *batch)
+{
+	Folder *folder = batch->item->folder;
+	IMAPSession *session = IMAP_SESSION(REMOTE_FOLDER(folder)->session);
+
+	if (batch->queued > 0) {
+		statusbar_progress_all(0, 0, 0);
+		statusbar_pop_all();
+	}
+
+	if (batch->error != MAILIMAP_NO_ERROR) {
+		g_warning("can't fetch messages of %s", batch->item->path);
+		imap_handle_error(SESSION(session), NULL, batch->error);
+	} else if (session != NULL) {
+		session_set_access_time(SESSION(session));
+		unlock_session(session);
+	}
+
+	if (batch->func != NULL)
+		batch->func(batch->item, batch->error, batch->data);
+	g_free(batch);
+}
+
+static void imap_cache_msgs_func(int error, size_t size, gpointer data)
+{
+	cache_msg_data *msg = (cache_msg_data *)data;
+	cache_msgs_data *batch = msg->batch;
+	FolderItem *item = batch->item;
+	MsgInfo *cached;
+
+	batch->done++;
+	statusbar_progress_all(batch->done, batch->queued, 10);
+
+	if (error != MAILIMAP_NO_ERROR) {
+		if (batch->error == MAILIMAP_NO_ERROR)
+			batch->error = error;
+	} else {
+		cached = msgcache_get_msg(item->cache, msg->uid);
+		if (cached) {
+			if ((goffset)size >= cached->size)
+				cached->total_size = cached->size;
+			procmsg_msginfo_set_flags(cached, MSG_FULLY_CACHED, 0);
+			procmsg_msginfo_free(&cached);
+		}
+		if (imap_item_pack(item) != NULL &&
+		    pack_store_add_file(imap_item_pack(item), msg->uid,
+					msg->filename) < 0)
+			g_warning("can't add message %d to the pack", msg->uid);
+	}
+
+	g_free(msg->filename);
+	g_free(msg);
+
+	if (batch->done == batch->queued)
+		imap_cache_msgs_done(batch);
+}
+
+/*!
+ *\brief	Download every message of msglist that is not fully cached
+ *		yet, selecting the folder once and queueing all the fetches
+ *		on the folder's thread. Returns once they are queued; each
+ *		message is filed away from the main loop as it arrives, and
+ *		func is called when the last one has.
+ */
+void imap_cache_msgs(FolderItem *item, GSList *msglist,
+		     IMAPCacheMsgsFunc func, gpointer data)
+{
+	Folder *folder;
+	IMAPSession *session;
+	cache_msgs_data *batch;
+	GSList *cur, *uids = NULL;
+	gchar *path;
+	gint ok;
+
+	cm_return_if_fail(item != NULL);
+	folder = item->folder;
+
+	batch = g_new0(cache_msgs_data, 1);
+	batch->item = item;
+	batch->error = MAILIMAP_NO_ERROR;
+	batch->func = func;
+	batch->data = data;
+
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (!imap_is_msg_fully_cached(folder, item, msginfo->msgnum))
+			uids = g_slist_prepend(uids,
+					GINT_TO_POINTER(msginfo->msgnum));
+	}
+	if (uids == NULL) {
+		if (func != NULL)
+			func(item, MAILIMAP_NO_ERROR, data);
+		g_free(batch);
+		return;
+	}
+	uids = g_slist_reverse(uids);
+
+	path = folder_item_get_path(item);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+	g_free(path);
+
+	debug_print("getting session...\n");
+	session = imap_session_get(folder);
+	if (!session) {
+		g_slist_free(uids);
+		if (func != NULL)
+			func(item, MAILIMAP_ERROR_CONNECTION_REFUSED, data);
+		g_free(batch);
+		return;
+	}
+	session_set_access_time(SESSION(session));
+	lock_session(session); /* unlocked once all are in */
+
+	ok = imap_select(session, IMAP_FOLDER(folder), item,
+			 NULL, NULL, NULL, NULL, NULL, FALSE);
+	if (ok != MAILIMAP_NO_ERROR) {
+		g_warning("can't select mailbox %s", item->path);
+		g_slist_free(uids);
+		batch->error = ok;
+		imap_cache_msgs_done(batch);
+		return;
+	}
+
+	statusbar_print_all(_("Fetching messages..."));
+	for (cur = uids; cur != NULL; cur = cur->next) {
+		cache_msg_data *msg = g_new0(cache_msg_data, 1);
+
+		msg->batch = batch;
+		msg->uid = GPOINTER_TO_INT(cur->data);
+		msg->filename = imap_get_cached_filename(item, msg->uid);
+		if (msg->filename == NULL) {
+			g_free(msg);
+			continue;
+		}
+		batch->queued++;
+		imap_threaded_fetch_content_async(folder, msg->uid, 1,
+						  msg->filename,
+						  imap_cache_msgs_func, msg);
+	}
+	g_slist_free(uids);
+
+	/* the callbacks run from the main loop, never from in here */
+	if (batch->queued == 0) {
+		statusbar_pop_all();
+		imap_cache_msgs_done(batch);
+	}
+}
+
 static gint imap_add_msg(Folder *folder, FolderItem *dest,
 			 const gchar *file, MsgFlags *flags)
 {
@@ -1651,7 +1905,11 @@ static gint imap_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 				missing_uids = TRUE;
 				debug_print("Missing UID (0)\n");
 			}
-			if (new_uid > 0) {
+			if (new_uid > 0 && imap_item_pack(dest) != NULL) {
+				if (pack_store_add_file(imap_item_pack(dest),
+							new_uid, real_file) < 0)
+					g_warning("can't add %s to the pack", real_file);
+			} else if (new_uid > 0) {
 				gchar *cache_path = folder_item_get_path(dest);
 				if (!is_dir_exist(cache_path))
 					make_dir_hier(cache_path);
@@ -1873,7 +2131,15 @@ static gint imap_do_copy_msgs(Folder *folder, FolderItem *dest,
 			debug_print("copied message %d as %d\n", msginfo->msgnum, num);
 			/* put the local file in the imapcache, so that we don't
 			 * have to fetch it back later. */
-			if (num > 0) {
+			if (num > 0 && imap_item_pack(dest) != NULL &&
+			    imap_item_pack(msginfo->folder) != NULL &&
+			    pack_store_has(imap_item_pack(msginfo->folder),
+					   msginfo->msgnum)) {
+				if (pack_store_copy(imap_item_pack(msginfo->folder),
+						    msginfo->msgnum,
+						    imap_item_pack(dest), num) < 0)
+					debug_print("couldn't cache %d in the pack\n", num);
+			} else if (num > 0) {
 				gchar *cache_path = folder_item_get_path(msginfo->folder);
 				gchar *real_file = g_strconcat(
 					cache_path, G_DIR_SEPARATOR_S,
@@ -2011,9 +2277,13 @@ static gint imap_do_remove_msgs(Folder *folder, FolderItem *dest,
 
 	dir = folder_item_get_path(msginfo->folder);
 	if (is_dir_exist(dir)) {
+		PackStore *pack = imap_item_pack(msginfo->folder);
+
 		for (cur = msglist; cur; cur = cur->next) {
 			msginfo = (MsgInfo *)cur->data;
 			remove_numbered_files(dir, msginfo->msgnum, msginfo->msgnum);
+			if (pack != NULL)
+				pack_store_remove(pack, msginfo->msgnum);
 		}
 	}
 	g_free(dir);
@@ -2883,6 +3153,7 @@ static gint imap_remove_folder_real(Folder *folder, FolderItem *item)
 	}
 
 	g_free(path);
+	imap_item_close_pack(item);
 	cache_dir = folder_item_get_path(item);
 	if (is_dir_exist(cache_dir) && remove_dir_recursive(cache_dir) < 0)
 		g_warning("can't remove directory '%s'", cache_dir);
@@ -2916,89 +3187,65 @@ static gint imap_remove_folder(Folder *folder, FolderItem *item)
 typedef struct _uncached_data {
 	IMAPSession *session;
 	FolderItem *item;
-	MsgNumberList *numlist;
+	GSList *result;
+	GSList *last;
 	guint cur;
 	guint total;
-	gboolean done;
 	int ok;
 } uncached_data;
 
-static void *imap_get_uncached_messages_thread(void *data)
+static gboolean imap_get_uncached_messages_func(int error, carray *env_list,
+						gpointer data)
 {
 	uncached_data *stuff = (uncached_data *)data;
 	IMAPSession *session = stuff->session;
 	FolderItem *item = stuff->item;
-	MsgNumberList *numlist = stuff->numlist;
-	GSList *newlist = NULL;
-	GSList *llast = NULL;
-	GSList *seq_list, *cur;
-
-	debug_print("uncached_messages\n");
+	unsigned int i;
 
-	if (session == NULL || item == NULL || item->folder == NULL
-	    || FOLDER_CLASS(item->folder) != &imap_class) {
-		stuff->done = TRUE;
-		return NULL;
+	if (error != MAILIMAP_NO_ERROR) {
+		imap_handle_error(SESSION(session), NULL, error);
+		if (is_fatal(error)) {
+			stuff->ok = error;
+			return FALSE;
+		}
+		return !session->cancelled;
 	}
 
-	seq_list = imap_get_lep_set_from_numlist(IMAP_FOLDER(item->folder), numlist);
-	debug_print("get msgs info\n");
-	for (cur = seq_list; cur != NULL; cur = g_slist_next(cur)) {
-		struct mailimap_set * imapset;
-		unsigned int i;
-		int r;
-		carray * env_list;
-
-		if (session->cancelled)
-			break;
-
-		imapset = cur->data;
+	session_set_access_time(SESSION(session));
 
-		r = imap_threaded_fetch_env(session->folder,
-					    imapset, &env_list);
-		if (r != MAILIMAP_NO_ERROR) {
-			imap_handle_error(SESSION(session), NULL, r);
-			if (is_fatal(r)) {
-				stuff->ok = r;
-				return NULL;
-			}
+	for(i = 0 ; i < carray_count(env_list) ; i += 2) {
+		struct imap_fetch_env_info * info;
+		MsgInfo * msginfo;
+		GSList *tags = NULL;
+		info = carray_get(env_list, i);
+		tags = carray_get(env_list, i+1);
+		msginfo = imap_envelope_from_lep(info, item);
+		if (msginfo == NULL) {
+			slist_free_strings_full(tags);
 			continue;
 		}
-
-		session_set_access_time(SESSION(session));
-
-		for(i = 0 ; i < carray_count(env_list) ; i += 2) {
-			struct imap_fetch_env_info * info;
-			MsgInfo * msginfo;
-			GSList *tags = NULL;
-			info = carray_get(env_list, i);
-			tags = carray_get(env_list, i+1);
-			msginfo = imap_envelope_from_lep(info, item);
-			if (msginfo == NULL) {
-				slist_free_strings_full(tags);
-				continue;
-			}
-			g_slist_free(msginfo->tags);
-			msginfo->tags = NULL;
-
-			msginfo->folder = item;
-			if (!newlist)
-				llast = newlist = g_slist_append(newlist, msginfo);
-			else {
-				llast = g_slist_append(llast, msginfo);
-				llast = llast->next;
-			}
+		g_slist_free(msginfo->tags);
+		msginfo->tags = NULL;
+
+		msginfo->folder = item;
+		if (!stuff->result)
+			stuff->last = stuff->result =
+				g_slist_append(stuff->result, msginfo);
+		else {
+			stuff->last = g_slist_append(stuff->last, msginfo);
+			stuff->last = stuff->last->next;
 		}
-		imap_fetch_env_free(env_list);
 	}
+	stuff->cur += carray_count(env_list) / 2;
+	imap_fetch_env_free(env_list);
 
-	imap_lep_set_free(seq_list);
+	statusbar_progress_all(stuff->cur, stuff->total, 1);
 
-	session_set_access_time(SESSION(session));
-	stuff->done = TRUE;
-	return newlist;
+	return !session->cancelled;
 }
 
+/* The first fetch is small so that something shows up quickly, the
+ * following ones double up to the account's batch size. */
 #define MAX_MSG_NUM 50
 
 static GSList *imap_get_uncached_messages(IMAPSession *session,
@@ -3006,75 +3253,80 @@ static GSList *imap_get_uncached_messages(IMAPSession *session,
 					MsgNumberList *numlist,
 					int *r)
 {
-	GSList *result = NULL;
-	GSList * cur;
-	uncached_data *data = g_new0(uncached_data, 1);
-
-	cur = numlist;
-	data->total = g_slist_length(numlist);
-	data->ok = MAILIMAP_NO_ERROR;
-	debug_print("messages list : %i\n", data->total);
+	uncached_data data;
+	GSList *sorted_list, *cur, *seq_list = NULL;
+	guint chunk = MAX_MSG_NUM;
+	guint max_chunk;
 
-	while (cur != NULL) {
-		GSList * partial_result;
-		int count;
-		GSList * newlist;
-		GSList * llast;
+	*r = MAILIMAP_NO_ERROR;
+	if (session == NULL || item == NULL || item->folder == NULL
+	    || FOLDER_CLASS(item->folder) != &imap_class)
+		return NULL;
 
-		llast = NULL;
-		count = 0;
-		newlist = NULL;
-		while (count < MAX_MSG_NUM) {
-			void * p;
+	if (prefs_common.work_offline &&
+	    !inc_offline_should_override(FALSE,
+		_("Claws Mail needs network access in order "
+		  "to access the IMAP server."))) {
+		return NULL;
+	}
 
-			p = cur->data;
+	memset(&data, 0, sizeof(data));
+	data.session = session;
+	data.item = item;
+	data.total = g_slist_length(numlist);
+	data.ok = MAILIMAP_NO_ERROR;
+	debug_print("messages list : %i\n", data.total);
 
-			if (newlist == NULL)
-				llast = newlist = g_slist_append(newlist, p);
-			else {
-				llast = g_slist_append(llast, p);
-				llast = llast->next;
-			}
-			count ++;
+	max_chunk = MAX(IMAP_FOLDER(item->folder)->max_set_size, MAX_MSG_NUM);
 
-			cur = cur->next;
-			if (cur == NULL)
-				break;
-		}
-
-		data->done = FALSE;
-		data->session = session;
-		data->item = item;
-		data->numlist = newlist;
-		data->cur += count;
-
-		if (prefs_common.work_offline &&
-		    !inc_offline_should_override(FALSE,
-			_("Claws Mail needs network access in order "
-			  "to access the IMAP server."))) {
-			g_free(data);
-			return NULL;
-		}
-
-		partial_result =
-			(GSList *)imap_get_uncached_messages_thread(data);
-		*r = data->ok;
-		if (data->ok != MAILIMAP_NO_ERROR) {
-			goto bail;
+	/* in UID order, as the cache wants them */
+	sorted_list = g_slist_sort(g_slist_copy(numlist), g_int_compare);
+	cur = sorted_list;
+	while (cur != NULL) {
+		GSList *rest;
+		guint count;
+
+		for (rest = cur, count = 1; count < chunk && rest->next != NULL;
+		     count++)
+			rest = rest->next;
+		/* cut the chunk off for imap_get_lep_set_from_numlist() */
+		if (rest->next != NULL) {
+			GSList *tail = rest->next;
+
+			rest->next = NULL;
+			seq_list = g_slist_concat(seq_list,
+				imap_get_lep_set_from_numlist(
+					IMAP_FOLDER(item->folder), cur));
+			rest->next = tail;
+			cur = tail;
+		} else {
+			seq_list = g_slist_concat(seq_list,
+				imap_get_lep_set_from_numlist(
+					IMAP_FOLDER(item->folder), cur));
+			cur = NULL;
 		}
-		statusbar_progress_all(data->cur,data->total, 1);
+		chunk = MIN(chunk * 2, max_chunk);
+	}
+	g_slist_free(sorted_list);
 
-		g_slist_free(newlist);
+	debug_print("get msgs info\n");
+	*r = imap_threaded_fetch_env_pipelined(session->folder, seq_list,
+					       imap_get_uncached_messages_func,
+					       &data);
+	if (*r == MAILIMAP_NO_ERROR)
+		*r = data.ok;
+	imap_lep_set_free(seq_list);
 
-		result = g_slist_concat(result, partial_result);
-	}
-bail:
-	g_free(data);
+	session_set_access_time(SESSION(session));
 
 	statusbar_progress_all(0,0,0);
 	statusbar_pop_all();
 
-	return result;
+	if (*r != MAILIMAP_NO_ERROR) {
+		procmsg_msg_list_free(data.result);
+		return NULL;
+	}
+	return data.result;
 }
 
 static void imap_delete_all_cached_messages(FolderItem *item)
@@ -3091,6 +3343,8 @@ static void imap_delete_all_cached_messages(FolderItem *item)
 	if (is_dir_exist(dir))
 		remove_all_numbered_files(dir);
 	g_free(dir);
+	if (imap_item_pack(item) != NULL)
+		pack_store_clear(imap_item_pack(item));
 
 	debug_print("Deleting all cached messages done.\n");
 }
@@ -3272,6 +3526,7 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 	gint exists_, recent_, unseen_;
 	guint32 uid_validity_;
 	gint can_create_flags_;
+	guint64 highestmodseq = 0;
 	const gchar *path = item ? item->path:NULL;
 
 	if (!item) {
@@ -3314,7 +3569,9 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 	IMAP_FOLDER_ITEM(item)->ok_flags = NULL;
 	ok = imap_cmd_select(session, real_path,
 			     exists, recent, unseen, uid_validity, can_create_flags,
-			     &(IMAP_FOLDER_ITEM(item)->ok_flags), block);
+			     &(IMAP_FOLDER_ITEM(item)->ok_flags),
+			     session->modseq_mode != IMAP_MODSEQ_NONE ? &highestmodseq : NULL,
+			     block);
 	if (ok != MAILIMAP_NO_ERROR) {
 		log_warning(LOG_PROTOCOL, _("can't select folder: %s\n"), real_path);
 	} else {
@@ -3325,9 +3582,11 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 		session->expunge = 0;
 		session->unseen = *unseen;
 		session->uid_validity = *uid_validity;
-		debug_print("select: exists %d recent %d expunge %d uid_validity %d can_create_flags %d\n",
+		session->highestmodseq = highestmodseq;
+		debug_print("select: exists %d recent %d expunge %d uid_validity %d can_create_flags %d"
+			" highestmodseq %" G_GUINT64_FORMAT "\n",
 			session->exists, session->recent, session->expunge,
-			session->uid_validity, *can_create_flags);
+			session->uid_validity, *can_create_flags, session->highestmodseq);
 	}
 	if (*can_create_flags) {
 		IMAP_FOLDER_ITEM(item)->can_create_flags = ITEM_CAN_CREATE_FLAGS;
@@ -3500,6 +3759,7 @@ static gint imap_cmd_login(IMAPSession *session,
 	} else {
 		log_print(LOG_PROTOCOL, "IMAP< Login to %s successful\n",
 				SESSION(session)->server);
+		session->login_type = type;
 		ok = MAILIMAP_NO_ERROR;
 	}
 	return ok;
@@ -3559,12 +3819,14 @@ static gint imap_cmd_starttls(IMAPSession *session)
 static gint imap_cmd_select(IMAPSession *session, const gchar *folder,
 			    gint *exists, gint *recent, gint *unseen,
 			    guint32 *uid_validity, gint *can_create_flags,
-			    GSList **ok_flags, gboolean block)
+			    GSList **ok_flags, guint64 *highestmodseq,
+			    gboolean block)
 {
 	int r;
 
 	r = imap_threaded_select(session->folder, folder,
-				 exists, recent, unseen, uid_validity, can_create_flags, ok_flags);
+				 exists, recent, unseen, uid_validity, can_create_flags, ok_flags,
+				 highestmodseq);
 	if (r != MAILIMAP_NO_ERROR) {
 		imap_handle_error(SESSION(session), NULL, r);
 		debug_print("select err %d\n", r);
@@ -3657,6 +3919,7 @@ typedef struct _fetch_data {
 	gboolean headers;
 	gboolean body;
 	gboolean done;
+	size_t size;
 } fetch_data;
 
 static void *imap_cmd_fetch_thread(void *data)
@@ -3669,11 +3932,11 @@ static void *imap_cmd_fetch_thread(void *data)
 
 	if (stuff->body) {
 		r = imap_threaded_fetch_content(session->folder,
-					       uid, 1, filename);
+					       uid, 1, filename, &stuff->size);
 	}
 	else {
 		r = imap_threaded_fetch_content(session->folder,
-						uid, 0, filename);
+						uid, 0, filename, &stuff->size);
 	}
 	if (r != MAILIMAP_NO_ERROR) {
 		imap_handle_error(SESSION(session), NULL, r);
@@ -3685,7 +3948,7 @@ static void *imap_cmd_fetch_thread(void *data)
 
 static gint imap_cmd_fetch(IMAPSession *session, guint32 uid,
 				const gchar *filename, gboolean headers,
-				gboolean body)
+				gboolean body, gsize *wire_size)
 {
 	fetch_data *data = g_new0(fetch_data, 1);
 	int result = 0;
@@ -3706,6 +3969,8 @@ static gint imap_cmd_fetch(IMAPSession *session, guint32 uid,
 	statusbar_print_all(_("Fetching message..."));
 	result = GPOINTER_TO_INT(imap_cmd_fetch_thread(data));
 	statusbar_pop_all();
+	if (wire_size)
+		*wire_size = data->size;
 	g_free(data);
 	return result;
 }
@@ -3846,6 +4111,9 @@ static gboolean imap_rename_folder_func(GNode *node, gpointer data)
 	gint oldpathlen;
 	IMAPSession *session = imap_session_get(item->folder);
 	gint ok = MAILIMAP_NO_ERROR;
+
+	/* the cache directory is about to move */
+	imap_item_close_pack(item);
 	oldpathlen = strlen(oldpath);
 	if (strncmp(oldpath, item->path, oldpathlen) != 0) {
 		g_warning("path doesn't match: %s, %s", oldpath, item->path);
@@ -3874,25 +4142,178 @@ static gboolean imap_rename_folder_func(GNode *node, gpointer data)
 	return FALSE;
 }
 
+typedef struct _UIDRange UIDRange;
+struct _UIDRange {
+	guint32 first;
+	guint32 last;
+};
+
+static gint uid_range_compare(gconstpointer a, gconstpointer b)
+{
+	const UIDRange *r1 = a, *r2 = b;
+
+	return (r1->first > r2->first) - (r1->first < r2->first);
+}
+
+/* Removes the UIDs in set from uids. A VANISHED (EARLIER) range can span
+ * billions of UIDs, so the known UIDs are looked up in the ranges rather
+ * than the other way round. */
+static void uids_remove_set(GHashTable *uids, struct mailimap_set *set)
+{
+	GArray *ranges = g_array_new(FALSE, FALSE, sizeof(UIDRange));
+	GHashTableIter iter;
+	gpointer key;
+	clistiter *lcur;
+	guint i, n;
+
+	for (lcur = clist_begin(set->set_list); lcur != NULL;
+	     lcur = clist_next(lcur)) {
+		struct mailimap_set_item *set_item = clist_content(lcur);
+		UIDRange range;
+
+		/* 0 stands for "*", and a:b may come as b:a */
+		range.first = set_item->set_first != 0 ? set_item->set_first : G_MAXUINT32;
+		range.last = set_item->set_last != 0 ? set_item->set_last : G_MAXUINT32;
+		if (range.first > range.last) {
+			guint32 tmp = range.first;
+
+			range.first = range.last;
+			range.last = tmp;
+		}
+		g_array_append_val(ranges, range);
+	}
+	if (ranges->len == 0) {
+		g_array_free(ranges, TRUE);
+		return;
+	}
+
+	/* sort and merge, so that a UID is in at most one range */
+	g_array_sort(ranges, uid_range_compare);
+	for (i = 1, n = 0; i < ranges->len; i++) {
+		UIDRange *last = &g_array_index(ranges, UIDRange, n);
+		UIDRange *range = &g_array_index(ranges, UIDRange, i);
+
+		if (range->first <= last->last || range->first - 1 == last->last) {
+			if (range->last > last->last)
+				last->last = range->last;
+		} else {
+			g_array_index(ranges, UIDRange, ++n) = *range;
+		}
+	}
+	g_array_set_size(ranges, n + 1);
+
+	g_hash_table_iter_init(&iter, uids);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		guint32 uid = GPOINTER_TO_UINT(key);
+		guint lo = 0, hi = ranges->len;
+
+		/* the last range starting at or before uid */
+		while (lo < hi) {
+			guint mid = lo + (hi - lo) / 2;
+
+			if (g_array_index(ranges, UIDRange, mid).first <= uid)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo > 0 && uid <= g_array_index(ranges, UIDRange, lo - 1).last)
+			g_hash_table_iter_remove(&iter);
+	}
+
+	g_array_free(ranges, TRUE);
+}
+
+/* Brings item->uid_list up to date from the UIDs that changed or vanished
+ * since item->highestmodseq, instead of listing the whole mailbox. Returns
+ * FALSE, leaving uid_list alone, if that could not be done or the result
+ * does not add up to the EXISTS count of the selection. */
+static gboolean get_changed_uids(IMAPSession *session, Folder *folder,
+				 IMAPFolderItem *item, gint exists)
+{
+	carray *lep_uidtab = NULL;
+	struct mailimap_set *vanished = NULL;
+	GHashTable *uids;
+	GHashTableIter iter;
+	gpointer key;
+	GSList *cur;
+	guint i;
+	int r;
+
+	r = imap_threaded_fetch_uid_flags_changedsince(folder,
+			item->highestmodseq, TRUE, &lep_uidtab, &vanished);
+	if (r != MAILIMAP_NO_ERROR) {
+		imap_handle_error(SESSION(session), NULL, r);
+		return FALSE;
+	}
+
+	uids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (cur = item->uid_list; cur != NULL; cur = cur->next)
+		g_hash_table_add(uids, cur->data);
+
+	if (vanished != NULL) {
+		uids_remove_set(uids, vanished);
+		mailimap_set_free(vanished);
+	}
+
+	for (i = 0; i < carray_count(lep_uidtab); i += 3) {
+		uint32_t *puid = carray_get(lep_uidtab, i);
+
+		g_hash_table_add(uids, GINT_TO_POINTER(*puid));
+		slist_free_strings_full(carray_get(lep_uidtab, i + 2));
+	}
+	imap_fetch_uid_flags_list_free(lep_uidtab);
+
+	debug_print("get_changed_uids: %u changed, %u known, %d exist\n",
+		    i / 3, g_hash_table_size(uids), exists);
+
+	if (g_hash_table_size(uids) != (guint)exists) {
+		g_hash_table_destroy(uids);
+		return FALSE;
+	}
+
+	g_slist_free(item->uid_list);
+	item->uid_list = NULL;
+	g_hash_table_iter_init(&iter, uids);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		item->uid_list = g_slist_prepend(item->uid_list, key);
+	g_hash_table_destroy(uids);
+
+	return TRUE;
+}
+
 static gint get_list_of_uids(IMAPSession *session, Folder *folder, IMAPFolderItem *item, GSList **msgnum_list)
 {
 	GSList *uidlist, *elem;
 	int r = -1;
 	clist *lep_uidlist = NULL;
 	gint ok, nummsgs = 0;
+	gint exists = 0;
 
 	if (session == NULL) {
 		return -1;
 	}
 
+	/* with mod-sequences, reselect to learn the current HIGHESTMODSEQ */
 	ok = imap_select(session, IMAP_FOLDER(folder), FOLDER_ITEM(item),
-			 NULL, NULL, NULL, NULL, NULL, TRUE);
+			 session->modseq_mode != IMAP_MODSEQ_NONE ? &exists : NULL,
+			 NULL, NULL, NULL, NULL, TRUE);
 	if (ok != MAILIMAP_NO_ERROR) {
 		return -1;
 	}
 
+	if (session->modseq_mode == IMAP_MODSEQ_QRESYNC &&
+	    item->highestmodseq != 0 && item->uid_list != NULL &&
+	    session->uid_validity == item->item.mtime &&
+	    get_changed_uids(session, folder, item, exists)) {
+		for (elem = item->uid_list; elem != NULL; elem = g_slist_next(elem))
+			*msgnum_list = g_slist_prepend(*msgnum_list, elem->data);
+		item->highestmodseq = session->highestmodseq;
+		return exists;
+	}
+
 	g_slist_free(item->uid_list);
 	item->uid_list = NULL;
+	item->highestmodseq = 0;
 
 	uidlist = NULL;
 
@@ -3930,6 +4351,10 @@ static gint get_list_of_uids(IMAPSession *session, Folder *folder, IMAPFolderIte
 	}
 	g_slist_free(uidlist);
 
+	/* the selection's HIGHESTMODSEQ predates the listing, so no expunge
+	 * up to it is missing from uid_list */
+	item->highestmodseq = session->highestmodseq;
+
 	return nummsgs;
 
 }
@@ -3943,6 +4368,8 @@ gint imap_get_num_list(Folder *folder, FolderItem *_item, GSList **msgnum_list,
 	gchar *dir;
 	gint known_list_len = 0;
 	gchar *path;
+	gboolean cache_empty;
+	PackStore *pack;
 
 	debug_print("get_num_list\n");
 
@@ -3973,7 +4400,9 @@ gint imap_get_num_list(Folder *folder, FolderItem *_item, GSList **msgnum_list,
 	}
 
 	path = folder_item_get_path(_item);
-	if (!is_dir_exist(path)) {
+	/* a directory made only now has nothing in it to clean up */
+	cache_empty = !is_dir_exist(path);
+	if (cache_empty) {
 		if(is_file_exist(path))
 			unlink(path);
 		make_dir_hier(path);
@@ -3998,10 +4427,13 @@ gint imap_get_num_list(Folder *folder, FolderItem *_item, GSList **msgnum_list,
 		debug_print("get_num_list: trashing num list\n");
 		debug_print("Freeing imap uid cache\n");
 		item->lastuid = 0;
+		item->highestmodseq = 0;
+		item->flags_modseq = 0;
 		g_slist_free(item->uid_list);
 		item->uid_list = NULL;
 
 		imap_delete_all_cached_messages((FolderItem *)item);
+		cache_empty = TRUE;
 	} else {
 		debug_print("get_num_list: updating num list\n");
 		*old_uids_valid = TRUE;
@@ -4022,10 +4454,20 @@ gint imap_get_num_list(Folder *folder, FolderItem *_item, GSList **msgnum_list,
 
 	*msgnum_list = uidlist;
 
-	dir = folder_item_get_path((FolderItem *)item);
-	debug_print("removing old messages from %s\n", dir);
-	remove_numbered_files_not_in_list(dir, *msgnum_list);
-	g_free(dir);
+	/* with a pack, the files in the directory are only copies written
+	 * out of it, which imap_item_release_pack() removes */
+	pack = imap_item_pack(_item);
+	if (pack != NULL) {
+		pack_store_remove_not_in_list(pack, *msgnum_list);
+	} else if (!cache_empty) {
+		dir = folder_item_get_path(_item);
+		debug_print("removing old messages from %s\n", dir);
+		remove_numbered_files_not_in_list(dir, *msgnum_list);
+		g_free(dir);
+	}
+	/* a folder scanned without being opened holds no descriptors */
+	if (pack != NULL && !_item->opened)
+		imap_item_release_pack(_item);
 
 	debug_print("get_num_list - ok - %i\n", nummsgs);
 	statusbar_pop_all();
@@ -4181,11 +4623,17 @@ gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 		debug_print("scan already required\n");
 		return TRUE;
 	}
+	if (item->idle != NULL) {
+		debug_print("%s is watched with IDLE\n", item->item.path);
+		return FALSE;
+	}
 	debug_print("getting session...\n");
 	session = imap_session_get(folder);
 
 	g_return_val_if_fail(session != NULL, FALSE);
 	lock_session(session); /* unlocked later in the function */
+	if (item->item.folder->inbox == &item->item || item->item.opened)
+		imap_idle_watch(item);
 
 	selected_folder = (session->mbox != NULL) &&
 			  (!strcmp(session->mbox, item->item.path));
@@ -4418,6 +4866,8 @@ static gint imap_remove_msg(Folder *folder, FolderItem *item, gint uid)
 	if (is_dir_exist(dir))
 		remove_numbered_files(dir, uid, uid);
 	g_free(dir);
+	if (imap_item_pack(item) != NULL)
+		pack_store_remove(imap_item_pack(item), uid);
 	return MAILIMAP_NO_ERROR;
 }
 
@@ -4476,6 +4926,7 @@ static /*gint*/ void *imap_get_flags_thread(void *data)
 	GSList *unseen = NULL, *answered = NULL, *flagged = NULL, *deleted = NULL, *forwarded = NULL, *spam = NULL;
 	GSList *seq_list;
 	gboolean selected_folder;
+	gboolean changed_only = FALSE;
 	gint exists_cnt, unseen_cnt;
 
 	session = imap_session_get(folder);
@@ -4506,12 +4957,25 @@ static /*gint*/ void *imap_get_flags_thread(void *data)
 		seq_list = g_slist_append(NULL, set);
 	}
 
-	r = imap_threaded_fetch_uid_flags(folder, 1, &lep_uidtab);
+	if (session->modseq_mode != IMAP_MODSEQ_NONE &&
+	    IMAP_FOLDER_ITEM(fitem)->flags_modseq != 0 &&
+	    session->uid_validity == fitem->mtime) {
+		changed_only = TRUE;
+		r = imap_threaded_fetch_uid_flags_changedsince(folder,
+				IMAP_FOLDER_ITEM(fitem)->flags_modseq, FALSE,
+				&lep_uidtab, NULL);
+	} else {
+		r = imap_threaded_fetch_uid_flags(folder, 1, &lep_uidtab);
+	}
 	if (r == MAILIMAP_NO_ERROR) {
 		flags_hash = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
 		tags_hash = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
 		imap_flags_hash_from_lep_uid_flags_tab(lep_uidtab, flags_hash, tags_hash);
 		imap_fetch_uid_flags_list_free(lep_uidtab);
+		/* the selection's HIGHESTMODSEQ predates the fetch, so every
+		 * flag change up to it is now in sync; uid_list is not, as
+		 * this fetch reports no expunges */
+		IMAP_FOLDER_ITEM(fitem)->flags_modseq = session->highestmodseq;
 	} else {
 		imap_handle_error(SESSION(session), NULL, r);
 		goto bail;
@@ -4532,8 +4996,16 @@ bail:
 		oldflags = flags & ~(MSG_NEW|MSG_UNREAD|MSG_REPLIED|MSG_FORWARDED|MSG_MARKED|MSG_DELETED|MSG_SPAM);
 
 		if (flags_hash != NULL) {
-			flags = GPOINTER_TO_INT(g_hash_table_lookup(flags_hash,
-					GINT_TO_POINTER(msginfo->msgnum)));
+			gpointer value;
+
+			if (!g_hash_table_lookup_extended(flags_hash,
+					GINT_TO_POINTER(msginfo->msgnum), NULL, &value)) {
+				/* unchanged since the last sync */
+				if (changed_only)
+					continue;
+				value = NULL;
+			}
+			flags = GPOINTER_TO_INT(value);
 		}
 
 		if ((flags & MSG_UNREAD) == 0)
@@ -5062,6 +5534,10 @@ void imap_disconnect_all(gboolean have_connectivity)
 		PrefsAccount *account = list->data;
 		if (account->protocol == A_IMAP4) {
 			RemoteFolder *folder = (RemoteFolder *)account->folder;
+			if (folder && FOLDER(folder)->node)
+				g_node_traverse(FOLDER(folder)->node, G_IN_ORDER,
+						G_TRAVERSE_ALL, -1,
+						imap_idle_unwatch_func, NULL);
 			if (folder && folder->session) {
 				if (imap_is_busy(FOLDER(folder)))
 					imap_threaded_cancel(FOLDER(folder));
@@ -5142,6 +5618,311 @@ static gboolean imap_is_busy(Folder *folder)
 	return imap_session->busy;
 }
 
+static gboolean imap_idle_scan_func(gpointer data)
+{
+	IMAPFolderItem *item = (IMAPFolderItem *)data;
+
+	/* leave it to the next round if the folder is in use */
+	if (imap_is_busy(item->item.folder) ||
+	    item->item.scanning != ITEM_NOT_SCANNING)
+		return TRUE;
+
+	item->idle_scan = 0;
+	debug_print("IDLE: scanning %s\n", item->item.path);
+	folder_item_scan(&item->item);
+	return FALSE;
+}
+
+static void imap_idle_cb(IMAPIdle *idle, gboolean alive, gpointer data)
+{
+	IMAPFolderItem *item = (IMAPFolderItem *)data;
+
+	if (!alive) {
+		log_warning(LOG_PROTOCOL, _("IMAP IDLE connection for %s "
+			    "was lost, checking it periodically instead\n"),
+			    item->item.path);
+		imap_idle_unwatch(item);
+		item->idle_failure = time(NULL);
+		return;
+	}
+
+	item->should_update = TRUE;
+	item->last_change = time(NULL);
+	if (item->idle_scan == 0)
+		item->idle_scan = g_timeout_add(200, imap_idle_scan_func, item);
+}
+
+/* Keeps a connection in IDLE on item so that changes are picked up as
+ * the server reports them instead of at the next check. */
+static void imap_idle_start(IMAPSession *session, IMAPIdleWatch *watch)
+{
+	IMAPFolderItem *item = watch->item;
+	Folder *folder = session->folder;
+	PrefsAccount *account = folder->account;
+	IMAPIdle *idle = NULL;
+	gchar *pass = NULL;
+	gchar *real_path;
+	gint ok;
+
+	if (item->idle != NULL || item->item.path == NULL ||
+	    item->item.no_select || account->set_tunnelcmd ||
+	    !imap_has_capability(session, "IDLE") ||
+	    time(NULL) - item->idle_failure < IMAP_IDLE_RETRY)
+		return;
+
+	/* never ask for a password just for this */
+	if (account->imap_auth_type == IMAP_AUTH_ANON ||
+	    account->imap_auth_type == IMAP_AUTH_GSSAPI)
+		pass = g_strdup("");
+	else if (!password_get(account->userid, account->recv_server, "imap",
+			       SESSION(session)->port, &pass))
+		pass = passwd_store_get_account(account->account_id,
+						PWS_ACCOUNT_RECV);
+	if (pass == NULL && account->session_passwd != NULL)
+		pass = g_strdup(account->session_passwd);
+	if (pass == NULL) {
+		item->idle_failure = time(NULL);
+		return;
+	}
+
+	real_path = imap_get_real_path(session, IMAP_FOLDER(folder),
+				       item->item.path, &ok);
+	if (ok == MAILIMAP_NO_ERROR)
+		idle = imap_threaded_idle_start(folder,
+				SESSION(session)->port, real_path,
+				account->userid, pass,
+				session->login_type ? session->login_type
+						    : "plaintext",
+				imap_idle_cb, item);
+	g_free(real_path);
+	memset(pass, 0, strlen(pass));
+	g_free(pass);
+
+	/* connecting waits in a main loop of its own */
+	if (watch->item == NULL) {
+		if (idle != NULL)
+			imap_threaded_idle_stop(idle);
+		return;
+	}
+	item->idle = idle;
+	if (item->idle == NULL) {
+		item->idle_failure = time(NULL);
+		return;
+	}
+	log_message(LOG_PROTOCOL, _("Watching %s for changes with IMAP IDLE\n"),
+		    item->item.path);
+}
+
+static gboolean imap_idle_watch_func(gpointer data)
+{
+	IMAPIdleWatch *watch = (IMAPIdleWatch *)data;
+	IMAPSession *session;
+
+	/* leave it to the next round if the folder is in use */
+	if (imap_is_busy(watch->item->item.folder))
+		return TRUE;
+
+	/* idle_watch stays set while connecting, which waits in a main
+	 * loop of its own, so that nothing starts a second connection.
+	 * The item may be unwatched or even destroyed meanwhile, which
+	 * clears watch->item and leaves watch to be freed here. */
+	watch->connecting = TRUE;
+	session = imap_session_get(watch->item->item.folder);
+	if (session != NULL && watch->item != NULL)
+		imap_idle_start(session, watch);
+	if (watch->item != NULL)
+		watch->item->idle_watch = NULL;
+	g_free(watch);
+	return FALSE;
+}
+
+/* Starts watching item once the main loop is back from whatever folder
+ * operation asked for it, as connecting may take a while. */
+static void imap_idle_watch(IMAPFolderItem *item)
+{
+	if (item->idle != NULL || item->idle_watch != NULL ||
+	    time(NULL) - item->idle_failure < IMAP_IDLE_RETRY)
+		return;
+
+	item->idle_watch = g_new0(IMAPIdleWatch, 1);
+	item->idle_watch->item = item;
+	item->idle_watch->id = g_timeout_add(200, imap_idle_watch_func,
+					     item->idle_watch);
+}
+
+static void imap_idle_unwatch(IMAPFolderItem *item)
+{
+	if (item->idle_watch != NULL) {
+		item->idle_watch->item = NULL;
+		if (!item->idle_watch->connecting) {
+			g_source_remove(item->idle_watch->id);
+			g_free(item->idle_watch);
+		}
+		item->idle_watch = NULL;
+	}
+	if (item->idle_scan != 0) {
+		g_source_remove(item->idle_scan);
+		item->idle_scan = 0;
+	}
+	if (item->idle != NULL) {
+		imap_threaded_idle_stop(item->idle);
+		item->idle = NULL;
+	}
+}
+
+static gboolean imap_idle_unwatch_func(GNode *node, gpointer data)
+{
+	imap_idle_unwatch(IMAP_FOLDER_ITEM(node->data));
+	return FALSE;
+}
+
+gboolean imap_item_is_idling(FolderItem *item)
+{
+	g_return_val_if_fail(item != NULL, FALSE);
+
+	if (item->folder == NULL || item->folder->klass != &imap_class)
+		return FALSE;
+	return IMAP_FOLDER_ITEM(item)->idle != NULL;
+}
+
+static void imap_item_opened(FolderItem *item)
+{
+	if (item->folder->inbox != item)
+		imap_idle_watch(IMAP_FOLDER_ITEM(item));
+}
+
+static void imap_item_closed(FolderItem *item)
+{
+	/* the inbox stays watched */
+	if (item->folder->inbox != item)
+		imap_idle_unwatch(IMAP_FOLDER_ITEM(item));
+
+	imap_item_release_pack(item);
+}
+
+/* Files written out of the pack were only needed while the folder was
+ * open; the pack still has the messages. Once the files cached before
+ * the pack have been moved into it, whatever else is left is a partial
+ * copy or one of a message since gone, and goes as well. The pack is
+ * closed too, and imap_item_pack() opens it again when it is next
+ * needed, so only the open folders hold its descriptors. */
+void imap_item_release_pack(FolderItem *item)
+{
+	PackStore *pack = IMAP_FOLDER_ITEM(item)->pack;
+	gboolean migrated = IMAP_FOLDER_ITEM(item)->pack_migrated;
+	const gchar *name;
+	gchar *dir, *file;
+	GDir *dp;
+	gint num;
+
+	if (pack == NULL)
+		return;
+
+	dir = folder_item_get_path(item);
+	if ((dp = g_dir_open(dir, 0, NULL)) == NULL) {
+		g_free(dir);
+		imap_item_close_pack(item);
+		return;
+	}
+	while ((name = g_dir_read_name(dp)) != NULL) {
+		num = to_number(name);
+		if (num <= 0 || (!migrated && !pack_store_has(pack, num)))
+			continue;
+		file = g_strconcat(dir, G_DIR_SEPARATOR_S, name, NULL);
+		if (!is_dir_exist(file) && unlink(file) < 0)
+			FILE_OP_ERROR(file, "unlink");
+		g_free(file);
+	}
+	g_dir_close(dp);
+	g_free(dir);
+
+	imap_item_close_pack(item);
+}
+
+/* Moves the messages cached one file each before the account used a
+ * pack into it. Only those known to be complete are moved, which needs
+ * the folder's cache; an open folder keeps the files until it is
+ * closed, as they may be in use. */
+static void imap_item_migrate_to_pack(FolderItem *item, PackStore *pack)
+{
+	const gchar *name;
+	gchar *dir, *file;
+	MsgInfo *msginfo;
+	gboolean complete;
+	GDir *dp;
+	gint num, moved = 0;
+
+	if (item->cache == NULL)
+		return;
+	IMAP_FOLDER_ITEM(item)->pack_migrated = TRUE;
+
+	dir = folder_item_get_path(item);
+	if ((dp = g_dir_open(dir, 0, NULL)) == NULL) {
+		g_free(dir);
+		return;
+	}
+	while ((name = g_dir_read_name(dp)) != NULL) {
+		num = to_number(name);
+		if (num <= 0 || pack_store_has(pack, num))
+			continue;
+		msginfo = msgcache_get_msg(item->cache, num);
+		complete = msginfo != NULL &&
+			   MSG_IS_FULLY_CACHED(msginfo->flags);
+		procmsg_msginfo_free(&msginfo);
+		if (!complete)
+			continue;
+
+		file = g_strconcat(dir, G_DIR_SEPARATOR_S, name, NULL);
+		if (!is_dir_exist(file) &&
+		    pack_store_add_file(pack, num, file) == 0) {
+			moved++;
+			if (!item->opened && unlink(file) < 0)
+				FILE_OP_ERROR(file, "unlink");
+		}
+		g_free(file);
+	}
+	g_dir_close(dp);
+	g_free(dir);
+
+	if (moved > 0)
+		debug_print("moved %d cached messages of %s into the pack\n",
+			    moved, item->path ? item->path : item->name);
+}
+
+/* Returns the item's packed offline cache, opening it if needed, or NULL
+ * if the account keeps one file per message. */
+static PackStore *imap_item_pack(FolderItem *item)
+{
+	IMAPFolderItem *imap_item = IMAP_FOLDER_ITEM(item);
+	gchar *path;
+
+	if (item->folder->account == NULL ||
+	    !item->folder->account->imap_packed_cache) {
+		imap_item_close_pack(item);
+		imap_item->pack_migrated = FALSE;
+		return NULL;
+	}
+	if (imap_item->pack == NULL) {
+		path = folder_item_get_path(item);
+		if (!is_dir_exist(path))
+			make_dir_hier(path);
+		imap_item->pack = pack_store_open(path);
+		g_free(path);
+	}
+	if (imap_item->pack != NULL && !imap_item->pack_migrated)
+		imap_item_migrate_to_pack(item, imap_item->pack);
+
+	return imap_item->pack;
+}
+
+static void imap_item_close_pack(FolderItem *item)
+{
+	IMAPFolderItem *imap_item = IMAP_FOLDER_ITEM(item);
+
+	pack_store_close(imap_item->pack);
+	imap_item->pack = NULL;
+}
+
 static void imap_synchronise(FolderItem *item, gint days)
 {
 	if (IMAP_FOLDER_ITEM(item)->last_sync == IMAP_FOLDER_ITEM(item)->last_change) {
@@ -5149,8 +5930,10 @@ static void imap_synchronise(FolderItem *item, gint days)
 		return;
 	}
 	debug_print("syncing %s\n", item->path?item->path:item->name);
-	imap_gtk_synchronise(item, days);
+	/* before it returns, as it does with the messages still coming;
+	 * a change meanwhile leaves the folder to be synced again */
 	IMAP_FOLDER_ITEM(item)->last_sync = IMAP_FOLDER_ITEM(item)->last_change;
+	imap_gtk_synchronise(item, days);
 }
 
 static void imap_item_set_xml(Folder *folder, FolderItem *item, XMLTag *tag)
@@ -5168,6 +5951,9 @@ static void imap_item_set_xml(Folder *folder, FolderItem *item, XMLTag *tag)
 			IMAP_FOLDER_ITEM(item)->last_sync = (time_t)atol(attr->value);
 		if (!strcmp(attr->name, "last_change"))
 			IMAP_FOLDER_ITEM(item)->last_change = (time_t)atol(attr->value);
+		if (!strcmp(attr->name, "flags_modseq"))
+			IMAP_FOLDER_ITEM(item)->flags_modseq =
+				g_ascii_strtoull(attr->value, NULL, 10);
 	}
 	if (IMAP_FOLDER_ITEM(item)->last_change == 0)
 		IMAP_FOLDER_ITEM(item)->last_change = time(NULL);
@@ -5185,6 +5971,12 @@ static XMLTag *imap_item_get_xml(Folder *folder, FolderItem *item)
 			IMAP_FOLDER_ITEM(item)->last_sync));
 	xml_tag_add_attr(tag, xml_attr_new_time_t("last_change",
 			IMAP_FOLDER_ITEM(item)->last_change));
+	if (IMAP_FOLDER_ITEM(item)->flags_modseq != 0) {
+		gchar *value = g_strdup_printf("%" G_GUINT64_FORMAT,
+				IMAP_FOLDER_ITEM(item)->flags_modseq);
+		xml_tag_add_attr(tag, xml_attr_new("flags_modseq", value));
+		g_free(value);
+	}
 	return tag;
 }
 
@@ -48,6 +48,12 @@ void imap_disconnect_all(gboolean have_connectivity);
 gint imap_subscribe(Folder *folder, FolderItem *item, gchar *rpath, gboolean sub);
 GList *imap_scan_subtree(Folder *folder, FolderItem *item, gboolean unsubs_only, gboolean recursive);
 void imap_cache_msg(FolderItem *item, gint msgnum);
+/* error is 0 if every message came in, else the first libetpan error */
+typedef void (*IMAPCacheMsgsFunc)(FolderItem *item, gint error, gpointer data);
+void imap_cache_msgs(FolderItem *item, GSList *msglist,
+		     IMAPCacheMsgsFunc func, gpointer data);
+void imap_item_release_pack(FolderItem *item);
+gboolean imap_item_is_idling(FolderItem *item);
 
 void imap_cancel_all(void);
 gboolean imap_cancel_all_enabled(void);
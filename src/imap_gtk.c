@@ -415,51 +415,107 @@ static void sync_cb(GtkAction *action, gpointer data)
 	folder_synchronise(item->folder);
 }
 
+typedef struct _SynchroniseData {
+	GSList *mlist;
+	GSList *wanted;
+} SynchroniseData;
+
+/* synchronisations whose messages are still coming in */
+static gint synchronising = 0;
+
+gboolean imap_gtk_is_synchronising(void)
+{
+	return synchronising > 0;
+}
+
+static void imap_gtk_synchronise_finish(FolderItem *item)
+{
+	MainWindow *mainwin = mainwindow_get_mainwindow();
+	FolderView *folderview = mainwin->folderview;
+
+	folder_set_ui_func(item->folder, NULL, NULL);
+	if (--synchronising == 0) {
+		main_window_progress_off(mainwin);
+		gtk_widget_set_sensitive(folderview->ctree, TRUE);
+		main_window_cursor_normal(mainwin);
+	}
+	main_window_unlock(mainwin);
+	inc_unlock();
+}
+
+/* Continuation of imap_cache_msgs(): the messages are all cached now,
+ * or as many as could be */
+static void imap_gtk_synchronise_done(FolderItem *item, gint error,
+				      gpointer data)
+{
+	SynchroniseData *sync = data;
+	GSList *cur;
+	gint num = 0;
+	gint total = g_slist_length(sync->wanted);
+
+	/* scanning those that did not come would fetch them one by one */
+	for (cur = sync->wanted; error == 0 && cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		g_free(folder_item_fetch_msg_full(msginfo->folder,
+						  msginfo->msgnum,
+						  TRUE, TRUE));
+		statusbar_progress_all(num++,total, 100);
+		if (num % 100 == 0)
+			GTK_EVENTS_FLUSH();
+	}
+	if (!item->opened)
+		imap_item_release_pack(item);
+
+	statusbar_progress_all(0,0,0);
+	g_slist_free(sync->wanted);
+	procmsg_msg_list_free(sync->mlist);
+	g_free(sync);
+
+	imap_gtk_synchronise_finish(item);
+}
+
+/*!
+ *\brief	Download the messages of item, or those of the last days
+ *		days, for offline use. Returns once the downloads are
+ *		queued; the folder view stays locked until they are in.
+ */
 void imap_gtk_synchronise(FolderItem *item, gint days)
 {
 	MainWindow *mainwin = mainwindow_get_mainwindow();
 	FolderView *folderview = mainwin->folderview;
+	SynchroniseData *sync;
+	GSList *cur;
+	time_t t = time(NULL);
 
 	cm_return_if_fail(item != NULL);
 	cm_return_if_fail(item->folder != NULL);
 
-	main_window_cursor_wait(mainwin);
 	inc_lock();
 	main_window_lock(mainwin);
-	gtk_widget_set_sensitive(folderview->ctree, FALSE);
-	main_window_progress_on(mainwin);
+	if (synchronising++ == 0) {
+		main_window_cursor_wait(mainwin);
+		gtk_widget_set_sensitive(folderview->ctree, FALSE);
+		main_window_progress_on(mainwin);
+	}
 	GTK_EVENTS_FLUSH();
-	if (item->no_select == FALSE) {
-		GSList *mlist;
-		GSList *cur;
-		gint num = 0;
-		gint total = item->total_msgs;
-		time_t t = time(NULL);
-
-		mlist = folder_item_get_msg_list(item);
-		for (cur = mlist; cur != NULL; cur = cur->next) {
-			MsgInfo *msginfo = (MsgInfo *)cur->data;
-			gint age = (t - msginfo->date_t) / (60*60*24);
-			if (days == 0 || age <= days) {
-				imap_cache_msg(msginfo->folder, msginfo->msgnum);
-				folder_item_fetch_msg_full(msginfo->folder, msginfo->msgnum,
-							   TRUE, TRUE);
-			}
-			statusbar_progress_all(num++,total, 100);
-			if (num % 100 == 0)
-				GTK_EVENTS_FLUSH();
-		}
 
-		statusbar_progress_all(0,0,0);
-		procmsg_msg_list_free(mlist);
+	if (item->no_select) {
+		imap_gtk_synchronise_finish(item);
+		return;
 	}
 
-	folder_set_ui_func(item->folder, NULL, NULL);
-	main_window_progress_off(mainwin);
-	gtk_widget_set_sensitive(folderview->ctree, TRUE);
-	main_window_unlock(mainwin);
-	inc_unlock();
-	main_window_cursor_normal(mainwin);
+	sync = g_new0(SynchroniseData, 1);
+	sync->mlist = folder_item_get_msg_list(item);
+	for (cur = sync->mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		gint age = (t - msginfo->date_t) / (60*60*24);
+		if (days == 0 || age <= days)
+			sync->wanted = g_slist_prepend(sync->wanted, msginfo);
+	}
+	sync->wanted = g_slist_reverse(sync->wanted);
+
+	/* download them all in one go, then scan them */
+	imap_cache_msgs(item, sync->wanted, imap_gtk_synchronise_done, sync);
 }
 
 static void chk_update_val(GtkWidget *widget, gpointer data)
@@ -25,6 +25,7 @@
 
 void imap_gtk_init(void);
 void imap_gtk_synchronise(FolderItem *item, gint days);
+gboolean imap_gtk_is_synchronising(void);
 gboolean imap_gtk_should_override(void);
 
 #endif /* IMAP_GTK_H */
@@ -425,6 +425,7 @@ int main(int argc, char *argv[])
 
 	imap_main_init(prefs_common.skip_ssl_cert_check);
 	imap_main_set_timeout(prefs_common.io_timeout_secs);
+	imap_main_set_max_workers(prefs_common.imap_worker_threads);
 	/* If we can't read a folder list or don't have accounts,
 	 * it means the configuration's not done. Either this is
 	 * a brand new install, a failed/refused migration,
@@ -591,7 +592,6 @@ int main(int argc, char *argv[])
 
 
 	gtk_main();
-	utils_free_regex();
 	exit_claws(mainwin);
 
 	return 0;
@@ -72,6 +72,7 @@
 #include "icon_legend.h"
 #include "textview.h"
 #include "imap.h"
+#include "imap_gtk.h"
 #include "socket.h"
 #include "send_message.h"
 
@@ -3203,6 +3204,26 @@ static void mainwindow_check_synchronise(MainWindow *mainwin, gboolean ask)
 		folder_synchronise(NULL);
 }
 
+static guint go_offline_id = 0;
+
+static void mainwindow_go_offline(void)
+{
+	prefs_common.work_offline = TRUE;
+	imap_disconnect_all(TRUE);
+	hooks_invoke(OFFLINE_SWITCH_HOOKLIST, NULL);
+}
+
+/* Goes offline once the folders being synchronised have all their
+ * messages, which come in from the main loop */
+static gboolean mainwindow_go_offline_func(gpointer data)
+{
+	if (imap_gtk_is_synchronising())
+		return TRUE;
+	go_offline_id = 0;
+	mainwindow_go_offline();
+	return FALSE;
+}
+
 static void online_switch_clicked (GtkButton *btn, gpointer data)
 {
 	MainWindow *mainwin;
@@ -3219,15 +3240,27 @@ static void online_switch_clicked (GtkButton *btn, gpointer data)
 		inc_autocheck_timer_remove();
 
 		/* go offline */
-		if (prefs_common.work_offline)
+		if (prefs_common.work_offline || go_offline_id != 0)
 			return;
 
 		mainwindow_check_synchronise(mainwin, TRUE);
-		prefs_common.work_offline = TRUE;
-		imap_disconnect_all(TRUE);
-		hooks_invoke(OFFLINE_SWITCH_HOOKLIST, NULL);
+		if (imap_gtk_is_synchronising())
+			go_offline_id = g_timeout_add(200,
+					mainwindow_go_offline_func, NULL);
+		else
+			mainwindow_go_offline();
 	} else {
 		/*go online */
+		if (go_offline_id != 0) {
+			/* never went offline */
+			g_source_remove(go_offline_id);
+			go_offline_id = 0;
+			gtk_widget_hide (mainwin->offline_switch);
+			gtk_widget_show (mainwin->online_switch);
+			cm_toggle_menu_set_active_full(mainwin->ui_manager, "Menu/File/OfflineMode", FALSE);
+			inc_autocheck_timer_set();
+			return;
+		}
 		if (!prefs_common.work_offline)
 			return;
 		gtk_widget_hide (mainwin->offline_switch);
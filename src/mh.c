@@ -22,6 +22,7 @@
 #include <glib/gi18n.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <err.h>
 #include <errno.h>
@@ -53,6 +54,9 @@ static gchar   *mh_fetch_msg		(Folder		*folder,
 static MsgInfo *mh_get_msginfo		(Folder		*folder,
 					 FolderItem	*item,
 					 gint		 num);
+static MsgInfoList *mh_get_msginfos	(Folder		*folder,
+					 FolderItem	*item,
+					 MsgNumberList	*numlist);
 static gint     mh_add_msg		(Folder		*folder,
 					 FolderItem	*dest,
 					 const gchar	*file,
@@ -152,6 +156,7 @@ FolderClass *mh_get_class(void)
 
 		/* Message functions */
 		mh_class.get_msginfo = mh_get_msginfo;
+		mh_class.get_msginfos = mh_get_msginfos;
 		mh_class.fetch_msg = mh_fetch_msg;
 		mh_class.add_msg = mh_add_msg;
 		mh_class.add_msgs = mh_add_msgs;
@@ -294,13 +299,13 @@ static gchar *mh_fetch_msg(Folder *folder, FolderItem *item, int num)
 		warn("fetch message %d: NULL folder item", num);
 		return NULL;
 	} else if (num <= 0) {
-		warn("fetch message %d: message number must be positive");
+		warn("fetch message %d: message number must be positive", num);
 		return NULL;
 	}
 
 	char *path = folder_item_get_path(item);
-	char *file = malloc(PATH_MAX);
-	snprintf(file, sizeof(file), "%s/%d", path, num);
+	char *file = g_strdup_printf("%s%c%d", path, G_DIR_SEPARATOR, num);
+	g_free(path);
 	return file;
 }
 
@@ -325,6 +330,117 @@ static MsgInfo *mh_get_msginfo(Folder *folder, FolderItem *item, gint num)
 	return msginfo;
 }
 
+/* below this many messages the thread pool costs more than it saves */
+#define MH_PARSE_THREAD_MIN	64
+
+typedef struct _MHParseData MHParseData;
+
+struct _MHParseData
+{
+	FolderItem *item;
+	gchar *path;
+	MsgFlags flags;
+	gint *nums;
+	MsgInfo **msginfos;
+};
+
+static gint mh_msgnum_compare(gconstpointer a, gconstpointer b)
+{
+	gint na = *(const gint *)a;
+	gint nb = *(const gint *)b;
+
+	return (na > nb) - (na < nb);
+}
+
+/* Runs on a pool thread: slot i of the result array belongs to exactly
+ * one task, so no locking is needed. */
+static void mh_parse_msg_func(gpointer task, gpointer user_data)
+{
+	MHParseData *data = user_data;
+	guint i = GPOINTER_TO_UINT(task) - 1;
+	MsgInfo *msginfo;
+	gchar *file;
+
+	file = g_strdup_printf("%s%c%d", data->path, G_DIR_SEPARATOR,
+			       data->nums[i]);
+	msginfo = procheader_parse_file(file, data->flags, FALSE, FALSE);
+	g_free(file);
+
+	if (msginfo) {
+		msginfo->msgnum = data->nums[i];
+		msginfo->folder = data->item;
+	}
+	data->msginfos[i] = msginfo;
+}
+
+static MsgInfoList *mh_get_msginfos(Folder *folder, FolderItem *item,
+				    MsgNumberList *numlist)
+{
+	MHParseData data;
+	GThreadPool *pool = NULL;
+	MsgInfoList *ret = NULL;
+	MsgNumberList *cur;
+	guint n = 0, i;
+
+	cm_return_val_if_fail(item != NULL, NULL);
+
+	data.nums = g_new(gint, g_slist_length(numlist));
+	for (cur = numlist; cur != NULL; cur = cur->next) {
+		gint num = GPOINTER_TO_INT(cur->data);
+		if (num > 0)
+			data.nums[n++] = num;
+	}
+	if (n == 0) {
+		g_free(data.nums);
+		return NULL;
+	}
+	qsort(data.nums, n, sizeof(gint), mh_msgnum_compare);
+
+	data.item = item;
+	data.path = folder_item_get_path(item);
+	data.msginfos = g_new0(MsgInfo *, n);
+	data.flags.perm_flags = MSG_NEW|MSG_UNREAD;
+	data.flags.tmp_flags = 0;
+	if (folder_has_parent_of_type(item, F_QUEUE)) {
+		MSG_SET_TMP_FLAGS(data.flags, MSG_QUEUED);
+	} else if (folder_has_parent_of_type(item, F_DRAFT)) {
+		MSG_SET_TMP_FLAGS(data.flags, MSG_DRAFT);
+	}
+
+	if (n >= MH_PARSE_THREAD_MIN && g_get_num_processors() > 1) {
+		/* build codeconv's lazily filled tables before the workers
+		   race to do it */
+		conv_get_locale_charset_str();
+		conv_get_locale_charset_str_no_utf8();
+		conv_get_charset_from_str(CS_UTF_8);
+
+		pool = g_thread_pool_new(mh_parse_msg_func, &data,
+					 g_get_num_processors(), TRUE, NULL);
+	}
+
+	if (pool != NULL) {
+		debug_print("MH: parsing %u messages on %u threads\n", n,
+			    g_get_num_processors());
+		for (i = 0; i < n; i++)
+			g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+		g_thread_pool_free(pool, FALSE, TRUE);
+	} else {
+		for (i = 0; i < n; i++)
+			mh_parse_msg_func(GUINT_TO_POINTER(i + 1), &data);
+	}
+
+	for (i = n; i > 0; i--) {
+		if (data.msginfos[i - 1] != NULL)
+			ret = g_slist_prepend(ret, data.msginfos[i - 1]);
+	}
+
+	g_free(data.msginfos);
+	g_free(data.path);
+	g_free(data.nums);
+
+	return ret;
+}
+
 static gchar *mh_get_new_msg_filename(FolderItem *dest)
 {
 	gchar *destfile;
@@ -26,6 +26,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 #include <time.h>
 
@@ -75,6 +76,103 @@ static gboolean msgcache_use_mmap_read = TRUE;
 
 static gboolean swapping = TRUE;
 
+/* Last version of the stream-of-fields cache format, still read so that
+ * existing caches migrate to the mapped layout on the next write. */
+#define CACHE_VERSION_STREAM	24
+
+/*
+ * Mapped cache layout, CACHE_VERSION 25 and later. All integers are
+ * little-endian guint32:
+ *
+ *   header	MsgCacheHeader
+ *   records	n_records fixed-size MsgCacheRecords
+ *   strings	strings_len bytes of NUL-terminated UTF-8 strings
+ *
+ * String fields are offsets into the string section. Offset 0 holds a
+ * lone NUL and stands for a NULL field. The references of a message are
+ * stored as n_references consecutive strings starting at references.
+ *
+ * MsgInfos read from such a file point straight into the mapping instead
+ * of owning copies; the mapping is released with the last of them.
+ */
+typedef struct _MsgCacheHeader MsgCacheHeader;
+struct _MsgCacheHeader {
+	guint32 version;
+	guint32 record_size;
+	guint32 n_records;
+	guint32 strings_len;
+};
+
+typedef struct _MsgCacheRecord MsgCacheRecord;
+struct _MsgCacheRecord {
+	guint32 msgnum;
+	guint32 size;
+	guint32 mtime;
+	guint32 date_t;
+	guint32 tmp_flags;
+	guint32 planned_download;
+	guint32 total_size;
+
+	guint32 fromname;
+	guint32 date;
+	guint32 from;
+	guint32 to;
+	guint32 cc;
+	guint32 subject;
+	guint32 msgid;
+	guint32 inreplyto;
+	guint32 xref;
+
+	guint32 references;
+	guint32 n_references;
+};
+
+struct _MsgCacheMap {
+	gchar	*data;
+	gsize	 len;
+	gint	 refcnt;
+};
+
+/*
+ * Journal of the changes made since the cache and mark files were last
+ * written, appended to instead of rewriting them. All integers are
+ * little-endian:
+ *
+ *   header	MsgCacheJournalHeader, naming the cache file it applies to
+ *   entries	MsgCacheJournalEntry followed by len bytes of data
+ *
+ * A JOURNAL_MSG entry carries the message as a MsgCacheRecord followed
+ * by its string section. Replaying the entries in order over the cache
+ * and mark files gives the current state; a torn entry at the end is
+ * ignored. The journal is folded back into the cache and mark files once
+ * it grows past 1/JOURNAL_COMPACT_RATIO of the cache file.
+ */
+#define JOURNAL_VERSION		1
+#define JOURNAL_COMPACT_RATIO	8
+
+typedef enum {
+	JOURNAL_MSG = 1,	/* message added or changed */
+	JOURNAL_FLAGS,		/* permanent flags changed */
+	JOURNAL_REMOVE		/* message removed */
+} JournalOp;
+
+typedef struct _MsgCacheJournalHeader MsgCacheJournalHeader;
+struct _MsgCacheJournalHeader {
+	guint32 version;
+	guint32 reserved;
+	guint64 base_ino;
+	guint64 base_size;
+	guint64 base_mtime;
+};
+
+typedef struct _MsgCacheJournalEntry MsgCacheJournalEntry;
+struct _MsgCacheJournalEntry {
+	guint32 op;
+	guint32 msgnum;
+	guint32 perm_flags;
+	guint32 len;
+};
+
 typedef enum
 {
 	DATA_READ,
@@ -85,8 +183,19 @@ typedef enum
 struct _MsgCache {
 	GHashTable	*msgnum_table;
 	GHashTable	*msgid_table;
+	/* In-Reply-To -> GPtrArray of the MsgInfos replying to it; built
+	 * on first use and dropped whenever messages come or go */
+	GHashTable	*children_table;
 	guint		 memusage;
 	time_t		 last_access;
+
+	/* msgnum -> JournalOp of messages changed since the last write */
+	GHashTable	*journal;
+	/* the cache file on disk, which the journal applies to */
+	gboolean	 journal_ok;
+	guint64		 base_ino;
+	guint64		 base_size;
+	guint64		 base_mtime;
 };
 
 typedef struct _StringConverter StringConverter;
@@ -108,6 +217,49 @@ struct _CharsetConverter {
 	gchar *dstcharset;
 };
 
+static void msgcache_drop_msg(MsgCache *cache, guint msgnum);
+
+static MsgCacheMap *msgcache_map_new(gchar *data, gsize len)
+{
+	MsgCacheMap *map;
+
+	map = g_new0(MsgCacheMap, 1);
+	map->data = data;
+	map->len = len;
+	map->refcnt = 1;
+
+	return map;
+}
+
+MsgCacheMap *msgcache_map_ref(MsgCacheMap *map)
+{
+	map->refcnt++;
+
+	return map;
+}
+
+void msgcache_map_unref(MsgCacheMap *map)
+{
+	if (map == NULL)
+		return;
+
+	map->refcnt--;
+	if (map->refcnt > 0)
+		return;
+
+	munmap(map->data, map->len);
+	g_free(map);
+}
+
+gboolean msgcache_map_contains(MsgCacheMap *map, gconstpointer ptr)
+{
+	if (map == NULL || ptr == NULL)
+		return FALSE;
+
+	return (const gchar *)ptr >= map->data &&
+	       (const gchar *)ptr < map->data + map->len;
+}
+
 MsgCache *msgcache_new(void)
 {
 	MsgCache *cache;
@@ -115,11 +267,39 @@ MsgCache *msgcache_new(void)
 	cache = g_new0(MsgCache, 1),
 	cache->msgnum_table = g_hash_table_new(g_int_hash, g_int_equal);
 	cache->msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+	cache->journal = g_hash_table_new(g_direct_hash, g_direct_equal);
 	cache->last_access = time(NULL);
 
 	return cache;
 }
 
+static void msgcache_set_base(MsgCache *cache, struct stat *st)
+{
+	cache->base_ino = st->st_ino;
+	cache->base_size = st->st_size;
+	cache->base_mtime = st->st_mtime;
+	cache->journal_ok = TRUE;
+	g_hash_table_remove_all(cache->journal);
+}
+
+static void msgcache_journal_note(MsgCache *cache, guint msgnum, JournalOp op)
+{
+	gpointer key = GUINT_TO_POINTER(msgnum);
+
+	if (GPOINTER_TO_INT(g_hash_table_lookup(cache->journal, key)) == JOURNAL_MSG)
+		return;
+	g_hash_table_insert(cache->journal, key, GINT_TO_POINTER(op));
+}
+
+static void msgcache_children_invalidate(MsgCache *cache)
+{
+	if (cache->children_table == NULL)
+		return;
+
+	g_hash_table_destroy(cache->children_table);
+	cache->children_table = NULL;
+}
+
 static gboolean msgcache_msginfo_free_func(gpointer num, gpointer msginfo, gpointer user_data)
 {
 	procmsg_msginfo_free((MsgInfo **)&msginfo);
@@ -128,22 +308,55 @@ static gboolean msgcache_msginfo_free_func(gpointer num, gpointer msginfo, gpoin
 
 void msgcache_destroy(MsgCache *cache)
 {
+	msgcache_children_invalidate(cache);
 	g_hash_table_foreach_remove(cache->msgnum_table, msgcache_msginfo_free_func, NULL);
 	g_hash_table_destroy(cache->msgid_table);
 	g_hash_table_destroy(cache->msgnum_table);
+	g_hash_table_destroy(cache->journal);
 	g_free(cache);
 }
 
+/* Takes over msginfo, replacing any message with the same number. The
+ * journal and dirty flags are left alone. */
+static void msgcache_insert_msg(MsgCache *cache, MsgInfo *msginfo)
+{
+	msgcache_drop_msg(cache, msginfo->msgnum);
+	msgcache_children_invalidate(cache);
+	g_hash_table_insert(cache->msgnum_table, &msginfo->msgnum, msginfo);
+	if (msginfo->msgid != NULL)
+		g_hash_table_insert(cache->msgid_table, msginfo->msgid, msginfo);
+	cache->memusage += procmsg_msginfo_memusage(msginfo);
+}
+
+static void msgcache_drop_msg(MsgCache *cache, guint msgnum)
+{
+	MsgInfo *msginfo;
+
+	msginfo = g_hash_table_lookup(cache->msgnum_table, &msgnum);
+	if (msginfo == NULL)
+		return;
+
+	msgcache_children_invalidate(cache);
+	cache->memusage -= procmsg_msginfo_memusage(msginfo);
+	if (msginfo->msgid != NULL &&
+	    g_hash_table_lookup(cache->msgid_table, msginfo->msgid) == msginfo)
+		g_hash_table_remove(cache->msgid_table, msginfo->msgid);
+	g_hash_table_remove(cache->msgnum_table, &msgnum);
+	procmsg_msginfo_free(&msginfo);
+}
+
 void msgcache_add_msg(MsgCache *cache, MsgInfo *msginfo)
 {
 	MsgInfo *newmsginfo;
 
+	msgcache_children_invalidate(cache);
 	newmsginfo = procmsg_msginfo_new_ref(msginfo);
 	g_hash_table_insert(cache->msgnum_table, &newmsginfo->msgnum, newmsginfo);
 	if(newmsginfo->msgid != NULL)
 		g_hash_table_insert(cache->msgid_table, newmsginfo->msgid, newmsginfo);
 	cache->memusage += procmsg_msginfo_memusage(msginfo);
 	cache->last_access = time(NULL);
+	msgcache_journal_note(cache, msginfo->msgnum, JOURNAL_MSG);
 
 	msginfo->folder->cache_dirty = TRUE;
 
@@ -158,10 +371,12 @@ void msgcache_remove_msg(MsgCache *cache, guint msgnum)
 	if(!msginfo)
 		return;
 
+	msgcache_children_invalidate(cache);
 	cache->memusage -= procmsg_msginfo_memusage(msginfo);
 	if(msginfo->msgid)
 		g_hash_table_remove(cache->msgid_table, msginfo->msgid);
 	g_hash_table_remove(cache->msgnum_table, &msginfo->msgnum);
+	msgcache_journal_note(cache, msgnum, JOURNAL_MSG);
 
 	msginfo->folder->cache_dirty = TRUE;
 
@@ -176,6 +391,7 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 {
 	MsgInfo *oldmsginfo, *newmsginfo;
 
+	msgcache_children_invalidate(cache);
 	oldmsginfo = g_hash_table_lookup(cache->msgnum_table, &msginfo->msgnum);
 	if(oldmsginfo && oldmsginfo->msgid)
 		g_hash_table_remove(cache->msgid_table, oldmsginfo->msgid);
@@ -191,6 +407,7 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 		g_hash_table_insert(cache->msgid_table, newmsginfo->msgid, newmsginfo);
 	cache->memusage += procmsg_msginfo_memusage(newmsginfo);
 	cache->last_access = time(NULL);
+	msgcache_journal_note(cache, msginfo->msgnum, JOURNAL_MSG);
 
 	debug_print("Cache size: %d messages, %u bytes\n", g_hash_table_size(cache->msgnum_table), cache->memusage);
 
@@ -199,6 +416,16 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 	return;
 }
 
+void msgcache_msg_changed(MsgCache *cache, MsgInfo *msginfo)
+{
+	msgcache_journal_note(cache, msginfo->msgnum, JOURNAL_MSG);
+}
+
+void msgcache_msg_flags_changed(MsgCache *cache, MsgInfo *msginfo)
+{
+	msgcache_journal_note(cache, msginfo->msgnum, JOURNAL_FLAGS);
+}
+
 MsgInfo *msgcache_get_msg(MsgCache *cache, guint num)
 {
 	MsgInfo *msginfo;
@@ -223,6 +450,78 @@ MsgInfo *msgcache_get_msg_by_id(MsgCache *cache, const gchar *msgid)
 	return procmsg_msginfo_new_ref(msginfo);
 }
 
+static void msgcache_children_add_func(gpointer key, gpointer value, gpointer user_data)
+{
+	GHashTable *children_table = user_data;
+	MsgInfo *msginfo = value;
+	GPtrArray *children;
+
+	if (msginfo->inreplyto == NULL || *msginfo->inreplyto == '\0')
+		return;
+
+	children = g_hash_table_lookup(children_table, msginfo->inreplyto);
+	if (children == NULL) {
+		children = g_ptr_array_new();
+		g_hash_table_insert(children_table, msginfo->inreplyto, children);
+	}
+	g_ptr_array_add(children, msginfo);
+}
+
+/*!
+ *\brief	Every message in the cache that replies to msginfo, directly
+ *		or through other replies, each once. The list holds
+ *		references, as msgcache_get_msg_list() does.
+ */
+MsgInfoList *msgcache_get_msg_descendants(MsgCache *cache, MsgInfo *msginfo)
+{
+	MsgInfoList *descendants = NULL;
+	GHashTable *seen;
+	GQueue queue = G_QUEUE_INIT;
+	MsgInfo *cur;
+	guint i;
+
+	cm_return_val_if_fail(cache != NULL, NULL);
+	cm_return_val_if_fail(msginfo != NULL, NULL);
+
+	if (cache->children_table == NULL) {
+		cache->children_table = g_hash_table_new_full(g_str_hash,
+			g_str_equal, NULL, (GDestroyNotify)g_ptr_array_unref);
+		g_hash_table_foreach(cache->msgnum_table,
+				     msgcache_children_add_func,
+				     cache->children_table);
+	}
+	cache->last_access = time(NULL);
+
+	/* reply loops end at messages already seen */
+	seen = g_hash_table_new(NULL, NULL);
+	g_hash_table_add(seen, msginfo);
+	if (msginfo->msgid != NULL &&
+	    (cur = g_hash_table_lookup(cache->msgid_table, msginfo->msgid)) != NULL)
+		g_hash_table_add(seen, cur);
+
+	for (cur = msginfo; cur != NULL; cur = g_queue_pop_head(&queue)) {
+		GPtrArray *children;
+
+		if (cur->msgid == NULL ||
+		    (children = g_hash_table_lookup(cache->children_table,
+						    cur->msgid)) == NULL)
+			continue;
+
+		for (i = 0; i < children->len; i++) {
+			MsgInfo *child = g_ptr_array_index(children, i);
+
+			if (!g_hash_table_add(seen, child))
+				continue;
+			descendants = g_slist_prepend(descendants,
+					procmsg_msginfo_new_ref(child));
+			g_queue_push_tail(&queue, child);
+		}
+	}
+	g_hash_table_destroy(seen);
+
+	return descendants;
+}
+
 static void msgcache_get_msg_list_func(gpointer key, gpointer value, gpointer user_data)
 {
 	MsgInfoList **listptr = user_data;
@@ -522,6 +821,186 @@ static void strconv_charset_free(StringConverter *conv)
 	g_free(charsetconv->dstcharset);
 }
 
+static gchar *msgcache_map_string(const gchar *strings, guint32 strings_len,
+				  guint32 off, gboolean *error)
+{
+	off = GUINT32_FROM_LE(off);
+	if (off == 0)
+		return NULL;
+	if (off >= strings_len) {
+		*error = TRUE;
+		return NULL;
+	}
+	return (gchar *)strings + off;
+}
+
+/* Builds a MsgInfo from a record whose strings live in strings, which must
+ * end with a NUL. The MsgInfo points into map if given, otherwise it gets
+ * copies of the strings. Returns NULL if the record is corrupted. */
+static MsgInfo *msgcache_read_record(const MsgCacheRecord *rec, const gchar *strings,
+				     guint32 strings_len, MsgCacheMap *map)
+{
+	MsgInfo *msginfo;
+	gboolean error = FALSE;
+	guint32 ref, n;
+
+	msginfo = procmsg_msginfo_new();
+	if (map != NULL)
+		msginfo->cache_map = msgcache_map_ref(map);
+
+	msginfo->msgnum = GUINT32_FROM_LE(rec->msgnum);
+	msginfo->size = GUINT32_FROM_LE(rec->size);
+	msginfo->mtime = GUINT32_FROM_LE(rec->mtime);
+	msginfo->date_t = GUINT32_FROM_LE(rec->date_t);
+	msginfo->flags.tmp_flags = GUINT32_FROM_LE(rec->tmp_flags);
+	msginfo->planned_download = GUINT32_FROM_LE(rec->planned_download);
+	msginfo->total_size = GUINT32_FROM_LE(rec->total_size);
+
+#define MAP_STRING(field) \
+	{ \
+		msginfo->field = msgcache_map_string(strings, strings_len, rec->field, &error); \
+		if (map == NULL) \
+			msginfo->field = g_strdup(msginfo->field); \
+	}
+
+	MAP_STRING(fromname);
+	MAP_STRING(date);
+	MAP_STRING(from);
+	MAP_STRING(to);
+	MAP_STRING(cc);
+	MAP_STRING(subject);
+	MAP_STRING(msgid);
+	MAP_STRING(inreplyto);
+	MAP_STRING(xref);
+#undef MAP_STRING
+
+	ref = GUINT32_FROM_LE(rec->references);
+	for (n = GUINT32_FROM_LE(rec->n_references); n > 0; n--) {
+		if (ref == 0 || ref >= strings_len) {
+			error = TRUE;
+			break;
+		}
+		msginfo->references = g_slist_prepend(msginfo->references,
+			map != NULL ? (gchar *)strings + ref : g_strdup(strings + ref));
+		ref += strlen(strings + ref) + 1;
+	}
+	if (msginfo->references)
+		msginfo->references = g_slist_reverse(msginfo->references);
+
+	if (error)
+		procmsg_msginfo_free(&msginfo);
+
+	return msginfo;
+}
+
+static MsgTmpFlags msgcache_get_item_tmp_flags(FolderItem *item)
+{
+	if (folder_has_parent_of_type(item, F_QUEUE))
+		return MSG_QUEUED;
+	else if (folder_has_parent_of_type(item, F_DRAFT))
+		return MSG_DRAFT;
+	return 0;
+}
+
+/* Reads a cache in the mapped layout. Returns NULL with *version set to
+ * the version found in the file if it is not in that layout, so that the
+ * caller can fall back to the stream reader. */
+static MsgCache *msgcache_read_mapped_cache(FolderItem *item, const gchar *cache_file,
+					    MsgTmpFlags tmp_flags, guint32 *version)
+{
+	MsgCache *cache;
+	MsgCacheMap *map;
+	const MsgCacheHeader *header;
+	const MsgCacheRecord *rec;
+	const gchar *strings;
+	guint32 n_records, strings_len, i;
+	guint64 records_len;
+	gchar *data;
+	struct stat st;
+	gboolean error = FALSE;
+	int fd;
+
+	*version = 0;
+
+	if ((fd = g_open(cache_file, O_RDONLY, 0)) < 0) {
+		debug_print("Mark/Cache file '%s' not found\n", cache_file);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(MsgCacheHeader)) {
+		close(fd);
+		return NULL;
+	}
+	/* writable but private: some callers edit MsgInfo strings in place
+	   (extract_address() on from, for instance), which must only ever
+	   touch a copy-on-write page and never the file */
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	map = msgcache_map_new(data, st.st_size);
+
+	header = (const MsgCacheHeader *)data;
+	*version = GUINT32_FROM_LE(header->version);
+	if (*version != CACHE_VERSION) {
+		msgcache_map_unref(map);
+		return NULL;
+	}
+
+	n_records = GUINT32_FROM_LE(header->n_records);
+	strings_len = GUINT32_FROM_LE(header->strings_len);
+	records_len = (guint64)n_records * sizeof(MsgCacheRecord);
+	if (GUINT32_FROM_LE(header->record_size) != sizeof(MsgCacheRecord) ||
+	    sizeof(MsgCacheHeader) + records_len + strings_len != (guint64)st.st_size ||
+	    strings_len == 0) {
+		g_warning("%s: cache data corrupted (header)", cache_file);
+		msgcache_map_unref(map);
+		return NULL;
+	}
+	strings = data + sizeof(MsgCacheHeader) + records_len;
+	/* every string is terminated inside the section */
+	if (strings[0] != '\0' || strings[strings_len - 1] != '\0') {
+		g_warning("%s: cache data corrupted (strings)", cache_file);
+		msgcache_map_unref(map);
+		return NULL;
+	}
+
+	debug_print("\tReading mapped message cache from %s...\n", cache_file);
+
+	cache = msgcache_new();
+	rec = (const MsgCacheRecord *)(data + sizeof(MsgCacheHeader));
+
+	for (i = 0; i < n_records; i++, rec++) {
+		MsgInfo *msginfo;
+
+		if ((msginfo = msgcache_read_record(rec, strings, strings_len, map)) == NULL) {
+			g_warning("%s: cache data corrupted (record %u)", cache_file, i);
+			error = TRUE;
+			break;
+		}
+		msginfo->folder = item;
+		msginfo->flags.tmp_flags |= tmp_flags;
+
+		cache->memusage += procmsg_msginfo_memusage(msginfo);
+		g_hash_table_insert(cache->msgnum_table, &msginfo->msgnum, msginfo);
+		if(msginfo->msgid)
+			g_hash_table_insert(cache->msgid_table, msginfo->msgid, msginfo);
+	}
+	msgcache_map_unref(map);
+
+	if (error) {
+		msgcache_destroy(cache);
+		return NULL;
+	}
+
+	msgcache_set_base(cache, &st);
+	cache->last_access = time(NULL);
+
+	debug_print("done. (%d items read)\n", g_hash_table_size(cache->msgnum_table));
+	debug_print("Cache size: %d messages, %u bytes\n", g_hash_table_size(cache->msgnum_table), cache->memusage);
+
+	return cache;
+}
+
 MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 {
 	MsgCache *cache;
@@ -541,6 +1020,14 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 	char *cache_data = NULL;
 	struct stat st;
 
+	guint32 version;
+
+	tmp_flags = msgcache_get_item_tmp_flags(item);
+
+	cache = msgcache_read_mapped_cache(item, cache_file, tmp_flags, &version);
+	if (cache != NULL || version == CACHE_VERSION)
+		return cache;
+
 	swapping = TRUE;
 
 	/* In case we can't open the mark file with MARK_VERSION, check if we can open it with the
@@ -549,9 +1036,9 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 	 * no effect on x86 as their file doesn't change. */
 
 	if ((fp = msgcache_open_data_file
-		(cache_file, CACHE_VERSION, DATA_READ, file_buf, sizeof(file_buf))) == NULL) {
+		(cache_file, CACHE_VERSION_STREAM, DATA_READ, file_buf, sizeof(file_buf))) == NULL) {
 		if ((fp = msgcache_open_data_file
-		(cache_file, bswap_32(CACHE_VERSION), DATA_READ, file_buf, sizeof(file_buf))) == NULL)
+		(cache_file, bswap_32(CACHE_VERSION_STREAM), DATA_READ, file_buf, sizeof(file_buf))) == NULL)
 			return NULL;
 		else
 			swapping = FALSE;
@@ -559,12 +1046,6 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 
 	debug_print("\tReading %sswapped message cache from %s...\n", swapping?"":"un", cache_file);
 
-	if (folder_has_parent_of_type(item, F_QUEUE)) {
-		tmp_flags |= MSG_QUEUED;
-	} else if (folder_has_parent_of_type(item, F_DRAFT)) {
-		tmp_flags |= MSG_DRAFT;
-	}
-
 	if (msgcache_read_cache_data_str(fp, &srccharset, NULL) < 0) {
 		fclose(fp);
 		return NULL;
@@ -722,6 +1203,8 @@ bail_err:
 	if (cache_data != NULL && cache_data != MAP_FAILED) {
 		munmap(cache_data, map_len);
 	}
+	if (!error && fstat(fileno(fp), &st) == 0)
+		msgcache_set_base(cache, &st);
 	fclose(fp);
 	if (conv != NULL) {
 		if (conv->free != NULL)
@@ -819,37 +1302,139 @@ bail_err:
 	}
 }
 
-static int msgcache_write_cache(MsgInfo *msginfo, FILE *fp)
+static guint32 msgcache_string_size(const gchar *str)
+{
+	return (str != NULL && *str != '\0') ? strlen(str) + 1 : 0;
+}
+
+/* Places str at *strings_len in the string section and returns its
+ * offset, or 0 for an empty field. */
+static guint32 msgcache_place_string(const gchar *str, guint64 *strings_len)
 {
-	MsgTmpFlags flags = msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK;
+	guint32 off, size;
+
+	if ((size = msgcache_string_size(str)) == 0)
+		return 0;
+	off = (guint32)*strings_len;
+	*strings_len += size;
+	return GUINT32_TO_LE(off);
+}
+
+static gint msgcache_fill_record(MsgInfo *msginfo, guint64 *strings_len, MsgCacheRecord *out)
+{
+	MsgCacheRecord rec;
 	GSList *cur;
-	int w_err = 0, wrote = 0;
+	guint32 n_refs = 0;
+
+	rec.msgnum = GUINT32_TO_LE(msginfo->msgnum);
+	rec.size = GUINT32_TO_LE((guint32)msginfo->size);
+	rec.mtime = GUINT32_TO_LE((guint32)msginfo->mtime);
+	rec.date_t = GUINT32_TO_LE((guint32)msginfo->date_t);
+	rec.tmp_flags = GUINT32_TO_LE(msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK);
+	rec.planned_download = GUINT32_TO_LE(msginfo->planned_download);
+	rec.total_size = GUINT32_TO_LE(msginfo->total_size);
+
+	rec.fromname = msgcache_place_string(msginfo->fromname, strings_len);
+	rec.date = msgcache_place_string(msginfo->date, strings_len);
+	rec.from = msgcache_place_string(msginfo->from, strings_len);
+	rec.to = msgcache_place_string(msginfo->to, strings_len);
+	rec.cc = msgcache_place_string(msginfo->cc, strings_len);
+	rec.subject = msgcache_place_string(msginfo->subject, strings_len);
+	rec.msgid = msgcache_place_string(msginfo->msgid, strings_len);
+	rec.inreplyto = msgcache_place_string(msginfo->inreplyto, strings_len);
+	rec.xref = msgcache_place_string(msginfo->xref, strings_len);
+
+	rec.references = GUINT32_TO_LE((guint32)*strings_len);
+	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
+		guint32 size = msgcache_string_size(cur->data);
 
-	WRITE_CACHE_DATA_INT(msginfo->msgnum, fp);
-	WRITE_CACHE_DATA_INT(msginfo->size, fp);
-	WRITE_CACHE_DATA_INT(msginfo->mtime, fp);
-	WRITE_CACHE_DATA_INT(msginfo->date_t, fp);
-	WRITE_CACHE_DATA_INT(flags, fp);
+		if (size == 0)
+			continue;
+		*strings_len += size;
+		n_refs++;
+	}
+	if (n_refs == 0)
+		rec.references = 0;
+	rec.n_references = GUINT32_TO_LE(n_refs);
 
-	WRITE_CACHE_DATA(msginfo->fromname, fp);
+	if (*strings_len > G_MAXUINT32)
+		return -1;
+	*out = rec;
+	return 0;
+}
 
-	WRITE_CACHE_DATA(msginfo->date, fp);
-	WRITE_CACHE_DATA(msginfo->from, fp);
-	WRITE_CACHE_DATA(msginfo->to, fp);
-	WRITE_CACHE_DATA(msginfo->cc, fp);
-	WRITE_CACHE_DATA(msginfo->subject, fp);
-	WRITE_CACHE_DATA(msginfo->msgid, fp);
-	WRITE_CACHE_DATA(msginfo->inreplyto, fp);
-	WRITE_CACHE_DATA(msginfo->xref, fp);
-	WRITE_CACHE_DATA_INT(msginfo->planned_download, fp);
-	WRITE_CACHE_DATA_INT(msginfo->total_size, fp);
+static int msgcache_write_record(MsgInfo *msginfo, guint64 *strings_len, FILE *fp)
+{
+	MsgCacheRecord rec;
 
-	WRITE_CACHE_DATA_INT(g_slist_length(msginfo->references), fp);
+	if (msgcache_fill_record(msginfo, strings_len, &rec) < 0)
+		return -1;
+	if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+		return -1;
+	return sizeof(rec);
+}
 
+/* Writes the strings of msginfo in the order msgcache_write_record()
+ * placed them. */
+static int msgcache_write_strings(MsgInfo *msginfo, FILE *fp)
+{
+	const gchar *fields[] = {
+		msginfo->fromname, msginfo->date, msginfo->from,
+		msginfo->to, msginfo->cc, msginfo->subject,
+		msginfo->msgid, msginfo->inreplyto, msginfo->xref
+	};
+	GSList *cur;
+	guint32 size;
+	int wrote = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(fields); i++) {
+		if ((size = msgcache_string_size(fields[i])) == 0)
+			continue;
+		if (fwrite(fields[i], 1, size, fp) != size)
+			return -1;
+		wrote += size;
+	}
 	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
-		WRITE_CACHE_DATA((gchar *)cur->data, fp);
+		if ((size = msgcache_string_size(cur->data)) == 0)
+			continue;
+		if (fwrite(cur->data, 1, size, fp) != size)
+			return -1;
+		wrote += size;
 	}
-	return w_err ? -1 : wrote;
+	return wrote;
+}
+
+static int msgcache_write_cache(GPtrArray *msgs, FILE *fp)
+{
+	MsgCacheHeader header;
+	guint64 strings_len = 1;
+	guint i;
+
+	/* the header is completed once the string section size is known */
+	if (fseek(fp, sizeof(header), SEEK_SET) != 0)
+		return -1;
+
+	for (i = 0; i < msgs->len; i++) {
+		if (msgcache_write_record(g_ptr_array_index(msgs, i), &strings_len, fp) < 0)
+			return -1;
+	}
+	if (fputc('\0', fp) == EOF)
+		return -1;
+	for (i = 0; i < msgs->len; i++) {
+		if (msgcache_write_strings(g_ptr_array_index(msgs, i), fp) < 0)
+			return -1;
+	}
+
+	header.version = GUINT32_TO_LE(CACHE_VERSION);
+	header.record_size = GUINT32_TO_LE(sizeof(MsgCacheRecord));
+	header.n_records = GUINT32_TO_LE(msgs->len);
+	header.strings_len = GUINT32_TO_LE((guint32)strings_len);
+	if (fseek(fp, 0, SEEK_SET) != 0 ||
+	    fwrite(&header, sizeof(header), 1, fp) != 1)
+		return -1;
+
+	return 0;
 }
 
 static int msgcache_write_flags(MsgInfo *msginfo, FILE *fp)
@@ -861,6 +1446,185 @@ static int msgcache_write_flags(MsgInfo *msginfo, FILE *fp)
 	return w_err ? -1 : wrote;
 }
 
+static gint msgcache_write_journal_entry(FILE *fp, JournalOp op, MsgInfo *msginfo,
+					 guint msgnum)
+{
+	MsgCacheJournalEntry entry;
+	MsgCacheRecord rec;
+	guint64 strings_len = 1;
+
+	entry.op = GUINT32_TO_LE(op);
+	entry.msgnum = GUINT32_TO_LE(msgnum);
+	entry.perm_flags = GUINT32_TO_LE(msginfo != NULL ? msginfo->flags.perm_flags : 0);
+	entry.len = 0;
+
+	if (op != JOURNAL_MSG)
+		return fwrite(&entry, sizeof(entry), 1, fp) == 1 ? 0 : -1;
+
+	if (msgcache_fill_record(msginfo, &strings_len, &rec) < 0)
+		return -1;
+	entry.len = GUINT32_TO_LE(sizeof(rec) + (guint32)strings_len);
+	if (fwrite(&entry, sizeof(entry), 1, fp) != 1 ||
+	    fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+	    fputc('\0', fp) == EOF ||
+	    msgcache_write_strings(msginfo, fp) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* Appends the changes made since the last write to journal_file. Returns
+ * -1 if they can't be journaled and the cache needs to be rewritten with
+ * msgcache_write(), which is also how the journal gets compacted. */
+gint msgcache_write_journal(const gchar *journal_file, MsgCache *cache)
+{
+	MsgCacheJournalHeader header, cur;
+	GHashTableIter iter;
+	gpointer key, value;
+	FILE *fp;
+	glong size;
+	gint error = 0;
+
+	if (!cache->journal_ok)
+		return -1;
+	if (g_hash_table_size(cache->journal) == 0)
+		return 0;
+
+	header.version = GUINT32_TO_LE(JOURNAL_VERSION);
+	header.reserved = 0;
+	header.base_ino = GUINT64_TO_LE(cache->base_ino);
+	header.base_size = GUINT64_TO_LE(cache->base_size);
+	header.base_mtime = GUINT64_TO_LE(cache->base_mtime);
+
+	if ((fp = g_fopen(journal_file, "a+b")) == NULL) {
+		FILE_OP_ERROR(journal_file, "g_fopen");
+		return -1;
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+		fclose(fp);
+		return -1;
+	}
+	if (size == 0) {
+		if (fwrite(&header, sizeof(header), 1, fp) != 1)
+			error = 1;
+	} else {
+		rewind(fp);
+		if (fread(&cur, sizeof(cur), 1, fp) != 1 ||
+		    memcmp(&cur, &header, sizeof(header)) != 0) {
+			debug_print("journal %s is for another cache file\n", journal_file);
+			error = 1;
+		} else if ((guint64)size > cache->base_size / JOURNAL_COMPACT_RATIO) {
+			debug_print("journal %s is due for compaction\n", journal_file);
+			error = 1;
+		}
+	}
+
+	g_hash_table_iter_init(&iter, cache->journal);
+	while (!error && g_hash_table_iter_next(&iter, &key, &value)) {
+		guint msgnum = GPOINTER_TO_UINT(key);
+		MsgInfo *msginfo = g_hash_table_lookup(cache->msgnum_table, &msgnum);
+		JournalOp op = GPOINTER_TO_INT(value);
+
+		if (msginfo == NULL)
+			op = JOURNAL_REMOVE;
+		if (msgcache_write_journal_entry(fp, op, msginfo, msgnum) < 0)
+			error = 1;
+	}
+
+	error |= (fclose(fp) != 0);
+	if (error) {
+		cache->journal_ok = FALSE;
+		return -1;
+	}
+
+	g_hash_table_remove_all(cache->journal);
+	debug_print("msgcache_write_journal() done.\n");
+	return 0;
+}
+
+/* Replays journal_file over a cache whose marks have been read. */
+void msgcache_read_journal(MsgCache *cache, FolderItem *item, const gchar *journal_file)
+{
+	MsgCacheJournalHeader header;
+	MsgTmpFlags tmp_flags;
+	gchar *data = NULL;
+	gsize len, pos;
+	guint count = 0;
+
+	if (!g_file_get_contents(journal_file, &data, &len, NULL))
+		return;
+
+	if (len < sizeof(header) || !cache->journal_ok)
+		goto out;
+	memcpy(&header, data, sizeof(header));
+	if (GUINT32_FROM_LE(header.version) != JOURNAL_VERSION ||
+	    GUINT64_FROM_LE(header.base_ino) != cache->base_ino ||
+	    GUINT64_FROM_LE(header.base_size) != cache->base_size ||
+	    GUINT64_FROM_LE(header.base_mtime) != cache->base_mtime) {
+		debug_print("ignoring stale journal %s\n", journal_file);
+		goto out;
+	}
+
+	tmp_flags = msgcache_get_item_tmp_flags(item);
+
+	for (pos = sizeof(header); pos < len; count++) {
+		MsgCacheJournalEntry entry;
+		MsgCacheRecord rec;
+		MsgInfo *msginfo;
+		const gchar *strings;
+		guint32 msgnum, entry_len;
+
+		if (len - pos < sizeof(entry))
+			break;
+		memcpy(&entry, data + pos, sizeof(entry));
+		pos += sizeof(entry);
+		msgnum = GUINT32_FROM_LE(entry.msgnum);
+		entry_len = GUINT32_FROM_LE(entry.len);
+		if (len - pos < entry_len)
+			break;
+
+		switch (GUINT32_FROM_LE(entry.op)) {
+		case JOURNAL_REMOVE:
+			msgcache_drop_msg(cache, msgnum);
+			break;
+		case JOURNAL_FLAGS:
+			msginfo = g_hash_table_lookup(cache->msgnum_table, &msgnum);
+			if (msginfo != NULL)
+				msginfo->flags.perm_flags = GUINT32_FROM_LE(entry.perm_flags);
+			break;
+		case JOURNAL_MSG:
+			if (entry_len <= sizeof(rec))
+				goto torn;
+			memcpy(&rec, data + pos, sizeof(rec));
+			strings = data + pos + sizeof(rec);
+			if (strings[0] != '\0' || strings[entry_len - sizeof(rec) - 1] != '\0')
+				goto torn;
+			msginfo = msgcache_read_record(&rec, strings, entry_len - sizeof(rec), NULL);
+			if (msginfo == NULL)
+				goto torn;
+			msginfo->folder = item;
+			msginfo->flags.perm_flags = GUINT32_FROM_LE(entry.perm_flags);
+			msginfo->flags.tmp_flags |= tmp_flags;
+			msgcache_insert_msg(cache, msginfo);
+			break;
+		default:
+			goto torn;
+		}
+		pos += entry_len;
+	}
+	if (pos == len) {
+		debug_print("replayed %u journal entries from %s\n", count, journal_file);
+		goto out;
+	}
+
+torn:
+	/* keep what was replayed, but don't append after the damage */
+	g_warning("%s: journal truncated after %u entries", journal_file, count);
+	cache->journal_ok = FALSE;
+out:
+	g_free(data);
+}
+
 struct write_fps
 {
 	FILE *cache_fp;
@@ -881,13 +1645,6 @@ static void msgcache_write_func(gpointer key, gpointer value, gpointer user_data
 	msginfo = (MsgInfo *)value;
 	write_fps = user_data;
 
-	if (write_fps->cache_fp) {
-		tmp = msgcache_write_cache(msginfo, write_fps->cache_fp);
-		if (tmp < 0)
-			write_fps->error = 1;
-		else
-			write_fps->cache_size += tmp;
-	}
 	if (write_fps->mark_fp) {
 		tmp = msgcache_write_flags(msginfo, write_fps->mark_fp);
 		if (tmp < 0)
@@ -901,7 +1658,6 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 {
 	struct write_fps write_fps;
 	gchar *new_cache = NULL, *new_mark = NULL;
-	int w_err = 0, wrote = 0;
 
 	if (cache_file)
 		new_cache = g_strconcat(cache_file, ".new", NULL);
@@ -916,28 +1672,16 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 	/* open files and write headers */
 
 	if (cache_file) {
-		write_fps.cache_fp = msgcache_open_data_file(new_cache, CACHE_VERSION,
-			DATA_WRITE, NULL, 0);
-		if (write_fps.cache_fp == NULL) {
+		if ((write_fps.cache_fp = g_fopen(new_cache, "wb")) == NULL) {
+			FILE_OP_ERROR(new_cache, "g_fopen");
 			g_free(new_cache);
 			g_free(new_mark);
 			return -1;
 		}
-		WRITE_CACHE_DATA(CS_UTF_8, write_fps.cache_fp);
 	} else {
 		write_fps.cache_fp = NULL;
 	}
 
-	if (w_err != 0) {
-		g_warning("failed to write charset");
-		if (write_fps.cache_fp)
-			fclose(write_fps.cache_fp);
-		unlink(new_cache);
-		g_free(new_cache);
-		g_free(new_mark);
-		return -1;
-	}
-
 	if (mark_file) {
 		write_fps.mark_fp = msgcache_open_data_file(new_mark, MARK_VERSION,
 			DATA_WRITE, NULL, 0);
@@ -956,12 +1700,26 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 	write_fps.tags_fp = NULL;
 
 	/* headers written, note file size */
-	if (write_fps.cache_fp)
-		write_fps.cache_size = ftell(write_fps.cache_fp);
 	if (write_fps.mark_fp)
 		write_fps.mark_size = ftell(write_fps.mark_fp);
 
 	/* write data to the files */
+	if (write_fps.cache_fp) {
+		GPtrArray *msgs;
+		GHashTableIter iter;
+		gpointer value;
+
+		msgs = g_ptr_array_sized_new(g_hash_table_size(cache->msgnum_table));
+		g_hash_table_iter_init(&iter, cache->msgnum_table);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			g_ptr_array_add(msgs, value);
+		if (msgcache_write_cache(msgs, write_fps.cache_fp) < 0) {
+			g_warning("failed to write cache to %s", new_cache);
+			write_fps.error = 1;
+		} else
+			write_fps.cache_size = ftell(write_fps.cache_fp);
+		g_ptr_array_free(msgs, TRUE);
+	}
 	g_hash_table_foreach(cache->msgnum_table, msgcache_write_func, (gpointer)&write_fps);
 
 	/* close files */
@@ -984,6 +1742,19 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 		if (mark_file)
 			rename(new_mark, mark_file);
 		cache->last_access = time(NULL);
+
+		/* the files now hold everything, start a new journal */
+		if (cache_file) {
+			struct stat st;
+
+			if (g_stat(cache_file, &st) == 0)
+				msgcache_set_base(cache, &st);
+			else
+				cache->journal_ok = FALSE;
+		} else if (mark_file && cache->base_ino != 0) {
+			cache->journal_ok = TRUE;
+			g_hash_table_remove_all(cache->journal);
+		}
 	}
 
 	g_free(new_cache);
@@ -33,13 +33,21 @@ MsgCache *msgcache_read_cache(FolderItem *item, const char *cache_file);
 void msgcache_read_mark(MsgCache *cache, const char *mark_file);
 void msgcache_read_tags(MsgCache *cache, const char *tags_file);
 int msgcache_write(const char *cache_file, const char *mark_file, const char *tags_file, MsgCache *cache);
+int msgcache_write_journal(const char *journal_file, MsgCache *cache);
+void msgcache_read_journal(MsgCache *cache, FolderItem *item, const char *journal_file);
 void msgcache_add_msg(MsgCache *cache, MsgInfo *msginfo);
 void msgcache_remove_msg(MsgCache *cache, unsigned int num);
 void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo);
+void msgcache_msg_changed(MsgCache *cache, MsgInfo *msginfo);
+void msgcache_msg_flags_changed(MsgCache *cache, MsgInfo *msginfo);
 MsgInfo *msgcache_get_msg(MsgCache *cache, unsigned int num);
 MsgInfo *msgcache_get_msg_by_id(MsgCache *cache, const char *msgid);
 MsgInfoList	*msgcache_get_msg_list(MsgCache *cache);
+MsgInfoList	*msgcache_get_msg_descendants(MsgCache *cache, MsgInfo *msginfo);
 time_t msgcache_get_last_access_time(MsgCache *cache);
 int msgcache_get_memory_usage(MsgCache *cache);
+MsgCacheMap *msgcache_map_ref(MsgCacheMap *map);
+void msgcache_map_unref(MsgCacheMap *map);
+gboolean msgcache_map_contains(MsgCacheMap *map, gconstpointer ptr);
 
 #endif
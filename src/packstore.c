@@ -0,0 +1,965 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2026 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "packstore.h"
+#include "utils.h"
+
+/*
+ * The messages of one folder's offline cache, packed into a handful of
+ * files in the folder's cache directory instead of one file each:
+ *
+ *   .pack.N	append-only segments holding the messages back to back
+ *   .pack.idx	PackStoreHeader, then a log of PackStoreRecords
+ *
+ * Each record says where message num now lives; a record with segment 0
+ * says it was removed. The log is replayed into a hash table on opening
+ * and rewritten with only the live messages once it has grown to more
+ * than twice their number. All integers are little-endian.
+ *
+ * Message data is always written before its record, so a crash leaves
+ * at worst some unreferenced bytes at the end of a segment. Segments
+ * that are mostly dead are compacted from an idle handler, one at a
+ * time, by copying their live messages to the end of the last segment.
+ * Each run of the handler copies at most PACK_STORE_COMPACT_CHUNK bytes,
+ * so a large segment is moved over many main loop iterations.
+ */
+
+#define PACK_STORE_MAGIC	0x4b434150	/* "PACK" */
+#define PACK_STORE_VERSION	1
+#define PACK_STORE_INDEX	".pack.idx"
+#define PACK_STORE_SEGMENT	".pack."
+#define PACK_STORE_SEGMENT_MAX	(64 << 20)
+#define PACK_STORE_COMPACT_MIN	(4 << 20)
+#define PACK_STORE_COMPACT_CHUNK	(1 << 20)
+#define PACK_STORE_BUFSIZE	65536
+
+typedef struct _PackStoreHeader	PackStoreHeader;
+typedef struct _PackStoreRecord	PackStoreRecord;
+typedef struct _PackEntry	PackEntry;
+typedef struct _PackSegment	PackSegment;
+
+struct _PackStoreHeader {
+	guint32 magic;
+	guint32 version;
+};
+
+struct _PackStoreRecord {
+	guint32 num;
+	guint32 seg;
+	guint64 offset;
+	guint64 len;
+};
+
+struct _PackEntry {
+	guint32 seg;
+	goffset offset;
+	goffset len;
+};
+
+struct _PackSegment {
+	guint32 id;
+	goffset size;
+	goffset live;
+};
+
+struct _PackStore {
+	gchar *dir;
+	gchar *index_path;
+	gint index_fd;
+	guint n_records;
+	GHashTable *entries;	/* num -> PackEntry */
+	GHashTable *segments;	/* id -> PackSegment */
+	guint32 tail;		/* the segment appended to */
+	gint tail_fd;
+	guint compact_id;
+	guint32 compact_seg;	/* the segment being compacted, or 0 */
+	gint compact_fd;
+	GArray *compact_nums;	/* its messages still to be moved */
+	guint32 compact_tail;	/* where the last of them is going */
+	goffset compact_start;
+	goffset compact_done;	/* how much of it has been copied */
+};
+
+static void pack_store_maybe_compact(PackStore *store);
+
+static gchar *pack_store_segment_path(PackStore *store, guint32 id)
+{
+	return g_strdup_printf("%s%c%s%u", store->dir, G_DIR_SEPARATOR,
+			       PACK_STORE_SEGMENT, id);
+}
+
+static PackSegment *pack_store_segment(PackStore *store, guint32 id,
+				       gboolean create)
+{
+	PackSegment *seg;
+
+	seg = g_hash_table_lookup(store->segments, GUINT_TO_POINTER(id));
+	if (seg == NULL && create) {
+		seg = g_new0(PackSegment, 1);
+		seg->id = id;
+		g_hash_table_insert(store->segments, GUINT_TO_POINTER(id), seg);
+	}
+	return seg;
+}
+
+static gint pack_store_write(gint fd, const gchar *path, gconstpointer data,
+			     gsize len)
+{
+	const gchar *p = data;
+	gssize r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			FILE_OP_ERROR(path, "write");
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static gint pack_store_put_record(gint fd, const gchar *path, guint32 num,
+				  guint32 seg, goffset offset, goffset len)
+{
+	PackStoreRecord rec;
+
+	rec.num = GUINT32_TO_LE(num);
+	rec.seg = GUINT32_TO_LE(seg);
+	rec.offset = GUINT64_TO_LE((guint64)offset);
+	rec.len = GUINT64_TO_LE((guint64)len);
+
+	return pack_store_write(fd, path, &rec, sizeof(rec));
+}
+
+static gint pack_store_log(PackStore *store, guint32 num, guint32 seg,
+			   goffset offset, goffset len)
+{
+	if (pack_store_put_record(store->index_fd, store->index_path,
+				  num, seg, offset, len) < 0)
+		return -1;
+	store->n_records++;
+	return 0;
+}
+
+/* Forgets where num was, leaving its bytes as dead space. */
+static void pack_store_drop(PackStore *store, guint num)
+{
+	PackEntry *entry;
+	PackSegment *seg;
+
+	entry = g_hash_table_lookup(store->entries, GUINT_TO_POINTER(num));
+	if (entry == NULL)
+		return;
+	seg = pack_store_segment(store, entry->seg, FALSE);
+	if (seg != NULL)
+		seg->live -= entry->len;
+	g_hash_table_remove(store->entries, GUINT_TO_POINTER(num));
+}
+
+static void pack_store_set(PackStore *store, guint num, guint32 seg_id,
+			   goffset offset, goffset len)
+{
+	PackEntry *entry;
+	PackSegment *seg;
+
+	pack_store_drop(store, num);
+
+	entry = g_new(PackEntry, 1);
+	entry->seg = seg_id;
+	entry->offset = offset;
+	entry->len = len;
+	g_hash_table_insert(store->entries, GUINT_TO_POINTER(num), entry);
+
+	seg = pack_store_segment(store, seg_id, TRUE);
+	seg->live += len;
+	if (seg->size < offset + len)
+		seg->size = offset + len;
+}
+
+static gint pack_store_open_tail(PackStore *store)
+{
+	PackSegment *seg;
+	GStatBuf st;
+	gchar *path;
+
+	if (store->tail_fd >= 0) {
+		seg = pack_store_segment(store, store->tail, TRUE);
+		if (seg->size < PACK_STORE_SEGMENT_MAX)
+			return 0;
+		close(store->tail_fd);
+		store->tail_fd = -1;
+		store->tail++;
+	}
+
+	path = pack_store_segment_path(store, store->tail);
+	store->tail_fd = g_open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (store->tail_fd < 0) {
+		FILE_OP_ERROR(path, "open");
+		g_free(path);
+		return -1;
+	}
+	if (fstat(store->tail_fd, &st) < 0) {
+		FILE_OP_ERROR(path, "fstat");
+		close(store->tail_fd);
+		store->tail_fd = -1;
+		g_free(path);
+		return -1;
+	}
+	g_free(path);
+
+	/* anything past what the index knows of is a leftover from a crash */
+	seg = pack_store_segment(store, store->tail, TRUE);
+	seg->size = st.st_size;
+
+	if (seg->size >= PACK_STORE_SEGMENT_MAX)
+		return pack_store_open_tail(store);
+	return 0;
+}
+
+/* Appends len bytes of in_fd from in_off to the last segment as num. */
+static gint pack_store_append(PackStore *store, guint num, gint in_fd,
+			      const gchar *in_path, goffset in_off, goffset len)
+{
+	PackSegment *seg;
+	gchar *buf, *path;
+	goffset start, done;
+	gssize r;
+	gint ret = 0;
+
+	if (pack_store_open_tail(store) < 0)
+		return -1;
+	seg = pack_store_segment(store, store->tail, TRUE);
+	start = seg->size;
+	path = pack_store_segment_path(store, store->tail);
+
+	buf = g_malloc(PACK_STORE_BUFSIZE);
+	for (done = 0; done < len; done += r) {
+		r = pread(in_fd, buf, MIN(PACK_STORE_BUFSIZE, len - done),
+			  in_off + done);
+		if (r < 0 && errno == EINTR) {
+			r = 0;
+			continue;
+		}
+		if (r <= 0) {
+			FILE_OP_ERROR(in_path, "pread");
+			ret = -1;
+			break;
+		}
+		if (pack_store_write(store->tail_fd, path, buf, r) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	g_free(buf);
+
+	if (ret == 0)
+		ret = pack_store_log(store, num, store->tail, start, len);
+	if (ret < 0) {
+		if (ftruncate(store->tail_fd, start) < 0)
+			FILE_OP_ERROR(path, "ftruncate");
+		g_free(path);
+		return -1;
+	}
+	g_free(path);
+
+	seg->size = start + len;
+	pack_store_set(store, num, store->tail, start, len);
+	return 0;
+}
+
+static gint pack_store_write_index(PackStore *store)
+{
+	PackStoreHeader header;
+	GHashTableIter iter;
+	gpointer key, value;
+	gchar *tmp;
+	gint fd;
+
+	tmp = g_strconcat(store->index_path, ".tmp", NULL);
+	fd = g_open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		FILE_OP_ERROR(tmp, "open");
+		g_free(tmp);
+		return -1;
+	}
+
+	header.magic = GUINT32_TO_LE(PACK_STORE_MAGIC);
+	header.version = GUINT32_TO_LE(PACK_STORE_VERSION);
+	if (pack_store_write(fd, tmp, &header, sizeof(header)) < 0)
+		goto fail;
+
+	g_hash_table_iter_init(&iter, store->entries);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		PackEntry *entry = value;
+
+		if (pack_store_put_record(fd, tmp, GPOINTER_TO_UINT(key),
+					  entry->seg, entry->offset,
+					  entry->len) < 0)
+			goto fail;
+	}
+
+	if (g_rename(tmp, store->index_path) < 0) {
+		FILE_OP_ERROR(store->index_path, "rename");
+		goto fail;
+	}
+	g_free(tmp);
+
+	if (store->index_fd >= 0)
+		close(store->index_fd);
+	store->index_fd = fd;
+	store->n_records = g_hash_table_size(store->entries);
+	return 0;
+
+fail:
+	close(fd);
+	if (g_unlink(tmp) < 0)
+		FILE_OP_ERROR(tmp, "unlink");
+	g_free(tmp);
+	return -1;
+}
+
+/* Returns -1 if there is no usable index, 1 if it should be rewritten
+ * before appending to it and 0 if it can be appended to as it is. */
+static gint pack_store_read_index(PackStore *store)
+{
+	const PackStoreHeader *header;
+	const PackStoreRecord *rec;
+	gchar *data = NULL;
+	gsize len, n, i;
+
+	gint ret;
+
+	if (!g_file_get_contents(store->index_path, &data, &len, NULL))
+		return -1;
+
+	header = (const PackStoreHeader *)data;
+	if (len < sizeof(PackStoreHeader) ||
+	    GUINT32_FROM_LE(header->magic) != PACK_STORE_MAGIC ||
+	    GUINT32_FROM_LE(header->version) != PACK_STORE_VERSION) {
+		g_warning("%s: not a pack index, discarding it",
+			  store->index_path);
+		g_free(data);
+		return -1;
+	}
+
+	rec = (const PackStoreRecord *)(data + sizeof(PackStoreHeader));
+	n = (len - sizeof(PackStoreHeader)) / sizeof(PackStoreRecord);
+	for (i = 0; i < n; i++, rec++) {
+		guint32 num = GUINT32_FROM_LE(rec->num);
+		guint32 seg = GUINT32_FROM_LE(rec->seg);
+
+		if (seg == 0)
+			pack_store_drop(store, num);
+		else
+			pack_store_set(store, num, seg,
+				       GUINT64_FROM_LE(rec->offset),
+				       GUINT64_FROM_LE(rec->len));
+		if (seg > store->tail)
+			store->tail = seg;
+	}
+	store->n_records = n;
+
+	/* a torn last record, or a log grown well past the live messages */
+	ret = ((len - sizeof(PackStoreHeader)) % sizeof(PackStoreRecord) != 0 ||
+	       n > 2 * g_hash_table_size(store->entries) + 1024) ? 1 : 0;
+	g_free(data);
+	return ret;
+}
+
+/* Drops the messages whose segment is missing or too short, which is
+ * what is left of a crash during compaction or a tampered directory. */
+static gboolean pack_store_check_segments(PackStore *store)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *gone = NULL, *cur;
+	gboolean changed;
+	guint32 id;
+
+	for (id = 1; id <= store->tail; id++) {
+		PackSegment *seg = pack_store_segment(store, id, FALSE);
+		gchar *path = pack_store_segment_path(store, id);
+		GStatBuf st;
+
+		if (g_stat(path, &st) < 0) {
+			if (seg != NULL)
+				g_hash_table_remove(store->segments,
+						    GUINT_TO_POINTER(id));
+		} else if (seg == NULL && id != store->tail) {
+			/* nothing refers to it any more */
+			g_unlink(path);
+		} else if (seg != NULL) {
+			seg->size = st.st_size;
+		}
+		g_free(path);
+	}
+
+	g_hash_table_iter_init(&iter, store->entries);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		PackEntry *entry = value;
+		PackSegment *seg = pack_store_segment(store, entry->seg, FALSE);
+
+		if (seg == NULL || entry->offset + entry->len > seg->size)
+			gone = g_slist_prepend(gone, key);
+	}
+	for (cur = gone; cur != NULL; cur = cur->next)
+		pack_store_drop(store, GPOINTER_TO_UINT(cur->data));
+	changed = gone != NULL;
+	g_slist_free(gone);
+
+	return changed;
+}
+
+/*!
+ *\brief	Open the pack in a folder's cache directory, creating it
+ *		if there is none
+ */
+PackStore *pack_store_open(const gchar *dir)
+{
+	PackStore *store;
+	gint r;
+
+	cm_return_val_if_fail(dir != NULL, NULL);
+
+	store = g_new0(PackStore, 1);
+	store->dir = g_strdup(dir);
+	store->index_path = g_strconcat(dir, G_DIR_SEPARATOR_S,
+					PACK_STORE_INDEX, NULL);
+	store->index_fd = -1;
+	store->tail_fd = -1;
+	store->compact_fd = -1;
+	store->entries = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					       NULL, g_free);
+	store->segments = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, g_free);
+
+	r = pack_store_read_index(store);
+	if (r >= 0 && pack_store_check_segments(store))
+		r = 1;
+	if (store->tail == 0)
+		store->tail = 1;
+
+	if (r == 0) {
+		store->index_fd = g_open(store->index_path,
+					 O_WRONLY | O_APPEND, 0600);
+		if (store->index_fd < 0)
+			FILE_OP_ERROR(store->index_path, "open");
+	}
+	if (store->index_fd < 0 && pack_store_write_index(store) < 0) {
+		pack_store_close(store);
+		return NULL;
+	}
+
+	debug_print("pack store %s: %u messages\n", dir,
+		    g_hash_table_size(store->entries));
+
+	/* carry on with any compaction cut short by closing it */
+	pack_store_maybe_compact(store);
+	return store;
+}
+
+static void pack_store_compact_reset(PackStore *store)
+{
+	if (store->compact_fd >= 0)
+		close(store->compact_fd);
+	if (store->compact_nums != NULL)
+		g_array_free(store->compact_nums, TRUE);
+	store->compact_seg = 0;
+	store->compact_fd = -1;
+	store->compact_nums = NULL;
+	store->compact_done = 0;
+}
+
+void pack_store_close(PackStore *store)
+{
+	if (store == NULL)
+		return;
+
+	if (store->compact_id != 0)
+		g_source_remove(store->compact_id);
+	pack_store_compact_reset(store);
+	if (store->index_fd >= 0)
+		close(store->index_fd);
+	if (store->tail_fd >= 0)
+		close(store->tail_fd);
+	g_hash_table_destroy(store->entries);
+	g_hash_table_destroy(store->segments);
+	g_free(store->index_path);
+	g_free(store->dir);
+	g_free(store);
+}
+
+static PackSegment *pack_store_compact_candidate(PackStore *store)
+{
+	GHashTableIter iter;
+	gpointer value;
+	PackSegment *best = NULL;
+
+	g_hash_table_iter_init(&iter, store->segments);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		PackSegment *seg = value;
+
+		if (seg->id == store->tail)
+			continue;
+		if (seg->live > 0 &&
+		    (seg->size - seg->live < PACK_STORE_COMPACT_MIN ||
+		     seg->live * 2 > seg->size))
+			continue;
+		if (best == NULL || seg->live < best->live)
+			best = seg;
+	}
+	return best;
+}
+
+/* Picks the deadest segment and lists the messages to move out of it.
+ * Returns 1 if there is one to compact, 0 if there is none and -1 on
+ * error. */
+static gint pack_store_compact_begin(PackStore *store)
+{
+	PackSegment *seg;
+	GHashTableIter iter;
+	gpointer key, value;
+	gchar *path;
+	guint32 id;
+	gint fd;
+
+	while ((seg = pack_store_compact_candidate(store)) != NULL) {
+		id = seg->id;
+		path = pack_store_segment_path(store, id);
+		fd = g_open(path, O_RDONLY, 0);
+		if (fd < 0 && errno == ENOENT && seg->live == 0) {
+			g_hash_table_remove(store->segments,
+					    GUINT_TO_POINTER(id));
+			g_free(path);
+			continue;
+		}
+		if (fd < 0) {
+			FILE_OP_ERROR(path, "open");
+			g_free(path);
+			return -1;
+		}
+		g_free(path);
+
+		debug_print("pack store %s: compacting segment %u (%"G_GOFFSET_FORMAT
+			    " of %"G_GOFFSET_FORMAT" bytes live)\n",
+			    store->dir, id, seg->live, seg->size);
+
+		store->compact_seg = id;
+		store->compact_fd = fd;
+		store->compact_nums = g_array_new(FALSE, FALSE, sizeof(guint));
+		store->compact_done = 0;
+		g_hash_table_iter_init(&iter, store->entries);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			if (((PackEntry *)value)->seg == id) {
+				guint num = GPOINTER_TO_UINT(key);
+				g_array_append_val(store->compact_nums, num);
+			}
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Copies at most *budget more bytes of num to the end of the last
+ * segment and logs it there once all of it is. Returns 1 when num has
+ * moved, 0 when some of it is left for the next step and -1 on error. */
+static gint pack_store_compact_move(PackStore *store, guint num,
+				    PackEntry *entry, goffset *budget)
+{
+	PackSegment *tail;
+	goffset len = entry->len;
+	gchar *path, *buf;
+	gssize r;
+	gint ret = 0;
+
+	/* something else was appended after the part copied so far,
+	 * which is dead space now */
+	if (store->compact_done > 0) {
+		tail = pack_store_segment(store, store->compact_tail, FALSE);
+		if (store->compact_tail != store->tail || store->tail_fd < 0 ||
+		    tail == NULL ||
+		    tail->size != store->compact_start + store->compact_done)
+			store->compact_done = 0;
+	}
+	if (store->compact_done == 0) {
+		if (pack_store_open_tail(store) < 0)
+			return -1;
+		store->compact_tail = store->tail;
+		store->compact_start =
+			pack_store_segment(store, store->tail, TRUE)->size;
+	}
+	tail = pack_store_segment(store, store->tail, TRUE);
+	path = pack_store_segment_path(store, store->tail);
+
+	buf = g_malloc(PACK_STORE_BUFSIZE);
+	while (store->compact_done < len && *budget > 0) {
+		r = pread(store->compact_fd, buf,
+			  MIN(PACK_STORE_BUFSIZE, len - store->compact_done),
+			  entry->offset + store->compact_done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			gchar *src = pack_store_segment_path(store,
+							     store->compact_seg);
+			FILE_OP_ERROR(src, "pread");
+			g_free(src);
+			ret = -1;
+			break;
+		}
+		if (pack_store_write(store->tail_fd, path, buf, r) < 0) {
+			ret = -1;
+			break;
+		}
+		store->compact_done += r;
+		tail->size += r;
+		*budget -= r;
+	}
+	g_free(buf);
+
+	if (ret == 0 && store->compact_done == len) {
+		ret = pack_store_log(store, num, store->tail,
+				     store->compact_start, len);
+		if (ret == 0) {
+			pack_store_set(store, num, store->tail,
+				       store->compact_start, len);
+			store->compact_done = 0;
+			ret = 1;
+		}
+	}
+	if (ret < 0) {
+		if (ftruncate(store->tail_fd, store->compact_start) < 0)
+			FILE_OP_ERROR(path, "ftruncate");
+		else
+			tail->size = store->compact_start;
+		store->compact_done = 0;
+	}
+	g_free(path);
+	return ret;
+}
+
+/* Moves the live messages out of the deadest segment a chunk at a time
+ * and deletes it once they are all out. */
+static gboolean pack_store_compact_step(gpointer data)
+{
+	PackStore *store = data;
+	goffset budget = PACK_STORE_COMPACT_CHUNK;
+	GArray *nums;
+	gchar *path;
+	gint r;
+
+	if (store->compact_seg == 0) {
+		r = pack_store_compact_begin(store);
+		if (r == 0 && store->n_records >
+			      2 * g_hash_table_size(store->entries) + 1024)
+			pack_store_write_index(store);
+		if (r <= 0) {
+			store->compact_id = 0;
+			return FALSE;
+		}
+	}
+
+	nums = store->compact_nums;
+	while (nums->len > 0 && budget > 0) {
+		guint num = g_array_index(nums, guint, nums->len - 1);
+		PackEntry *entry = g_hash_table_lookup(store->entries,
+						       GUINT_TO_POINTER(num));
+
+		/* removed or replaced since the segment was picked */
+		if (entry == NULL || entry->seg != store->compact_seg) {
+			store->compact_done = 0;
+			g_array_set_size(nums, nums->len - 1);
+			continue;
+		}
+		r = pack_store_compact_move(store, num, entry, &budget);
+		if (r < 0) {
+			pack_store_compact_reset(store);
+			store->compact_id = 0;
+			return FALSE;
+		}
+		if (r > 0)
+			g_array_set_size(nums, nums->len - 1);
+	}
+	if (nums->len > 0)
+		return TRUE;
+
+	g_hash_table_remove(store->segments,
+			    GUINT_TO_POINTER(store->compact_seg));
+	path = pack_store_segment_path(store, store->compact_seg);
+	pack_store_compact_reset(store);
+	if (g_unlink(path) < 0)
+		FILE_OP_ERROR(path, "unlink");
+	g_free(path);
+
+	return TRUE;
+}
+
+static void pack_store_maybe_compact(PackStore *store)
+{
+	if (store->compact_id != 0)
+		return;
+	if (pack_store_compact_candidate(store) == NULL &&
+	    store->n_records <= 2 * g_hash_table_size(store->entries) + 1024)
+		return;
+	store->compact_id = g_idle_add_full(G_PRIORITY_LOW,
+					    pack_store_compact_step,
+					    store, NULL);
+}
+
+gboolean pack_store_has(PackStore *store, guint num)
+{
+	cm_return_val_if_fail(store != NULL, FALSE);
+
+	return g_hash_table_contains(store->entries, GUINT_TO_POINTER(num));
+}
+
+/*!
+ *\brief	Copy file into the pack as message num, replacing any
+ *		message already stored under that number
+ */
+gint pack_store_add_file(PackStore *store, guint num, const gchar *file)
+{
+	GStatBuf st;
+	gint fd, ret;
+
+	cm_return_val_if_fail(store != NULL, -1);
+	cm_return_val_if_fail(file != NULL, -1);
+
+	fd = g_open(file, O_RDONLY, 0);
+	if (fd < 0) {
+		FILE_OP_ERROR(file, "open");
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		FILE_OP_ERROR(file, "fstat");
+		close(fd);
+		return -1;
+	}
+	ret = pack_store_append(store, num, fd, file, 0, st.st_size);
+	close(fd);
+
+	if (ret == 0)
+		pack_store_maybe_compact(store);
+	return ret;
+}
+
+/* Opens the segment holding num for reading. */
+static gint pack_store_open_entry(PackStore *store, guint num,
+				  PackEntry **entry, gchar **path)
+{
+	gint fd;
+
+	*entry = g_hash_table_lookup(store->entries, GUINT_TO_POINTER(num));
+	if (*entry == NULL)
+		return -1;
+
+	*path = pack_store_segment_path(store, (*entry)->seg);
+	fd = g_open(*path, O_RDONLY, 0);
+	if (fd < 0) {
+		FILE_OP_ERROR(*path, "open");
+		g_free(*path);
+		*path = NULL;
+	}
+	return fd;
+}
+
+gint pack_store_copy(PackStore *src, guint src_num,
+		     PackStore *dest, guint dest_num)
+{
+	PackEntry *entry;
+	gchar *path;
+	gint fd, ret;
+
+	cm_return_val_if_fail(src != NULL, -1);
+	cm_return_val_if_fail(dest != NULL, -1);
+
+	fd = pack_store_open_entry(src, src_num, &entry, &path);
+	if (fd < 0)
+		return -1;
+	ret = pack_store_append(dest, dest_num, fd, path,
+				entry->offset, entry->len);
+	close(fd);
+	g_free(path);
+
+	if (ret == 0)
+		pack_store_maybe_compact(dest);
+	return ret;
+}
+
+/*!
+ *\brief	Write message num out to file
+ *
+ *\return	0 on success, -1 if num is not in the pack or on error
+ */
+gint pack_store_extract(PackStore *store, guint num, const gchar *file)
+{
+	PackEntry *entry;
+	gchar *path, *buf;
+	goffset done;
+	gssize r;
+	gint fd, out;
+	gint ret = 0;
+
+	cm_return_val_if_fail(store != NULL, -1);
+	cm_return_val_if_fail(file != NULL, -1);
+
+	fd = pack_store_open_entry(store, num, &entry, &path);
+	if (fd < 0)
+		return -1;
+
+	out = g_open(file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (out < 0) {
+		FILE_OP_ERROR(file, "open");
+		close(fd);
+		g_free(path);
+		return -1;
+	}
+
+	buf = g_malloc(PACK_STORE_BUFSIZE);
+	for (done = 0; done < entry->len; done += r) {
+		r = pread(fd, buf, MIN(PACK_STORE_BUFSIZE, entry->len - done),
+			  entry->offset + done);
+		if (r < 0 && errno == EINTR) {
+			r = 0;
+			continue;
+		}
+		if (r <= 0) {
+			FILE_OP_ERROR(path, "pread");
+			ret = -1;
+			break;
+		}
+		if (pack_store_write(out, file, buf, r) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	g_free(buf);
+	close(fd);
+	g_free(path);
+
+	if (close(out) < 0) {
+		FILE_OP_ERROR(file, "close");
+		ret = -1;
+	}
+	if (ret < 0 && g_unlink(file) < 0)
+		FILE_OP_ERROR(file, "unlink");
+	return ret;
+}
+
+gint pack_store_remove(PackStore *store, guint num)
+{
+	cm_return_val_if_fail(store != NULL, -1);
+
+	if (!pack_store_has(store, num))
+		return 0;
+	if (pack_store_log(store, num, 0, 0, 0) < 0)
+		return -1;
+	pack_store_drop(store, num);
+	pack_store_maybe_compact(store);
+	return 0;
+}
+
+/*!
+ *\brief	Remove the messages whose numbers are not in numlist, the
+ *		way remove_numbered_files_not_in_list() does for a directory
+ */
+gint pack_store_remove_not_in_list(PackStore *store, GSList *numlist)
+{
+	GHashTable *keep;
+	GHashTableIter iter;
+	gpointer key;
+	GSList *gone = NULL, *cur;
+	gint ret = 0;
+
+	cm_return_val_if_fail(store != NULL, -1);
+
+	keep = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (cur = numlist; cur != NULL; cur = cur->next)
+		g_hash_table_add(keep, cur->data);
+
+	g_hash_table_iter_init(&iter, store->entries);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (!g_hash_table_contains(keep, key))
+			gone = g_slist_prepend(gone, key);
+	}
+	g_hash_table_destroy(keep);
+
+	for (cur = gone; cur != NULL; cur = cur->next) {
+		guint num = GPOINTER_TO_UINT(cur->data);
+
+		if (pack_store_log(store, num, 0, 0, 0) < 0) {
+			ret = -1;
+			break;
+		}
+		pack_store_drop(store, num);
+	}
+	if (gone != NULL)
+		debug_print("pack store %s: removed %u messages\n", store->dir,
+			    g_slist_length(gone));
+	g_slist_free(gone);
+
+	pack_store_maybe_compact(store);
+	return ret;
+}
+
+/*!
+ *\brief	Remove every message and segment
+ */
+gint pack_store_clear(PackStore *store)
+{
+	guint32 id;
+
+	cm_return_val_if_fail(store != NULL, -1);
+
+	if (store->compact_id != 0) {
+		g_source_remove(store->compact_id);
+		store->compact_id = 0;
+	}
+	pack_store_compact_reset(store);
+	if (store->tail_fd >= 0) {
+		close(store->tail_fd);
+		store->tail_fd = -1;
+	}
+
+	g_hash_table_remove_all(store->entries);
+	g_hash_table_remove_all(store->segments);
+	if (pack_store_write_index(store) < 0)
+		return -1;
+
+	for (id = 1; id <= store->tail; id++) {
+		gchar *path = pack_store_segment_path(store, id);
+
+		if (g_unlink(path) < 0 && errno != ENOENT)
+			FILE_OP_ERROR(path, "unlink");
+		g_free(path);
+	}
+	store->tail = 1;
+	return 0;
+}
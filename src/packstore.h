@@ -0,0 +1,48 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2026 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PACKSTORE_H__
+#define __PACKSTORE_H__
+
+#include <glib.h>
+
+typedef struct _PackStore	PackStore;
+
+PackStore *pack_store_open	(const gchar	*dir);
+void pack_store_close		(PackStore	*store);
+
+gboolean pack_store_has		(PackStore	*store,
+				 guint		 num);
+gint pack_store_add_file	(PackStore	*store,
+				 guint		 num,
+				 const gchar	*file);
+gint pack_store_copy		(PackStore	*src,
+				 guint		 src_num,
+				 PackStore	*dest,
+				 guint		 dest_num);
+gint pack_store_extract		(PackStore	*store,
+				 guint		 num,
+				 const gchar	*file);
+gint pack_store_remove		(PackStore	*store,
+				 guint		 num);
+gint pack_store_remove_not_in_list
+				(PackStore	*store,
+				 GSList		*numlist);
+gint pack_store_clear		(PackStore	*store);
+
+#endif /* __PACKSTORE_H__ */
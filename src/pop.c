@@ -41,12 +41,36 @@ typedef enum {
 	POP3_MUST_COMPLETE_RECV = 2
 } PartialDownloadStatus;
 
+/* where pop3_session_recv_stream() is in the message */
+typedef enum {
+	RETR_LINE_START,
+	RETR_LINE,
+	RETR_CR,
+	RETR_DOT,
+	RETR_DOT_CR
+} RetrState;
+
+/* commands in flight at once when the server supports pipelining */
+#define POP3_PIPELINE_DEPTH	32
+
+typedef struct _Pop3Command	Pop3Command;
+
+struct _Pop3Command
+{
+	Pop3State state;
+	gint msgnum;
+};
+
 static gint pop3_greeting_recv		(Pop3Session *session,
 					 const gchar *msg);
 static gint pop3_getauth_user_send	(Pop3Session *session);
 static gint pop3_getauth_pass_send	(Pop3Session *session);
 static gint pop3_stls_send		(Pop3Session *session);
 static gint pop3_stls_recv		(Pop3Session *session);
+static gint pop3_capa_send		(Pop3Session *session);
+static gint pop3_capa_recv		(Pop3Session *session,
+					 const gchar *data,
+					 guint        len);
 static gint pop3_getrange_stat_send	(Pop3Session *session);
 static gint pop3_getrange_stat_recv	(Pop3Session *session,
 					 const gchar *msg);
@@ -62,9 +86,10 @@ static gint pop3_getsize_list_recv	(Pop3Session *session,
 					 const gchar *data,
 					 guint        len);
 static gint pop3_retr_send		(Pop3Session *session);
+static gint pop3_retr_open		(Pop3Session *session);
 static gint pop3_retr_recv		(Pop3Session *session,
 					 const gchar *data,
-					 guint        len);
+					 guint len);
 static gint pop3_delete_send		(Pop3Session *session);
 static gint pop3_delete_recv		(Pop3Session *session);
 static gint pop3_logout_send		(Pop3Session *session);
@@ -80,6 +105,11 @@ static gint pop3_write_msg_to_file	(const gchar	*file,
 					 const gchar 	*prefix);
 
 static Pop3State pop3_lookup_next	(Pop3Session	*session);
+static void pop3_pipeline_queue		(Pop3Session	*session,
+					 Pop3State	 state,
+					 gint		 msgnum);
+static void pop3_pipeline_send		(Pop3Session	*session);
+static void pop3_pipeline_next		(Pop3Session	*session);
 static Pop3ErrorValue pop3_ok		(Pop3Session	*session,
 					 const gchar	*msg);
 
@@ -88,7 +118,11 @@ static gint pop3_session_recv_msg		(Session	*session,
 static gint pop3_session_recv_data_finished	(Session	*session,
 						 guchar		*data,
 						 guint		 len);
-static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session);
+static gint pop3_session_recv_stream		(Session	*session,
+						 const gchar	*data,
+						 guint		 len,
+						 gboolean	*done);
+static void pop3_open_uidl_store(PrefsAccount *ac_prefs, Pop3Session *session);
 
 static gint pop3_greeting_recv(Pop3Session *session, const gchar *msg)
 {
@@ -132,6 +166,39 @@ static gint pop3_getauth_pass_send(Pop3Session *session)
 	return PS_SUCCESS;
 }
 
+static gint pop3_capa_send(Pop3Session *session)
+{
+	session->state = POP3_CAPA;
+	pop3_gen_send(session, "CAPA");
+	return PS_SUCCESS;
+}
+
+static gint pop3_capa_recv(Pop3Session *session, const gchar *data, guint len)
+{
+	const gchar *p = data;
+	const gchar *lastp = data + len;
+	const gchar *newline;
+
+	session->pipelining = FALSE;
+
+	while (p < lastp) {
+		if ((newline = memchr(p, '\r', lastp - p)) == NULL)
+			return -1;
+
+		if (newline - p >= 10 &&
+		    !g_ascii_strncasecmp(p, "PIPELINING", 10) &&
+		    (newline - p == 10 || g_ascii_isspace(p[10])))
+			session->pipelining = TRUE;
+
+		p = newline + 1;
+		if (p < lastp && *p == '\n') p++;
+	}
+
+	debug_print("POP: server %s pipelining\n",
+		    session->pipelining ? "supports" : "does not support");
+	return PS_SUCCESS;
+}
+
 static gint pop3_getrange_stat_send(Pop3Session *session)
 {
 	session->state = POP3_GETRANGE_STAT;
@@ -198,6 +265,7 @@ static gint pop3_getrange_uidl_recv(Pop3Session *session, const gchar *data,
 	gint buf_len;
 	guint32 num;
 	time_t recv_time;
+	gint partial_recv;
 	const gchar *p = data;
 	const gchar *lastp = data + len;
 	const gchar *newline;
@@ -220,10 +288,23 @@ static gint pop3_getrange_uidl_recv(Pop3Session *session, const gchar *data,
 
 		session->msg[num].uidl = g_strdup(id);
 
-		recv_time = (time_t)(GPOINTER_TO_INT(g_hash_table_lookup(
-					session->uidl_table, id)));
+		if (session->uidl_store == NULL ||
+		    !uidl_store_lookup(session->uidl_store, id,
+				       &recv_time, &partial_recv)) {
+			recv_time = RECV_TIME_NONE;
+			partial_recv = POP3_TOTALLY_RECEIVED;
+		}
 		session->msg[num].recv_time = recv_time;
 
+		if (recv_time != RECV_TIME_NONE ||
+		    partial_recv != POP3_TOTALLY_RECEIVED) {
+			session->msg[num].received =
+				(partial_recv != POP3_MUST_COMPLETE_RECV);
+			session->msg[num].partial_recv = partial_recv;
+			if (partial_recv == POP3_MUST_COMPLETE_RECV)
+				session->new_msg_exist = TRUE;
+		}
+
 		if (recv_time != RECV_TIME_NONE) {
 			debug_print("num %d uidl %s: already got it\n", num, id);
 		} else {
@@ -293,30 +374,63 @@ static gint pop3_retr_send(Pop3Session *session)
 	return PS_SUCCESS;
 }
 
+static gint pop3_retr_open(Pop3Session *session)
+{
+	session->retr_file = get_tmp_file();
+	if ((session->retr_fp = g_fopen(session->retr_file, "wb")) == NULL) {
+		FILE_OP_ERROR(session->retr_file, "g_fopen");
+		g_free(session->retr_file);
+		session->retr_file = NULL;
+		session->error_val = PS_IOERR;
+		return -1;
+	}
+	session->retr_state = RETR_LINE_START;
+	return PS_SUCCESS;
+}
+
+/* Finishes off a message that pop3_session_recv_stream() wrote to disk,
+ * or one received whole into data for MAIL_RECEIVE_HOOKLIST to see. */
 static gint pop3_retr_recv(Pop3Session *session, const gchar *data, guint len)
 {
 	gchar *file;
+	FILE *fp;
 	gint drop_ok;
-	MailReceiveData mail_receive_data;
-
-	/* NOTE: we allocate a slightly larger buffer with a zero terminator
-	 * because some plugins may think that it has a C string. */
-	mail_receive_data.session  = session;
-	mail_receive_data.data     = g_new0(gchar, len + 1);
-	mail_receive_data.data_len = len;
-	memcpy(mail_receive_data.data, data, len);
 
-	hooks_invoke(MAIL_RECEIVE_HOOKLIST, &mail_receive_data);
+	if (session->retr_fp != NULL) {
+		file = session->retr_file;
+		fp = session->retr_fp;
+		session->retr_file = NULL;
+		session->retr_fp = NULL;
 
-	file = get_tmp_file();
-	if (pop3_write_msg_to_file(file, mail_receive_data.data,
-				   mail_receive_data.data_len, NULL) < 0) {
-		g_free(file);
+		if (fclose(fp) == EOF) {
+			FILE_OP_ERROR(file, "fclose");
+			unlink(file);
+			g_free(file);
+			session->error_val = PS_IOERR;
+			return -1;
+		}
+	} else {
+		MailReceiveData mail_receive_data;
+
+		/* NOTE: we allocate a slightly larger buffer with a zero terminator
+		 * because some plugins may think that it has a C string. */
+		mail_receive_data.session  = session;
+		mail_receive_data.data     = g_new0(gchar, len + 1);
+		mail_receive_data.data_len = len;
+		memcpy(mail_receive_data.data, data, len);
+
+		hooks_invoke(MAIL_RECEIVE_HOOKLIST, &mail_receive_data);
+
+		file = get_tmp_file();
+		if (pop3_write_msg_to_file(file, mail_receive_data.data,
+					   mail_receive_data.data_len, NULL) < 0) {
+			g_free(file);
+			g_free(mail_receive_data.data);
+			session->error_val = PS_IOERR;
+			return -1;
+		}
 		g_free(mail_receive_data.data);
-		session->error_val = PS_IOERR;
-		return -1;
 	}
-	g_free(mail_receive_data.data);
 
 	/* drop_ok: 0: success 1: don't receive -1: error */
 	drop_ok = session->drop_message(session, file);
@@ -457,6 +571,7 @@ Session *pop3_session_new(PrefsAccount *account)
 
 	SESSION(session)->recv_msg = pop3_session_recv_msg;
 	SESSION(session)->recv_data_finished = pop3_session_recv_data_finished;
+	SESSION(session)->recv_stream = pop3_session_recv_stream;
 	SESSION(session)->send_data_finished = NULL;
 	SESSION(session)->ssl_cert_auto_accept = TRUE;
 	SESSION(session)->destroy = pop3_session_destroy;
@@ -469,7 +584,9 @@ Session *pop3_session_new(PrefsAccount *account)
 	session->state = POP3_READY;
 	session->ac_prefs = account;
 	session->pop_before_smtp = FALSE;
-	pop3_get_uidl_table(account, session);
+	pop3_open_uidl_store(account, session);
+	session->pipeline = g_queue_new();
+	session->pipeline_buf = g_string_new(NULL);
 	session->current_time = time(NULL);
 	session->error_val = PS_SUCCESS;
 	session->error_msg = NULL;
@@ -487,16 +604,17 @@ static void pop3_session_destroy(Session *session)
 		g_free(pop3_session->msg[n].uidl);
 	g_free(pop3_session->msg);
 
-	if (pop3_session->uidl_table) {
-		hash_free_strings(pop3_session->uidl_table);
-		g_hash_table_destroy(pop3_session->uidl_table);
-	}
+	uidl_store_close(pop3_session->uidl_store);
 
-	if (pop3_session->partial_recv_table) {
-		hash_free_strings(pop3_session->partial_recv_table);
-		g_hash_table_destroy(pop3_session->partial_recv_table);
+	if (pop3_session->retr_fp) {
+		fclose(pop3_session->retr_fp);
+		unlink(pop3_session->retr_file);
+		g_free(pop3_session->retr_file);
 	}
 
+	g_queue_free_full(pop3_session->pipeline, g_free);
+	g_string_free(pop3_session->pipeline_buf, TRUE);
+
 	g_free(pop3_session->greeting);
 	g_free(pop3_session->user);
 	g_free(pop3_session->pass);
@@ -505,10 +623,24 @@ static void pop3_session_destroy(Session *session)
 	pop3_session->ac_prefs->receive_in_progress = FALSE;
 }
 
-static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session)
+static gchar *pop3_uidl_store_path(PrefsAccount *ac_prefs)
+{
+	gchar *sanitized_uid = g_strdup(ac_prefs->userid);
+	gchar *path;
+
+	subst_for_filename(sanitized_uid);
+	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+			   "uidl", G_DIR_SEPARATOR_S, ac_prefs->recv_server,
+			   "-", sanitized_uid, ".idx", NULL);
+	g_free(sanitized_uid);
+
+	return path;
+}
+
+/* Fills a new store from the text UIDL list that older versions kept.
+ * The list is left in place. */
+static void pop3_import_uidl_list(PrefsAccount *ac_prefs, UIDLStore *store)
 {
-	GHashTable *table;
-	GHashTable *partial_recv_table;
 	gchar *path;
 	FILE *fp;
 	gchar buf[POPBUFSIZE];
@@ -520,9 +652,6 @@ static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session)
 
 	subst_for_filename(sanitized_uid);
 
-	table = g_hash_table_new(g_str_hash, g_str_equal);
-	partial_recv_table = g_hash_table_new(g_str_hash, g_str_equal);
-
 	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
 			   "uidl", G_DIR_SEPARATOR_S, ac_prefs->recv_server,
 			   "-", sanitized_uid, NULL);
@@ -537,11 +666,10 @@ static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session)
 		if ((fp = g_fopen(path, "rb")) == NULL) {
 			if (ENOENT != errno) FILE_OP_ERROR(path, "g_fopen");
 			g_free(path);
-			session->uidl_table = table;
-			session->partial_recv_table = partial_recv_table;
 			return;
 		}
 	}
+	debug_print("importing UIDL list %s\n", path);
 	g_free(path);
 
 	now = time(NULL);
@@ -567,93 +695,55 @@ static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session)
 
 		if (recv_time == RECV_TIME_NONE)
 			recv_time = RECV_TIME_RECEIVED;
-		g_hash_table_insert(table, g_strdup(uidl),
-				    GINT_TO_POINTER(recv_time));
 		if (strlen(tmp) == 1)
 			partial_recv = atoi(tmp); /* totally received ?*/
 		else
 			partial_recv = POP3_MUST_COMPLETE_RECV;
 
-		g_hash_table_insert(partial_recv_table, g_strdup(uidl),
-				    GINT_TO_POINTER(partial_recv));
+		uidl_store_set(store, uidl, recv_time, partial_recv);
 	}
 
 	fclose(fp);
-	session->uidl_table = table;
-	session->partial_recv_table = partial_recv_table;
-
-	return;
 }
 
-#define TRY(func) \
-if (!(func)) \
-{ \
-	g_warning("failed to write"); \
-	goto err_write;			\
-} \
+static void pop3_open_uidl_store(PrefsAccount *ac_prefs, Pop3Session *session)
+{
+	gchar *path = pop3_uidl_store_path(ac_prefs);
+	gboolean created;
+
+	session->uidl_store = uidl_store_open(path, &created);
+	if (session->uidl_store != NULL && created)
+		pop3_import_uidl_list(ac_prefs, session->uidl_store);
+	g_free(path);
+}
 
 gint pop3_write_uidl_list(Pop3Session *session)
 {
-	gchar *path, *tmp_path;
-	FILE *fp;
 	Pop3MsgInfo *msg;
 	gint n;
-	gchar *sanitized_uid = g_strdup(session->ac_prefs->userid);
 
-	subst_for_filename(sanitized_uid);
-
-	if (!session->uidl_is_valid) {
-		g_free(sanitized_uid);
+	if (!session->uidl_is_valid || session->uidl_store == NULL)
 		return 0;
-	}
-
-	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S,
-			   session->ac_prefs->recv_server,
-			   "-", sanitized_uid, NULL);
-	tmp_path = g_strconcat(path, ".tmp", NULL);
-
-	g_free(sanitized_uid);
-
-	if ((fp = g_fopen(tmp_path, "wb")) == NULL) {
-		FILE_OP_ERROR(tmp_path, "g_fopen");
-		goto err_write;
-	}
 
 	for (n = 1; n <= session->count; n++) {
 		msg = &session->msg[n];
-		if (msg->uidl && msg->received &&
-		    (!msg->deleted || session->state != POP3_DONE))
-			TRY(fprintf(fp, "%s\t%ld\t%d\n",
-				msg->uidl, (long int)
-				msg->recv_time,
-				msg->partial_recv)
-			    > 0);
+		if (!msg->uidl)
+			continue;
+		if (msg->deleted && session->state == POP3_DONE) {
+			if (uidl_store_remove(session->uidl_store, msg->uidl) < 0)
+				return -1;
+		} else if (msg->received) {
+			if (uidl_store_set(session->uidl_store, msg->uidl,
+					   msg->recv_time,
+					   msg->partial_recv) < 0)
+				return -1;
+		}
 	}
 
-	if (fclose(fp) == EOF) {
-		FILE_OP_ERROR(tmp_path, "fclose");
-		fp = NULL;
-		goto err_write;
-	}
-	fp = NULL;
-	if (g_rename(tmp_path, path) < 0) {
-		FILE_OP_ERROR(path, "rename");
-		goto err_write;
-	}
-	g_free(path);
-	g_free(tmp_path);
-	return 0;
-err_write:
-	if (fp)
-		fclose(fp);
-	g_free(path);
-	g_free(tmp_path);
-	return -1;
+	/* forget the messages that are gone from the server */
+	return uidl_store_prune(session->uidl_store);
 }
 
-#undef TRY
-
 static gint pop3_write_msg_to_file(const gchar *file, const gchar *data,
 				   guint len, const gchar *prefix)
 {
@@ -735,14 +825,17 @@ static gint pop3_write_msg_to_file(const gchar *file, const gchar *data,
 	return 0;
 }
 
-static Pop3State pop3_lookup_next(Pop3Session *session)
+/* Finds what to do with message *num or the first one after it that
+ * needs anything: POP3_DELETE, POP3_RETR, or POP3_LOGOUT once there
+ * is nothing left. */
+static Pop3State pop3_next_action(Pop3Session *session, gint *num)
 {
 	Pop3MsgInfo *msg;
 	PrefsAccount *ac = session->ac_prefs;
 	gint size;
 
 	for (;;) {
-		msg = &session->msg[session->cur_msg];
+		msg = &session->msg[*num];
 		size = msg->size;
 
 		if (ac->rmmail &&
@@ -754,27 +847,134 @@ static Pop3State pop3_lookup_next(Pop3Session *session)
 		     (ac->msg_leave_hour * 60 * 60))) {
 			log_message(LOG_PROTOCOL,
 					_("POP: Deleting expired message %d [%s]\n"),
-					session->cur_msg, msg->uidl?msg->uidl:" ");
+					*num, msg->uidl?msg->uidl:" ");
 			session->cur_total_bytes += size;
-			pop3_delete_send(session);
 			return POP3_DELETE;
 		}
 
 		if (size == 0 || msg->received) {
 			session->cur_total_bytes += size;
-			if (session->cur_msg == session->count) {
-				pop3_logout_send(session);
+			if (*num == session->count)
 				return POP3_LOGOUT;
-			} else
-				session->cur_msg++;
+			else
+				(*num)++;
 		} else
 			break;
 	}
 
-	pop3_retr_send(session);
 	return POP3_RETR;
 }
 
+static Pop3State pop3_lookup_next(Pop3Session *session)
+{
+	if (session->pipelining) {
+		if (session->pipeline_msg == 0)
+			session->pipeline_msg = session->cur_msg;
+		pop3_pipeline_next(session);
+		return session->state;
+	}
+
+	switch (pop3_next_action(session, &session->cur_msg)) {
+	case POP3_DELETE:
+		pop3_delete_send(session);
+		return POP3_DELETE;
+	case POP3_LOGOUT:
+		pop3_logout_send(session);
+		return POP3_LOGOUT;
+	default:
+		pop3_retr_send(session);
+		return POP3_RETR;
+	}
+}
+
+/* Adds a command to those going out with the next pop3_pipeline_send(),
+ * and to the commands awaiting a reply. */
+static void pop3_pipeline_queue(Pop3Session *session, Pop3State state,
+				gint msgnum)
+{
+	GString *buf = session->pipeline_buf;
+	gsize start = buf->len;
+	Pop3Command *cmd;
+
+	switch (state) {
+	case POP3_GETRANGE_LAST:
+		g_string_append(buf, "LAST");
+		break;
+	case POP3_GETRANGE_UIDL:
+		g_string_append(buf, "UIDL");
+		break;
+	case POP3_GETSIZE_LIST:
+		g_string_append(buf, "LIST");
+		break;
+	case POP3_RETR:
+		debug_print("retrieving %d [%s]\n", msgnum,
+			session->msg[msgnum].uidl ?
+			 session->msg[msgnum].uidl:" ");
+		g_string_append_printf(buf, "RETR %d", msgnum);
+		break;
+	case POP3_DELETE:
+		g_string_append_printf(buf, "DELE %d", msgnum);
+		break;
+	default:
+		g_warning("POP: can't pipeline state %d", state);
+		return;
+	}
+	log_print(LOG_PROTOCOL, "POP> %s\n", buf->str + start);
+	g_string_append(buf, "\r\n");
+
+	cmd = g_new(Pop3Command, 1);
+	cmd->state = state;
+	cmd->msgnum = msgnum;
+	g_queue_push_tail(session->pipeline, cmd);
+}
+
+/* Sends all queued commands in one go. The replies are then read one
+ * at a time, each against the command at the head of the pipeline. */
+static void pop3_pipeline_send(Pop3Session *session)
+{
+	GString *buf = session->pipeline_buf;
+
+	/* session_send_msg() adds the last CRLF */
+	g_string_truncate(buf, buf->len - 2);
+	session_send_msg(SESSION(session), buf->str);
+	g_string_truncate(buf, 0);
+}
+
+/* Makes the oldest unanswered command the current one. */
+static void pop3_pipeline_shift(Pop3Session *session)
+{
+	Pop3Command *cmd = g_queue_pop_head(session->pipeline);
+
+	session->state = cmd->state;
+	if (cmd->msgnum > 0)
+		session->cur_msg = cmd->msgnum;
+	g_free(cmd);
+}
+
+/* Tops up the pipeline with commands for the messages not looked at
+ * yet and sends them, or else goes on reading the replies still due.
+ * Logs out once everything has been answered. */
+static void pop3_pipeline_next(Pop3Session *session)
+{
+	while (g_queue_get_length(session->pipeline) < POP3_PIPELINE_DEPTH &&
+	       session->pipeline_msg <= session->count) {
+		gint num = session->pipeline_msg;
+		Pop3State next = pop3_next_action(session, &num);
+
+		session->pipeline_msg = num + 1;
+		if (next == POP3_LOGOUT)
+			break;
+		pop3_pipeline_queue(session, next, num);
+	}
+
+	if (session->pipeline_buf->len > 0)
+		pop3_pipeline_send(session);
+	else if (!g_queue_is_empty(session->pipeline))
+		session_recv_msg(SESSION(session));
+	else
+		pop3_logout_send(session);
+}
+
 static Pop3ErrorValue pop3_ok(Pop3Session *session, const gchar *msg)
 {
 	Pop3ErrorValue ok;
@@ -805,6 +1005,7 @@ static Pop3ErrorValue pop3_ok(Pop3Session *session, const gchar *msg)
 				log_error(LOG_PROTOCOL, _("error occurred on authentication\n"));
 				ok = PS_AUTHFAIL;
 				break;
+			case POP3_CAPA:
 			case POP3_GETRANGE_LAST:
 			case POP3_GETRANGE_UIDL:
 			case POP3_TOP:
@@ -834,6 +1035,10 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 	Pop3ErrorValue val = PS_SUCCESS;
 	const gchar *body;
 
+	/* with pipelining, each reply belongs to the oldest command */
+	if (!g_queue_is_empty(pop3_session->pipeline))
+		pop3_pipeline_shift(pop3_session);
+
 	body = msg;
 	if (pop3_session->state != POP3_GETRANGE_UIDL_RECV &&
 	    pop3_session->state != POP3_GETSIZE_LIST_RECV) {
@@ -872,32 +1077,62 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	case POP3_GETAUTH_PASS:
 		if (!pop3_session->pop_before_smtp)
-			val = pop3_getrange_stat_send(pop3_session);
+			val = pop3_capa_send(pop3_session);
 		else
 			val = pop3_logout_send(pop3_session);
 		break;
+	case POP3_CAPA:
+		if (val == PS_NOTSUPPORTED) {
+			pop3_session->error_val = PS_SUCCESS;
+			val = pop3_getrange_stat_send(pop3_session);
+		} else {
+			pop3_session->state = POP3_CAPA_RECV;
+			session_recv_data(session, 0, ".\r\n");
+		}
+		break;
 	case POP3_GETRANGE_STAT:
 		if (pop3_getrange_stat_recv(pop3_session, body) < 0)
 			return -1;
-		if (pop3_session->count > 0)
-			val = pop3_getrange_uidl_send(pop3_session);
-		else
+		if (pop3_session->count == 0)
 			val = pop3_logout_send(pop3_session);
+		else if (pop3_session->pipelining) {
+			/* LIST is only needed with new messages, but
+			 * asking right away saves a round trip */
+			pop3_pipeline_queue(pop3_session, POP3_GETRANGE_UIDL, 0);
+			pop3_pipeline_queue(pop3_session, POP3_GETSIZE_LIST, 0);
+			pop3_pipeline_send(pop3_session);
+		} else
+			val = pop3_getrange_uidl_send(pop3_session);
 		break;
 	case POP3_GETRANGE_LAST:
 		if (val == PS_NOTSUPPORTED)
 			pop3_session->error_val = PS_SUCCESS;
 		else if (pop3_getrange_last_recv(pop3_session, body) < 0)
 			return -1;
-		if (pop3_session->cur_msg > 0)
-			val = pop3_getsize_list_send(pop3_session);
-		else
+		if (pop3_session->cur_msg == 0)
 			val = pop3_logout_send(pop3_session);
+		else if (pop3_session->pipelining) {
+			/* the sizes came with the pipelined LIST */
+			gint n;
+
+			for (n = 1; n < pop3_session->cur_msg; n++)
+				pop3_session->cur_total_bytes +=
+					pop3_session->msg[n].size;
+			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
+				return -1;
+		} else
+			val = pop3_getsize_list_send(pop3_session);
 		break;
 	case POP3_GETRANGE_UIDL:
 		if (val == PS_NOTSUPPORTED) {
 			pop3_session->error_val = PS_SUCCESS;
-			val = pop3_getrange_last_send(pop3_session);
+			if (pop3_session->pipelining) {
+				/* answered after the LIST already sent */
+				pop3_pipeline_queue(pop3_session,
+						    POP3_GETRANGE_LAST, 0);
+				pop3_pipeline_send(pop3_session);
+			} else
+				val = pop3_getrange_last_send(pop3_session);
 		} else {
 			pop3_session->state = POP3_GETRANGE_UIDL_RECV;
 			session_recv_data(session, 0, ".\r\n");
@@ -909,7 +1144,15 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	case POP3_RETR:
 		pop3_session->state = POP3_RETR_RECV;
-		session_recv_data(session, 0, ".\r\n");
+		/* a plugin on MAIL_RECEIVE_HOOKLIST gets the message in
+		 * memory as it came, like one retrieved with TOP */
+		if (hooks_has_hooks(MAIL_RECEIVE_HOOKLIST)) {
+			session_recv_data(session, 0, ".\r\n");
+			break;
+		}
+		if (pop3_retr_open(pop3_session) < 0)
+			return -1;
+		session_recv_stream(session);
 		break;
 	case POP3_TOP:
 		if (val == PS_NOTSUPPORTED) {
@@ -921,7 +1164,9 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	case POP3_DELETE:
 		pop3_delete_recv(pop3_session);
-		if (pop3_session->cur_msg == pop3_session->count)
+		if (pop3_session->pipelining)
+			pop3_pipeline_next(pop3_session);
+		else if (pop3_session->cur_msg == pop3_session->count)
 			val = pop3_logout_send(pop3_session);
 		else {
 			pop3_session->cur_msg++;
@@ -941,6 +1186,98 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 	return val == PS_SUCCESS?0:-1;
 }
 
+/* Writes a RETR response to the message file as it arrives, turning
+ * CRLF into LF and undoing dot-stuffing, up to the terminating line. */
+static gint pop3_session_recv_stream(Session *session, const gchar *data,
+				     guint len, gboolean *done)
+{
+	Pop3Session *pop3_session = POP3_SESSION(session);
+	FILE *fp = pop3_session->retr_fp;
+	RetrState state = pop3_session->retr_state;
+	const gchar *p = data;
+	const gchar *end = data + len;
+	const gchar *cr;
+
+	cm_return_val_if_fail(fp != NULL, -1);
+
+	while (p < end && !*done) {
+		switch (state) {
+		case RETR_LINE_START:
+			if (*p == '.') {
+				state = RETR_DOT;
+				p++;
+				break;
+			}
+			state = RETR_LINE;
+			/* fall through */
+		case RETR_LINE:
+			if ((cr = memchr(p, '\r', end - p)) == NULL)
+				cr = end;
+			if (cr > p && fwrite(p, 1, cr - p, fp) < (size_t)(cr - p))
+				goto write_error;
+			p = cr;
+			if (p < end) {
+				state = RETR_CR;
+				p++;
+			}
+			break;
+		case RETR_CR:
+			if (*p == '\n') {
+				if (fputc('\n', fp) == EOF)
+					goto write_error;
+				state = RETR_LINE_START;
+				p++;
+			} else {
+				/* a bare CR is kept */
+				if (fputc('\r', fp) == EOF)
+					goto write_error;
+				state = RETR_LINE;
+			}
+			break;
+		case RETR_DOT:
+			/* a leading dot is either stuffing or the end */
+			if (*p == '\r') {
+				state = RETR_DOT_CR;
+				p++;
+			} else
+				state = RETR_LINE;
+			break;
+		case RETR_DOT_CR:
+			if (*p == '\n') {
+				*done = TRUE;
+				state = RETR_LINE_START;
+				p++;
+			} else {
+				if (fputc('\r', fp) == EOF)
+					goto write_error;
+				state = RETR_LINE;
+			}
+			break;
+		}
+	}
+
+	pop3_session->retr_state = state;
+	return p - data;
+
+write_error:
+	FILE_OP_ERROR(pop3_session->retr_file, "fwrite");
+	g_warning("can't write to file: %s", pop3_session->retr_file);
+	pop3_session->error_val = PS_IOERR;
+	return -1;
+}
+
+/* Whether a message just retrieved is to be removed from the server
+ * straight away. */
+static gboolean pop3_delete_after_retr(Pop3Session *session)
+{
+	PrefsAccount *ac = session->ac_prefs;
+
+	return ac->rmmail &&
+	       ac->msg_leave_time == 0 &&
+	       ac->msg_leave_hour == 0 &&
+	       session->msg[session->cur_msg].recv_time != RECV_TIME_KEEP;
+}
+
 static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 					    guint len)
 {
@@ -948,33 +1285,43 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 	Pop3ErrorValue val = PS_SUCCESS;
 
 	switch (pop3_session->state) {
+	case POP3_CAPA_RECV:
+		if (pop3_capa_recv(pop3_session, data, len) < 0)
+			return -1;
+		pop3_getrange_stat_send(pop3_session);
+		break;
 	case POP3_GETRANGE_UIDL_RECV:
 		val = pop3_getrange_uidl_recv(pop3_session, data, len);
-		if (val == PS_SUCCESS) {
-			if (pop3_session->new_msg_exist)
-				pop3_getsize_list_send(pop3_session);
-			else
-				pop3_logout_send(pop3_session);
-		} else
+		if (val != PS_SUCCESS)
 			return -1;
+		if (pop3_session->pipelining)
+			session_recv_msg(session);
+		else if (pop3_session->new_msg_exist)
+			pop3_getsize_list_send(pop3_session);
+		else
+			pop3_logout_send(pop3_session);
 		break;
 	case POP3_GETSIZE_LIST_RECV:
 		val = pop3_getsize_list_recv(pop3_session, data, len);
-		if (val == PS_SUCCESS) {
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-				return -1;
-		} else
+		if (val != PS_SUCCESS)
+			return -1;
+		if (!g_queue_is_empty(pop3_session->pipeline))
+			session_recv_msg(session);
+		else if (!pop3_session->new_msg_exist)
+			pop3_logout_send(pop3_session);
+		else if (pop3_lookup_next(pop3_session) == POP3_ERROR)
 			return -1;
 		break;
 	case POP3_RETR_RECV:
-		if (pop3_retr_recv(pop3_session, data, len) < 0)
+		if (pop3_retr_recv(pop3_session, (gchar *)data, len) < 0)
 			return -1;
 
-		if (pop3_session->ac_prefs->rmmail &&
-		    pop3_session->ac_prefs->msg_leave_time == 0 &&
-		    pop3_session->ac_prefs->msg_leave_hour == 0 &&
-		    pop3_session->msg[pop3_session->cur_msg].recv_time
-		    != RECV_TIME_KEEP)
+		if (pop3_session->pipelining) {
+			if (pop3_delete_after_retr(pop3_session))
+				pop3_pipeline_queue(pop3_session, POP3_DELETE,
+						    pop3_session->cur_msg);
+			pop3_pipeline_next(pop3_session);
+		} else if (pop3_delete_after_retr(pop3_session))
 			pop3_delete_send(pop3_session);
 		else if (pop3_session->cur_msg == pop3_session->count)
 			pop3_logout_send(pop3_session);
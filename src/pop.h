@@ -20,16 +20,20 @@
 #define _POP_H_
 
 #include <glib.h>
+#include <stdio.h>
 #include <time.h>
 
 #include "session.h"
 #include "prefs_account.h"
+#include "uidlstore.h"
 
 typedef struct _Pop3MsgInfo	Pop3MsgInfo;
 typedef struct _Pop3Session	Pop3Session;
 
 #define POP3_SESSION(obj)	((Pop3Session *)obj)
 
+/* invoked with each message retrieved, RETR or TOP, as the server sent
+ * it; data may be replaced before the message is saved */
 #define MAIL_RECEIVE_HOOKLIST	"mail_receive_hooklist"
 struct _MailReceiveData
 {
@@ -47,6 +51,8 @@ typedef enum {
 	POP3_GETAUTH_USER_PHASE2,
 	POP3_GETAUTH_PASS,
 	POP3_GETAUTH_OAUTH2,
+	POP3_CAPA,
+	POP3_CAPA_RECV,
 	POP3_GETRANGE_STAT,
 	POP3_GETRANGE_LAST,
 	POP3_GETRANGE_UIDL,
@@ -128,12 +134,23 @@ struct _Pop3Session
 
 	Pop3MsgInfo *msg;
 
-	GHashTable *uidl_table;
-	GHashTable *partial_recv_table;
+	UIDLStore *uidl_store;
 
 	gboolean new_msg_exist;
 	gboolean uidl_is_valid;
 
+	/* RFC 2449 pipelining: commands sent but not yet answered, the
+	 * commands still to be sent, and the next message to look at */
+	gboolean pipelining;
+	GQueue *pipeline;
+	GString *pipeline_buf;
+	gint pipeline_msg;
+
+	/* message being received by RETR, written as it arrives */
+	FILE *retr_fp;
+	gchar *retr_file;
+	gint retr_state;
+
 	time_t current_time;
 
 	Pop3ErrorValue error_val;
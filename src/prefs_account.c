@@ -150,6 +150,7 @@ typedef struct ReceivePage
 	GtkWidget *imapdir_label;
 	GtkWidget *imapdir_entry;
 	GtkWidget *subsonly_checkbtn;
+	GtkWidget *packed_cache_checkbtn;
 	GtkWidget *imap_batch_size_spinbtn;
 
 	GtkWidget *autochk_checkbtn;
@@ -415,6 +416,10 @@ static PrefParam receive_param[] = {
 	 &receive_page.imap_batch_size_spinbtn,
 	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 
+	{"imap_packed_cache", "FALSE", &tmp_ac_prefs.imap_packed_cache, P_BOOL,
+	 &receive_page.packed_cache_checkbtn,
+	 prefs_set_data_from_toggle, prefs_set_toggle},
+
 	{"autochk_use_default", "TRUE", &tmp_ac_prefs.autochk_use_default, P_BOOL,
 		&receive_page.autochk_use_default_checkbtn,
 		prefs_set_data_from_toggle, prefs_set_toggle},
@@ -1079,6 +1084,7 @@ static void receive_create_widget_func(PrefsPage * _page,
  	GtkWidget *imapdir_label;
 	GtkWidget *imapdir_entry;
 	GtkWidget *subsonly_checkbtn;
+	GtkWidget *packed_cache_checkbtn;
 	GtkWidget *imap_batch_size_spinbtn;
 	GtkWidget *local_frame;
 	GtkWidget *local_vbox;
@@ -1285,6 +1291,9 @@ static void receive_create_widget_func(PrefsPage * _page,
 	gtk_widget_show (hbox1);
 	gtk_box_pack_start (GTK_BOX (vbox2), hbox1, FALSE, FALSE, 4);
 
+	PACK_CHECK_BUTTON (hbox1, packed_cache_checkbtn,
+			   _("Pack offline messages into a few large files"));
+
 	hbox1 = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
 	gtk_widget_show (hbox1);
 	gtk_box_pack_start (GTK_BOX (vbox2), hbox1, FALSE, FALSE, 4);
@@ -1382,6 +1391,7 @@ static void receive_create_widget_func(PrefsPage * _page,
 	page->imapdir_label		= imapdir_label;
 	page->imapdir_entry		= imapdir_entry;
 	page->subsonly_checkbtn		= subsonly_checkbtn;
+	page->packed_cache_checkbtn	= packed_cache_checkbtn;
 	page->imap_batch_size_spinbtn	= imap_batch_size_spinbtn;
 	page->local_frame		= local_frame;
 	page->local_inbox_label	= local_inbox_label;
@@ -3777,6 +3787,7 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_label);
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
+		gtk_widget_hide(receive_page.packed_cache_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
 		break;
 	case A_IMAP4:
@@ -3838,6 +3849,7 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_show(receive_page.imapdir_label);
 		gtk_widget_show(receive_page.imapdir_entry);
 		gtk_widget_show(receive_page.subsonly_checkbtn);
+		gtk_widget_show(receive_page.packed_cache_checkbtn);
 		gtk_widget_show(receive_page.imap_batch_size_spinbtn);
 		break;
 	case A_NONE:
@@ -3894,6 +3906,7 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_label);
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
+		gtk_widget_hide(receive_page.packed_cache_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
 		break;
 	case A_POP3:
@@ -3955,6 +3968,7 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_label);
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
+		gtk_widget_hide(receive_page.packed_cache_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
 		break;
 	}
@@ -95,6 +95,7 @@ struct _PrefsAccount
 
 	gint imap_auth_type;
 	guint imap_batch_size;
+	gboolean imap_packed_cache;
 
 	gboolean receive_in_progress;
 
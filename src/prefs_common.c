@@ -774,6 +774,8 @@ static PrefParam param[] = {
 	/* Hidden */
 	{"imap_scan_tree_recurs_limit", "64", &prefs_common.imap_scan_tree_recurs_limit, P_INT,
 	 NULL, NULL, NULL},
+	{"imap_worker_threads", "4", &prefs_common.imap_worker_threads, P_INT,
+	 NULL, NULL, NULL},
 	{"warn_dnd", "1", &prefs_common.warn_dnd, P_INT,
 	 NULL, NULL, NULL},
 	{"show_save_all_success", "1", &prefs_common.show_save_all_success, P_INT,
@@ -455,6 +455,7 @@ struct _PrefsCommon
 	gint news_subscribe_height;
 
 	gint imap_scan_tree_recurs_limit;
+	gint imap_worker_threads;
 	gint warn_dnd;
 	gint broken_are_utf8;
 	gint skip_ssl_cert_check;
@@ -41,19 +41,26 @@ static gchar monthstr[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 typedef char *(*getlinefunc) (char *, size_t, void *);
 typedef int (*peekcharfunc) (void *);
 typedef int (*getcharfunc) (void *);
-typedef gint (*get_one_field_func) (gchar **, void *, HeaderEntry[]);
+typedef gint (*read_field_func) (GString *, void *, HeaderEntry[]);
 
-static gint string_get_one_field(gchar **buf, char **str,
-				 HeaderEntry hentry[]);
+static gint file_read_field(GString *field, FILE *fp, HeaderEntry hentry[]);
+static gint string_read_field(GString *field, char **str,
+			      HeaderEntry hentry[]);
 
 static char *string_getline(char *buf, size_t len, char **str);
 static int string_peekchar(char **str);
 static int file_peekchar(FILE *fp);
+static gint generic_read_field(GString *field, void *data,
+			       HeaderEntry hentry[],
+			       getlinefunc getline,
+			       peekcharfunc peekchar,
+			       gboolean unfold);
 static gint generic_get_one_field(gchar **bufptr, void *data,
 				  HeaderEntry hentry[],
 				  getlinefunc getline,
 				  peekcharfunc peekchar,
 				  gboolean unfold);
+static gint procheader_find_entry(HeaderEntry *hentry, const gchar *line);
 static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 			     gboolean full, gboolean decrypted);
 
@@ -66,13 +73,21 @@ gint procheader_get_one_field(gchar **buf, FILE *fp,
 				     TRUE);
 }
 
-static gint string_get_one_field(gchar **buf, char **str,
-				 HeaderEntry hentry[])
+static gint file_read_field(GString *field, FILE *fp, HeaderEntry hentry[])
 {
-	return generic_get_one_field(buf, str, hentry,
-				     (getlinefunc)string_getline,
-				     (peekcharfunc)string_peekchar,
-				     TRUE);
+	return generic_read_field(field, fp, hentry,
+				  (getlinefunc)fgets_crlf,
+				  (peekcharfunc)file_peekchar,
+				  TRUE);
+}
+
+static gint string_read_field(GString *field, char **str,
+			      HeaderEntry hentry[])
+{
+	return generic_read_field(field, str, hentry,
+				  (getlinefunc)string_getline,
+				  (peekcharfunc)string_peekchar,
+				  TRUE);
 }
 
 gboolean procheader_skip_headers(FILE *fp)
@@ -129,125 +144,121 @@ static int file_peekchar(FILE *fp)
 	return ungetc(getc(fp), fp);
 }
 
-static gint generic_get_one_field(gchar **bufptr, void *data,
-			  HeaderEntry *hentry,
-			  getlinefunc getline, peekcharfunc peekchar,
-			  gboolean unfold)
+static void field_chomp(GString *field)
 {
-	/* returns -1 in case of failure of any kind, whatever it's a parsing error
-	   or an allocation error. if returns -1, *bufptr is always NULL, and vice-versa,
-	   and if returning 0 (OK), *bufptr is always non-NULL, so callers just have to
-	   test the return value
+	gsize len = field->len;
+
+	while (len > 0 && (field->str[len - 1] == '\n' ||
+			   field->str[len - 1] == '\r'))
+		len--;
+	g_string_truncate(field, len);
+}
+
+/* Reads one (unfolded) header into field, which the caller keeps across
+ * calls so that a whole header block is parsed without allocating per
+ * line; lines are read into a stack buffer and appended in place. */
+static gint generic_read_field(GString *field, void *data,
+			       HeaderEntry *hentry,
+			       getlinefunc getline, peekcharfunc peekchar,
+			       gboolean unfold)
+{
+	/* returns -1 at the end of the header block or on a read error,
+	   otherwise the index of the matching entry of hentry (0 if hentry
+	   is NULL), with the header line in field
 	*/
+	gchar line[BUFFSIZE];
 	gint nexthead;
 	gint hnum = 0;
 	HeaderEntry *hp = NULL;
-	size_t len;
-	gchar *buf;
 
-	cm_return_val_if_fail(bufptr != NULL, -1);
-
-	len = BUFFSIZE;
-	buf = g_malloc(len);
+	cm_return_val_if_fail(field != NULL, -1);
 
 	if (hentry != NULL) {
 		/* skip non-required headers */
 		/* and get hentry header line */
 		do {
 			do {
-				if (getline(buf, len, data) == NULL) {
-					debug_print("generic_get_one_field: getline\n");
-					g_free(buf);
-					*bufptr = NULL;
+				if (getline(line, sizeof(line), data) == NULL) {
+					debug_print("generic_read_field: getline\n");
 					return -1;
 				}
-				if (buf[0] == '\r' || buf[0] == '\n') {
-					debug_print("generic_get_one_field: empty line\n");
-					g_free(buf);
-					*bufptr = NULL;
+				if (line[0] == '\r' || line[0] == '\n') {
+					debug_print("generic_read_field: empty line\n");
 					return -1;
 				}
-			} while (buf[0] == ' ' || buf[0] == '\t');
+			} while (line[0] == ' ' || line[0] == '\t');
 
-			for (hp = hentry, hnum = 0; hp->name != NULL;
-			     hp++, hnum++) {
-				if (!g_ascii_strncasecmp(hp->name, buf,
-						 strlen(hp->name)))
-					break;
-			}
-		} while (hp->name == NULL);
+			hnum = procheader_find_entry(hentry, line);
+		} while (hnum < 0);
+		hp = hentry + hnum;
 	} else {
 		/* read first line */
-		if (getline(buf, len, data) == NULL) {
-			debug_print("generic_get_one_field: getline\n");
-			g_free(buf);
-			*bufptr = NULL;
+		if (getline(line, sizeof(line), data) == NULL) {
+			debug_print("generic_read_field: getline\n");
 			return -1;
 		}
-		if (buf[0] == '\r' || buf[0] == '\n') {
-			debug_print("generic_get_one_field: empty line\n");
-			g_free(buf);
-			*bufptr = NULL;
+		if (line[0] == '\r' || line[0] == '\n') {
+			debug_print("generic_read_field: empty line\n");
 			return -1;
 		}
 	}
-	/* reduce initial buffer to its useful part */
-	len = strlen(buf)+1;
-	buf = g_realloc(buf, len);
-	if (buf == NULL) {
-		debug_print("generic_get_one_field: reallocation error\n");
-		*bufptr = NULL;
-		return -1;
-	}
+	g_string_assign(field, line);
 
 	/* unfold line */
 	while (1) {
 		nexthead = peekchar(data);
 		/* ([*WSP CRLF] 1*WSP) */
 		if (nexthead == ' ' || nexthead == '\t') {
-			size_t buflen;
-			gchar *tmpbuf;
-			size_t tmplen;
+			gsize buflen;
 
-			gboolean skiptab = (nexthead == '\t');
 			/* trim previous trailing \n if requesting one header or
 			 * unfolding was requested */
 			if ((!hentry && unfold) || (hp && hp->unfold))
-				strretchomp(buf);
+				field_chomp(field);
 
-			buflen = strlen(buf);
+			buflen = field->len;
 
 			/* read next line */
-			tmpbuf = g_malloc(BUFFSIZE);
-
-			if (getline(tmpbuf, BUFFSIZE, data) == NULL) {
-				g_free(tmpbuf);
+			if (getline(line, sizeof(line), data) == NULL)
 				break;
-			}
-			tmplen = strlen(tmpbuf)+1;
-
-			/* extend initial buffer and concatenate next line */
-			len += tmplen;
-			buf = g_realloc(buf, len);
-			if (buf == NULL) {
-				debug_print("generic_get_one_field: reallocation error\n");
-				g_free(buf);
-				*bufptr = NULL;
-				return -1;
-			}
-			memcpy(buf+buflen, tmpbuf, tmplen);
-			g_free(tmpbuf);
-			if (skiptab) { /* replace tab with space */
-				*(buf + buflen) = ' ';
-			}
+
+			g_string_append(field, line);
+			if (nexthead == '\t') /* replace tab with space */
+				field->str[buflen] = ' ';
 		} else {
 			/* remove trailing new line */
-			strretchomp(buf);
+			field_chomp(field);
 			break;
 		}
 	}
 
-	*bufptr = buf;
+	return hnum;
+}
+
+static gint generic_get_one_field(gchar **bufptr, void *data,
+			  HeaderEntry *hentry,
+			  getlinefunc getline, peekcharfunc peekchar,
+			  gboolean unfold)
+{
+	/* returns -1 in case of failure of any kind, whatever it's a parsing error
+	   or an allocation error. if returns -1, *bufptr is always NULL, and vice-versa,
+	   and if returning 0 (OK), *bufptr is always non-NULL, so callers just have to
+	   test the return value
+	*/
+	GString *field;
+	gint hnum;
+
+	cm_return_val_if_fail(bufptr != NULL, -1);
+
+	field = g_string_sized_new(256);
+	hnum = generic_read_field(field, data, hentry, getline, peekchar,
+				  unfold);
+	if (hnum < 0) {
+		g_string_free(field, TRUE);
+		*bufptr = NULL;
+		return -1;
+	}
+	*bufptr = g_string_free(field, FALSE);
 
 	return hnum;
 }
@@ -528,6 +539,98 @@ static HeaderEntry hentry_short[] = {
 				    {"SC-Message-Size:",NULL, FALSE},
 				    {NULL,		NULL, FALSE}};
 
+/* hentry_short is a prefix of hentry_full */
+#define HENTRY_SHORT_LEN	(G_N_ELEMENTS(hentry_short) - 1)
+
+/* Open-addressed table over the names of hentry_full, hashed on the
+ * case-folded name including its trailing ':' (or ' ' for "From "). No
+ * name has a delimiter before its last character, so an exact match up
+ * to the line's first delimiter finds the same entry as comparing the
+ * line against each name as a prefix. */
+#define KNOWN_HEADER_SLOTS	128
+
+static gint8 known_header_slot[KNOWN_HEADER_SLOTS];	/* entry + 1, 0 if free */
+static guint8 known_header_len[G_N_ELEMENTS(hentry_full)];
+
+static guint known_header_hash_step(guint h, gchar c)
+{
+	return (h ^ (guchar)g_ascii_tolower(c)) * 16777619U;
+}
+
+static void known_header_init(void)
+{
+	static gsize initialized = 0;
+	guint h, slot;
+	gint i;
+	const gchar *p;
+
+	if (!g_once_init_enter(&initialized))
+		return;
+
+	for (i = 0; hentry_full[i].name != NULL; i++) {
+		h = 2166136261U;
+		for (p = hentry_full[i].name; *p; p++)
+			h = known_header_hash_step(h, *p);
+		known_header_len[i] = p - hentry_full[i].name;
+
+		slot = h % KNOWN_HEADER_SLOTS;
+		while (known_header_slot[slot] != 0)
+			slot = (slot + 1) % KNOWN_HEADER_SLOTS;
+		known_header_slot[slot] = i + 1;
+	}
+
+	g_once_init_leave(&initialized, 1);
+}
+
+static gint known_header_lookup(const gchar *line)
+{
+	guint h = 2166136261U, slot;
+	const gchar *p;
+	gsize len;
+	gint i;
+
+	for (p = line; *p != ':' && *p != ' '; p++) {
+		if (*p == '\0' || *p == '\t' || *p == '\r' || *p == '\n')
+			return -1;
+		h = known_header_hash_step(h, *p);
+	}
+	h = known_header_hash_step(h, *p);
+	len = p - line + 1;
+
+	known_header_init();
+
+	for (slot = h % KNOWN_HEADER_SLOTS; known_header_slot[slot] != 0;
+	     slot = (slot + 1) % KNOWN_HEADER_SLOTS) {
+		i = known_header_slot[slot] - 1;
+		if (known_header_len[i] == len &&
+		    !g_ascii_strncasecmp(hentry_full[i].name, line, len))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Index of the entry of hentry the header line starts with, or -1 */
+static gint procheader_find_entry(HeaderEntry *hentry, const gchar *line)
+{
+	HeaderEntry *hp;
+	gint hnum;
+
+	if (hentry == hentry_full)
+		return known_header_lookup(line);
+	if (hentry == hentry_short) {
+		hnum = known_header_lookup(line);
+		return hnum < (gint)HENTRY_SHORT_LEN ? hnum : -1;
+	}
+
+	for (hp = hentry, hnum = 0; hp->name != NULL; hp++, hnum++) {
+		if (!g_ascii_strncasecmp(hp->name, line, strlen(hp->name)))
+			return hnum;
+	}
+
+	return -1;
+}
+
 static HeaderEntry* procheader_get_headernames(gboolean full)
 {
 	return full ? hentry_full : hentry_short;
@@ -559,27 +662,28 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 			     gboolean full, gboolean decrypted)
 {
 	MsgInfo *msginfo;
-	gchar *buf = NULL;
+	GString *field;
+	gchar *buf;
 	gchar *p, *tmp;
 	gchar *hp;
 	HeaderEntry *hentry;
 	gint hnum;
 	void *orig_data = data;
 
-	get_one_field_func get_one_field =
-		isstring ? (get_one_field_func)string_get_one_field
-			 : (get_one_field_func)procheader_get_one_field;
+	read_field_func read_field =
+		isstring ? (read_field_func)string_read_field
+			 : (read_field_func)file_read_field;
 
 	hentry = procheader_get_headernames(full);
+	field = g_string_sized_new(256);
 
 	if (MSG_IS_QUEUED(flags) || MSG_IS_DRAFT(flags)) {
-		while (get_one_field(&buf, data, NULL) != -1) {
+		while (read_field(field, data, NULL) != -1) {
+			buf = field->str;
 			if ((!strncmp(buf, "X-Claws-End-Special-Headers: 1",
 				strlen("X-Claws-End-Special-Headers:"))) ||
 			    (!strncmp(buf, "X-Sylpheed-End-Special-Headers: 1",
 				strlen("X-Sylpheed-End-Special-Headers:")))) {
-				g_free(buf);
-				buf = NULL;
 				break;
 			}
 			/* from other mailers */
@@ -591,12 +695,8 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 					data = orig_data;
 				else
 					rewind((FILE *)data);
-				g_free(buf);
-				buf = NULL;
 				break;
 			}
-			g_free(buf);
-			buf = NULL;
 		}
 	}
 
@@ -609,17 +709,20 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 
 	msginfo->inreplyto = NULL;
 
-	if (avatar_hook_id == HOOK_NONE &&
+	/* the short table carries no Face headers, so short parses leave
+	   the avatar hooklist alone and stay safe to run off the main thread */
+	if (full && avatar_hook_id == HOOK_NONE &&
 	    (prefs_common.enable_avatars & (AVATARS_ENABLE_CAPTURE | AVATARS_ENABLE_RENDER))) {
 		avatar_hook_id = hooks_register_hook(AVATAR_HEADER_UPDATE_HOOKLIST,
 						     avatar_from_some_face, NULL);
-	} else if (avatar_hook_id != HOOK_NONE &&
+	} else if (full && avatar_hook_id != HOOK_NONE &&
 		   !(prefs_common.enable_avatars & AVATARS_ENABLE_CAPTURE)) {
 		hooks_unregister_hook(AVATAR_HEADER_UPDATE_HOOKLIST, avatar_hook_id);
 		avatar_hook_id = HOOK_NONE;
 	}
 
-	while ((hnum = get_one_field(&buf, data, hentry)) != -1) {
+	while ((hnum = read_field(field, data, hentry)) != -1) {
+		buf = field->str;
 		hp = buf + strlen(hentry[hnum].name);
 		while (*hp == ' ' || *hp == '\t') hp++;
 
@@ -802,7 +905,7 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 		}
 		/* to avoid performance penalty hooklist is invoked only for
 		   headers known to be able to generate avatars */
-		if (hnum == H_FROM || hnum == H_X_FACE || hnum == H_FACE) {
+		if (full && (hnum == H_FROM || hnum == H_X_FACE || hnum == H_FACE)) {
 			AvatarCaptureData *acd = g_new0(AvatarCaptureData, 1);
 			/* no extra memory is wasted, hooks are expected to
 			   take care of copying members when needed */
@@ -812,9 +915,8 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 			hooks_invoke(AVATAR_HEADER_UPDATE_HOOKLIST, (gpointer)acd);
 			g_free(acd);
 		}
-		g_free(buf);
-		buf = NULL;
 	}
+	g_string_free(field, TRUE);
 
 	if (!msginfo->inreplyto && msginfo->references)
 		msginfo->inreplyto =
@@ -855,12 +957,13 @@ gchar *procheader_get_fromname(const gchar *str)
 
 static gint procheader_remove_comment_in_date_string(gchar *o_str)
 {
-	gchar str[strlen(o_str)+1];
-	int i, j = 0;
+	gsize len = strlen(o_str);
+	gchar str[len + 1];
+	gsize i, j = 0;
 	int in_comment_nest_level = 0;
 	gboolean flag_escape_backslash = FALSE;
 
-	for (i=0; i < strlen(o_str); i++) {
+	for (i = 0; i < len; i++) {
 		switch (o_str[i]) {
 		case '(':
 			in_comment_nest_level++;
@@ -901,138 +1004,231 @@ static gint procheader_remove_comment_in_date_string(gchar *o_str)
 	return TRUE;
 }
 
-
-static gint procheader_scan_date_string(const gchar *o_str,
-					gchar *weekday, gint *day,
-					gchar *month, gint *year,
-					gint *hh, gint *mm, gint *ss,
-					gchar *zone)
+/* The date scanner below is built from these, which convert exactly like
+ * sscanf()'s %<width>d and %<width>s (width 0 meaning unlimited), so that
+ * it takes the same liberties with spacing that the sscanf() formats it
+ * replaced did. buf may be NULL to skip the word. */
+static gboolean date_scan_int(const gchar **p, gint width, gint *val)
 {
-	gint result;
-	gint month_n;
-	gint secfract;
-	gint zone1 = 0, zone2 = 0;
-	gchar offset_sign, zonestr[7];
-	gchar sep1;
+	const gchar *s = *p;
+	gboolean neg = FALSE;
+	gint n = 0, v = 0;
+
+	while (g_ascii_isspace(*s))
+		s++;
+	if (*s == '+' || *s == '-') {
+		neg = (*s == '-');
+		s++;
+		n++;
+	}
+	if (!g_ascii_isdigit(*s) || (width > 0 && n >= width))
+		return FALSE;
+	for (; g_ascii_isdigit(*s) && (width == 0 || n < width); s++, n++) {
+		if (v < G_MAXINT / 10)
+			v = v * 10 + (*s - '0');
+	}
 
-	if (o_str == NULL)
-		return -1;
+	*val = neg ? -v : v;
+	*p = s;
+	return TRUE;
+}
 
-	gchar str[strlen(o_str)+1];
+static gboolean date_scan_word(const gchar **p, gint width, gchar *buf)
+{
+	const gchar *s = *p;
+	gint n;
 
-	strcpy(str, o_str);
-	if (strchr(str, '(') != NULL)
-		procheader_remove_comment_in_date_string(str);
+	while (g_ascii_isspace(*s))
+		s++;
+	if (*s == '\0')
+		return FALSE;
+	for (n = 0; *s != '\0' && !g_ascii_isspace(*s) && n < width; s++, n++) {
+		if (buf)
+			buf[n] = *s;
+	}
+	if (buf)
+		buf[n] = '\0';
 
-	result = sscanf(str, "%10s %d %9s %d %2d:%2d:%2d %6s",
-			weekday, day, month, year, hh, mm, ss, zone);
-	if (result == 8) return 0;
+	*p = s;
+	return TRUE;
+}
 
-	/* RFC2822 */
-	result = sscanf(str, "%3s,%d %9s %d %2d:%2d:%2d %6s",
-			weekday, day, month, year, hh, mm, ss, zone);
-	if (result == 8) return 0;
+static gboolean date_scan_char(const gchar **p, gchar c)
+{
+	if (**p != c)
+		return FALSE;
+	(*p)++;
+	return TRUE;
+}
 
-	result = sscanf(str, "%3s %3s %d %2d:%2d:%2d %d %6s",
-			weekday, month, day, hh, mm, ss, year, zone);
-	if (result == 8) return 0;
+static gboolean date_scan_hhmmss(const gchar **p, gint *hh, gint *mm, gint *ss)
+{
+	const gchar *s = *p;
 
-	result = sscanf(str, "%d %9s %d %2d:%2d:%2d %6s",
-			day, month, year, hh, mm, ss, zone);
-	if (result == 7) return 0;
+	if (!date_scan_int(&s, 2, hh) || !date_scan_char(&s, ':') ||
+	    !date_scan_int(&s, 2, mm) || !date_scan_char(&s, ':') ||
+	    !date_scan_int(&s, 2, ss))
+		return FALSE;
 
-	*zone = '\0';
-	result = sscanf(str, "%10s %d %9s %d %2d:%2d:%2d",
-			weekday, day, month, year, hh, mm, ss);
-	if (result == 7) return 0;
+	*p = s;
+	return TRUE;
+}
 
-	result = sscanf(str, "%3s %3s %d %2d:%2d:%2d %d",
-			weekday, month, day, hh, mm, ss, year);
-	if (result == 7) return 0;
+/* "hh:mm:ss [zone]" or "hh:mm [zone]" */
+static gint date_scan_time_zone(const gchar *p, gint *hh, gint *mm, gint *ss,
+				gchar *zone, gint short_zone_width)
+{
+	const gchar *s = p;
 
-	result = sscanf(str, "%d %9s %d %2d:%2d:%2d",
-			day, month, year, hh, mm, ss);
-	if (result == 6) return 0;
+	if (date_scan_hhmmss(&s, hh, mm, ss)) {
+		date_scan_word(&s, 6, zone);
+		return 0;
+	}
 
+	if (!date_scan_int(&p, 2, hh) || !date_scan_char(&p, ':') ||
+	    !date_scan_int(&p, 2, mm))
+		return -1;
 	*ss = 0;
-	result = sscanf(str, "%10s %d %9s %d %2d:%2d %6s",
-			weekday, day, month, year, hh, mm, zone);
-	if (result == 7) return 0;
+	date_scan_word(&p, short_zone_width, zone);
+	return 0;
+}
 
-	result = sscanf(str, "%d %9s %d %2d:%2d %5s",
-			day, month, year, hh, mm, zone);
-	if (result == 6) return 0;
+/* RFC 3339 subset: what follows "YYYY-" */
+static gint date_scan_iso8601(const gchar *p, gint *day, gchar *month,
+			      gint *hh, gint *mm, gint *ss, gchar *zone)
+{
+	const gchar *s, *z;
+	gint month_n, secfract, zone1, zone2;
+	gchar zonestr[7];
+	gboolean has_zone;
 
-	*zone = '\0';
-	result = sscanf(str, "%10s %d %9s %d %2d:%2d",
-			weekday, day, month, year, hh, mm);
-	if (result == 6) return 0;
-
-	result = sscanf(str, "%d %9s %d %2d:%2d",
-			day, month, year, hh, mm);
-	if (result == 5) return 0;
-
-	*weekday = '\0';
-
-	/* RFC3339 subset, with fraction of second */
-	result = sscanf(str, "%4d-%2d-%2d%c%2d:%2d:%2d.%d%6s",
-			year, &month_n, day, &sep1, hh, mm, ss, &secfract, zonestr);
-	if (result == 9
-			&& (sep1 == 'T' || sep1 == 't' || sep1 == ' ')) {
-		if (month_n >= 1 && month_n <= 12) {
-			strncpy2(month, monthstr+((month_n-1)*3), 4);
-			if (zonestr[0] == 'z' || zonestr[0] == 'Z') {
-				strlcat(zone, "+00:00", sizeof(zone));
-			} else if (sscanf(zonestr, "%c%2d:%2d",
-						&offset_sign, &zone1, &zone2) == 3) {
-				strlcat(zone, zonestr, sizeof(zone));
-			}
+	if (!date_scan_int(&p, 2, &month_n) || !date_scan_char(&p, '-') ||
+	    !date_scan_int(&p, 2, day))
+		return -1;
+	if (month_n < 1 || month_n > 12)
+		return -1;
+	strncpy2(month, monthstr + ((month_n - 1) * 3), 4);
+
+	/* date and time, with an optional fraction of second, and a zone */
+	s = p;
+	if ((date_scan_char(&s, 'T') || date_scan_char(&s, 't') ||
+	     date_scan_char(&s, ' ')) &&
+	    date_scan_hhmmss(&s, hh, mm, ss)) {
+		z = s;
+		has_zone = date_scan_char(&z, '.') &&
+			   date_scan_int(&z, 0, &secfract) &&
+			   date_scan_word(&z, 6, zonestr);
+		if (!has_zone)
+			has_zone = date_scan_word(&s, 6, zonestr);
+		if (has_zone) {
+			/* only "Z" and "+hh:mm" are taken as zones */
+			z = zonestr + 1;
+			if (zonestr[0] == 'z' || zonestr[0] == 'Z')
+				strcpy(zone, "+00:00");
+			else if (date_scan_int(&z, 2, &zone1) &&
+				 date_scan_char(&z, ':') &&
+				 date_scan_int(&z, 2, &zone2))
+				strcpy(zone, zonestr);
 			return 0;
 		}
 	}
 
-	/* RFC3339 subset, no fraction of second */
-	result = sscanf(str, "%4d-%2d-%2d%c%2d:%2d:%2d%6s",
-			year, &month_n, day, &sep1, hh, mm, ss, zonestr);
-	if (result == 8
-			&& (sep1 == 'T' || sep1 == 't' || sep1 == ' ')) {
-		if (month_n >= 1 && month_n <= 12) {
-			strncpy2(month, monthstr+((month_n-1)*3), 4);
-			if (zonestr[0] == 'z' || zonestr[0] == 'Z') {
-				strlcat(zone, "+00:00", sizeof(zone));
-			} else if (sscanf(zonestr, "%c%2d:%2d",
-						&offset_sign, &zone1, &zone2) == 3) {
-				strlcat(zone, zonestr, sizeof(zone));
-			}
+	/* no timezone offset, which RFC 3339 requires */
+	s = p;
+	if (date_scan_hhmmss(&s, hh, mm, ss))
+		return 0;
+
+	/* ISO 8601 date only */
+	*hh = *mm = *ss = 0;
+	return 0;
+}
+
+/* Reads the forms below in the order the sscanf() formats this replaced
+ * were tried in, skipping those the first word rules out, so that a
+ * well-formed date is read in a single pass without copying the string
+ * unless it has comments to strip:
+ *
+ *   YYYY-MM-DD[Tt ]hh:mm:ss[.frac][zone]		RFC 3339 subset
+ *   YYYY-MM-DD
+ *   [weekday] day month year hh:mm[:ss] [zone]	RFC 5322 and obsolete
+ *   weekday,day month year hh:mm:ss zone
+ *   weekday month day hh:mm:ss year [zone]		asctime()
+ */
+static gint date_scan(const gchar *str, gint *day, gchar *month, gint *year,
+		      gint *hh, gint *mm, gint *ss, gchar *zone)
+{
+	const gchar *p = str, *q;
+
+	while (g_ascii_isspace(*p))
+		p++;
+
+	*month = '\0';
+	*zone = '\0';
+
+	if (g_ascii_isdigit(*p)) {
+		q = p;
+		if (date_scan_int(&q, 4, year) && *q == '-' &&
+		    date_scan_iso8601(q + 1, day, month, hh, mm, ss, zone) == 0)
 			return 0;
-		}
+
+		q = p;
+		if (date_scan_int(&q, 0, day) &&
+		    date_scan_word(&q, 9, month) &&
+		    date_scan_int(&q, 0, year) &&
+		    date_scan_time_zone(q, hh, mm, ss, zone, 5) == 0)
+			return 0;
+		*month = '\0';
+		*zone = '\0';
 	}
 
+	q = p;
+	if (date_scan_word(&q, 10, NULL) &&
+	    date_scan_int(&q, 0, day) &&
+	    date_scan_word(&q, 9, month) &&
+	    date_scan_int(&q, 0, year) &&
+	    date_scan_time_zone(q, hh, mm, ss, zone, 6) == 0)
+		return 0;
+	*month = '\0';
 	*zone = '\0';
 
-	/* RFC3339 subset, no fraction of second, and no timezone offset */
-	/* This particular "subset" is invalid, RFC requires the offset */
-	result = sscanf(str, "%4d-%2d-%2d %2d:%2d:%2d",
-			year, &month_n, day, hh, mm, ss);
-	if (result == 6) {
-		if (1 <= month_n && month_n <= 12) {
-			strncpy2(month, monthstr+((month_n-1)*3), 4);
+	q = p;
+	date_scan_word(&q, 3, NULL);
+	if (date_scan_char(&q, ',')) {
+		if (date_scan_int(&q, 0, day) &&
+		    date_scan_word(&q, 9, month) &&
+		    date_scan_int(&q, 0, year) &&
+		    date_scan_hhmmss(&q, hh, mm, ss) &&
+		    date_scan_word(&q, 6, zone))
 			return 0;
-		}
+		return -1;
 	}
 
-	/* ISO8601 format with just date (YYYY-MM-DD) */
-	result = sscanf(str, "%4d-%2d-%2d",
-			year, &month_n, day);
-	if (result == 3) {
-		*hh = *mm = *ss = 0;
-		if (1 <= month_n && month_n <= 12) {
-			strncpy2(month, monthstr+((month_n-1)*3), 4);
-			return 0;
-		}
+	if (!date_scan_word(&q, 3, month) ||
+	    !date_scan_int(&q, 0, day) ||
+	    !date_scan_hhmmss(&q, hh, mm, ss) ||
+	    !date_scan_int(&q, 0, year))
+		return -1;
+	date_scan_word(&q, 6, zone);
+	return 0;
+}
+
+static gint procheader_scan_date_string(const gchar *o_str,
+					gint *day, gchar *month, gint *year,
+					gint *hh, gint *mm, gint *ss,
+					gchar *zone)
+{
+	if (o_str == NULL)
+		return -1;
+
+	if (strchr(o_str, '(') != NULL) {
+		gchar str[strlen(o_str) + 1];
+
+		strcpy(str, o_str);
+		procheader_remove_comment_in_date_string(str);
+		return date_scan(str, day, month, year, hh, mm, ss, zone);
 	}
 
-	return -1;
+	return date_scan(o_str, day, month, year, hh, mm, ss, zone);
 }
 
 /*
@@ -1041,7 +1237,6 @@ static gint procheader_scan_date_string(const gchar *o_str,
  */
 gboolean procheader_date_parse_to_tm(const gchar *src, struct tm *t, char *zone)
 {
-	gchar weekday[11];
 	gint day;
 	gchar month[10];
 	gint year;
@@ -1054,7 +1249,7 @@ gboolean procheader_date_parse_to_tm(const gchar *src, struct tm *t, char *zone)
 
 	memset(t, 0, sizeof *t);
 
-	if (procheader_scan_date_string(src, weekday, &day, month, &year,
+	if (procheader_scan_date_string(src, &day, month, &year,
 					&hh, &mm, &ss, zone) < 0) {
 		g_warning("invalid date: %s", src);
 		return FALSE;
@@ -1093,7 +1288,6 @@ gboolean procheader_date_parse_to_tm(const gchar *src, struct tm *t, char *zone)
 
 time_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
 {
-	gchar weekday[11];
 	gint day;
 	gchar month[10];
 	gint year;
@@ -1103,7 +1297,7 @@ time_t procheader_date_parse(gchar *dest, const gchar *src, gint len)
 	gchar *p;
 	time_t timer;
 
-	if (procheader_scan_date_string(src, weekday, &day, month, &year,
+	if (procheader_scan_date_string(src, &day, month, &year,
 					&hh, &mm, &ss, zone) < 0) {
 		if (dest && len > 0)
 			strncpy2(dest, src, len);
@@ -135,7 +135,7 @@ static void subject_hashtable_insert(GHashTable *hashtable, GNode *node)
 	if (subject == NULL)
 		return;
 
-	subject += subject_get_prefix_length(subject);
+	subject += procmsg_msginfo_get_subject_prefix_length(msginfo);
 
 	list = g_hash_table_lookup(hashtable, subject);
 	list = g_slist_prepend(list, node);
@@ -156,7 +156,7 @@ static GNode *subject_hashtable_lookup(GHashTable *hashtable, MsgInfo *msginfo)
 	subject = msginfo->subject;
 	if (subject == NULL)
 		return NULL;
-	prefix_length = subject_get_prefix_length(subject);
+	prefix_length = procmsg_msginfo_get_subject_prefix_length(msginfo);
 	if (prefix_length <= 0)
 		return NULL;
 	subject += prefix_length;
@@ -305,6 +305,451 @@ GNode *procmsg_get_thread_tree(GSList *mlist)
 	return root;
 }
 
+/* A thread tree that is kept up to date as messages come and go, so
+ * that a few new messages in a big folder are threaded on their own
+ * instead of rethreading the folder. Parents are found by the rules of
+ * procmsg_get_thread_tree(): In-Reply-To, then the first of the
+ * References that is present, then (with thread_by_subject) the oldest
+ * message with the same subject, never making a loop. */
+
+struct _MsgThreadTree {
+	GNode *root;
+	GHashTable *node_table;		/* MsgInfo -> GNode */
+	GHashTable *msgid_table;	/* Message-ID -> GPtrArray of GNodes,
+					   the first added being the parent */
+	GHashTable *ref_table;		/* Message-ID -> GPtrArray of GNodes
+					   naming it in In-Reply-To or
+					   References */
+	GHashTable *subject_table;	/* subject without prefix -> GPtrArray
+					   of GNodes by date, the last added
+					   first among those of one date */
+
+	/* prefs the tree was threaded with */
+	gboolean by_subject;
+	gint max_age;
+};
+
+#define THREAD_MSGINFO(node)	((MsgInfo *)(node)->data)
+
+static const gchar *thread_tree_subject(MsgInfo *msginfo)
+{
+	if (msginfo->subject == NULL)
+		return NULL;
+	return msginfo->subject + procmsg_msginfo_get_subject_prefix_length(msginfo);
+}
+
+static time_t thread_tree_max_age(MsgThreadTree *tree)
+{
+	return (time_t)tree->max_age * 3600 * 24;
+}
+
+static GPtrArray *thread_tree_nodes(GHashTable *table, const gchar *key)
+{
+	GPtrArray *nodes = g_hash_table_lookup(table, key);
+
+	if (nodes == NULL) {
+		nodes = g_ptr_array_new();
+		g_hash_table_insert(table, g_strdup(key), nodes);
+	}
+	return nodes;
+}
+
+static void thread_tree_nodes_remove(GHashTable *table, const gchar *key,
+				     GNode *node)
+{
+	GPtrArray *nodes = g_hash_table_lookup(table, key);
+
+	if (nodes == NULL)
+		return;
+	while (g_ptr_array_remove(nodes, node))
+		;
+	if (nodes->len == 0)
+		g_hash_table_remove(table, key);
+}
+
+/* Index of the first of nodes dated t or later */
+static guint thread_tree_date_index(GPtrArray *nodes, time_t t)
+{
+	guint lo = 0, hi = nodes->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+
+		if (THREAD_MSGINFO((GNode *)g_ptr_array_index(nodes, mid))->date_t < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static gint thread_tree_date_compare(gconstpointer a, gconstpointer b)
+{
+	time_t t1 = THREAD_MSGINFO(*(GNode **)a)->date_t;
+	time_t t2 = THREAD_MSGINFO(*(GNode **)b)->date_t;
+
+	return (t1 > t2) - (t1 < t2);
+}
+
+static void thread_tree_sort_subject(gpointer key, gpointer value,
+				     gpointer data)
+{
+	GPtrArray *nodes = value;
+	gpointer tmp;
+	guint i;
+
+	/* the sort is stable, so reversing the list first puts the last
+	 * of a date first, the one subject_hashtable_lookup() picks */
+	for (i = 0; i < nodes->len / 2; i++) {
+		tmp = nodes->pdata[i];
+		nodes->pdata[i] = nodes->pdata[nodes->len - 1 - i];
+		nodes->pdata[nodes->len - 1 - i] = tmp;
+	}
+	g_ptr_array_sort(nodes, thread_tree_date_compare);
+}
+
+static GNode *thread_tree_lookup(MsgThreadTree *tree, const gchar *msgid)
+{
+	GPtrArray *nodes = g_hash_table_lookup(tree->msgid_table, msgid);
+
+	return nodes != NULL ? g_ptr_array_index(nodes, 0) : NULL;
+}
+
+/* The match subject_hashtable_lookup() would find: the oldest message
+ * with the same subject that is older than msginfo, by no more than
+ * thread_by_subject_max_age days */
+static GNode *thread_tree_subject_parent(MsgThreadTree *tree, MsgInfo *msginfo)
+{
+	const gchar *subject = thread_tree_subject(msginfo);
+	GPtrArray *nodes;
+	GNode *node;
+	guint i;
+
+	if (subject == NULL ||
+	    procmsg_msginfo_get_subject_prefix_length(msginfo) <= 0)
+		return NULL;
+	nodes = g_hash_table_lookup(tree->subject_table, subject);
+	if (nodes == NULL)
+		return NULL;
+
+	i = thread_tree_date_index(nodes,
+			msginfo->date_t - thread_tree_max_age(tree));
+	if (i == nodes->len)
+		return NULL;
+	node = g_ptr_array_index(nodes, i);
+	if (THREAD_MSGINFO(node)->date_t >= msginfo->date_t)
+		return NULL;
+	return node;
+}
+
+static GNode *thread_tree_find_parent(MsgThreadTree *tree, GNode *node)
+{
+	MsgInfo *msginfo = THREAD_MSGINFO(node);
+	GNode *parent = NULL;
+	GSList *cur;
+
+	if (msginfo->inreplyto != NULL)
+		parent = thread_tree_lookup(tree, msginfo->inreplyto);
+	for (cur = msginfo->references; parent == NULL && cur != NULL;
+	     cur = cur->next)
+		parent = thread_tree_lookup(tree, cur->data);
+
+	/* node should not be the parent, and node should not
+	   be an ancestor of parent (circular reference) */
+	if (parent != NULL &&
+	    (parent == node || g_node_is_ancestor(node, parent)))
+		parent = NULL;
+
+	if (parent == NULL && tree->by_subject) {
+		parent = thread_tree_subject_parent(tree, msginfo);
+		if (parent != NULL &&
+		    (parent == node || g_node_is_ancestor(node, parent)))
+			parent = NULL;
+	}
+
+	return parent != NULL ? parent : tree->root;
+}
+
+static void thread_tree_reparent(MsgThreadTree *tree, GNode *node)
+{
+	GNode *parent = thread_tree_find_parent(tree, node);
+
+	if (parent == node->parent)
+		return;
+	g_node_unlink(node);
+	g_node_prepend(parent, node);
+}
+
+/* Indexes msginfo in a node of its own, not yet linked into the tree.
+ * With sorted FALSE, the subject lists are left to be sorted later. */
+static GNode *thread_tree_add(MsgThreadTree *tree, MsgInfo *msginfo,
+			      gboolean sorted)
+{
+	GNode *node = g_node_new(procmsg_msginfo_new_ref(msginfo));
+	const gchar *subject;
+	GPtrArray *nodes;
+	GSList *cur;
+
+	g_hash_table_insert(tree->node_table, msginfo, node);
+	if (msginfo->msgid != NULL && *msginfo->msgid != '\0')
+		g_ptr_array_add(thread_tree_nodes(tree->msgid_table,
+						  msginfo->msgid), node);
+	if (msginfo->inreplyto != NULL)
+		g_ptr_array_add(thread_tree_nodes(tree->ref_table,
+						  msginfo->inreplyto), node);
+	for (cur = msginfo->references; cur != NULL; cur = cur->next)
+		g_ptr_array_add(thread_tree_nodes(tree->ref_table, cur->data),
+				node);
+
+	if (tree->by_subject && (subject = thread_tree_subject(msginfo)) != NULL) {
+		nodes = thread_tree_nodes(tree->subject_table, subject);
+		if (sorted)
+			g_ptr_array_insert(nodes,
+				thread_tree_date_index(nodes, msginfo->date_t),
+				node);
+		else
+			g_ptr_array_add(nodes, node);
+	}
+
+	return node;
+}
+
+static void thread_tree_insert(MsgThreadTree *tree, MsgInfo *msginfo)
+{
+	GNode *node = thread_tree_add(tree, msginfo, TRUE);
+	const gchar *subject;
+	GPtrArray *nodes;
+	time_t date = msginfo->date_t;
+	time_t age = thread_tree_max_age(tree);
+	guint i, pos;
+
+	g_node_prepend(thread_tree_find_parent(tree, node), node);
+
+	/* replies to it that came first */
+	if (msginfo->msgid != NULL && thread_tree_lookup(tree, msginfo->msgid) == node &&
+	    (nodes = g_hash_table_lookup(tree->ref_table, msginfo->msgid)) != NULL) {
+		for (i = 0; i < nodes->len; i++)
+			thread_tree_reparent(tree, g_ptr_array_index(nodes, i));
+	}
+
+	/* younger messages with its subject that it is now the oldest
+	 * match for; none when it is the newest, as new mail mostly is */
+	if (!tree->by_subject || (subject = thread_tree_subject(msginfo)) == NULL)
+		return;
+	nodes = g_hash_table_lookup(tree->subject_table, subject);
+	for (pos = thread_tree_date_index(nodes, date);
+	     g_ptr_array_index(nodes, pos) != node; pos++)
+		;
+	for (i = pos + 1; i < nodes->len; i++) {
+		GNode *younger = g_ptr_array_index(nodes, i);
+		time_t younger_date = THREAD_MSGINFO(younger)->date_t;
+
+		if (younger_date > date + age)
+			break;
+		if (younger_date == date)
+			continue;
+		/* the one before it is in range too, and stays the oldest */
+		if (pos > 0 &&
+		    THREAD_MSGINFO((GNode *)g_ptr_array_index(nodes, pos - 1))->date_t >=
+		    younger_date - age)
+			continue;
+		thread_tree_reparent(tree, younger);
+	}
+}
+
+static void thread_tree_remove(MsgThreadTree *tree, GNode *node)
+{
+	MsgInfo *msginfo = THREAD_MSGINFO(node);
+	GPtrArray *orphans = g_ptr_array_new();
+	GPtrArray *nodes;
+	GNode *child, *next;
+	const gchar *subject;
+	GSList *cur;
+	guint i;
+
+	/* its replies find a new place once it is gone */
+	for (child = node->children; child != NULL; child = next) {
+		next = child->next;
+		g_node_unlink(child);
+		g_ptr_array_add(orphans, child);
+	}
+
+	if (msginfo->inreplyto != NULL)
+		thread_tree_nodes_remove(tree->ref_table, msginfo->inreplyto, node);
+	for (cur = msginfo->references; cur != NULL; cur = cur->next)
+		thread_tree_nodes_remove(tree->ref_table, cur->data, node);
+	if (tree->by_subject && (subject = thread_tree_subject(msginfo)) != NULL)
+		thread_tree_nodes_remove(tree->subject_table, subject, node);
+
+	if (msginfo->msgid != NULL && thread_tree_lookup(tree, msginfo->msgid) == node) {
+		thread_tree_nodes_remove(tree->msgid_table, msginfo->msgid, node);
+		/* another message with its Message-ID takes its place */
+		if (thread_tree_lookup(tree, msginfo->msgid) != NULL &&
+		    (nodes = g_hash_table_lookup(tree->ref_table,
+						 msginfo->msgid)) != NULL) {
+			for (i = 0; i < nodes->len; i++)
+				g_ptr_array_add(orphans,
+						g_ptr_array_index(nodes, i));
+		}
+	} else if (msginfo->msgid != NULL) {
+		thread_tree_nodes_remove(tree->msgid_table, msginfo->msgid, node);
+	}
+
+	g_hash_table_remove(tree->node_table, msginfo);
+	g_node_unlink(node);
+	g_node_destroy(node);
+	procmsg_msginfo_free(&msginfo);
+
+	for (i = 0; i < orphans->len; i++)
+		thread_tree_reparent(tree, g_ptr_array_index(orphans, i));
+	g_ptr_array_free(orphans, TRUE);
+}
+
+/* Threads mlist into the empty tree in one go */
+static void thread_tree_build(MsgThreadTree *tree, GSList *mlist)
+{
+	GSList *cur;
+	GNode *node;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		if (!g_hash_table_contains(tree->node_table, cur->data))
+			thread_tree_add(tree, cur->data, FALSE);
+	}
+	if (tree->by_subject)
+		g_hash_table_foreach(tree->subject_table,
+				     thread_tree_sort_subject, NULL);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		node = g_hash_table_lookup(tree->node_table, cur->data);
+		if (node->parent == NULL)
+			g_node_prepend(thread_tree_find_parent(tree, node), node);
+	}
+}
+
+static gboolean thread_tree_free_func(GNode *node, gpointer data)
+{
+	MsgInfo *msginfo = node->data;
+
+	procmsg_msginfo_free(&msginfo);
+	return FALSE;
+}
+
+static void thread_tree_clear(MsgThreadTree *tree)
+{
+	g_node_traverse(tree->root, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			thread_tree_free_func, NULL);
+	g_node_destroy(tree->root);
+	tree->root = g_node_new(NULL);
+
+	g_hash_table_remove_all(tree->node_table);
+	g_hash_table_remove_all(tree->msgid_table);
+	g_hash_table_remove_all(tree->ref_table);
+	g_hash_table_remove_all(tree->subject_table);
+
+	tree->by_subject = prefs_common.thread_by_subject;
+	tree->max_age = prefs_common.thread_by_subject_max_age;
+}
+
+MsgThreadTree *procmsg_thread_tree_new(void)
+{
+	MsgThreadTree *tree = g_new0(MsgThreadTree, 1);
+
+	tree->root = g_node_new(NULL);
+	tree->node_table = g_hash_table_new(NULL, NULL);
+	tree->msgid_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)g_ptr_array_unref);
+	tree->ref_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)g_ptr_array_unref);
+	tree->subject_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)g_ptr_array_unref);
+	tree->by_subject = prefs_common.thread_by_subject;
+	tree->max_age = prefs_common.thread_by_subject_max_age;
+
+	return tree;
+}
+
+/*!
+ *\brief	Make tree hold the messages in mlist and no others,
+ *		threading new ones in and taking out those that are gone.
+ *		The tree keeps references on its messages.
+ *
+ *\return	The root of the threads, which belongs to the tree and
+ *		stays valid until the next update
+ */
+GNode *procmsg_thread_tree_update(MsgThreadTree *tree, GSList *mlist)
+{
+	GSList *cur, *added = NULL, *gone = NULL;
+	GHashTable *present;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint kept = 0, n_added = 0, n_gone;
+
+	cm_return_val_if_fail(tree != NULL, NULL);
+
+	if (tree->by_subject != prefs_common.thread_by_subject ||
+	    tree->max_age != prefs_common.thread_by_subject_max_age)
+		thread_tree_clear(tree);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		if (g_hash_table_contains(tree->node_table, cur->data))
+			kept++;
+		else {
+			added = g_slist_prepend(added, cur->data);
+			n_added++;
+		}
+	}
+	n_gone = g_hash_table_size(tree->node_table) - kept;
+
+	/* rethreading from scratch is cheaper when most has changed */
+	if (n_added + n_gone > kept) {
+		debug_print("threading %d messages\n", kept + n_added);
+		g_slist_free(added);
+		thread_tree_clear(tree);
+		thread_tree_build(tree, mlist);
+		return tree->root;
+	}
+
+	debug_print("threading %d new and %d gone of %d messages\n",
+		    n_added, n_gone, kept + n_added);
+
+	if (n_gone > 0) {
+		present = g_hash_table_new(NULL, NULL);
+		for (cur = mlist; cur != NULL; cur = cur->next)
+			g_hash_table_add(present, cur->data);
+		g_hash_table_iter_init(&iter, tree->node_table);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			if (!g_hash_table_contains(present, key))
+				gone = g_slist_prepend(gone, value);
+		}
+		g_hash_table_destroy(present);
+
+		for (cur = gone; cur != NULL; cur = cur->next)
+			thread_tree_remove(tree, cur->data);
+		g_slist_free(gone);
+	}
+
+	added = g_slist_reverse(added);
+	for (cur = added; cur != NULL; cur = cur->next)
+		thread_tree_insert(tree, cur->data);
+	g_slist_free(added);
+
+	return tree->root;
+}
+
+void procmsg_thread_tree_free(MsgThreadTree *tree)
+{
+	if (tree == NULL)
+		return;
+
+	thread_tree_clear(tree);
+	g_node_destroy(tree->root);
+	g_hash_table_destroy(tree->node_table);
+	g_hash_table_destroy(tree->msgid_table);
+	g_hash_table_destroy(tree->ref_table);
+	g_hash_table_destroy(tree->subject_table);
+	g_free(tree);
+}
+
 gint procmsg_move_messages(GSList *mlist)
 {
 	GSList *cur, *movelist = NULL;
@@ -1082,6 +1527,7 @@ MsgInfo *procmsg_msginfo_copy(MsgInfo *msginfo)
 	MEMBDUP(to);
 	MEMBDUP(cc);
 	MEMBDUP(subject);
+	MEMBCOPY(subject_prefix_len);
 	MEMBDUP(msgid);
 	MEMBDUP(inreplyto);
 	MEMBDUP(xref);
@@ -1203,9 +1649,15 @@ MsgInfo *procmsg_msginfo_get_full_info(MsgInfo *msginfo)
 }
 
 #define FREENULL(n) { g_free(n); n = NULL; }
+#define FREEUNMAPPED(n) { \
+	if (!msgcache_map_contains(msginfo->cache_map, n)) \
+		g_free(n); \
+	n = NULL; \
+}
 void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 {
 	MsgInfo *msginfo = *msginfo_ptr;
+	GSList *tmp;
 
 	if (msginfo == NULL) return;
 
@@ -1220,16 +1672,16 @@ void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 
 	FREENULL(msginfo->fromspace);
 
-	FREENULL(msginfo->fromname);
+	FREEUNMAPPED(msginfo->fromname);
 
-	FREENULL(msginfo->date);
-	FREENULL(msginfo->from);
-	FREENULL(msginfo->to);
-	FREENULL(msginfo->cc);
-	FREENULL(msginfo->subject);
-	FREENULL(msginfo->msgid);
-	FREENULL(msginfo->inreplyto);
-	FREENULL(msginfo->xref);
+	FREEUNMAPPED(msginfo->date);
+	FREEUNMAPPED(msginfo->from);
+	FREEUNMAPPED(msginfo->to);
+	FREEUNMAPPED(msginfo->cc);
+	FREEUNMAPPED(msginfo->subject);
+	FREEUNMAPPED(msginfo->msgid);
+	FREEUNMAPPED(msginfo->inreplyto);
+	FREEUNMAPPED(msginfo->xref);
 
 	if (msginfo->extradata) {
 		if (msginfo->extradata->avatars) {
@@ -1253,44 +1705,61 @@ void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 		FREENULL(msginfo->extradata->resent_from);
 		FREENULL(msginfo->extradata);
 	}
-	slist_free_strings_full(msginfo->references);
+	for (tmp = msginfo->references; tmp != NULL; tmp = tmp->next)
+		FREEUNMAPPED(tmp->data);
+	g_slist_free(msginfo->references);
 	msginfo->references = NULL;
 	g_slist_free(msginfo->tags);
 	msginfo->tags = NULL;
 
 	FREENULL(msginfo->plaintext_file);
 
+	msgcache_map_unref(msginfo->cache_map);
+	msginfo->cache_map = NULL;
+
 	g_free(msginfo);
 	*msginfo_ptr = NULL;
 }
+#undef FREEUNMAPPED
 #undef FREENULL
 
+/*!
+ *\brief	subject_get_prefix_length() of the message's subject, worked
+ *		out once and kept in the MsgInfo for threading and sorting
+ */
+gint procmsg_msginfo_get_subject_prefix_length(MsgInfo *msginfo)
+{
+	cm_return_val_if_fail(msginfo != NULL, 0);
+
+	if (msginfo->subject_prefix_len == 0)
+		msginfo->subject_prefix_len =
+			subject_get_prefix_length(msginfo->subject) + 1;
+	return msginfo->subject_prefix_len - 1;
+}
+
+/* strings mapped from the cache file are not counted, they are not
+ * allocated per message */
+#define STRUSAGE(s) \
+	(((s) != NULL && !msgcache_map_contains(msginfo->cache_map, s)) ? strlen(s) : 0)
+
 guint procmsg_msginfo_memusage(MsgInfo *msginfo)
 {
 	guint memusage = 0;
 	GSList *tmp;
 
 	memusage += sizeof(MsgInfo);
-	if (msginfo->fromname)
-		memusage += strlen(msginfo->fromname);
-	if (msginfo->date)
-		memusage += strlen(msginfo->date);
-	if (msginfo->from)
-		memusage += strlen(msginfo->from);
-	if (msginfo->to)
-		memusage += strlen(msginfo->to);
-	if (msginfo->cc)
-		memusage += strlen(msginfo->cc);
-	if (msginfo->subject)
-		memusage += strlen(msginfo->subject);
-	if (msginfo->msgid)
-		memusage += strlen(msginfo->msgid);
-	if (msginfo->inreplyto)
-		memusage += strlen(msginfo->inreplyto);
+	memusage += STRUSAGE(msginfo->fromname);
+	memusage += STRUSAGE(msginfo->date);
+	memusage += STRUSAGE(msginfo->from);
+	memusage += STRUSAGE(msginfo->to);
+	memusage += STRUSAGE(msginfo->cc);
+	memusage += STRUSAGE(msginfo->subject);
+	memusage += STRUSAGE(msginfo->msgid);
+	memusage += STRUSAGE(msginfo->inreplyto);
 
 	for (tmp = msginfo->references; tmp; tmp=tmp->next) {
 		gchar *r = (gchar *)tmp->data;
-		memusage += r?strlen(r):0 + sizeof(GSList);
+		memusage += STRUSAGE(r) + sizeof(GSList);
 	}
 	if (msginfo->fromspace)
 		memusage += strlen(msginfo->fromspace);
@@ -1336,6 +1805,7 @@ guint procmsg_msginfo_memusage(MsgInfo *msginfo)
 	}
 	return memusage;
 }
+#undef STRUSAGE
 
 static gint procmsg_send_message_queue_full(const gchar *file, gboolean keep_session, gchar **errstr,
 					    FolderItem *queue, gint msgnum, gboolean *queued_removed)
@@ -1726,6 +2196,9 @@ void procmsg_msginfo_set_flags(MsgInfo *msginfo, MsgPermFlags perm_flags, MsgTmp
 	tmp_flags_old = msginfo->flags.tmp_flags;
 	msginfo->flags.tmp_flags |= tmp_flags;
 
+	if (((tmp_flags_old ^ msginfo->flags.tmp_flags) & MSG_CACHED_FLAG_MASK) && item->cache)
+		msgcache_msg_changed(item->cache, msginfo);
+
 	/* update notification */
 	if ((perm_flags_old != perm_flags_new) || (tmp_flags_old != msginfo->flags.tmp_flags)) {
 		msginfo_update.msginfo = msginfo;
@@ -1762,6 +2235,9 @@ void procmsg_msginfo_unset_flags(MsgInfo *msginfo, MsgPermFlags perm_flags, MsgT
 	tmp_flags_old = msginfo->flags.tmp_flags;
 	msginfo->flags.tmp_flags &= ~tmp_flags;
 
+	if (((tmp_flags_old ^ msginfo->flags.tmp_flags) & MSG_CACHED_FLAG_MASK) && item->cache)
+		msgcache_msg_changed(item->cache, msginfo);
+
 	/* update notification */
 	if ((perm_flags_old != perm_flags_new) || (tmp_flags_old != msginfo->flags.tmp_flags)) {
 		msginfo_update.msginfo = msginfo;
@@ -1808,6 +2284,9 @@ void procmsg_msginfo_change_flags(MsgInfo *msginfo,
 	msginfo->flags.tmp_flags &= ~rem_tmp_flags;
 	msginfo->flags.tmp_flags |= add_tmp_flags;
 
+	if (((tmp_flags_old ^ msginfo->flags.tmp_flags) & MSG_CACHED_FLAG_MASK) && item->cache)
+		msgcache_msg_changed(item->cache, msginfo);
+
 	/* update notification */
 	if ((perm_flags_old != perm_flags_new) || (tmp_flags_old != msginfo->flags.tmp_flags)) {
 		msginfo_update.msginfo = msginfo;
@@ -1897,69 +2376,110 @@ gboolean procmsg_msg_has_marked_parent(MsgInfo *info)
 	return procmsg_msg_has_flagged_parent(info, MSG_MARKED);
 }
 
+/* flags procmsg_thread_index_parent_flags() collects from ancestors */
+#define THREAD_INDEX_FLAGS (MSG_IGNORE_THREAD | MSG_WATCH_THREAD | MSG_MARKED)
 
-static GSList *procmsg_find_children_func(MsgInfo *info,
-				   GSList *children, GSList *all)
+struct _MsgThreadIndex {
+	GHashTable *msgid_table;	/* msgid -> MsgInfo */
+	GHashTable *parent_flags;	/* MsgInfo -> flags of its ancestors */
+};
+
+/*!
+ *\brief	Index a message list by message id, so the flags of all
+ *		ancestors of each message can be looked up without going
+ *		through the folder's cache once per hop.
+ *		The index does not take references on the messages.
+ */
+MsgThreadIndex *procmsg_thread_index_new(GSList *mlist)
 {
+	MsgThreadIndex *index = g_new0(MsgThreadIndex, 1);
 	GSList *cur;
 
-	cm_return_val_if_fail(info!=NULL, children);
-	if (info->msgid == NULL)
-		return children;
+	index->msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+	index->parent_flags = g_hash_table_new(NULL, NULL);
 
-	for (cur = all; cur != NULL; cur = g_slist_next(cur)) {
-		MsgInfo *tmp = (MsgInfo *)cur->data;
-		if (tmp->inreplyto && !strcmp(tmp->inreplyto, info->msgid)) {
-			/* Check if message is already in the list */
-			if ((children == NULL) ||
-			    (g_slist_index(children, tmp) == -1)) {
-				children = g_slist_prepend(children,
-						procmsg_msginfo_new_ref(tmp));
-				children = procmsg_find_children_func(tmp,
-							children,
-							all);
-			}
-		}
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (msginfo->msgid != NULL && *msginfo->msgid != '\0')
+			g_hash_table_insert(index->msgid_table,
+					    msginfo->msgid, msginfo);
 	}
-	return children;
+
+	return index;
 }
 
-static GSList *procmsg_find_children (MsgInfo *info)
+/*!
+ *\brief	Return which of the ignore, watch and marked flags are set
+ *		on any message up info's In-Reply-To chain. Results are
+ *		kept, so every message in a thread is walked only once.
+ */
+MsgPermFlags procmsg_thread_index_parent_flags(MsgThreadIndex *index,
+					       MsgInfo *info)
 {
-	GSList *children;
-	GSList *all, *cur;
-
-	cm_return_val_if_fail(info!=NULL, NULL);
-	all = folder_item_get_msg_list(info->folder);
-	children = procmsg_find_children_func(info, NULL, all);
-	if (children != NULL) {
-		for (cur = all; cur != NULL; cur = g_slist_next(cur)) {
-			/* this will not free the used pointers
-			   created with procmsg_msginfo_new_ref */
-			procmsg_msginfo_free((MsgInfo **)&(cur->data));
-		}
-	}
-	g_slist_free(all);
+	MsgInfo *parent;
+	MsgPermFlags flags = 0;
+	gpointer val;
+
+	cm_return_val_if_fail(index != NULL, 0);
+	cm_return_val_if_fail(info != NULL, 0);
+
+	if (g_hash_table_lookup_extended(index->parent_flags, info, NULL, &val))
+		return GPOINTER_TO_UINT(val);
+
+	if (info->inreplyto != NULL &&
+	    (parent = g_hash_table_lookup(index->msgid_table,
+					  info->inreplyto)) != NULL) {
+		/* stands in while the chain is walked, so a reply loop
+		 * ends here instead of recursing forever */
+		g_hash_table_insert(index->parent_flags, info,
+				    GUINT_TO_POINTER(0));
+		flags = (parent->flags.perm_flags & THREAD_INDEX_FLAGS) |
+			procmsg_thread_index_parent_flags(index, parent);
+	}
+	g_hash_table_insert(index->parent_flags, info,
+			    GUINT_TO_POINTER(flags));
+
+	return flags;
+}
+
+void procmsg_thread_index_free(MsgThreadIndex *index)
+{
+	if (index == NULL)
+		return;
 
-	return children;
+	g_hash_table_destroy(index->msgid_table);
+	g_hash_table_destroy(index->parent_flags);
+	g_free(index);
 }
 
+
 static void procmsg_update_unread_children(MsgInfo *info, gboolean newly_marked)
 {
-	GSList *children = procmsg_find_children(info);
+	GSList *children;
 	GSList *cur;
+	gint unread = 0;
+
+	cm_return_if_fail(info != NULL);
+	if (info->folder == NULL || info->msgid == NULL)
+		return;
+
+	children = folder_item_get_msg_descendants(info->folder, info);
 	for (cur = children; cur != NULL; cur = g_slist_next(cur)) {
 		MsgInfo *tmp = (MsgInfo *)cur->data;
-		if(MSG_IS_UNREAD(tmp->flags) && !MSG_IS_IGNORE_THREAD(tmp->flags)) {
-			if(newly_marked)
-				info->folder->unreadmarked_msgs++;
-			else
-				info->folder->unreadmarked_msgs--;
-			folder_item_update(info->folder, F_ITEM_UPDATE_MSGCNT);
-		}
+		if(MSG_IS_UNREAD(tmp->flags) && !MSG_IS_IGNORE_THREAD(tmp->flags))
+			unread++;
 		procmsg_msginfo_free(&tmp);
 	}
 	g_slist_free(children);
+
+	if (unread == 0)
+		return;
+	if (newly_marked)
+		info->folder->unreadmarked_msgs += unread;
+	else
+		info->folder->unreadmarked_msgs -= unread;
+	folder_item_update(info->folder, F_ITEM_UPDATE_MSGCNT);
 }
 
 /**
@@ -225,6 +225,12 @@ struct _MsgInfo
 	GSList *tags;
 
 	MsgInfoExtraData *extradata;
+
+	/* cache file mapping the string members may point into */
+	MsgCacheMap *cache_map;
+
+	/* subject_get_prefix_length() of subject plus one, 0 until known */
+	gint subject_prefix_len;
 };
 
 struct _MsgInfoExtraData
@@ -288,6 +294,10 @@ void	procmsg_get_mark_sum		(const gchar	*folder,
 					 gint		 first);
 
 GNode  *procmsg_get_thread_tree		(GSList		*mlist);
+MsgThreadTree *procmsg_thread_tree_new	(void);
+GNode  *procmsg_thread_tree_update	(MsgThreadTree	*tree,
+					 GSList		*mlist);
+void	procmsg_thread_tree_free	(MsgThreadTree	*tree);
 
 gint	procmsg_move_messages		(GSList		*mlist);
 void	procmsg_copy_messages		(GSList		*mlist);
@@ -322,6 +332,8 @@ MsgInfo *procmsg_msginfo_get_full_info_from_file
 					const gchar *file);
 void	 procmsg_msginfo_free		(MsgInfo	**msginfo);
 guint	 procmsg_msginfo_memusage	(MsgInfo	*msginfo);
+gint	 procmsg_msginfo_get_subject_prefix_length
+					(MsgInfo	*msginfo);
 
 gint procmsg_send_message_queue_with_lock(const gchar *file,
 					  gchar **errstr,
@@ -351,6 +363,11 @@ gint procmsg_save_to_outbox(FolderItem *outbox, const gchar *file);
 gboolean procmsg_msg_has_flagged_parent	(MsgInfo 	*info,
 					 MsgPermFlags    perm_flags);
 gboolean procmsg_msg_has_marked_parent	(MsgInfo	*info);
+MsgThreadIndex *procmsg_thread_index_new	(GSList		*mlist);
+MsgPermFlags procmsg_thread_index_parent_flags
+					(MsgThreadIndex	*index,
+					 MsgInfo	*info);
+void procmsg_thread_index_free		(MsgThreadIndex	*index);
 void procmsg_msginfo_set_to_folder	(MsgInfo 	*msginfo,
 					 FolderItem 	*to_folder);
 
@@ -46,6 +46,15 @@ typedef struct _MsgInfoExtraData	MsgInfoExtraData;
 struct _MsgInfoAvatar;
 typedef struct _MsgInfoAvatar		MsgInfoAvatar;
 
+struct _MsgCacheMap;
+typedef struct _MsgCacheMap		MsgCacheMap;
+
+struct _MsgThreadIndex;
+typedef struct _MsgThreadIndex		MsgThreadIndex;
+
+struct _MsgThreadTree;
+typedef struct _MsgThreadTree		MsgThreadTree;
+
 typedef GSList MsgInfoList;
 typedef GSList MsgNumberList;
 
@@ -355,8 +355,12 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 	smtp_session->from = g_strdup(spec_from);
 	smtp_session->to_list = to_list;
 	smtp_session->cur_to = to_list;
-	smtp_session->send_data = (guchar *)get_outgoing_rfc2822_str(fp);
-	smtp_session->send_data_len = strlen((gchar *)smtp_session->send_data);
+	if (smtp_set_message(smtp_session, fp) < 0) {
+		session_destroy(session);
+		send_progress_dialog_destroy(send_dialog);
+		ac_prefs->session = NULL;
+		return -1;
+	}
 
 	session_set_timeout(session,
 			    prefs_common.io_timeout_secs * 1000);
@@ -425,6 +429,8 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 		g_free(smtp_session->from);
 		g_free(smtp_session->send_data);
 		g_free(smtp_session->error_msg);
+		smtp_session->send_data = NULL;
+		smtp_session->send_fp = NULL;
 	}
 	if (keep_session && ret == 0 && ac_prefs->session == NULL)
 		ac_prefs->session = SMTP_SESSION(session);
@@ -475,6 +481,7 @@ static gint send_recv_message(Session *session, const gchar *msg, gpointer data)
 		state_str = _("Sending");
 		break;
 	case SMTP_DATA:
+	case SMTP_BDAT:
 	case SMTP_EOM:
 		g_snprintf(buf, sizeof(buf), _("Sending DATA..."));
 		state_str = _("Sending");
@@ -496,18 +503,13 @@ static gint send_recv_message(Session *session, const gchar *msg, gpointer data)
 	return 0;
 }
 
-static gint send_send_data_progressive(Session *session, guint cur_len,
-				       guint total_len, gpointer data)
+static void send_progress_set(SendProgressDialog *dialog, guint cur_len,
+			      guint total_len)
 {
 	gchar buf[BUFFSIZE];
-	SendProgressDialog *dialog = (SendProgressDialog *)data;
 	MainWindow *mainwin = mainwindow_get_mainwindow();
 
-	cm_return_val_if_fail(dialog != NULL, -1);
-
-	if (SMTP_SESSION(session)->state != SMTP_SEND_DATA &&
-	    SMTP_SESSION(session)->state != SMTP_EOM)
-		return 0;
+	cur_len = MIN(cur_len, total_len);
 
 	g_snprintf(buf, sizeof(buf), _("Sending message (%d / %d bytes)"),
 		   cur_len, total_len);
@@ -522,18 +524,44 @@ static gint send_send_data_progressive(Session *session, guint cur_len,
 			(GTK_PROGRESS_BAR(mainwin->progressbar),
 			 (total_len == 0) ? 0 : (gfloat)cur_len / (gfloat)total_len);
 	}
+}
+
+/* cur_len and total_len cover the chunk being written; the SMTP
+ * session knows where it lies in the whole message */
+static gint send_send_data_progressive(Session *session, guint cur_len,
+				       guint total_len, gpointer data)
+{
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+	SendProgressDialog *dialog = (SendProgressDialog *)data;
+
+	cm_return_val_if_fail(dialog != NULL, -1);
+
+	if (smtp_session->state != SMTP_SEND_DATA &&
+	    smtp_session->state != SMTP_BDAT &&
+	    smtp_session->state != SMTP_EOM)
+		return 0;
+
+	send_progress_set(dialog, smtp_session->send_data_sent + cur_len,
+			  smtp_session->send_data_len);
 
 	return 0;
 }
 
 static gint send_send_data_finished(Session *session, guint len, gpointer data)
 {
+	SMTPSession *smtp_session = SMTP_SESSION(session);
 	SendProgressDialog *dialog = (SendProgressDialog *)data;
 	MainWindow *mainwin = mainwindow_get_mainwindow();
 
 	cm_return_val_if_fail(dialog != NULL, -1);
 
-	send_send_data_progressive(session, len, len, dialog);
+	send_progress_set(dialog, smtp_session->send_data_sent,
+			  smtp_session->send_data_len);
+
+	/* called for every chunk, more may follow */
+	if (smtp_session->state != SMTP_EOM)
+		return 0;
+
 	if (mainwin) {
 		gtk_widget_hide(mainwin->progressbar);
 		gtk_progress_bar_set_fraction
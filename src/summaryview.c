@@ -149,6 +149,15 @@ static void summary_set_ctree_from_list	(SummaryView		*summaryview,
 static inline void summary_set_header	(SummaryView		*summaryview,
 					 gchar			*text[],
 					 MsgInfo		*msginfo);
+static const gchar *summary_subject_text	(SummaryView		*summaryview,
+					 MsgInfo		*msginfo);
+static void summary_fill_row		(GtkSCTree		*sctree,
+					 GtkCMCListRow		*row,
+					 gpointer		 data);
+static void summary_start_address_completion
+					(SummaryView		*summaryview);
+static void summary_end_address_completion
+					(SummaryView		*summaryview);
 static void summary_display_msg		(SummaryView		*summaryview,
 					 GtkCMCTreeNode		*row);
 static void summary_display_msg_full	(SummaryView		*summaryview,
@@ -343,6 +352,21 @@ static gint summary_cmp_by_locked	(GtkCMCList 		*clist,
 				         gconstpointer 		 ptr1,
 					 gconstpointer 		 ptr2);
 
+/* sort keys for the string columns, collated once per row */
+static gchar *summary_sort_key_from	(GtkSCTree		*sctree,
+					 GtkCMCListRow		*row,
+					 gpointer		 data);
+static gchar *summary_sort_key_to	(GtkSCTree		*sctree,
+					 GtkCMCListRow		*row,
+					 gpointer		 data);
+static gchar *summary_sort_key_subject	(GtkSCTree		*sctree,
+					 GtkCMCListRow		*row,
+					 gpointer		 data);
+static gchar *summary_sort_key_simplified_subject
+					(GtkSCTree		*sctree,
+					 GtkCMCListRow		*row,
+					 gpointer		 data);
+
 static void summary_find_answers	(SummaryView 	*summaryview,
 					 MsgInfo	*msg);
 
@@ -941,8 +965,6 @@ gboolean summary_show(SummaryView *summaryview, FolderItem *item, gboolean avoid
 
 	menu_set_sensitive_all(GTK_MENU_SHELL(summaryview->popupmenu), TRUE);
 
-	utils_free_regex();
-
 	is_refresh = (item == summaryview->folder_item && !avoid_refresh) ? TRUE : FALSE;
 
 	if (item && item->folder->klass->item_opened) {
@@ -1292,6 +1314,7 @@ void summary_clear_list(SummaryView *summaryview)
 	summaryview->mlist = NULL;
 
 	gtk_cmclist_clear(clist);
+	summary_end_address_completion(summaryview);
 	if (summaryview->col_pos[S_COL_SUBJECT] == N_SUMMARY_COLS - 1) {
 		optimal_width = gtk_cmclist_optimal_column_width
 			(clist, summaryview->col_pos[S_COL_SUBJECT]);
@@ -2383,6 +2406,7 @@ void summary_sort(SummaryView *summaryview,
 	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
 	GtkCMCList *clist = GTK_CMCLIST(summaryview->ctree);
 	GtkCMCListCompareFunc cmp_func = NULL;
+	GtkSCTreeSortKeyFunc key_func = NULL;
 	g_signal_handlers_block_by_func(G_OBJECT(summaryview->ctree),
 				       G_CALLBACK(summary_tree_expanded), summaryview);
 	summary_freeze(summaryview);
@@ -2411,12 +2435,16 @@ void summary_sort(SummaryView *summaryview,
 		break;
 	case SORT_BY_FROM:
 		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_from;
+		key_func = summary_sort_key_from;
 		break;
 	case SORT_BY_SUBJECT:
-		if (summaryview->simplify_subject_preg)
+		if (summaryview->simplify_subject_preg) {
 			cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_simplified_subject;
-		else
+			key_func = summary_sort_key_simplified_subject;
+		} else {
 			cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_subject;
+			key_func = summary_sort_key_subject;
+		}
 		break;
 	case SORT_BY_SCORE:
 		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_score;
@@ -2426,6 +2454,7 @@ void summary_sort(SummaryView *summaryview,
 		break;
 	case SORT_BY_TO:
 		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_to;
+		key_func = summary_sort_key_to;
 		break;
 	case SORT_BY_LOCKED:
 		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_locked;
@@ -2452,7 +2481,10 @@ void summary_sort(SummaryView *summaryview,
 
 		main_window_cursor_wait(summaryview->mainwin);
 
+		/* cmp_func still places rows inserted later */
 		gtk_cmclist_set_compare_func(clist, cmp_func);
+		gtk_sctree_set_sort_key_func(GTK_SCTREE(ctree), key_func,
+			(GtkCMCListCompareFunc)summary_cmp_by_date, summaryview);
 
 		gtk_cmclist_set_sort_type(clist, (GtkSortType)sort_type);
 		gtk_sctree_sort_recursive(ctree, NULL);
@@ -2558,37 +2590,46 @@ static gboolean summary_insert_gnode_func(GtkCMCTree *ctree, guint depth, GNode
 	const gchar *msgid = msginfo->msgid;
 	GHashTable *msgid_table = summaryview->msgid_table;
 	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
+	gboolean expanded = summaryview->threaded && !summaryview->thread_collapsed;
+
+	if (!(vert_layout && prefs_common.two_line_vert)) {
+		/* the other columns are filled by summary_fill_row() */
+		gtk_cmctree_set_node_info(ctree, cnode,
+					  summary_subject_text(summaryview, msginfo),
+					  2, NULL, NULL, FALSE, expanded);
+		GTKUT_CTREE_NODE_SET_ROW_DATA(cnode, msginfo);
+		gtk_sctree_node_set_pending(GTK_SCTREE(ctree), cnode);
+	} else {
+		summary_set_header(summaryview, text, msginfo);
 
-	summary_set_header(summaryview, text, msginfo);
-
-	gtk_cmctree_set_node_info(ctree, cnode, text[col_pos[S_COL_SUBJECT]], 2,
-				NULL, NULL, FALSE, summaryview->threaded && !summaryview->thread_collapsed);
+		gtk_cmctree_set_node_info(ctree, cnode, text[col_pos[S_COL_SUBJECT]], 2,
+					NULL, NULL, FALSE, expanded);
 #define SET_TEXT(col) {						\
 	gtk_cmctree_node_set_text(ctree, cnode, col_pos[col], 	\
 				text[col_pos[col]]);		\
 }
 
-	if (summaryview->col_state[summaryview->col_pos[S_COL_NUMBER]].visible)
-		SET_TEXT(S_COL_NUMBER);
-	if (summaryview->col_state[summaryview->col_pos[S_COL_SCORE]].visible)
-		SET_TEXT(S_COL_SCORE);
-	if (summaryview->col_state[summaryview->col_pos[S_COL_SIZE]].visible)
-		SET_TEXT(S_COL_SIZE);
-	if (summaryview->col_state[summaryview->col_pos[S_COL_DATE]].visible)
-		SET_TEXT(S_COL_DATE);
-	if (summaryview->col_state[summaryview->col_pos[S_COL_FROM]].visible)
-		SET_TEXT(S_COL_FROM);
-	if (summaryview->col_state[summaryview->col_pos[S_COL_TO]].visible)
-		SET_TEXT(S_COL_TO);
-	if (summaryview->col_state[summaryview->col_pos[S_COL_TAGS]].visible)
-		SET_TEXT(S_COL_TAGS);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_NUMBER]].visible)
+			SET_TEXT(S_COL_NUMBER);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_SCORE]].visible)
+			SET_TEXT(S_COL_SCORE);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_SIZE]].visible)
+			SET_TEXT(S_COL_SIZE);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_DATE]].visible)
+			SET_TEXT(S_COL_DATE);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_FROM]].visible)
+			SET_TEXT(S_COL_FROM);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_TO]].visible)
+			SET_TEXT(S_COL_TO);
+		if (summaryview->col_state[summaryview->col_pos[S_COL_TAGS]].visible)
+			SET_TEXT(S_COL_TAGS);
 
-	if (vert_layout && prefs_common.two_line_vert)
 		g_free(text[summaryview->col_pos[S_COL_SUBJECT]]);
 
 #undef SET_TEXT
 
-	GTKUT_CTREE_NODE_SET_ROW_DATA(cnode, msginfo);
+		GTKUT_CTREE_NODE_SET_ROW_DATA(cnode, msginfo);
+	}
 	summary_set_marks_func(ctree, cnode, summaryview);
 
 	if (msgid && msgid[0] != '\0')
@@ -2632,13 +2673,18 @@ static void summary_set_ctree_from_list(SummaryView *summaryview,
 		summaryview->subject_table = NULL;
 	}
 
-	if (prefs_common.use_addr_book)
-		start_address_completion(NULL);
+	summary_start_address_completion(summaryview);
 
 	if (summaryview->threaded) {
 		GNode *root, *gnode;
-		root = procmsg_get_thread_tree(mlist);
 
+		FolderItem *item = summaryview->folder_item;
+
+		/* kept with the cache, so that coming back to a folder only
+		 * threads what changed in it meanwhile */
+		if (!item->thread_tree)
+			item->thread_tree = procmsg_thread_tree_new();
+		root = procmsg_thread_tree_update(item->thread_tree, mlist);
 
 		for (gnode = root->children; gnode != NULL;
 		     gnode = gnode->next) {
@@ -2652,24 +2698,34 @@ static void summary_set_ctree_from_list(SummaryView *summaryview,
 			}
 		}
 
-		g_node_destroy(root);
-
 	} else {
 		gchar *text[N_SUMMARY_COLS];
+		gboolean two_line = vert_layout && prefs_common.two_line_vert;
+
+		procmsg_thread_tree_free(summaryview->folder_item->thread_tree);
+		summaryview->folder_item->thread_tree = NULL;
 		cur = mlist;
+		if (!two_line)
+			memset(text, 0, sizeof(text));
 		for (; mlist != NULL; mlist = mlist->next) {
 			msginfo = (MsgInfo *)mlist->data;
 
-			summary_set_header(summaryview, text, msginfo);
+			if (two_line)
+				summary_set_header(summaryview, text, msginfo);
+			else
+				text[summaryview->col_pos[S_COL_SUBJECT]] =
+					(gchar *)summary_subject_text(summaryview, msginfo);
 
 			node = gtk_sctree_insert_node
 				(ctree, NULL, node, text, 2,
 				 NULL, NULL,
 				 FALSE, FALSE);
-			if (vert_layout && prefs_common.two_line_vert)
+			if (two_line)
 				g_free(text[summaryview->col_pos[S_COL_SUBJECT]]);
 
 			GTKUT_CTREE_NODE_SET_ROW_DATA(node, msginfo);
+			if (!two_line)
+				gtk_sctree_node_set_pending(GTK_SCTREE(ctree), node);
 			summary_set_marks_func(ctree, node, summaryview);
 
 			if (msginfo->msgid && msginfo->msgid[0] != '\0')
@@ -2695,9 +2751,6 @@ static void summary_set_ctree_from_list(SummaryView *summaryview,
 					   optimal_width);
 	}
 
-	if (prefs_common.use_addr_book)
-		end_address_completion();
-
 	debug_print("Setting summary from message data done.\n");
 	STATUSBAR_POP(summaryview->mainwin);
 	if (debug_get_mode()) {
@@ -2725,6 +2778,67 @@ static void summary_set_ctree_from_list(SummaryView *summaryview,
 				       G_CALLBACK(summary_tree_expanded), summaryview);
 }
 
+/* Rows are filled lazily, so the address book stays loaded until the
+ * list is cleared rather than just while it is being built. */
+static void summary_start_address_completion(SummaryView *summaryview)
+{
+	if (!prefs_common.use_addr_book || summaryview->address_completion)
+		return;
+
+	start_address_completion(NULL);
+	summaryview->address_completion = TRUE;
+}
+
+static void summary_end_address_completion(SummaryView *summaryview)
+{
+	if (!summaryview->address_completion)
+		return;
+
+	end_address_completion();
+	summaryview->address_completion = FALSE;
+}
+
+static const gchar *summary_subject_text(SummaryView *summaryview,
+					 MsgInfo *msginfo)
+{
+	static gchar buf[BUFFSIZE];
+
+	if (!msginfo->subject)
+		return _("(No Subject)");
+	if (summaryview->simplify_subject_preg != NULL)
+		return string_remove_match(buf, BUFFSIZE, msginfo->subject,
+					   summaryview->simplify_subject_preg);
+	return msginfo->subject;
+}
+
+/* Fills in the columns left out when the row was inserted, the first
+ * time the row is drawn, measured or compared by text. */
+static void summary_fill_row(GtkSCTree *sctree, GtkCMCListRow *row,
+			     gpointer data)
+{
+	static const SummaryColumnType cols[] = {
+		S_COL_NUMBER, S_COL_SCORE, S_COL_SIZE, S_COL_DATE,
+		S_COL_FROM, S_COL_TO, S_COL_TAGS
+	};
+	SummaryView *summaryview = (SummaryView *)data;
+	MsgInfo *msginfo = (MsgInfo *)row->data;
+	gchar *text[N_SUMMARY_COLS];
+	gint *col_pos = summaryview->col_pos;
+	gint i;
+
+	if (!msginfo)
+		return;
+
+	summary_start_address_completion(summaryview);
+	summary_set_header(summaryview, text, msginfo);
+
+	for (i = 0; i < G_N_ELEMENTS(cols); i++) {
+		if (summaryview->col_state[col_pos[cols[i]]].visible)
+			gtk_sctree_row_set_text(sctree, row, col_pos[cols[i]],
+						text[col_pos[cols[i]]]);
+	}
+}
+
 static gchar *summary_complete_address(const gchar *addr)
 {
 	gint count;
@@ -2757,7 +2871,7 @@ static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
 	static gchar date_modified[80];
 	static gchar col_score[11];
 	static gchar from_buf[BUFFSIZE], to_buf[BUFFSIZE];
-	static gchar tmp2[BUFFSIZE+4], tmp3[BUFFSIZE];
+	static gchar tmp2[BUFFSIZE+4];
 	gint *col_pos = summaryview->col_pos;
 	gchar *from_text = NULL, *to_text = NULL;
 	gboolean should_swap = FALSE;
@@ -2891,14 +3005,8 @@ static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
 		text[col_pos[S_COL_FROM]] = tmp2;
 	}
 
-	if (summaryview->simplify_subject_preg != NULL)
-		text[col_pos[S_COL_SUBJECT]] = msginfo->subject ?
-			string_remove_match(tmp3, BUFFSIZE, msginfo->subject,
-					summaryview->simplify_subject_preg) :
-			_("(No Subject)");
-	else
-		text[col_pos[S_COL_SUBJECT]] = msginfo->subject ? msginfo->subject :
-			_("(No Subject)");
+	text[col_pos[S_COL_SUBJECT]] =
+		(gchar *)summary_subject_text(summaryview, msginfo);
 	if (vert_layout && prefs_common.two_line_vert) {
 		if (!FOLDER_SHOWS_TO_HDR(summaryview->folder_item)) {
 			gchar *tmp = g_markup_printf_escaped(g_strconcat("%s\n",
@@ -5039,6 +5147,8 @@ static gboolean tooltip_cb (GtkWidget  *widget,
 	if ((info = gtk_cmctree_node_get_row_data(ctree, node)) == NULL)
 		return FALSE;
 
+	gtk_sctree_fill_row(GTK_SCTREE(ctree), &GTK_CMCTREE_ROW(node)->row);
+
 	switch (gtk_cmctree_node_get_cell_type(ctree, node, column)) {
 		case GTK_CMCELL_TEXT:
 			if (gtk_cmctree_node_get_text(ctree, node, column, &text) != TRUE)
@@ -5133,6 +5243,8 @@ static GtkWidget *summary_ctree_create(SummaryView *summaryview)
 		(N_SUMMARY_COLS, col_pos[S_COL_SUBJECT], titles);
 
 	gtk_widget_set_name(GTK_WIDGET(ctree), "summaryview_sctree");
+	gtk_sctree_set_fill_func(GTK_SCTREE(ctree), summary_fill_row,
+				 summaryview);
 
 	if (prefs_common.show_col_headers == FALSE)
 		gtk_cmclist_column_titles_hide(GTK_CMCLIST(ctree));
@@ -6073,8 +6185,11 @@ static gint summary_cmp_by_subject(GtkCMCList *clist,
 	if (!msginfo2->subject)
 		return -1;
 
-	res = subject_compare_for_sort
-		(msginfo1->subject, msginfo2->subject);
+	res = subject_compare_for_sort_prefixed
+		(msginfo1->subject,
+		 procmsg_msginfo_get_subject_prefix_length(msginfo1),
+		 msginfo2->subject,
+		 procmsg_msginfo_get_subject_prefix_length(msginfo2));
 	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
 }
 
@@ -6105,6 +6220,8 @@ static gint summary_cmp_by_from(GtkCMCList *clist, gconstpointer ptr1,
 
 	cm_return_val_if_fail(sv, -1);
 	if (sv->col_state[sv->col_pos[S_COL_FROM]].visible) {
+		gtk_sctree_fill_row(GTK_SCTREE(clist), (GtkCMCListRow *)r1);
+		gtk_sctree_fill_row(GTK_SCTREE(clist), (GtkCMCListRow *)r2);
 		str1 = GTK_CMCELL_TEXT(r1->cell[sv->col_pos[S_COL_FROM]])->text;
 		str2 = GTK_CMCELL_TEXT(r2->cell[sv->col_pos[S_COL_FROM]])->text;
 	} else {
@@ -6135,6 +6252,8 @@ static gint summary_cmp_by_to(GtkCMCList *clist, gconstpointer ptr1,
 	cm_return_val_if_fail(sv, -1);
 
 	if (sv->col_state[sv->col_pos[S_COL_TO]].visible) {
+		gtk_sctree_fill_row(GTK_SCTREE(clist), (GtkCMCListRow *)r1);
+		gtk_sctree_fill_row(GTK_SCTREE(clist), (GtkCMCListRow *)r2);
 		str1 = GTK_CMCELL_TEXT(r1->cell[sv->col_pos[S_COL_TO]])->text;
 		str2 = GTK_CMCELL_TEXT(r2->cell[sv->col_pos[S_COL_TO]])->text;
 	} else {
@@ -6207,6 +6326,97 @@ static gint summary_cmp_by_score(GtkCMCList *clist,
 		return summary_cmp_by_date(clist, ptr1, ptr2);
 }
 
+static gchar *summary_collate_key(const gchar *str)
+{
+	gchar *valid, *key;
+
+	if (!str)
+		return NULL;
+	if (g_utf8_validate(str, -1, NULL))
+		return g_utf8_collate_key(str, -1);
+
+	g_warning("\"%s\" failed UTF-8 validation", str);
+	valid = g_utf8_make_valid(str, -1);
+	key = g_utf8_collate_key(valid, -1);
+	g_free(valid);
+	return key;
+}
+
+/* The key for a column compared like summary_cmp_by_from(): by the
+ * shown text if the column is visible, else by the header */
+static gchar *summary_sort_key_column(GtkSCTree *sctree, GtkCMCListRow *row,
+				      SummaryView *summaryview,
+				      SummaryColumnType type,
+				      const gchar *header)
+{
+	gint pos = summaryview->col_pos[type];
+
+	if (summaryview->col_state[pos].visible) {
+		gtk_sctree_fill_row(sctree, row);
+		return summary_collate_key(GTK_CMCELL_TEXT(row->cell[pos])->text);
+	}
+	return summary_collate_key(header);
+}
+
+static gchar *summary_sort_key_from(GtkSCTree *sctree, GtkCMCListRow *row,
+				    gpointer data)
+{
+	MsgInfo *msginfo = row->data;
+
+	return summary_sort_key_column(sctree, row, data, S_COL_FROM,
+				       msginfo->from);
+}
+
+static gchar *summary_sort_key_to(GtkSCTree *sctree, GtkCMCListRow *row,
+				  gpointer data)
+{
+	MsgInfo *msginfo = row->data;
+
+	return summary_sort_key_column(sctree, row, data, S_COL_TO,
+				       msginfo->to);
+}
+
+static gchar *summary_sort_key_subject(GtkSCTree *sctree, GtkCMCListRow *row,
+				       gpointer data)
+{
+	MsgInfo *msginfo = row->data;
+	gchar *str, *key;
+
+	if (!msginfo->subject)
+		return NULL;
+
+	str = subject_strip_for_sort(msginfo->subject,
+			procmsg_msginfo_get_subject_prefix_length(msginfo));
+	key = summary_collate_key(str);
+	g_free(str);
+	return key;
+}
+
+static gchar *summary_sort_key_simplified_subject(GtkSCTree *sctree,
+						  GtkCMCListRow *row,
+						  gpointer data)
+{
+	SummaryView *summaryview = data;
+	MsgInfo *msginfo = row->data;
+	gint pos = summaryview->col_pos[S_COL_SUBJECT];
+	const gchar *subject;
+	gchar *str, *key;
+
+	if (summaryview->col_state[pos].visible) {
+		gtk_sctree_fill_row(sctree, row);
+		subject = GTK_CMCELL_TEXT(row->cell[pos])->text;
+	} else {
+		subject = msginfo->subject;
+	}
+	if (!subject)
+		return NULL;
+
+	str = subject_strip_for_sort(subject, -1);
+	key = summary_collate_key(str);
+	g_free(str);
+	return key;
+}
+
 static void summary_ignore_thread_func_mark_unread(GtkCMCTree *ctree, GtkCMCTreeNode *row, gpointer data)
 {
 	MsgInfo *msginfo;
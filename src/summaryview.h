@@ -145,6 +145,9 @@ private:
 	GHashTable *msgid_table;
 	GHashTable *subject_table;
 
+	/* address completion is held while rows may still be filled */
+	gboolean address_completion;
+
 	/* list for moving/deleting messages */
 	GSList *mlist;
 	int msginfo_update_callback_id;
@@ -0,0 +1,304 @@
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "mock_debug_print.h"
+
+#include "folder.h"
+#include "procmsg.h"
+#include "prefs_account.h"
+#include "imap-thread.h"
+
+#include "mock_gtk_main_iteration.h"
+#include "mock_imap_folder_ref.h"
+#include "mock_mainwindow_show_error.h"
+
+#include "script_server.h"
+
+/* past 32 bits, as mod-sequences on busy servers are */
+#define HIGHESTMODSEQ		"715194045007"
+#define LAST_MODSEQ		"715194045000"
+
+static Folder folder;
+static PrefsAccount account;
+
+/* Connects and logs in to server, and reads its capabilities the way
+ * imap.c does before it enables anything */
+static void
+imap_start(ScriptServer *server)
+{
+	struct mailimap_capability_data *caps = NULL;
+
+	memset(&account, 0, sizeof(account));
+	account.recv_server = "127.0.0.1";
+	account.ssl_imap = SSL_NONE;
+	memset(&folder, 0, sizeof(folder));
+	folder.account = &account;
+
+	imap_init(&folder);
+	g_assert_cmpint(imap_threaded_connect(&folder, "127.0.0.1",
+					      server->port),
+			==, MAILIMAP_NO_ERROR_NON_AUTHENTICATED);
+	g_assert_cmpint(imap_threaded_login(&folder, "user", "secret",
+					    "plaintext"),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpint(imap_threaded_capability(&folder, &caps),
+			==, MAILIMAP_NO_ERROR);
+	mailimap_capability_data_free(caps);
+}
+
+static void
+imap_stop(ScriptServer *server)
+{
+	imap_threaded_disconnect(&folder);
+	imap_done(&folder);
+	script_server_finish(server);
+}
+
+static void
+select_inbox(guint64 *highestmodseq)
+{
+	gint exists, recent, unseen, can_create_flags;
+	guint32 uid_validity;
+	GSList *ok_flags = NULL;
+
+	g_assert_cmpint(imap_threaded_select(&folder, "INBOX", &exists,
+					     &recent, &unseen, &uid_validity,
+					     &can_create_flags, &ok_flags,
+					     highestmodseq),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpint(exists, ==, 4);
+	g_assert_cmpuint(uid_validity, ==, 7);
+	g_slist_free(ok_flags);
+}
+
+/* The flags reported for uid in a list from imap_threaded_fetch_uid_flags*,
+ * or -1 if it is not there */
+static gint
+uid_flags(carray *tab, guint32 uid)
+{
+	guint i;
+
+	for (i = 0; i < carray_count(tab); i += 3)
+		if (*(uint32_t *)carray_get(tab, i) == uid)
+			return *(int *)carray_get(tab, i + 1);
+	return -1;
+}
+
+static void
+uid_flags_free(carray *tab)
+{
+	guint i;
+
+	for (i = 0; i < carray_count(tab); i += 3)
+		slist_free_strings_full(carray_get(tab, i + 2));
+	imap_fetch_uid_flags_list_free(tab);
+}
+
+#define SELECT_REPLY(modseq_code)				\
+	{ SCRIPT_SEND, "* FLAGS (\\Seen \\Flagged \\Deleted)\r\n"	\
+		       "* 4 EXISTS\r\n"					\
+		       "* 0 RECENT\r\n"					\
+		       "* OK [UIDVALIDITY 7] ok\r\n"			\
+		       "* OK [UIDNEXT 14] ok\r\n"			\
+		       "* OK [" modseq_code "] ok\r\n" },		\
+	{ SCRIPT_REPLY, "OK [READ-WRITE] done\r\n" }
+
+#define LOGOUT							\
+	{ SCRIPT_EXPECT, "* LOGOUT" },				\
+	{ SCRIPT_SEND, "* BYE logging out\r\n" },		\
+	{ SCRIPT_REPLY, "OK done\r\n" },			\
+	{ SCRIPT_EOF }
+
+/* CONDSTORE alone needs no ENABLE; SELECT reports HIGHESTMODSEQ and a
+ * flags sync only gets the messages changed since the one we had */
+static const ScriptStep condstore[] = {
+	{ SCRIPT_SEND, "* OK ready\r\n" },
+	{ SCRIPT_EXPECT, "* LOGIN *" },
+	{ SCRIPT_REPLY, "OK logged in\r\n" },
+	{ SCRIPT_EXPECT, "* CAPABILITY" },
+	{ SCRIPT_SEND, "* CAPABILITY IMAP4rev1 CONDSTORE\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EXPECT, "* SELECT INBOX (CONDSTORE)" },
+	SELECT_REPLY("HIGHESTMODSEQ " HIGHESTMODSEQ),
+	{ SCRIPT_EXPECT, "* UID FETCH 1:* (*) (CHANGEDSINCE " LAST_MODSEQ ")" },
+	{ SCRIPT_SEND, "* 2 FETCH (UID 11 MODSEQ (715194045001) "
+		       "FLAGS (\\Seen))\r\n"
+		       "* 4 FETCH (UID 13 FLAGS (\\Flagged) "
+		       "MODSEQ (" HIGHESTMODSEQ "))\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	LOGOUT,
+	{ SCRIPT_END }
+};
+
+static void
+test_imap_condstore(void)
+{
+	ScriptServer *server = script_server_new(condstore);
+	IMAPModSeqMode mode = IMAP_MODSEQ_QRESYNC;
+	guint64 highestmodseq = 0;
+	carray *tab = NULL;
+	struct mailimap_set *vanished = NULL;
+
+	imap_start(server);
+	g_assert_cmpint(imap_threaded_enable_modseq(&folder, &mode),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpint(mode, ==, IMAP_MODSEQ_CONDSTORE);
+
+	select_inbox(&highestmodseq);
+	g_assert_cmpuint(highestmodseq, ==, G_GUINT64_CONSTANT(715194045007));
+
+	g_assert_cmpint(imap_threaded_fetch_uid_flags_changedsince(&folder,
+				G_GUINT64_CONSTANT(715194045000), FALSE,
+				&tab, &vanished),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_null(vanished);
+	g_assert_cmpuint(carray_count(tab), ==, 2 * 3);
+	g_assert_cmpint(uid_flags(tab, 11), ==, 0);
+	g_assert_cmpint(uid_flags(tab, 13), ==, MSG_UNREAD | MSG_MARKED);
+	uid_flags_free(tab);
+
+	imap_stop(server);
+}
+
+/* With QRESYNC enabled the same fetch also brings back the UIDs
+ * expunged since, in a VANISHED (EARLIER) response */
+static const ScriptStep qresync[] = {
+	{ SCRIPT_SEND, "* OK ready\r\n" },
+	{ SCRIPT_EXPECT, "* LOGIN *" },
+	{ SCRIPT_REPLY, "OK logged in\r\n" },
+	{ SCRIPT_EXPECT, "* CAPABILITY" },
+	{ SCRIPT_SEND, "* CAPABILITY IMAP4rev1 ENABLE CONDSTORE QRESYNC\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EXPECT, "* ENABLE QRESYNC" },
+	{ SCRIPT_SEND, "* ENABLED QRESYNC\r\n" },
+	{ SCRIPT_REPLY, "OK enabled\r\n" },
+	{ SCRIPT_EXPECT, "* SELECT INBOX (CONDSTORE)" },
+	SELECT_REPLY("HIGHESTMODSEQ " HIGHESTMODSEQ),
+	{ SCRIPT_EXPECT, "* UID FETCH 1:* (*) (CHANGEDSINCE " LAST_MODSEQ
+			 " VANISHED)" },
+	{ SCRIPT_SEND, "* VANISHED (EARLIER) 3:5,9\r\n"
+		       "* 4 FETCH (UID 13 FLAGS (\\Seen \\Answered) "
+		       "MODSEQ (" HIGHESTMODSEQ "))\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	LOGOUT,
+	{ SCRIPT_END }
+};
+
+static void
+test_imap_qresync(void)
+{
+	ScriptServer *server = script_server_new(qresync);
+	IMAPModSeqMode mode = IMAP_MODSEQ_NONE;
+	guint64 highestmodseq = 0;
+	carray *tab = NULL;
+	struct mailimap_set *vanished = NULL;
+	struct mailimap_set_item *item;
+
+	imap_start(server);
+	g_assert_cmpint(imap_threaded_enable_modseq(&folder, &mode),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpint(mode, ==, IMAP_MODSEQ_QRESYNC);
+
+	select_inbox(&highestmodseq);
+	g_assert_cmpuint(highestmodseq, ==, G_GUINT64_CONSTANT(715194045007));
+
+	g_assert_cmpint(imap_threaded_fetch_uid_flags_changedsince(&folder,
+				G_GUINT64_CONSTANT(715194045000), TRUE,
+				&tab, &vanished),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpuint(carray_count(tab), ==, 3);
+	g_assert_cmpint(uid_flags(tab, 13), ==, MSG_REPLIED);
+	uid_flags_free(tab);
+
+	g_assert_nonnull(vanished);
+	g_assert_cmpint(clist_count(vanished->set_list), ==, 2);
+	item = clist_content(clist_begin(vanished->set_list));
+	g_assert_cmpuint(item->set_first, ==, 3);
+	g_assert_cmpuint(item->set_last, ==, 5);
+	item = clist_content(clist_next(clist_begin(vanished->set_list)));
+	g_assert_cmpuint(item->set_first, ==, 9);
+	g_assert_cmpuint(item->set_last, ==, 9);
+	mailimap_set_free(vanished);
+
+	imap_stop(server);
+}
+
+/* A mailbox the server keeps no mod-sequences for reports NOMODSEQ,
+ * which leaves HIGHESTMODSEQ at 0 */
+static const ScriptStep nomodseq[] = {
+	{ SCRIPT_SEND, "* OK ready\r\n" },
+	{ SCRIPT_EXPECT, "* LOGIN *" },
+	{ SCRIPT_REPLY, "OK logged in\r\n" },
+	{ SCRIPT_EXPECT, "* CAPABILITY" },
+	{ SCRIPT_SEND, "* CAPABILITY IMAP4rev1 CONDSTORE\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EXPECT, "* SELECT INBOX (CONDSTORE)" },
+	SELECT_REPLY("NOMODSEQ"),
+	LOGOUT,
+	{ SCRIPT_END }
+};
+
+static void
+test_imap_nomodseq(void)
+{
+	ScriptServer *server = script_server_new(nomodseq);
+	IMAPModSeqMode mode = IMAP_MODSEQ_NONE;
+	guint64 highestmodseq = 1;
+
+	imap_start(server);
+	g_assert_cmpint(imap_threaded_enable_modseq(&folder, &mode),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpint(mode, ==, IMAP_MODSEQ_CONDSTORE);
+
+	select_inbox(&highestmodseq);
+	g_assert_cmpuint(highestmodseq, ==, 0);
+
+	imap_stop(server);
+}
+
+/* Without CONDSTORE nothing is enabled, and imap.c selects as before */
+static const ScriptStep no_condstore[] = {
+	{ SCRIPT_SEND, "* OK ready\r\n" },
+	{ SCRIPT_EXPECT, "* LOGIN *" },
+	{ SCRIPT_REPLY, "OK logged in\r\n" },
+	{ SCRIPT_EXPECT, "* CAPABILITY" },
+	{ SCRIPT_SEND, "* CAPABILITY IMAP4rev1 ENABLE\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EXPECT, "* SELECT INBOX" },
+	SELECT_REPLY("PERMANENTFLAGS (\\Seen \\Flagged \\Deleted)"),
+	LOGOUT,
+	{ SCRIPT_END }
+};
+
+static void
+test_imap_no_condstore(void)
+{
+	ScriptServer *server = script_server_new(no_condstore);
+	IMAPModSeqMode mode = IMAP_MODSEQ_QRESYNC;
+
+	imap_start(server);
+	g_assert_cmpint(imap_threaded_enable_modseq(&folder, &mode),
+			==, MAILIMAP_NO_ERROR);
+	g_assert_cmpint(mode, ==, IMAP_MODSEQ_NONE);
+
+	select_inbox(NULL);
+
+	imap_stop(server);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	imap_main_init(TRUE);
+
+	g_test_add_func("/core/imap/condstore", test_imap_condstore);
+	g_test_add_func("/core/imap/qresync", test_imap_qresync);
+	g_test_add_func("/core/imap/nomodseq", test_imap_nomodseq);
+	g_test_add_func("/core/imap/no_condstore", test_imap_no_condstore);
+
+	return g_test_run();
+}
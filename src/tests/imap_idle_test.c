@@ -0,0 +1,183 @@
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "mock_debug_print.h"
+
+#include "folder.h"
+#include "prefs_account.h"
+#include "imap-thread.h"
+
+#include "mock_gtk_main_iteration.h"
+#include "mock_imap_folder_ref.h"
+#include "mock_mainwindow_show_error.h"
+
+#include "script_server.h"
+
+static gint changes;
+static gint losses;
+
+static void
+idle_cb(IMAPIdle *idle, gboolean alive, gpointer data)
+{
+	if (alive)
+		g_atomic_int_inc(&changes);
+	else
+		g_atomic_int_inc(&losses);
+}
+
+/* Holds the server back until the client has seen GPOINTER_TO_INT(data)
+ * changes, so that the next one is not folded into them. */
+static gboolean
+wait_for_changes(ScriptServer *server, gpointer data)
+{
+	gint64 end = g_get_monotonic_time() + SCRIPT_TIMEOUT_MS * 1000;
+
+	while (g_atomic_int_get(&changes) < GPOINTER_TO_INT(data)) {
+		if (g_get_monotonic_time() > end) {
+			script_server_fail(server, "no change reported");
+			return FALSE;
+		}
+		g_usleep(10 * 1000);
+	}
+	return TRUE;
+}
+
+static const ScriptStep idle_script[] = {
+	{ SCRIPT_SEND, "* OK [CAPABILITY IMAP4rev1 IDLE] ready\r\n" },
+	{ SCRIPT_EXPECT, "* LOGIN *" },
+	{ SCRIPT_REPLY, "OK logged in\r\n" },
+	{ SCRIPT_EXPECT, "* CAPABILITY" },
+	{ SCRIPT_SEND, "* CAPABILITY IMAP4rev1 IDLE\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EXPECT, "* EXAMINE INBOX" },
+	{ SCRIPT_SEND, "* FLAGS (\\Seen \\Deleted)\r\n"
+		       "* 2 EXISTS\r\n"
+		       "* 0 RECENT\r\n"
+		       "* OK [UIDVALIDITY 7] ok\r\n"
+		       "* OK [UIDNEXT 3] ok\r\n" },
+	{ SCRIPT_REPLY, "OK [READ-ONLY] done\r\n" },
+
+	/* a new message, reported once the client waits on the socket */
+	{ SCRIPT_EXPECT, "* IDLE" },
+	{ SCRIPT_SEND, "+ idling\r\n" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "* 3 EXISTS\r\n" },
+	{ SCRIPT_EXPECT, "DONE" },
+	{ SCRIPT_REPLY, "OK IDLE terminated\r\n" },
+	{ SCRIPT_CALL, NULL, wait_for_changes, GINT_TO_POINTER(1) },
+
+	/* one gone */
+	{ SCRIPT_EXPECT, "* IDLE" },
+	{ SCRIPT_SEND, "+ idling\r\n" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "* 1 EXPUNGE\r\n" },
+	{ SCRIPT_EXPECT, "DONE" },
+	{ SCRIPT_REPLY, "OK IDLE terminated\r\n" },
+	{ SCRIPT_CALL, NULL, wait_for_changes, GINT_TO_POINTER(2) },
+
+	/* imap_threaded_idle_stop() */
+	{ SCRIPT_EXPECT, "* IDLE" },
+	{ SCRIPT_SEND, "+ idling\r\n" },
+	{ SCRIPT_EXPECT, "DONE" },
+	{ SCRIPT_REPLY, "OK IDLE terminated\r\n" },
+	{ SCRIPT_EXPECT, "* LOGOUT" },
+	{ SCRIPT_SEND, "* BYE logging out\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static gboolean
+changes_seen(gpointer data)
+{
+	return g_atomic_int_get(&changes) >= GPOINTER_TO_INT(data);
+}
+
+static gboolean
+script_done(gpointer data)
+{
+	ScriptServer *server = data;
+
+	return g_atomic_int_get(&server->done);
+}
+
+static void
+test_imap_idle(void)
+{
+	PrefsAccount account;
+	Folder folder;
+	ScriptServer *server;
+	IMAPIdle *idle;
+
+	memset(&account, 0, sizeof(account));
+	account.recv_server = "127.0.0.1";
+	account.ssl_imap = SSL_NONE;
+	memset(&folder, 0, sizeof(folder));
+	folder.account = &account;
+
+	server = script_server_new(idle_script);
+	idle = imap_threaded_idle_start(&folder, server->port, "INBOX",
+					"user", "secret", "plaintext",
+					idle_cb, NULL);
+	g_assert_nonnull(idle);
+
+	script_server_run_until(server, changes_seen, GINT_TO_POINTER(2));
+
+	/* the server sees DONE and LOGOUT, and the connection closed */
+	imap_threaded_idle_stop(idle);
+	script_server_run_until(server, script_done, server);
+	script_server_finish(server);
+
+	g_assert_cmpint(changes, ==, 2);
+	g_assert_cmpint(losses, ==, 0);
+}
+
+/* Without IDLE among the server's capabilities the connection is
+ * dropped again */
+static const ScriptStep no_idle_script[] = {
+	{ SCRIPT_SEND, "* OK [CAPABILITY IMAP4rev1] ready\r\n" },
+	{ SCRIPT_EXPECT, "* LOGIN *" },
+	{ SCRIPT_REPLY, "OK logged in\r\n" },
+	{ SCRIPT_EXPECT, "* CAPABILITY" },
+	{ SCRIPT_SEND, "* CAPABILITY IMAP4rev1\r\n" },
+	{ SCRIPT_REPLY, "OK done\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static void
+test_imap_idle_unsupported(void)
+{
+	PrefsAccount account;
+	Folder folder;
+	ScriptServer *server;
+
+	memset(&account, 0, sizeof(account));
+	account.recv_server = "127.0.0.1";
+	account.ssl_imap = SSL_NONE;
+	memset(&folder, 0, sizeof(folder));
+	folder.account = &account;
+
+	server = script_server_new(no_idle_script);
+	g_assert_null(imap_threaded_idle_start(&folder, server->port, "INBOX",
+					       "user", "secret", "plaintext",
+					       idle_cb, NULL));
+	script_server_run_until(server, script_done, server);
+	script_server_finish(server);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	imap_main_init(TRUE);
+
+	g_test_add_func("/core/imap/idle", test_imap_idle);
+	g_test_add_func("/core/imap/idle_unsupported",
+			test_imap_idle_unsupported);
+
+	return g_test_run();
+}
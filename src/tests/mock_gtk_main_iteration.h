@@ -0,0 +1,5 @@
+gboolean gtk_main_iteration(void)
+{
+	g_main_context_iteration(NULL, TRUE);
+	return FALSE;
+}
@@ -0,0 +1,9 @@
+void imap_folder_ref(Folder *folder)
+{
+	return;
+}
+
+void imap_folder_unref(Folder *folder)
+{
+	return;
+}
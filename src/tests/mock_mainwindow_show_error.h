@@ -0,0 +1,4 @@
+void mainwindow_show_error(void)
+{
+	return;
+}
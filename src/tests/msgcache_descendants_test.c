@@ -0,0 +1,194 @@
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "mock_debug_print.h"
+
+#include "folder.h"
+#include "msgcache.h"
+#include "procmsg.h"
+
+static FolderItem item;
+
+/* Adds a message to cache and keeps the caller's reference */
+static MsgInfo *
+add_msg(MsgCache *cache, gint num, const gchar *msgid, const gchar *inreplyto)
+{
+	MsgInfo *msginfo = procmsg_msginfo_new();
+
+	msginfo->msgnum = num;
+	msginfo->msgid = g_strdup(msgid);
+	msginfo->inreplyto = g_strdup(inreplyto);
+	msginfo->folder = &item;
+	msgcache_add_msg(cache, msginfo);
+	return msginfo;
+}
+
+static gint
+msgnum_cmp(gconstpointer a, gconstpointer b)
+{
+	return ((MsgInfo *)a)->msgnum - ((MsgInfo *)b)->msgnum;
+}
+
+/* The numbers of msginfo's descendants in order, as "2,3,4" */
+static gchar *
+descendants(MsgCache *cache, MsgInfo *msginfo)
+{
+	MsgInfoList *list = msgcache_get_msg_descendants(cache, msginfo);
+	GString *str = g_string_new(NULL);
+	MsgInfoList *cur;
+
+	list = g_slist_sort(list, msgnum_cmp);
+	for (cur = list; cur != NULL; cur = cur->next) {
+		MsgInfo *desc = cur->data;
+
+		g_string_append_printf(str, "%s%d", str->len ? "," : "",
+				       desc->msgnum);
+		procmsg_msginfo_free(&desc);
+	}
+	g_slist_free(list);
+	return g_string_free(str, FALSE);
+}
+
+#define assert_descendants(cache, msginfo, expected) G_STMT_START {	\
+	gchar *__desc = descendants(cache, msginfo);			\
+	g_assert_cmpstr(__desc, ==, expected);				\
+	g_free(__desc);							\
+} G_STMT_END
+
+static void
+free_msgs(MsgInfo **msgs, gint n)
+{
+	gint i;
+
+	for (i = 0; i < n; i++)
+		procmsg_msginfo_free(&msgs[i]);
+}
+
+static void
+test_msgcache_descendants_chain(void)
+{
+	MsgCache *cache = msgcache_new();
+	MsgInfo *msgs[6];
+
+	msgs[0] = add_msg(cache, 1, "a@test", NULL);
+	msgs[1] = add_msg(cache, 2, "b@test", "a@test");
+	msgs[2] = add_msg(cache, 3, "c@test", "b@test");
+	msgs[3] = add_msg(cache, 4, "d@test", "c@test");
+	/* a branch, and a message outside the thread */
+	msgs[4] = add_msg(cache, 5, "e@test", "b@test");
+	msgs[5] = add_msg(cache, 6, "f@test", "elsewhere@test");
+
+	assert_descendants(cache, msgs[0], "2,3,4,5");
+	assert_descendants(cache, msgs[1], "3,4,5");
+	assert_descendants(cache, msgs[2], "4");
+	assert_descendants(cache, msgs[3], "");
+	assert_descendants(cache, msgs[5], "");
+
+	free_msgs(msgs, 6);
+	msgcache_destroy(cache);
+}
+
+/* Replies that go round in a circle end where they started */
+static void
+test_msgcache_descendants_loop(void)
+{
+	MsgCache *cache = msgcache_new();
+	MsgInfo *msgs[4];
+	MsgInfo *copy;
+
+	msgs[0] = add_msg(cache, 1, "a@test", "c@test");
+	msgs[1] = add_msg(cache, 2, "b@test", "a@test");
+	msgs[2] = add_msg(cache, 3, "c@test", "b@test");
+	/* and one that replies to itself */
+	msgs[3] = add_msg(cache, 4, "self@test", "self@test");
+
+	assert_descendants(cache, msgs[0], "2,3");
+	assert_descendants(cache, msgs[1], "1,3");
+	assert_descendants(cache, msgs[2], "1,2");
+	assert_descendants(cache, msgs[3], "");
+
+	/* a copy of a cached message, as a full MsgInfo would be */
+	copy = procmsg_msginfo_new();
+	copy->msgnum = 1;
+	copy->msgid = g_strdup("a@test");
+	assert_descendants(cache, copy, "2,3");
+	procmsg_msginfo_free(&copy);
+
+	free_msgs(msgs, 4);
+	msgcache_destroy(cache);
+}
+
+/* Many replies to one message, and a Message-ID that two messages share,
+ * still give each descendant once */
+static void
+test_msgcache_descendants_duplicates(void)
+{
+	MsgCache *cache = msgcache_new();
+	MsgInfo *msgs[6];
+
+	msgs[0] = add_msg(cache, 1, "a@test", NULL);
+	msgs[1] = add_msg(cache, 2, "b@test", "a@test");
+	msgs[2] = add_msg(cache, 3, "c@test", "a@test");
+	/* the same message stored twice */
+	msgs[3] = add_msg(cache, 4, "d@test", "a@test");
+	msgs[4] = add_msg(cache, 5, "d@test", "a@test");
+	msgs[5] = add_msg(cache, 6, "e@test", "d@test");
+
+	assert_descendants(cache, msgs[0], "2,3,4,5,6");
+	assert_descendants(cache, msgs[3], "6");
+	assert_descendants(cache, msgs[4], "6");
+
+	free_msgs(msgs, 6);
+	msgcache_destroy(cache);
+}
+
+/* The index behind the lookups follows the messages added and removed
+ * after it was built */
+static void
+test_msgcache_descendants_rebuild(void)
+{
+	MsgCache *cache = msgcache_new();
+	MsgInfo *msgs[4];
+
+	msgs[0] = add_msg(cache, 1, "a@test", NULL);
+	msgs[1] = add_msg(cache, 2, "b@test", "a@test");
+	assert_descendants(cache, msgs[0], "2");
+
+	msgs[2] = add_msg(cache, 3, "c@test", "b@test");
+	assert_descendants(cache, msgs[0], "2,3");
+	/* a reply that arrives before its parent */
+	msgs[3] = add_msg(cache, 4, "d@test", "later@test");
+	assert_descendants(cache, msgs[0], "2,3");
+
+	msgcache_remove_msg(cache, 2);
+	assert_descendants(cache, msgs[0], "");
+	assert_descendants(cache, msgs[1], "3");
+
+	free_msgs(msgs, 4);
+	msgs[0] = add_msg(cache, 5, "later@test", "c@test");
+	assert_descendants(cache, msgs[0], "4");
+	msgs[1] = msgcache_get_msg(cache, 3);
+	assert_descendants(cache, msgs[1], "4,5");
+
+	free_msgs(msgs, 2);
+	msgcache_destroy(cache);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/msgcache/descendants/chain",
+			test_msgcache_descendants_chain);
+	g_test_add_func("/core/msgcache/descendants/loop",
+			test_msgcache_descendants_loop);
+	g_test_add_func("/core/msgcache/descendants/duplicates",
+			test_msgcache_descendants_duplicates);
+	g_test_add_func("/core/msgcache/descendants/rebuild",
+			test_msgcache_descendants_rebuild);
+
+	return g_test_run();
+}
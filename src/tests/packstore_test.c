@@ -0,0 +1,312 @@
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mock_debug_print.h"
+
+#include "packstore.h"
+
+/* the limits in packstore.c that the compaction test works against */
+#define SEGMENT_MAX	(64 << 20)
+#define COMPACT_CHUNK	(1 << 20)
+
+static gchar *tmp_dir;
+
+/* Deterministic contents for message num of the given size */
+static gchar *
+message(guint num, gsize len)
+{
+	gchar *data = g_malloc(len + 1);
+	gsize i;
+
+	for (i = 0; i < len; i++)
+		data[i] = (gchar)(num * 31 + i * 7 + i / 4093);
+	return data;
+}
+
+/* A file in the scratch directory holding message(num, len) */
+static gchar *
+message_file(guint num, gsize len)
+{
+	gchar *path = g_strdup_printf("%s%cmsg.%u", tmp_dir,
+				      G_DIR_SEPARATOR, num);
+	gchar *data = message(num, len);
+
+	g_assert_true(g_file_set_contents(path, data, len, NULL));
+	g_free(data);
+	return path;
+}
+
+static void
+add(PackStore *store, guint num, gsize len)
+{
+	gchar *path = message_file(num, len);
+
+	g_assert_cmpint(pack_store_add_file(store, num, path), ==, 0);
+	g_unlink(path);
+	g_free(path);
+}
+
+/* Checks that num comes back out of store as message(from, len) */
+static void
+check(PackStore *store, guint num, guint from, gsize len)
+{
+	gchar *path = g_strdup_printf("%s%cout", tmp_dir, G_DIR_SEPARATOR);
+	gchar *expected = message(from, len);
+	gchar *data;
+	gsize data_len;
+
+	g_assert_true(pack_store_has(store, num));
+	g_assert_cmpint(pack_store_extract(store, num, path), ==, 0);
+	g_assert_true(g_file_get_contents(path, &data, &data_len, NULL));
+	g_assert_cmpuint(data_len, ==, len);
+	g_assert_true(memcmp(data, expected, len) == 0);
+
+	g_unlink(path);
+	g_free(path);
+	g_free(data);
+	g_free(expected);
+}
+
+static void
+check_missing(PackStore *store, guint num)
+{
+	gchar *path = g_strdup_printf("%s%cout", tmp_dir, G_DIR_SEPARATOR);
+
+	g_assert_false(pack_store_has(store, num));
+	g_assert_cmpint(pack_store_extract(store, num, path), ==, -1);
+	g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+	g_free(path);
+}
+
+static gchar *
+pack_dir(const gchar *name)
+{
+	gchar *dir = g_build_filename(tmp_dir, name, NULL);
+
+	g_assert_cmpint(g_mkdir(dir, 0700), ==, 0);
+	return dir;
+}
+
+static gchar *
+pack_file(const gchar *dir, const gchar *name)
+{
+	return g_build_filename(dir, name, NULL);
+}
+
+/* Empties a pack's directory and removes it */
+static void
+pack_remove(PackStore *store, gchar *dir)
+{
+	gchar *path;
+
+	g_assert_cmpint(pack_store_clear(store), ==, 0);
+	pack_store_close(store);
+	path = pack_file(dir, ".pack.idx");
+	g_unlink(path);
+	g_free(path);
+	g_assert_cmpint(g_rmdir(dir), ==, 0);
+	g_free(dir);
+}
+
+static void
+run_idle(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static void
+test_pack_store_basic(void)
+{
+	gchar *dir = pack_dir("basic");
+	gchar *other_dir = pack_dir("other");
+	PackStore *store, *other;
+	GSList *keep = NULL;
+
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	add(store, 1, 1000);
+	add(store, 2, 0);
+	add(store, 3, 70000);
+	check(store, 1, 1, 1000);
+	check(store, 2, 2, 0);
+	check(store, 3, 3, 70000);
+	check_missing(store, 4);
+
+	/* replacing and removing */
+	add(store, 1, 5000);
+	check(store, 1, 1, 5000);
+	g_assert_cmpint(pack_store_remove(store, 2), ==, 0);
+	check_missing(store, 2);
+	g_assert_cmpint(pack_store_remove(store, 2), ==, 0);
+
+	/* copying between packs, and within one */
+	other = pack_store_open(other_dir);
+	g_assert_nonnull(other);
+	g_assert_cmpint(pack_store_copy(store, 3, other, 30), ==, 0);
+	g_assert_cmpint(pack_store_copy(store, 3, store, 4), ==, 0);
+	g_assert_cmpint(pack_store_copy(store, 2, other, 20), ==, -1);
+	check(other, 30, 3, 70000);
+	check(store, 4, 3, 70000);
+	check(store, 3, 3, 70000);
+	check_missing(other, 20);
+
+	/* all of it survives reopening */
+	pack_store_close(store);
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	check(store, 1, 1, 5000);
+	check_missing(store, 2);
+	check(store, 3, 3, 70000);
+	check(store, 4, 3, 70000);
+
+	keep = g_slist_prepend(keep, GUINT_TO_POINTER(3));
+	keep = g_slist_prepend(keep, GUINT_TO_POINTER(7));
+	g_assert_cmpint(pack_store_remove_not_in_list(store, keep), ==, 0);
+	g_slist_free(keep);
+	check_missing(store, 1);
+	check(store, 3, 3, 70000);
+	check_missing(store, 4);
+
+	pack_store_close(store);
+	store = pack_store_open(dir);
+	check_missing(store, 1);
+	check(store, 3, 3, 70000);
+	check_missing(store, 4);
+
+	run_idle();
+	pack_remove(store, dir);
+	pack_remove(other, other_dir);
+}
+
+/* A compaction that is cut short by closing the pack, with a message
+ * half copied, carries on where it left off once it is reopened */
+static void
+test_pack_store_compact_resume(void)
+{
+	gchar *dir = pack_dir("compact");
+	gchar *seg1 = pack_file(dir, ".pack.1");
+	/* not a multiple of the chunk, so that steps end mid-message */
+	const gsize len = COMPACT_CHUNK + COMPACT_CHUNK / 2;
+	const guint n = SEGMENT_MAX / len + 2;
+	PackStore *store;
+	guint num, i;
+
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	for (num = 1; num <= n; num++)
+		add(store, num, len);
+	/* the first segment was full before the last message */
+	g_assert_true(g_file_test(seg1, G_FILE_TEST_EXISTS));
+
+	/* leave a third of it live, which makes it worth compacting */
+	for (num = 1; num <= n - 2; num++)
+		if (num % 3 != 0)
+			g_assert_cmpint(pack_store_remove(store, num), ==, 0);
+
+	/* a few chunks' worth of steps, then the pack is closed */
+	for (i = 0; i < 4; i++)
+		g_assert_true(g_main_context_iteration(NULL, FALSE));
+	pack_store_close(store);
+	g_assert_false(g_main_context_pending(NULL));
+	g_assert_true(g_file_test(seg1, G_FILE_TEST_EXISTS));
+
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	for (num = 1; num <= n; num++) {
+		if (num % 3 != 0 && num <= n - 2)
+			check_missing(store, num);
+		else
+			check(store, num, num, len);
+	}
+
+	run_idle();
+	g_assert_false(g_file_test(seg1, G_FILE_TEST_EXISTS));
+	for (num = 1; num <= n; num++) {
+		if (num % 3 != 0 && num <= n - 2)
+			check_missing(store, num);
+		else
+			check(store, num, num, len);
+	}
+
+	/* and the moves were logged */
+	pack_store_close(store);
+	store = pack_store_open(dir);
+	for (num = 3; num <= n - 2; num += 3)
+		check(store, num, num, len);
+	check(store, n, n, len);
+
+	pack_remove(store, dir);
+	g_free(seg1);
+}
+
+/* A crash while the index was being appended to leaves a partial record
+ * at its end; the message it was for is lost, the others are kept and
+ * later records line up again */
+static void
+test_pack_store_torn_record(void)
+{
+	gchar *dir = pack_dir("torn");
+	gchar *index = pack_file(dir, ".pack.idx");
+	PackStore *store;
+	GStatBuf st;
+
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	add(store, 1, 3000);
+	add(store, 2, 4000);
+	add(store, 3, 5000);
+	pack_store_close(store);
+
+	g_assert_cmpint(g_stat(index, &st), ==, 0);
+	g_assert_cmpint(truncate(index, st.st_size - 5), ==, 0);
+
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	check(store, 1, 1, 3000);
+	check(store, 2, 2, 4000);
+	check_missing(store, 3);
+
+	add(store, 4, 6000);
+	pack_store_close(store);
+
+	store = pack_store_open(dir);
+	g_assert_nonnull(store);
+	check(store, 1, 1, 3000);
+	check(store, 2, 2, 4000);
+	check_missing(store, 3);
+	check(store, 4, 4, 6000);
+
+	run_idle();
+	pack_remove(store, dir);
+	g_free(index);
+}
+
+int
+main(int argc, char *argv[])
+{
+	gint ret;
+
+	g_test_init(&argc, &argv, NULL);
+
+	tmp_dir = g_dir_make_tmp("packstore_test-XXXXXX", NULL);
+	g_assert_nonnull(tmp_dir);
+
+	g_test_add_func("/core/packstore/basic", test_pack_store_basic);
+	g_test_add_func("/core/packstore/compact_resume",
+			test_pack_store_compact_resume);
+	g_test_add_func("/core/packstore/torn_record",
+			test_pack_store_torn_record);
+
+	ret = g_test_run();
+
+	g_rmdir(tmp_dir);
+	g_free(tmp_dir);
+
+	return ret;
+}
@@ -0,0 +1,273 @@
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mock_debug_print.h"
+
+#include "pop.h"
+#include "utils.h"
+
+#include "script_server.h"
+
+#define MSG_ONE		"Subject: one\r\n\r\n..dotted\r\nbody\r\n.\r\n"
+#define MSG_TWO		"Subject: two\r\n\r\nbody two\r\n.\r\n"
+
+/* the messages as they should be saved */
+#define SAVED_ONE	"Subject: one\n\n.dotted\nbody\n"
+#define SAVED_TWO	"Subject: two\n\nbody two\n"
+
+static GPtrArray *received;
+
+static gint
+drop_message(Pop3Session *session, const gchar *file)
+{
+	gchar *contents;
+
+	g_assert_true(g_file_get_contents(file, &contents, NULL, NULL));
+	g_ptr_array_add(received, contents);
+	g_unlink(file);
+	return 0;
+}
+
+static gint
+recv_msg_notify(Session *session, const gchar *msg, gpointer data)
+{
+	return 0;
+}
+
+static gint
+recv_data_progressive_notify(Session *session, guint cur_len,
+			     guint total_len, gpointer data)
+{
+	return 0;
+}
+
+static gint
+recv_data_notify(Session *session, guint len, gpointer data)
+{
+	return 0;
+}
+
+static gboolean
+pop3_finished(gpointer data)
+{
+	Pop3Session *session = POP3_SESSION(data);
+
+	return session->state == POP3_DONE || session->state == POP3_ERROR ||
+	       !session_is_running(SESSION(session));
+}
+
+/* Fetches everything from a server playing script as userid and checks
+ * that the session ended as expected */
+static void
+fetch(const ScriptStep *script, const gchar *userid, gboolean rmmail)
+{
+	PrefsAccount account;
+	ScriptServer *server;
+	Session *session;
+	gchar *path;
+
+	memset(&account, 0, sizeof(account));
+	account.recv_server = "127.0.0.1";
+	account.userid = (gchar *)userid;
+	account.rmmail = rmmail;
+
+	server = script_server_new(script);
+	session = pop3_session_new(&account);
+	g_assert_nonnull(POP3_SESSION(session)->uidl_store);
+	POP3_SESSION(session)->user = g_strdup(userid);
+	POP3_SESSION(session)->pass = g_strdup("secret");
+	POP3_SESSION(session)->drop_message = drop_message;
+	session_set_recv_message_notify(session, recv_msg_notify, NULL);
+	session_set_recv_data_progressive_notify(session,
+						 recv_data_progressive_notify,
+						 NULL);
+	session_set_recv_data_notify(session, recv_data_notify, NULL);
+
+	received = g_ptr_array_new_with_free_func(g_free);
+	g_assert_cmpint(session_connect(session, "127.0.0.1", server->port),
+			==, 0);
+	script_server_run_until(server, pop3_finished, session);
+	g_assert_cmpint(POP3_SESSION(session)->state, ==, POP3_DONE);
+	g_assert_cmpint(POP3_SESSION(session)->error_val, ==, PS_SUCCESS);
+
+	session_destroy(session);
+	script_server_finish(server);
+
+	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S, "uidl",
+			   G_DIR_SEPARATOR_S, "127.0.0.1-", userid, ".idx",
+			   NULL);
+	g_unlink(path);
+	g_free(path);
+}
+
+static void
+check_received(void)
+{
+	g_assert_cmpuint(received->len, ==, 2);
+	g_assert_cmpstr(g_ptr_array_index(received, 0), ==, SAVED_ONE);
+	g_assert_cmpstr(g_ptr_array_index(received, 1), ==, SAVED_TWO);
+	g_ptr_array_free(received, TRUE);
+	received = NULL;
+}
+
+/* UIDL and LIST go out together, and so do the RETRs, and each batch of
+ * replies comes back in one write */
+static const ScriptStep pipelined[] = {
+	{ SCRIPT_SEND, "+OK ready\r\n" },
+	{ SCRIPT_EXPECT, "USER pipelined" },
+	{ SCRIPT_SEND, "+OK\r\n" },
+	{ SCRIPT_EXPECT, "PASS secret" },
+	{ SCRIPT_SEND, "+OK\r\n" },
+	{ SCRIPT_EXPECT, "CAPA" },
+	{ SCRIPT_SEND, "+OK\r\nTOP\r\nUIDL\r\nPIPELINING\r\n.\r\n" },
+	{ SCRIPT_EXPECT, "STAT" },
+	{ SCRIPT_SEND, "+OK 2 320\r\n" },
+	{ SCRIPT_EXPECT, "UIDL" },
+	{ SCRIPT_EXPECT, "LIST" },
+	{ SCRIPT_SEND, "+OK\r\n1 uid-1\r\n2 uid-2\r\n.\r\n"
+		       "+OK\r\n1 120\r\n2 200\r\n.\r\n" },
+	{ SCRIPT_EXPECT, "RETR 1" },
+	{ SCRIPT_EXPECT, "RETR 2" },
+	{ SCRIPT_SEND, "+OK 120 octets\r\n" MSG_ONE
+		       "+OK 200 octets\r\n" MSG_TWO },
+	{ SCRIPT_EXPECT, "QUIT" },
+	{ SCRIPT_SEND, "+OK bye\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static void
+test_pop3_pipelined(void)
+{
+	fetch(pipelined, "pipelined", FALSE);
+	check_received();
+}
+
+/* Without PIPELINING in CAPA, each command waits for its reply */
+static const ScriptStep lockstep[] = {
+	{ SCRIPT_SEND, "+OK ready\r\n" },
+	{ SCRIPT_EXPECT, "USER lockstep" },
+	{ SCRIPT_SEND, "+OK\r\n" },
+	{ SCRIPT_EXPECT, "PASS secret" },
+	{ SCRIPT_SEND, "+OK\r\n" },
+	{ SCRIPT_EXPECT, "CAPA" },
+	{ SCRIPT_SEND, "+OK\r\nTOP\r\nUIDL\r\nPIPELINING-NOT\r\n.\r\n" },
+	{ SCRIPT_EXPECT, "STAT" },
+	{ SCRIPT_SEND, "+OK 2 320\r\n" },
+	{ SCRIPT_EXPECT, "UIDL" },
+	{ SCRIPT_WAITING },
+	{ SCRIPT_SEND, "+OK\r\n1 uid-1\r\n2 uid-2\r\n.\r\n" },
+	{ SCRIPT_EXPECT, "LIST" },
+	{ SCRIPT_WAITING },
+	{ SCRIPT_SEND, "+OK\r\n1 120\r\n2 200\r\n.\r\n" },
+	{ SCRIPT_EXPECT, "RETR 1" },
+	{ SCRIPT_WAITING },
+	{ SCRIPT_SEND, "+OK 120 octets\r\n" MSG_ONE },
+	{ SCRIPT_EXPECT, "RETR 2" },
+	{ SCRIPT_WAITING },
+	{ SCRIPT_SEND, "+OK 200 octets\r\n" MSG_TWO },
+	{ SCRIPT_EXPECT, "QUIT" },
+	{ SCRIPT_SEND, "+OK bye\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static void
+test_pop3_no_pipelining(void)
+{
+	fetch(lockstep, "lockstep", FALSE);
+	check_received();
+}
+
+/* Pipelined replies broken up across reads: in the middle of status
+ * lines, of listings, of a dot-stuffed line and of the terminators.
+ * The messages are deleted as they come in, so a DELE goes out while
+ * the second RETR is still being answered. */
+static const ScriptStep split[] = {
+	{ SCRIPT_SEND, "+O" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "K ready\r\n" },
+	{ SCRIPT_EXPECT, "USER split" },
+	{ SCRIPT_SEND, "+OK\r" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "\n" },
+	{ SCRIPT_EXPECT, "PASS secret" },
+	{ SCRIPT_SEND, "+OK\r\n" },
+	{ SCRIPT_EXPECT, "CAPA" },
+	{ SCRIPT_SEND, "+OK\r\nUIDL\r\nPIPEL" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "INING\r\n." },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "\r\n" },
+	{ SCRIPT_EXPECT, "STAT" },
+	{ SCRIPT_SEND, "+OK 2 320\r\n" },
+	{ SCRIPT_EXPECT, "UIDL" },
+	{ SCRIPT_EXPECT, "LIST" },
+	{ SCRIPT_SEND, "+OK\r\n1 uid-1\r\n2 ui" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "d-2\r\n.\r" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "\n+OK\r\n1 120\r\n2 200\r\n.\r\n" },
+	{ SCRIPT_EXPECT, "RETR 1" },
+	{ SCRIPT_EXPECT, "RETR 2" },
+	{ SCRIPT_SEND, "+OK 120 octets\r\nSubject: one\r\n\r\n." },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, ".dotted\r\nbody\r\n.\r" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "\n+OK 200" },
+	{ SCRIPT_EXPECT, "DELE 1" },
+	{ SCRIPT_SEND, " octets\r\nSubject: two\r\n\r\nbody two\r\n." },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "\r\n" },
+	{ SCRIPT_EXPECT, "DELE 2" },
+	{ SCRIPT_SEND, "+OK\r\n+O" },
+	{ SCRIPT_PAUSE },
+	{ SCRIPT_SEND, "K\r\n" },
+	{ SCRIPT_EXPECT, "QUIT" },
+	{ SCRIPT_SEND, "+OK bye\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static void
+test_pop3_split_replies(void)
+{
+	fetch(split, "split", TRUE);
+	check_received();
+}
+
+int
+main(int argc, char *argv[])
+{
+	gchar *dir;
+	gchar *path;
+	gint ret;
+
+	g_test_init(&argc, &argv, NULL);
+
+	dir = g_dir_make_tmp("pop3_pipelining_test-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	set_rc_dir(dir);
+	path = g_build_filename(dir, "tmp", NULL);
+	g_assert_cmpint(g_mkdir(path, 0700), ==, 0);
+
+	g_test_add_func("/core/pop3/pipelined", test_pop3_pipelined);
+	g_test_add_func("/core/pop3/no_pipelining", test_pop3_no_pipelining);
+	g_test_add_func("/core/pop3/split_replies", test_pop3_split_replies);
+
+	ret = g_test_run();
+
+	g_rmdir(path);
+	g_free(path);
+	path = g_build_filename(dir, "uidl", NULL);
+	g_rmdir(path);
+	g_free(path);
+	g_rmdir(dir);
+	g_free(dir);
+
+	return ret;
+}
@@ -0,0 +1,421 @@
+#include "config.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mock_debug_print.h"
+
+#include "utils.h"
+#include "procheader.h"
+
+/* The sscanf() cascade procheader_date_parse() used before it got its
+ * own scanner, kept verbatim as the reference to test against. */
+
+static gchar monthstr[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static gint ref_remove_comment_in_date_string(gchar *o_str)
+{
+	gchar str[strlen(o_str)+1];
+	int i, j = 0;
+	int in_comment_nest_level = 0;
+	gboolean flag_escape_backslash = FALSE;
+
+	for (i=0; i < strlen(o_str); i++) {
+		switch (o_str[i]) {
+		case '(':
+			in_comment_nest_level++;
+			if (in_comment_nest_level > 16) {
+				str[j] = '\0';
+				return TRUE;
+			}
+			continue;
+		case '\\':
+			if (in_comment_nest_level > 0) {
+				flag_escape_backslash = TRUE;
+				continue;
+			}
+			break;
+		case ')':
+			if (flag_escape_backslash == TRUE) {
+				flag_escape_backslash = FALSE;
+				continue;
+			}
+			in_comment_nest_level--;
+			if (in_comment_nest_level < 0) {
+				str[j] = '\0';
+				return TRUE;
+			}
+			continue;
+		default:
+			if (in_comment_nest_level > 0) {
+				if (flag_escape_backslash == TRUE)
+					flag_escape_backslash = FALSE;
+				continue;
+			}
+			break;
+		}
+		str[j++] = o_str[i];
+	}
+	str[j] = '\0';
+	strcpy(o_str, str);
+	return TRUE;
+}
+
+
+static gint ref_scan_date_string(const gchar *o_str,
+				gchar *weekday, gint *day,
+				gchar *month, gint *year,
+				gint *hh, gint *mm, gint *ss,
+				gchar *zone)
+{
+	gint result;
+	gint month_n;
+	gint secfract;
+	gint zone1 = 0, zone2 = 0;
+	gchar offset_sign, zonestr[7];
+	gchar sep1;
+
+	if (o_str == NULL)
+		return -1;
+
+	gchar str[strlen(o_str)+1];
+
+	strcpy(str, o_str);
+	if (strchr(str, '(') != NULL)
+		ref_remove_comment_in_date_string(str);
+
+	result = sscanf(str, "%10s %d %9s %d %2d:%2d:%2d %6s",
+			weekday, day, month, year, hh, mm, ss, zone);
+	if (result == 8) return 0;
+
+	/* RFC2822 */
+	result = sscanf(str, "%3s,%d %9s %d %2d:%2d:%2d %6s",
+			weekday, day, month, year, hh, mm, ss, zone);
+	if (result == 8) return 0;
+
+	result = sscanf(str, "%3s %3s %d %2d:%2d:%2d %d %6s",
+			weekday, month, day, hh, mm, ss, year, zone);
+	if (result == 8) return 0;
+
+	result = sscanf(str, "%d %9s %d %2d:%2d:%2d %6s",
+			day, month, year, hh, mm, ss, zone);
+	if (result == 7) return 0;
+
+	*zone = '\0';
+	result = sscanf(str, "%10s %d %9s %d %2d:%2d:%2d",
+			weekday, day, month, year, hh, mm, ss);
+	if (result == 7) return 0;
+
+	result = sscanf(str, "%3s %3s %d %2d:%2d:%2d %d",
+			weekday, month, day, hh, mm, ss, year);
+	if (result == 7) return 0;
+
+	result = sscanf(str, "%d %9s %d %2d:%2d:%2d",
+			day, month, year, hh, mm, ss);
+	if (result == 6) return 0;
+
+	*ss = 0;
+	result = sscanf(str, "%10s %d %9s %d %2d:%2d %6s",
+			weekday, day, month, year, hh, mm, zone);
+	if (result == 7) return 0;
+
+	result = sscanf(str, "%d %9s %d %2d:%2d %5s",
+			day, month, year, hh, mm, zone);
+	if (result == 6) return 0;
+
+	*zone = '\0';
+	result = sscanf(str, "%10s %d %9s %d %2d:%2d",
+			weekday, day, month, year, hh, mm);
+	if (result == 6) return 0;
+
+	result = sscanf(str, "%d %9s %d %2d:%2d",
+			day, month, year, hh, mm);
+	if (result == 5) return 0;
+
+	*weekday = '\0';
+
+	/* RFC3339 subset, with fraction of second */
+	result = sscanf(str, "%4d-%2d-%2d%c%2d:%2d:%2d.%d%6s",
+			year, &month_n, day, &sep1, hh, mm, ss, &secfract, zonestr);
+	if (result == 9
+			&& (sep1 == 'T' || sep1 == 't' || sep1 == ' ')) {
+		if (month_n >= 1 && month_n <= 12) {
+			strncpy2(month, monthstr+((month_n-1)*3), 4);
+			if (zonestr[0] == 'z' || zonestr[0] == 'Z') {
+				strlcat(zone, "+00:00", sizeof(zone));
+			} else if (sscanf(zonestr, "%c%2d:%2d",
+						&offset_sign, &zone1, &zone2) == 3) {
+				strlcat(zone, zonestr, sizeof(zone));
+			}
+			return 0;
+		}
+	}
+
+	/* RFC3339 subset, no fraction of second */
+	result = sscanf(str, "%4d-%2d-%2d%c%2d:%2d:%2d%6s",
+			year, &month_n, day, &sep1, hh, mm, ss, zonestr);
+	if (result == 8
+			&& (sep1 == 'T' || sep1 == 't' || sep1 == ' ')) {
+		if (month_n >= 1 && month_n <= 12) {
+			strncpy2(month, monthstr+((month_n-1)*3), 4);
+			if (zonestr[0] == 'z' || zonestr[0] == 'Z') {
+				strlcat(zone, "+00:00", sizeof(zone));
+			} else if (sscanf(zonestr, "%c%2d:%2d",
+						&offset_sign, &zone1, &zone2) == 3) {
+				strlcat(zone, zonestr, sizeof(zone));
+			}
+			return 0;
+		}
+	}
+
+	*zone = '\0';
+
+	/* RFC3339 subset, no fraction of second, and no timezone offset */
+	/* This particular "subset" is invalid, RFC requires the offset */
+	result = sscanf(str, "%4d-%2d-%2d %2d:%2d:%2d",
+			year, &month_n, day, hh, mm, ss);
+	if (result == 6) {
+		if (1 <= month_n && month_n <= 12) {
+			strncpy2(month, monthstr+((month_n-1)*3), 4);
+			return 0;
+		}
+	}
+
+	/* ISO8601 format with just date (YYYY-MM-DD) */
+	result = sscanf(str, "%4d-%2d-%2d",
+			year, &month_n, day);
+	if (result == 3) {
+		*hh = *mm = *ss = 0;
+		if (1 <= month_n && month_n <= 12) {
+			strncpy2(month, monthstr+((month_n-1)*3), 4);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static time_t ref_date_parse(const gchar *src)
+{
+	gchar weekday[11];
+	gint day;
+	gchar month[10];
+	gint year;
+	gint hh, mm, ss;
+	gchar zone[7];
+	GDateMonth dmonth = G_DATE_BAD_MONTH;
+	gchar *p;
+	time_t timer;
+	struct tm t;
+	time_t tz_offset;
+
+	if (ref_scan_date_string(src, weekday, &day, month, &year,
+				 &hh, &mm, &ss, zone) < 0)
+		return 0;
+
+	month[3] = '\0';
+	for (p = monthstr; *p != '\0'; p += 3) {
+		if (!g_ascii_strncasecmp(p, month, 3)) {
+			dmonth = (gint)(p - monthstr) / 3 + 1;
+			break;
+		}
+	}
+
+	if (year < 1000) {
+		if (year < 50)
+			year += 2000;
+		else
+			year += 1900;
+	}
+
+	t.tm_sec = ss;
+	t.tm_min = mm;
+	t.tm_hour = hh;
+	t.tm_mday = day;
+	t.tm_mon = dmonth - 1;
+	t.tm_year = year - 1900;
+	t.tm_wday = 0;
+	t.tm_yday = 0;
+	t.tm_isdst = -1;
+
+	timer = mktime(&t);
+	tz_offset = remote_tzoffset_sec(zone);
+	if (tz_offset != -1)
+		timer += tzoffset_sec(&timer) - tz_offset;
+
+	return timer;
+}
+
+/* Date headers as found in the wild, including obsolete and broken ones */
+static const gchar *date_corpus[] = {
+	/* RFC 5322 */
+	"Mon, 2 Jan 2006 15:04:05 -0700",
+	"Tue, 1 Jul 2003 10:52:37 +0200",
+	"Fri, 21 Nov 1997 09:55:06 -0600",
+	"Thu, 13 Feb 1969 23:32:54 -0330",
+	"Sat, 29 Feb 2020 00:00:00 +0000",
+	"Sun, 31 Dec 2023 23:59:59 +1400",
+	"Wed, 01 Jan 2025 12:00:00 -1200",
+	"2 Jan 2006 15:04:05 -0700",
+	"02 Jan 2006 15:04 -0700",
+	"Mon, 2 Jan 2006 15:04 -0700",
+	/* comments */
+	"Thu, 4 Jan 2024 15:43:05 -0800 (PST)",
+	"Sun, 3 Mar 2024 18:39:29 +0100 (CET)",
+	"Wed, 17 Jan 2024 09:00:00 +0000 (GMT Standard Time)",
+	"Fri, 13 Mar 2009 12:55:45 +0100 (Westeuropäische Normalzeit)",
+	"Tue, 5 Mar 2024 08:00:00 +0000 (UTC)",
+	"Mon, 2 Jan 2006 (a (nested) comment) 15:04:05 -0700",
+	"Mon, 2 Jan 2006 15:04:05 -0700 (escaped \\) paren)",
+	"Mon, 2 Jan 2006 15:04:05 -0700 (unbalanced",
+	"Mon, 2 Jan 2006 15:04:05 -0700 (UTC))",
+	/* obsolete zones */
+	"Sat, 01 Jan 2000 00:00:00 GMT",
+	"Sat, 01 Jan 2000 00:00:00 UT",
+	"Sat, 01 Jan 2000 00:00:00 UTC",
+	"Mon, 15 Aug 2005 15:52:01 EST",
+	"Mon, 15 Aug 2005 15:52:01 EDT",
+	"Mon, 15 Aug 2005 15:52:01 PDT",
+	"Mon, 15 Aug 2005 15:52:01 cst",
+	"Mon, 15 Aug 2005 15:52:01 Z",
+	"Mon, 15 Aug 2005 15:52:01 A",
+	"Mon, 15 Aug 2005 15:52:01 CET",
+	"1 Jan 2000 00:00 GMT",
+	/* no zone */
+	"Mon, 15 Aug 2005 15:52:01",
+	"Mon, 15 Aug 2005 15:52",
+	"15 Aug 2005 15:52:01",
+	"15 Aug 2005 15:52",
+	/* two-digit and three-digit years */
+	"Tue, 1 Jul 03 10:52:37 +0200",
+	"Fri, 31 Dec 99 23:59:59 -0000",
+	"Sat, 1 Jan 00 00:00:00 +0000",
+	"Sat, 1 Jan 49 00:00:00 +0000",
+	"Sat, 1 Jan 50 00:00:00 +0000",
+	"Thu, 1 Jan 100 00:00:00 +0000",
+	/* odd spelling and spacing */
+	"mon, 2 jan 2006 15:04:05 -0700",
+	"MON, 2 JAN 2006 15:04:05 -0700",
+	"Monday, 2 January 2006 15:04:05 -0700",
+	"Wednesday, 6 September 2006 15:04:05 -0700",
+	"Mon, 2 Sept 2006 15:04:05 -0700",
+	"Mon,  2 Jan 2006 15:04:05 -0700",
+	"  Mon, 2 Jan 2006 15:04:05 -0700",
+	"Mon, 2 Jan 2006 15:04:05 -0700  ",
+	"Mon,\t2 Jan 2006\t15:04:05\t-0700",
+	"Mon,2 Jan 2006 15:04:05 -0700",
+	"Mon, 2 Jan 2006 15:04:05-0700",
+	"Mon, 2 Jan 2006 1:4:5 -0700",
+	"Mon, 2 Jan 2006 15:04: 05 -0700",
+	"Mon, 2 Jan 2006 15:04:05 +0000 GMT",
+	"Mon, 2 Jan 2006 15:04:05 GMT+1",
+	"Mon, 2 Jan 2006 15:04:05 +05:30",
+	"Mon, 2 Jan 2006 15:04:05 -0700 (MST) +0000",
+	"Mon, 2 Jan 2006 15:04:05.123 -0700",
+	"Mon, 2 Jan 2006 15:04:xx -0700",
+	"Mon, 2 Jan 2006 15:04:60 -0700",
+	"Mon, 32 Jan 2006 15:04:05 -0700",
+	"Mon, 2 Foo 2006 15:04:05 -0700",
+	"Mon, 2 Mär 2006 15:04:05 +0100",
+	"Di, 7 Mai 2024 10:00:00 +0200",
+	"Donnerstag, 2 Jan 2006 15:04:05 -0700",
+	/* asctime() */
+	"Mon Jan  2 15:04:05 2006",
+	"Mon Jan 2 15:04:05 2006",
+	"Mon Jan  2 15:04:05 2006 +0000",
+	"Mon Jan  2 15:04:05 2006 UTC",
+	"mon jan 2 15:04:05 06",
+	"Thursday Jan 1 15:04:05 2006",
+	/* RFC 3339 */
+	"2006-01-02T15:04:05Z",
+	"2006-01-02t15:04:05z",
+	"2006-01-02T15:04:05+07:00",
+	"2006-01-02T15:04:05-07:00",
+	"2006-01-02 15:04:05+07:00",
+	"2006-01-02T15:04:05.999999999Z",
+	"2006-01-02T15:04:05.5+07:00",
+	"2006-01-02T15:04:05.123",
+	"2006-01-02T15:04:05-0700",
+	"2006-01-02T15:04:05",
+	"2006-01-02 15:04:05",
+	"2006-01-02  15:04:05",
+	"2006-01-02",
+	"2006-1-2",
+	"2006-13-02T15:04:05Z",
+	"2006-00-02",
+	/* broken */
+	"",
+	"   ",
+	"Mon",
+	"Mon, 2 Jan",
+	"Mon, 2 Jan 2006",
+	"Mon, 2 Jan 2006 15",
+	"15:04:05",
+	"yesterday",
+	"Mon, 2 Jan 2006 15.04.05 -0700",
+	"Mon, 2-Jan-2006 15:04:05 -0700",
+	"02/01/2006 15:04:05",
+	"0Mon, 2 Jan 2006 15:04:05 -0700",
+	"1Mon, 02 Jan 2006 15:04:05 -0700",
+	"Mon,2Jan 2006 15:04:05 -0700",
+	NULL
+};
+
+/* Where the sscanf() cascade got it wrong: it read these as asctime()
+ * dates with day and year swapped, or as junk. Each is checked against
+ * a plainer spelling of the same date instead. */
+static const gchar *date_fixed[][2] = {
+	{ "2 Jan 2006 15:04:05 -0700 (MST) +0000",
+	  "2 Jan 2006 15:04:05 -0700" },
+	{ "2 Jan 2006 15:04:05 +0000 UTC",
+	  "2 Jan 2006 15:04:05 +0000" },
+	{ "2 Jan 2006 15:04:05 +05:30",
+	  "Mon, 2 Jan 2006 15:04:05 +05:30" },
+	{ "2006-1-2 15:04:05 +07:00",
+	  "2006-01-02 15:04:05+07:00" },
+	{ NULL, NULL }
+};
+
+static void
+test_date_parse_differential(void)
+{
+	gint i;
+
+	for (i = 0; date_corpus[i] != NULL; i++) {
+		if (g_test_verbose())
+			g_printerr("date '%s'\n", date_corpus[i]);
+		g_assert_cmpint(procheader_date_parse(NULL, date_corpus[i], 0),
+				==, ref_date_parse(date_corpus[i]));
+	}
+}
+
+static void
+test_date_parse_fixed(void)
+{
+	gint i;
+
+	for (i = 0; date_fixed[i][0] != NULL; i++) {
+		if (g_test_verbose())
+			g_printerr("date '%s'\n", date_fixed[i][0]);
+		g_assert_cmpint(procheader_date_parse(NULL, date_fixed[i][1], 0),
+				!=, 0);
+		g_assert_cmpint(procheader_date_parse(NULL, date_fixed[i][0], 0),
+				==,
+				procheader_date_parse(NULL, date_fixed[i][1], 0));
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/procheader/date_parse_differential",
+			test_date_parse_differential);
+	g_test_add_func("/core/procheader/date_parse_fixed",
+			test_date_parse_fixed);
+
+	return g_test_run();
+}
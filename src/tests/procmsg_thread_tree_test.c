@@ -0,0 +1,342 @@
+#include "config.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mock_debug_print.h"
+
+#include "procmsg.h"
+#include "prefs_common.h"
+
+#define DAY	(24 * 3600)
+
+static MsgInfo *
+msg_new(gint num, const gchar *msgid, const gchar *inreplyto,
+	const gchar *ref, const gchar *subject, time_t date)
+{
+	MsgInfo *msginfo = procmsg_msginfo_new();
+
+	msginfo->msgnum = num;
+	msginfo->msgid = g_strdup(msgid);
+	msginfo->inreplyto = g_strdup(inreplyto);
+	if (ref != NULL)
+		msginfo->references = g_slist_append(NULL, g_strdup(ref));
+	msginfo->subject = g_strdup(subject);
+	msginfo->date_t = date;
+	return msginfo;
+}
+
+/* The message a message is threaded under, NULL at the top */
+static MsgInfo *
+parent_of(GNode *root, MsgInfo *msginfo)
+{
+	GNode *node = g_node_find(root, G_PRE_ORDER, G_TRAVERSE_ALL, msginfo);
+
+	g_assert_nonnull(node);
+	return node->parent == root ? NULL : node->parent->data;
+}
+
+/* Updates tree to mlist and checks that it threads every message the
+ * way procmsg_get_thread_tree() does */
+static GNode *
+update_and_check(MsgThreadTree *tree, GSList *mlist)
+{
+	GNode *root, *ref;
+	GSList *cur;
+
+	root = procmsg_thread_tree_update(tree, mlist);
+	ref = procmsg_get_thread_tree(mlist);
+
+	g_assert_cmpuint(g_node_n_nodes(root, G_TRAVERSE_ALL), ==,
+			 g_node_n_nodes(ref, G_TRAVERSE_ALL));
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = cur->data;
+		MsgInfo *parent = parent_of(root, msginfo);
+		MsgInfo *expected = parent_of(ref, msginfo);
+
+		if (parent != expected)
+			g_test_message("message %d: under %d, expected %d",
+				       msginfo->msgnum,
+				       parent ? parent->msgnum : 0,
+				       expected ? expected->msgnum : 0);
+		g_assert_true(parent == expected);
+	}
+
+	g_node_destroy(ref);
+	return root;
+}
+
+/* Many messages that take no part, so that small changes are threaded
+ * in on their own instead of rethreading everything */
+static GSList *
+filler_list(gint n)
+{
+	GSList *mlist = NULL;
+	gint i;
+
+	for (i = 0; i < n; i++) {
+		gchar *msgid = g_strdup_printf("filler%d@test", i);
+		gchar *subject = g_strdup_printf("filler %d", i);
+
+		mlist = g_slist_prepend(mlist, msg_new(1000 + i, msgid, NULL,
+						       NULL, subject, i));
+		g_free(subject);
+		g_free(msgid);
+	}
+	return g_slist_reverse(mlist);
+}
+
+static void
+test_thread_tree_orphans(void)
+{
+	MsgThreadTree *tree;
+	GSList *mlist = filler_list(20);
+	MsgInfo *top, *reply, *reply2, *grandchild;
+	GNode *root;
+
+	prefs_common.thread_by_subject = FALSE;
+	tree = procmsg_thread_tree_new();
+	update_and_check(tree, mlist);
+
+	/* the replies come first, then what they answer */
+	reply = msg_new(2, "b@test", "a@test", "a@test", "Re: a", 2 * DAY);
+	grandchild = msg_new(3, "c@test", "b@test", "a@test", "Re: a", 3 * DAY);
+	mlist = g_slist_append(mlist, reply);
+	mlist = g_slist_append(mlist, grandchild);
+	root = update_and_check(tree, mlist);
+	g_assert_null(parent_of(root, reply));
+	g_assert_true(parent_of(root, grandchild) == reply);
+
+	top = msg_new(1, "a@test", NULL, NULL, "a", DAY);
+	mlist = g_slist_append(mlist, top);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == top);
+
+	/* with its parent gone, a message falls back to its References */
+	mlist = g_slist_remove(mlist, reply);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, grandchild) == top);
+
+	reply2 = msg_new(4, "b@test", "a@test", NULL, "Re: a", 4 * DAY);
+	mlist = g_slist_append(mlist, reply);
+	mlist = g_slist_append(mlist, reply2);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, grandchild) == reply);
+
+	mlist = g_slist_remove(mlist, top);
+	root = update_and_check(tree, mlist);
+	g_assert_null(parent_of(root, reply));
+	procmsg_msginfo_free(&top);
+
+	procmsg_thread_tree_free(tree);
+	procmsg_msg_list_free(mlist);
+}
+
+static void
+test_thread_tree_subject(void)
+{
+	MsgThreadTree *tree;
+	GSList *mlist = filler_list(20);
+	MsgInfo *first, *same_day, *older, *reply, *late;
+	GNode *root;
+
+	prefs_common.thread_by_subject = TRUE;
+	prefs_common.thread_by_subject_max_age = 10;
+	tree = procmsg_thread_tree_new();
+	update_and_check(tree, mlist);
+
+	first = msg_new(1, "s1@test", NULL, NULL, "topic", 20 * DAY);
+	reply = msg_new(2, "s2@test", NULL, NULL, "Re: topic", 25 * DAY);
+	mlist = g_slist_append(mlist, first);
+	mlist = g_slist_append(mlist, reply);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == first);
+
+	/* of two as old, the one added last wins */
+	same_day = msg_new(3, "s3@test", NULL, NULL, "topic", 20 * DAY);
+	mlist = g_slist_append(mlist, same_day);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == same_day);
+
+	/* an older one takes the reply over */
+	older = msg_new(4, "s4@test", NULL, NULL, "topic", 17 * DAY);
+	mlist = g_slist_append(mlist, older);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == older);
+
+	/* too late to be threaded with the oldest, not with the others */
+	late = msg_new(5, "s5@test", NULL, NULL, "Re: topic", 29 * DAY);
+	mlist = g_slist_append(mlist, late);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, late) == same_day);
+
+	mlist = g_slist_remove(mlist, older);
+	procmsg_msginfo_free(&older);
+	mlist = g_slist_remove(mlist, same_day);
+	procmsg_msginfo_free(&same_day);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == first);
+	g_assert_true(parent_of(root, late) == first);
+
+	/* threading by subject turned off rethreads it all */
+	prefs_common.thread_by_subject = FALSE;
+	root = update_and_check(tree, mlist);
+	g_assert_null(parent_of(root, reply));
+
+	procmsg_thread_tree_free(tree);
+	procmsg_msg_list_free(mlist);
+}
+
+static void
+test_thread_tree_duplicate_msgid(void)
+{
+	MsgThreadTree *tree;
+	GSList *mlist = filler_list(20);
+	MsgInfo *dup1, *dup2, *reply;
+	GNode *root;
+
+	prefs_common.thread_by_subject = FALSE;
+	tree = procmsg_thread_tree_new();
+
+	reply = msg_new(1, "r@test", "d@test", NULL, "Re: d", 3 * DAY);
+	dup1 = msg_new(2, "d@test", NULL, NULL, "d", 2 * DAY);
+	dup2 = msg_new(3, "d@test", NULL, NULL, "d", DAY);
+	mlist = g_slist_append(mlist, reply);
+	update_and_check(tree, mlist);
+
+	mlist = g_slist_append(mlist, dup1);
+	mlist = g_slist_append(mlist, dup2);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == dup1);
+
+	/* the other copy takes its place */
+	mlist = g_slist_remove(mlist, dup1);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == dup2);
+
+	mlist = g_slist_append(mlist, dup1);
+	root = update_and_check(tree, mlist);
+	g_assert_true(parent_of(root, reply) == dup2);
+
+	procmsg_thread_tree_free(tree);
+	procmsg_msg_list_free(mlist);
+}
+
+#define RANDOM_MSGS	60
+
+static gchar *
+random_ref(GRand *rand, gint i)
+{
+	gint j = g_rand_int_range(rand, 0, i + 3);
+
+	/* only ever older messages, which keeps the threads free of
+	 * loops, or one that is not there */
+	return j < i ? g_strdup_printf("m%d@test", j) : g_strdup("none@test");
+}
+
+static void
+random_msgs(GRand *rand, MsgInfo **msgs)
+{
+	static const gchar *subjects[] = { "one", "two", "three" };
+	gint i;
+
+	for (i = 0; i < RANDOM_MSGS; i++) {
+		MsgInfo *msginfo = procmsg_msginfo_new();
+		const gchar *subject;
+
+		msginfo->msgnum = i + 1;
+		/* dates increase with i and some are the same */
+		msginfo->date_t = (time_t)(i / 2) * (DAY / 2);
+		msgs[i] = msginfo;
+
+		if (i > 0 && g_rand_int_range(rand, 0, 6) == 0) {
+			/* a copy of an older one */
+			msginfo->msgid = g_strdup(msgs[g_rand_int_range(rand, 0, i)]->msgid);
+			continue;
+		}
+		if (g_rand_int_range(rand, 0, 10) != 0)
+			msginfo->msgid = g_strdup_printf("m%d@test", i);
+		if (g_rand_boolean(rand))
+			msginfo->inreplyto = random_ref(rand, i);
+		if (g_rand_boolean(rand))
+			msginfo->references = g_slist_append(msginfo->references,
+							     random_ref(rand, i));
+		if (g_rand_int_range(rand, 0, 3) == 0)
+			msginfo->references = g_slist_append(msginfo->references,
+							     random_ref(rand, i));
+		if (g_rand_int_range(rand, 0, 10) == 0)
+			continue;
+		subject = subjects[g_rand_int_range(rand, 0, G_N_ELEMENTS(subjects))];
+		msginfo->subject = g_rand_boolean(rand) ?
+			g_strconcat("Re: ", subject, NULL) : g_strdup(subject);
+	}
+}
+
+static void
+test_thread_tree_random(void)
+{
+	MsgInfo *msgs[RANDOM_MSGS];
+	GRand *rand = g_rand_new_with_seed(1);
+	gint round, step, i;
+
+	for (round = 0; round < 200; round++) {
+		MsgThreadTree *tree;
+		GSList *mlist = NULL;
+		gboolean in[RANDOM_MSGS] = { FALSE };
+
+		prefs_common.thread_by_subject = g_rand_int_range(rand, 0, 4) != 0;
+		prefs_common.thread_by_subject_max_age = g_rand_int_range(rand, 1, 4);
+		random_msgs(rand, msgs);
+		tree = procmsg_thread_tree_new();
+
+		for (step = 0; step < 40; step++) {
+			gint n = g_rand_int_range(rand, 1, 4);
+
+			/* new messages go to the end of the list, as they
+			 * are added to the tree */
+			if (g_rand_int_range(rand, 0, 5) < 3) {
+				while (n-- > 0) {
+					i = g_rand_int_range(rand, 0, RANDOM_MSGS);
+					if (!in[i])
+						mlist = g_slist_append(mlist, msgs[i]);
+					in[i] = TRUE;
+				}
+			} else {
+				while (n-- > 0) {
+					i = g_rand_int_range(rand, 0, RANDOM_MSGS);
+					if (in[i])
+						mlist = g_slist_remove(mlist, msgs[i]);
+					in[i] = FALSE;
+				}
+			}
+			update_and_check(tree, mlist);
+		}
+
+		procmsg_thread_tree_free(tree);
+		g_slist_free(mlist);
+		for (i = 0; i < RANDOM_MSGS; i++) {
+			g_assert_cmpint(msgs[i]->refcnt, ==, 1);
+			procmsg_msginfo_free(&msgs[i]);
+		}
+	}
+
+	g_rand_free(rand);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/procmsg/thread_tree/orphans",
+			test_thread_tree_orphans);
+	g_test_add_func("/core/procmsg/thread_tree/subject",
+			test_thread_tree_subject);
+	g_test_add_func("/core/procmsg/thread_tree/duplicate_msgid",
+			test_thread_tree_duplicate_msgid);
+	g_test_add_func("/core/procmsg/thread_tree/random",
+			test_thread_tree_random);
+
+	return g_test_run();
+}
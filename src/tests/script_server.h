@@ -0,0 +1,304 @@
+/* A server on the loopback interface that plays a script against the
+ * one client that connects to it, for the protocol tests. It sends
+ * what the script says, reads the client's lines and checks them
+ * against the patterns the script expects, in order. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* how long the server waits for the client, and a test for the server */
+#define SCRIPT_TIMEOUT_MS	10000
+
+typedef struct _ScriptServer	ScriptServer;
+typedef struct _ScriptStep	ScriptStep;
+
+typedef gboolean (*ScriptFunc)	(ScriptServer	*server,
+				 gpointer	 data);
+
+typedef enum {
+	SCRIPT_SEND,	/* send text as it is */
+	SCRIPT_REPLY,	/* send text after the tag of the last command read */
+	SCRIPT_EXPECT,	/* read a line, CRLF left out, matching the glob text */
+	SCRIPT_PAUSE,	/* let the client read what was sent so far alone */
+	SCRIPT_WAITING,	/* expect the client to send nothing before a reply */
+	SCRIPT_CALL,	/* run func, which reads and sends on its own */
+	SCRIPT_EOF,	/* expect the client to close the connection */
+	SCRIPT_END
+} ScriptOp;
+
+struct _ScriptStep
+{
+	ScriptOp op;
+	const gchar *text;
+	ScriptFunc func;
+	gpointer data;
+};
+
+struct _ScriptServer
+{
+	const ScriptStep *script;
+	gint listen_fd;
+	gint fd;
+	gushort port;
+	GThread *thread;
+
+	GString *in;
+	gchar *tag;
+
+	/* set once the thread is done, with error NULL if it all matched */
+	gint done;
+	gchar *error;
+};
+
+void script_server_fail(ScriptServer *server, const gchar *format, ...)
+{
+	va_list args;
+
+	if (server->error != NULL)
+		return;
+	va_start(args, format);
+	server->error = g_strdup_vprintf(format, args);
+	va_end(args);
+}
+
+/* Reads more of what the client sent into server->in; FALSE on EOF,
+ * error or timeout. */
+static gboolean script_server_fill(ScriptServer *server)
+{
+	struct pollfd pfd;
+	gchar buf[4096];
+	gssize len;
+
+	pfd.fd = server->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, SCRIPT_TIMEOUT_MS) <= 0)
+		return FALSE;
+	if ((len = read(server->fd, buf, sizeof(buf))) <= 0)
+		return FALSE;
+	g_string_append_len(server->in, buf, len);
+	return TRUE;
+}
+
+/* The next line from the client without its CRLF, or NULL if the
+ * connection ended first. */
+gchar *script_server_read_line(ScriptServer *server)
+{
+	gchar *nl;
+	gchar *line;
+
+	while ((nl = memchr(server->in->str, '\n', server->in->len)) == NULL)
+		if (!script_server_fill(server))
+			return NULL;
+
+	line = g_strndup(server->in->str, nl - server->in->str);
+	g_string_erase(server->in, 0, nl - server->in->str + 1);
+	g_strchomp(line);
+	return line;
+}
+
+/* Exactly len bytes from the client, or NULL if they did not come. */
+gchar *script_server_read(ScriptServer *server, gsize len)
+{
+	gchar *data;
+
+	while (server->in->len < len)
+		if (!script_server_fill(server))
+			return NULL;
+
+	data = g_strndup(server->in->str, len);
+	g_string_erase(server->in, 0, len);
+	return data;
+}
+
+gboolean script_server_send(ScriptServer *server, const gchar *text)
+{
+	gsize len = strlen(text);
+	gssize n;
+
+	while (len > 0) {
+		if ((n = write(server->fd, text, len)) < 0) {
+			script_server_fail(server, "write: %s", g_strerror(errno));
+			return FALSE;
+		}
+		text += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+static gboolean script_server_expect(ScriptServer *server,
+				     const gchar *pattern)
+{
+	gchar *line = script_server_read_line(server);
+	gchar *p;
+
+	if (line == NULL) {
+		script_server_fail(server, "expected \"%s\", got nothing",
+				   pattern);
+		return FALSE;
+	}
+	if (!g_pattern_match_simple(pattern, line)) {
+		script_server_fail(server, "expected \"%s\", got \"%s\"",
+				   pattern, line);
+		g_free(line);
+		return FALSE;
+	}
+
+	/* an IMAP continuation such as DONE carries no tag */
+	if ((p = strchr(line, ' ')) != NULL) {
+		*p = '\0';
+		g_free(server->tag);
+		server->tag = line;
+	} else
+		g_free(line);
+	return TRUE;
+}
+
+static gboolean script_server_step(ScriptServer *server,
+				   const ScriptStep *step)
+{
+	struct pollfd pfd;
+	gchar *text;
+	gboolean ok;
+
+	switch (step->op) {
+	case SCRIPT_SEND:
+		return script_server_send(server, step->text);
+	case SCRIPT_REPLY:
+		text = g_strconcat(server->tag ? server->tag : "*", " ",
+				   step->text, NULL);
+		ok = script_server_send(server, text);
+		g_free(text);
+		return ok;
+	case SCRIPT_EXPECT:
+		return script_server_expect(server, step->text);
+	case SCRIPT_PAUSE:
+		g_usleep(100 * 1000);
+		return TRUE;
+	case SCRIPT_WAITING:
+		pfd.fd = server->fd;
+		pfd.events = POLLIN;
+		if (server->in->len > 0 || poll(&pfd, 1, 100) > 0) {
+			script_server_fail(server, "client did not wait");
+			return FALSE;
+		}
+		return TRUE;
+	case SCRIPT_CALL:
+		return step->func(server, step->data);
+	case SCRIPT_EOF:
+		if (server->in->len > 0 || script_server_fill(server)) {
+			script_server_fail(server, "expected EOF, got \"%.*s\"",
+					   (gint)server->in->len,
+					   server->in->str);
+			return FALSE;
+		}
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static gpointer script_server_thread(gpointer data)
+{
+	ScriptServer *server = data;
+	const ScriptStep *step;
+	struct pollfd pfd;
+
+	pfd.fd = server->listen_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, SCRIPT_TIMEOUT_MS) <= 0 ||
+	    (server->fd = accept(server->listen_fd, NULL, NULL)) < 0) {
+		script_server_fail(server, "no client connected");
+		g_atomic_int_set(&server->done, 1);
+		return NULL;
+	}
+
+	for (step = server->script; step->op != SCRIPT_END; step++)
+		if (!script_server_step(server, step)) {
+			/* the connection is kept so that the client does not
+			 * fail on it before the test can report why */
+			script_server_fail(server, "step %d failed",
+					   (gint)(step - server->script));
+			g_atomic_int_set(&server->done, 1);
+			return NULL;
+		}
+
+	close(server->fd);
+	server->fd = -1;
+	g_atomic_int_set(&server->done, 1);
+	return NULL;
+}
+
+/* Starts playing script to the first client to connect to the port
+ * returned in server->port. */
+ScriptServer *script_server_new(const ScriptStep *script)
+{
+	ScriptServer *server = g_new0(ScriptServer, 1);
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	server->script = script;
+	server->fd = -1;
+	server->in = g_string_new(NULL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	g_assert_cmpint(server->listen_fd, >=, 0);
+	g_assert_cmpint(bind(server->listen_fd, (struct sockaddr *)&addr,
+			     sizeof(addr)), ==, 0);
+	g_assert_cmpint(listen(server->listen_fd, 1), ==, 0);
+	g_assert_cmpint(getsockname(server->listen_fd,
+				    (struct sockaddr *)&addr, &len), ==, 0);
+	server->port = ntohs(addr.sin_port);
+
+	server->thread = g_thread_new("script_server", script_server_thread,
+				      server);
+	return server;
+}
+
+static gboolean script_server_tick(gpointer data)
+{
+	return TRUE;
+}
+
+/* Runs the main loop until done(data), failing the test if that takes
+ * too long or the server gives up on the client first. */
+void script_server_run_until(ScriptServer *server,
+			     gboolean (*done)(gpointer data), gpointer data)
+{
+	gint64 end = g_get_monotonic_time() + SCRIPT_TIMEOUT_MS * 2 * 1000;
+	guint tick = g_timeout_add(100, script_server_tick, NULL);
+
+	while (!done(data)) {
+		g_assert_cmpint(g_get_monotonic_time(), <, end);
+		if (g_atomic_int_get(&server->done) && server->error != NULL)
+			break;
+		g_main_context_iteration(NULL, TRUE);
+	}
+	g_source_remove(tick);
+	g_assert_cmpstr(server->error, ==, NULL);
+}
+
+/* Waits for the script to end, checks that it all went as expected
+ * and frees server. */
+void script_server_finish(ScriptServer *server)
+{
+	g_thread_join(server->thread);
+	g_assert_cmpstr(server->error, ==, NULL);
+
+	if (server->fd >= 0)
+		close(server->fd);
+	close(server->listen_fd);
+	g_string_free(server->in, TRUE);
+	g_free(server->tag);
+	g_free(server);
+}
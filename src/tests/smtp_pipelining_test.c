@@ -0,0 +1,278 @@
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock_debug_print.h"
+
+#include "smtp.h"
+
+#include "script_server.h"
+
+/* what the server got through BDAT, and in how many chunks */
+static GString *bdat_data;
+static gint bdat_chunks;
+
+static gint
+recv_msg_notify(Session *session, const gchar *msg, gpointer data)
+{
+	return 0;
+}
+
+static gint
+send_data_progressive_notify(Session *session, guint cur_len,
+			     guint total_len, gpointer data)
+{
+	return 0;
+}
+
+static gint
+send_data_notify(Session *session, guint len, gpointer data)
+{
+	return 0;
+}
+
+static gboolean
+smtp_finished(gpointer data)
+{
+	SMTPSession *session = SMTP_SESSION(data);
+
+	return session->state == SMTP_MAIL_SENT_OK ||
+	       !session_is_running(SESSION(session));
+}
+
+static gboolean
+smtp_disconnected(gpointer data)
+{
+	return !session_is_connected(SESSION(data));
+}
+
+/* Writes a message to a temporary file, open at its start, and sets
+ * *wire to what should go out for it without dot stuffing. */
+static FILE *
+make_message(gint lines, gchar **wire)
+{
+	GString *str = g_string_new("From: from@example.com\r\n"
+				    "Subject: test\r\n"
+				    "\r\n");
+	FILE *fp = tmpfile();
+	gint i;
+
+	g_assert_nonnull(fp);
+	fputs("From: from@example.com\n"
+	      "Bcc: hidden@example.com\n"
+	      "Subject: test\n"
+	      "\n", fp);
+	for (i = 0; i < lines; i++) {
+		/* every so often a line that DATA would have to dot-stuff */
+		const gchar *fmt = i % 100 == 0 ?
+			".line %06d of the body, long enough to fill the chunks" :
+			"line %06d of the body, long enough to fill the chunks";
+
+		fprintf(fp, fmt, i);
+		fputc('\n', fp);
+		g_string_append_printf(str, fmt, i);
+		g_string_append(str, "\r\n");
+	}
+	rewind(fp);
+
+	*wire = g_string_free(str, FALSE);
+	return fp;
+}
+
+static SMTPSession *
+smtp_start(ScriptServer *server, FILE *fp, GSList *to_list)
+{
+	Session *session = smtp_session_new(NULL);
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+
+	smtp_session->hostname = g_strdup("client.example.com");
+	smtp_session->from = g_strdup("from@example.com");
+	smtp_session->to_list = to_list;
+	smtp_session->cur_to = to_list;
+	g_assert_cmpint(smtp_set_message(smtp_session, fp), ==, 0);
+
+	session_set_recv_message_notify(session, recv_msg_notify, NULL);
+	session_set_send_data_progressive_notify(session,
+						 send_data_progressive_notify,
+						 NULL);
+	session_set_send_data_notify(session, send_data_notify, NULL);
+
+	g_assert_cmpint(session_connect(session, "127.0.0.1", server->port),
+			==, 0);
+	return smtp_session;
+}
+
+/* MAIL FROM, both RCPT TOs and DATA come before any reply, and the
+ * rejected recipient ends the transaction before any data is sent */
+static const ScriptStep rejected_rcpt[] = {
+	{ SCRIPT_SEND, "220 localhost ESMTP ready\r\n" },
+	{ SCRIPT_EXPECT, "EHLO client.example.com" },
+	{ SCRIPT_SEND, "250-localhost\r\n"
+		       "250-PIPELINING\r\n"
+		       "250 SIZE 10000000\r\n" },
+	{ SCRIPT_EXPECT, "MAIL FROM:<from@example.com> SIZE=*" },
+	{ SCRIPT_EXPECT, "RCPT TO:<to@example.com>" },
+	{ SCRIPT_EXPECT, "RCPT TO:<nobody@example.com>" },
+	{ SCRIPT_EXPECT, "DATA" },
+	{ SCRIPT_SEND, "250 2.1.0 sender ok\r\n"
+		       "250 2.1.5 recipient ok\r\n"
+		       "550 5.1.1 no such user\r\n"
+		       "354 go ahead\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static void
+test_smtp_rejected_rcpt(void)
+{
+	ScriptServer *server;
+	SMTPSession *session;
+	GSList *to_list = NULL;
+	gchar *wire;
+	FILE *fp;
+
+	to_list = g_slist_append(to_list, "to@example.com");
+	to_list = g_slist_append(to_list, "nobody@example.com");
+	fp = make_message(10, &wire);
+
+	server = script_server_new(rejected_rcpt);
+	session = smtp_start(server, fp, to_list);
+	script_server_run_until(server, smtp_finished, session);
+
+	g_assert_cmpint(session->state, ==, SMTP_ERROR);
+	g_assert_cmpint(session->error_val, ==, SM_ERROR);
+	g_assert_cmpstr(session->error_msg, ==, "550 5.1.1 no such user");
+	g_assert_cmpuint(session->send_data_sent, ==, 0);
+
+	/* closing the connection is the only thing left to do */
+	session_destroy(SESSION(session));
+	script_server_finish(server);
+
+	g_slist_free(to_list);
+	g_free(wire);
+	fclose(fp);
+}
+
+/* Reads BDAT chunks up to the LAST one, acknowledging each */
+static gboolean
+read_bdat(ScriptServer *server, gpointer data)
+{
+	gboolean last = FALSE;
+
+	while (!last) {
+		gchar *line = script_server_read_line(server);
+		gchar *chunk;
+		gchar *end;
+		gsize len;
+		gchar *reply;
+
+		if (line == NULL || strncmp(line, "BDAT ", 5) != 0) {
+			script_server_fail(server, "expected BDAT, got \"%s\"",
+					   line ? line : "nothing");
+			g_free(line);
+			return FALSE;
+		}
+		len = strtoul(line + 5, &end, 10);
+		last = strcmp(end, " LAST") == 0;
+		if (!last && *end != '\0') {
+			script_server_fail(server, "bad BDAT \"%s\"", line);
+			g_free(line);
+			return FALSE;
+		}
+		g_free(line);
+
+		if ((chunk = script_server_read(server, len)) == NULL) {
+			script_server_fail(server, "short chunk");
+			return FALSE;
+		}
+		g_string_append_len(bdat_data, chunk, len);
+		g_free(chunk);
+		bdat_chunks++;
+
+		/* the next chunk must wait for this reply */
+		if (!last && !script_server_step(server,
+				&(ScriptStep){ SCRIPT_WAITING }))
+			return FALSE;
+
+		reply = g_strdup_printf("250 2.0.0 %" G_GSIZE_FORMAT
+					" octets received\r\n", len);
+		if (!script_server_send(server, reply)) {
+			g_free(reply);
+			return FALSE;
+		}
+		g_free(reply);
+	}
+	return TRUE;
+}
+
+/* A message of more than one chunk goes out in BDATs without DATA */
+static const ScriptStep chunked[] = {
+	{ SCRIPT_SEND, "220 localhost ESMTP ready\r\n" },
+	{ SCRIPT_EXPECT, "EHLO client.example.com" },
+	{ SCRIPT_SEND, "250-localhost\r\n"
+		       "250-PIPELINING\r\n"
+		       "250-CHUNKING\r\n"
+		       "250 SIZE 10000000\r\n" },
+	{ SCRIPT_EXPECT, "MAIL FROM:<from@example.com> SIZE=*" },
+	{ SCRIPT_EXPECT, "RCPT TO:<to@example.com>" },
+	{ SCRIPT_SEND, "250 2.1.0 sender ok\r\n"
+		       "250 2.1.5 recipient ok\r\n" },
+	{ SCRIPT_CALL, NULL, read_bdat },
+	{ SCRIPT_EXPECT, "QUIT" },
+	{ SCRIPT_SEND, "221 2.0.0 bye\r\n" },
+	{ SCRIPT_EOF },
+	{ SCRIPT_END }
+};
+
+static void
+test_smtp_bdat(void)
+{
+	ScriptServer *server;
+	SMTPSession *session;
+	GSList *to_list = NULL;
+	gchar *wire;
+	FILE *fp;
+
+	to_list = g_slist_append(to_list, "to@example.com");
+	/* a little over two chunks */
+	fp = make_message(2 * SMTP_SEND_CHUNK / 50, &wire);
+	g_assert_cmpuint(strlen(wire), >, 2 * SMTP_SEND_CHUNK);
+	bdat_data = g_string_new(NULL);
+	bdat_chunks = 0;
+
+	server = script_server_new(chunked);
+	session = smtp_start(server, fp, to_list);
+	script_server_run_until(server, smtp_finished, session);
+	g_assert_cmpint(session->state, ==, SMTP_MAIL_SENT_OK);
+	g_assert_cmpint(session->error_val, ==, SM_OK);
+	g_assert_cmpuint(session->send_data_sent, >, strlen(wire));
+
+	smtp_quit(session);
+	script_server_run_until(server, smtp_disconnected, session);
+	session_destroy(SESSION(session));
+	script_server_finish(server);
+
+	g_assert_cmpint(bdat_chunks, ==, 3);
+	g_assert_cmpuint(bdat_data->len, ==, strlen(wire));
+	g_assert_true(strcmp(bdat_data->str, wire) == 0);
+
+	g_string_free(bdat_data, TRUE);
+	g_slist_free(to_list);
+	g_free(wire);
+	fclose(fp);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/smtp/rejected_rcpt", test_smtp_rejected_rcpt);
+	g_test_add_func("/core/smtp/bdat", test_smtp_bdat);
+
+	return g_test_run();
+}
@@ -0,0 +1,298 @@
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "mock_debug_print.h"
+
+#include "uidlstore.h"
+#include "utils.h"
+
+#include "../common/tests/mock_prefs_common_get_use_shred.h"
+#include "../common/tests/mock_prefs_common_get_flush_metadata.h"
+
+/* a header and the smallest table of 1024 slots, with no records */
+#define EMPTY_STORE_SIZE	(24 + 1024 * 4)
+
+/* the writes the store has made, counted in place of the C library's */
+static gint pwrites;
+
+ssize_t
+pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	pwrites++;
+	return syscall(SYS_pwrite64, fd, buf, count, offset);
+}
+
+static gchar *
+uidl_at(gint i)
+{
+	return g_strdup_printf("%d.uidl", i);
+}
+
+static gchar *
+store_path(void)
+{
+	gchar *dir = g_dir_make_tmp("uidlstore_test-XXXXXX", NULL);
+	gchar *path;
+
+	g_assert_nonnull(dir);
+	path = g_build_filename(dir, "uidl", "server-user", NULL);
+	g_free(dir);
+	return path;
+}
+
+static void
+remove_store(gchar *path)
+{
+	gchar *dir = g_path_get_dirname(path);
+	gchar *top = g_path_get_dirname(dir);
+
+	g_unlink(path);
+	g_rmdir(dir);
+	g_rmdir(top);
+	g_free(top);
+	g_free(dir);
+	g_free(path);
+}
+
+static void
+add_uidls(UIDLStore *store, gint first, gint n)
+{
+	gint i;
+
+	for (i = first; i < first + n; i++) {
+		gchar *uidl = uidl_at(i);
+
+		g_assert_cmpint(uidl_store_set(store, uidl, 1000 + i, i % 3), ==, 0);
+		g_free(uidl);
+	}
+}
+
+static void
+check_uidls(UIDLStore *store, gint first, gint n, gboolean present)
+{
+	time_t recv_time;
+	gint partial_recv;
+	gint i;
+
+	for (i = first; i < first + n; i++) {
+		gchar *uidl = uidl_at(i);
+
+		g_assert_cmpint(uidl_store_lookup(store, uidl, &recv_time,
+						  &partial_recv), ==, present);
+		if (present) {
+			g_assert_cmpint(recv_time, ==, 1000 + i);
+			g_assert_cmpint(partial_recv, ==, i % 3);
+		}
+		g_free(uidl);
+	}
+}
+
+static gsize
+file_size(const gchar *path)
+{
+	GStatBuf st;
+
+	g_assert_cmpint(g_stat(path, &st), ==, 0);
+	return st.st_size;
+}
+
+static void
+test_uidl_store_reopen(void)
+{
+	gchar *path = store_path();
+	UIDLStore *store;
+	gboolean created;
+	time_t recv_time;
+	gint partial_recv;
+
+	store = uidl_store_open(path, &created);
+	g_assert_nonnull(store);
+	g_assert_true(created);
+	g_assert_cmpuint(file_size(path), ==, EMPTY_STORE_SIZE);
+
+	/* enough to grow the table past its first size */
+	add_uidls(store, 0, 1500);
+	check_uidls(store, 0, 1500, TRUE);
+	check_uidls(store, 1500, 10, FALSE);
+	g_assert_cmpint(uidl_store_set(store, "0.uidl-updated", 5, 1), ==, 0);
+	g_assert_cmpint(uidl_store_set(store, "0.uidl-updated", 6, 2), ==, 0);
+	uidl_store_close(store);
+
+	store = uidl_store_open(path, &created);
+	g_assert_nonnull(store);
+	g_assert_false(created);
+	check_uidls(store, 0, 1500, TRUE);
+	g_assert_cmpint(uidl_store_remove(store, "0.uidl-updated"), ==, 0);
+	g_assert_cmpint(uidl_store_remove(store, "not-there"), ==, 0);
+	uidl_store_close(store);
+
+	store = uidl_store_open(path, &created);
+	g_assert_false(created);
+	check_uidls(store, 0, 1500, TRUE);
+	g_assert_false(uidl_store_lookup(store, "0.uidl-updated", &recv_time,
+					 &partial_recv));
+	uidl_store_close(store);
+
+	remove_store(path);
+}
+
+static void
+test_uidl_store_prune(void)
+{
+	gchar *path = store_path();
+	UIDLStore *store;
+	gboolean created;
+
+	store = uidl_store_open(path, &created);
+	add_uidls(store, 0, 300);
+	uidl_store_close(store);
+
+	/* the server only has the first 100 and 50 new ones now */
+	store = uidl_store_open(path, &created);
+	check_uidls(store, 0, 100, TRUE);
+	add_uidls(store, 300, 50);
+	g_assert_cmpint(uidl_store_prune(store), ==, 0);
+	check_uidls(store, 100, 200, FALSE);
+	uidl_store_close(store);
+
+	store = uidl_store_open(path, &created);
+	g_assert_false(created);
+	check_uidls(store, 0, 100, TRUE);
+	check_uidls(store, 100, 200, FALSE);
+	check_uidls(store, 300, 50, TRUE);
+	uidl_store_close(store);
+
+	/* nothing looked up is gone from the server; the tombstones then
+	 * outnumber the records and the file is compacted */
+	store = uidl_store_open(path, &created);
+	g_assert_cmpint(uidl_store_prune(store), ==, 0);
+	uidl_store_close(store);
+	g_assert_cmpuint(file_size(path), ==, EMPTY_STORE_SIZE);
+
+	store = uidl_store_open(path, &created);
+	g_assert_false(created);
+	check_uidls(store, 0, 350, FALSE);
+	uidl_store_close(store);
+
+	remove_store(path);
+}
+
+/* Setting a message to what the store already has writes nothing, but
+ * still counts as seeing it */
+static void
+test_uidl_store_unchanged(void)
+{
+	gchar *path = store_path();
+	UIDLStore *store;
+	gboolean created;
+
+	store = uidl_store_open(path, &created);
+	add_uidls(store, 0, 200);
+	uidl_store_close(store);
+
+	store = uidl_store_open(path, &created);
+	pwrites = 0;
+	add_uidls(store, 0, 100);
+	g_assert_cmpint(pwrites, ==, 0);
+
+	/* a changed record is written in place, in one go */
+	g_assert_cmpint(uidl_store_set(store, "5.uidl", 1005, 0), ==, 0);
+	g_assert_cmpint(uidl_store_set(store, "6.uidl", 7, 0), ==, 0);
+	g_assert_cmpint(pwrites, ==, 2);
+
+	g_assert_cmpint(uidl_store_prune(store), ==, 0);
+	uidl_store_close(store);
+
+	store = uidl_store_open(path, &created);
+	check_uidls(store, 0, 5, TRUE);
+	check_uidls(store, 7, 93, TRUE);
+	check_uidls(store, 100, 100, FALSE);
+	uidl_store_close(store);
+
+	remove_store(path);
+}
+
+static void
+test_uidl_store_crash(void)
+{
+	gchar *path = store_path();
+	UIDLStore *store;
+	gboolean created;
+	gchar *image;
+	gsize len;
+
+	/* records appended while the header still says the store is
+	 * empty, as if the process died before closing it */
+	store = uidl_store_open(path, &created);
+	add_uidls(store, 0, 400);
+	g_assert_true(g_file_get_contents(path, &image, &len, NULL));
+	uidl_store_close(store);
+	g_assert_true(g_file_set_contents(path, image, len, NULL));
+	g_free(image);
+
+	store = uidl_store_open(path, &created);
+	g_assert_false(created);
+	check_uidls(store, 0, 400, TRUE);
+	uidl_store_close(store);
+
+	/* none of them is on the server any more: with the counts right,
+	 * pruning sees that the file is all tombstones and compacts it */
+	store = uidl_store_open(path, &created);
+	g_assert_cmpint(uidl_store_prune(store), ==, 0);
+	uidl_store_close(store);
+	g_assert_cmpuint(file_size(path), ==, EMPTY_STORE_SIZE);
+
+	store = uidl_store_open(path, &created);
+	check_uidls(store, 0, 400, FALSE);
+	add_uidls(store, 400, 10);
+	uidl_store_close(store);
+
+	store = uidl_store_open(path, &created);
+	check_uidls(store, 400, 10, TRUE);
+	uidl_store_close(store);
+
+	remove_store(path);
+}
+
+static void
+test_uidl_store_damaged(void)
+{
+	gchar *path = store_path();
+	UIDLStore *store;
+	gboolean created;
+
+	store = uidl_store_open(path, &created);
+	add_uidls(store, 0, 10);
+	uidl_store_close(store);
+
+	g_assert_true(g_file_set_contents(path, "not a store", -1, NULL));
+	g_test_expect_message(NULL, G_LOG_LEVEL_WARNING, "*is damaged*");
+	store = uidl_store_open(path, &created);
+	g_test_assert_expected_messages();
+	g_assert_nonnull(store);
+	g_assert_true(created);
+	check_uidls(store, 0, 10, FALSE);
+	uidl_store_close(store);
+
+	remove_store(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/uidlstore/reopen", test_uidl_store_reopen);
+	g_test_add_func("/core/uidlstore/prune", test_uidl_store_prune);
+	g_test_add_func("/core/uidlstore/unchanged",
+			test_uidl_store_unchanged);
+	g_test_add_func("/core/uidlstore/crash", test_uidl_store_crash);
+	g_test_add_func("/core/uidlstore/damaged", test_uidl_store_damaged);
+
+	return g_test_run();
+}
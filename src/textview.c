@@ -1036,6 +1036,127 @@ static void textview_show_html(TextView *textview, FILE *fp,
 	sc_html_parser_destroy(parser);
 }
 
+/* Case-insensitive multi-needle search for the URI parse tables below,
+ * an Aho-Corasick automaton so a line is scanned once for all needles
+ * instead of once per needle. */
+#define URI_MATCHER_MAX_NEEDLES	16
+#define URI_MATCHER_MAX_STATES	128
+#define URI_MATCHER_MAX_CLASSES	32
+
+typedef struct _URIMatcher {
+	gboolean built;
+	gint maxlen;
+	guint8 needle_len[URI_MATCHER_MAX_NEEDLES];
+	/* needle bytes map to their own class, everything else to 0 */
+	guint8 class[256];
+	guint8 delta[URI_MATCHER_MAX_STATES][URI_MATCHER_MAX_CLASSES];
+	/* longest needle ending in a state, or -1 */
+	gint8 out[URI_MATCHER_MAX_STATES];
+} URIMatcher;
+
+static void uri_matcher_build(URIMatcher *m, const gchar **needles,
+			      gint n_needles)
+{
+	gint16 go[URI_MATCHER_MAX_STATES][URI_MATCHER_MAX_CLASSES];
+	guint8 fail[URI_MATCHER_MAX_STATES];
+	guint8 queue[URI_MATCHER_MAX_STATES];
+	gint n_states = 1, n_classes = 1, head = 0, tail = 0;
+	gint i, c;
+
+	cm_return_if_fail(n_needles <= URI_MATCHER_MAX_NEEDLES);
+
+	memset(m, 0, sizeof(*m));
+	memset(go, 0xff, sizeof(go));
+	memset(m->out, 0xff, sizeof(m->out));
+
+	for (i = 0; i < n_needles; i++) {
+		const guchar *p;
+		gint s = 0;
+
+		for (p = (const guchar *)needles[i]; *p; p++) {
+			guchar lc = g_ascii_tolower(*p);
+
+			if (m->class[lc] == 0) {
+				cm_return_if_fail(n_classes < URI_MATCHER_MAX_CLASSES);
+				m->class[lc] = n_classes;
+				m->class[g_ascii_toupper(lc)] = n_classes;
+				n_classes++;
+			}
+			c = m->class[lc];
+			if (go[s][c] < 0) {
+				cm_return_if_fail(n_states < URI_MATCHER_MAX_STATES);
+				go[s][c] = n_states++;
+			}
+			s = go[s][c];
+		}
+		if (m->out[s] < 0)
+			m->out[s] = i;
+		m->needle_len[i] = strlen(needles[i]);
+		m->maxlen = MAX(m->maxlen, m->needle_len[i]);
+	}
+
+	/* breadth-first, so failure links always point at finished states */
+	for (c = 0; c < n_classes; c++) {
+		if (go[0][c] < 0) {
+			m->delta[0][c] = 0;
+		} else {
+			m->delta[0][c] = go[0][c];
+			fail[go[0][c]] = 0;
+			queue[tail++] = go[0][c];
+		}
+	}
+	while (head < tail) {
+		gint s = queue[head++];
+
+		for (c = 0; c < n_classes; c++) {
+			gint t = go[s][c];
+
+			if (t < 0) {
+				m->delta[s][c] = m->delta[fail[s]][c];
+				continue;
+			}
+			m->delta[s][c] = t;
+			fail[t] = m->delta[fail[s]][c];
+			if (m->out[t] < 0)
+				m->out[t] = m->out[fail[t]];
+			queue[tail++] = t;
+		}
+	}
+
+	m->built = TRUE;
+}
+
+/* Returns the leftmost needle occurrence in haystack, preferring the
+ * lowest needle index when several start at the same position, which
+ * is what picking the first of per-needle strcasestr() calls did. */
+static gchar *uri_matcher_search(const URIMatcher *m, const gchar *haystack,
+				 gint *index)
+{
+	const guchar *p, *best = NULL, *limit = NULL;
+	gint s = 0;
+
+	for (p = (const guchar *)haystack; *p && (!limit || p <= limit); p++) {
+		const guchar *start;
+		gint n;
+
+		s = m->delta[s][m->class[*p]];
+		if ((n = m->out[s]) < 0)
+			continue;
+
+		/* out[] holds the longest needle ending here, hence the
+		 * leftmost start; keep scanning while a needle starting at
+		 * or before the best match could still end */
+		start = p - m->needle_len[n] + 1;
+		if (!best || start < best || (start == best && n < *index)) {
+			best = start;
+			*index = n;
+			limit = best + m->maxlen - 1;
+		}
+	}
+
+	return (gchar *)best;
+}
+
 #define ADD_TXT_POS(bp_, ep_, pti_) \
 	if ((last->next = alloca(sizeof(struct txtpos))) != NULL) { \
 		last = last->next; \
@@ -1074,9 +1195,6 @@ static void textview_make_clickable_parts(TextView *textview,
 	struct table {
 		const gchar *needle; /* token */
 
-		/* token search function */
-		gchar    *(*search)	(const gchar *haystack,
-					 const gchar *needle);
 		/* part parsing function */
 		gboolean  (*parse)	(const gchar *start,
 					 const gchar *scanpos,
@@ -1089,19 +1207,20 @@ static void textview_make_clickable_parts(TextView *textview,
 	};
 
 	static struct table parser[] = {
-		{"http://",  strcasestr, get_uri_part,   make_uri_string},
-		{"https://", strcasestr, get_uri_part,   make_uri_string},
-		{"ftp://",   strcasestr, get_uri_part,   make_uri_string},
-		{"ftps://",  strcasestr, get_uri_part,   make_uri_string},
-		{"sftp://",  strcasestr, get_uri_part,   make_uri_string},
-		{"gopher://",strcasestr, get_uri_part,   make_uri_string},
-		{"www.",     strcasestr, get_uri_part,   make_http_string},
-		{"webcal://",strcasestr, get_uri_part,   make_uri_string},
-		{"webcals://",strcasestr, get_uri_part,  make_uri_string},
-		{"mailto:",  strcasestr, get_uri_part,   make_uri_string},
-		{"@",        strcasestr, get_email_part, make_email_string}
+		{"http://",  get_uri_part,   make_uri_string},
+		{"https://", get_uri_part,   make_uri_string},
+		{"ftp://",   get_uri_part,   make_uri_string},
+		{"ftps://",  get_uri_part,   make_uri_string},
+		{"sftp://",  get_uri_part,   make_uri_string},
+		{"gopher://",get_uri_part,   make_uri_string},
+		{"www.",     get_uri_part,   make_http_string},
+		{"webcal://",get_uri_part,   make_uri_string},
+		{"webcals://",get_uri_part,  make_uri_string},
+		{"mailto:",  get_uri_part,   make_uri_string},
+		{"@",        get_email_part, make_email_string}
 	};
 	const gint PARSE_ELEMS = sizeof parser / sizeof parser[0];
+	static URIMatcher matcher;
 
 	gint  n;
 	const gchar *walk, *bp, *ep;
@@ -1120,23 +1239,20 @@ static void textview_make_clickable_parts(TextView *textview,
 
 	gtk_text_buffer_get_end_iter(buffer, &iter);
 
+	if (!matcher.built) {
+		const gchar *needles[G_N_ELEMENTS(parser)];
+
+		for (n = 0; n < PARSE_ELEMS; n++)
+			needles[n] = parser[n].needle;
+		uri_matcher_build(&matcher, needles, PARSE_ELEMS);
+	}
+
 	/* parse for clickable parts, and build a list of begin and end positions  */
 	for (walk = mybuf;;) {
 		gint last_index = PARSE_ELEMS;
-		gchar *scanpos = NULL;
-
-		/* FIXME: this looks phony. scanning for anything in the parse table */
-		for (n = 0; n < PARSE_ELEMS; n++) {
-			gchar *tmp;
+		gchar *scanpos;
 
-			tmp = parser[n].search(walk, parser[n].needle);
-			if (tmp) {
-				if (scanpos == NULL || tmp < scanpos) {
-					scanpos = tmp;
-					last_index = n;
-				}
-			}
-		}
+		scanpos = uri_matcher_search(&matcher, walk, &last_index);
 
 		if (scanpos) {
 			/* check if URI can be parsed */
@@ -1201,9 +1317,6 @@ static void textview_make_clickable_parts_later(TextView *textview,
 	struct table {
 		const gchar *needle; /* token */
 
-		/* token search function */
-		gchar    *(*search)	(const gchar *haystack,
-					 const gchar *needle);
 		/* part parsing function */
 		gboolean  (*parse)	(const gchar *start,
 					 const gchar *scanpos,
@@ -1216,18 +1329,19 @@ static void textview_make_clickable_parts_later(TextView *textview,
 	};
 
 	static struct table parser[] = {
-		{"http://",  strcasestr, get_uri_part,   make_uri_string},
-		{"https://", strcasestr, get_uri_part,   make_uri_string},
-		{"ftp://",   strcasestr, get_uri_part,   make_uri_string},
-		{"ftps://",  strcasestr, get_uri_part,   make_uri_string},
-		{"sftp://",  strcasestr, get_uri_part,   make_uri_string},
-		{"www.",     strcasestr, get_uri_part,   make_http_string},
-		{"mailto:",  strcasestr, get_uri_part,   make_uri_string},
-		{"webcal://",strcasestr, get_uri_part,   make_uri_string},
-		{"webcals://",strcasestr, get_uri_part,  make_uri_string},
-		{"@",        strcasestr, get_email_part, make_email_string}
+		{"http://",  get_uri_part,   make_uri_string},
+		{"https://", get_uri_part,   make_uri_string},
+		{"ftp://",   get_uri_part,   make_uri_string},
+		{"ftps://",  get_uri_part,   make_uri_string},
+		{"sftp://",  get_uri_part,   make_uri_string},
+		{"www.",     get_uri_part,   make_http_string},
+		{"mailto:",  get_uri_part,   make_uri_string},
+		{"webcal://",get_uri_part,   make_uri_string},
+		{"webcals://",get_uri_part,  make_uri_string},
+		{"@",        get_email_part, make_email_string}
 	};
 	const gint PARSE_ELEMS = sizeof parser / sizeof parser[0];
+	static URIMatcher matcher;
 
 	gint  n;
 	const gchar *walk, *bp, *ep;
@@ -1243,23 +1357,20 @@ static void textview_make_clickable_parts_later(TextView *textview,
 	mybuf = gtk_text_buffer_get_text(buffer, &start_iter, &end_iter, FALSE);
 	offset = gtk_text_iter_get_offset(&start_iter);
 
+	if (!matcher.built) {
+		const gchar *needles[G_N_ELEMENTS(parser)];
+
+		for (n = 0; n < PARSE_ELEMS; n++)
+			needles[n] = parser[n].needle;
+		uri_matcher_build(&matcher, needles, PARSE_ELEMS);
+	}
+
 	/* parse for clickable parts, and build a list of begin and end positions  */
 	for (walk = mybuf;;) {
 		gint last_index = PARSE_ELEMS;
-		gchar *scanpos = NULL;
-
-		/* FIXME: this looks phony. scanning for anything in the parse table */
-		for (n = 0; n < PARSE_ELEMS; n++) {
-			gchar *tmp;
+		gchar *scanpos;
 
-			tmp = parser[n].search(walk, parser[n].needle);
-			if (tmp) {
-				if (scanpos == NULL || tmp < scanpos) {
-					scanpos = tmp;
-					last_index = n;
-				}
-			}
-		}
+		scanpos = uri_matcher_search(&matcher, walk, &last_index);
 
 		if (scanpos) {
 			/* check if URI can be parsed */
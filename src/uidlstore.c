@@ -0,0 +1,576 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2026 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uidlstore.h"
+#include "utils.h"
+
+/*
+ * The UIDs of the messages seen on a POP3 server, kept in a file that is
+ * memory-mapped and probed in place. All integers are little-endian:
+ *
+ *   header	UIDLStoreHeader
+ *   slots	n_slots offsets of records from the start of the file, 0 for
+ *		an empty slot; open addressing with linear probing
+ *   records	UIDLStoreRecord followed by the UID, padded to 8 bytes
+ *
+ * New UIDs are appended and their slot filled in. Records are updated and
+ * deleted in place, a deleted record staying as a tombstone until the
+ * file is next rebuilt, which happens when the table fills up.
+ *
+ * The counts in the header are only written on close and prune, so they
+ * are recounted from the slots on open rather than trusted.
+ */
+
+#define UIDL_STORE_MAGIC	0x4c444955	/* "UIDL" */
+#define UIDL_STORE_VERSION	1
+#define UIDL_STORE_MIN_SLOTS	1024
+
+typedef struct _UIDLStoreHeader	UIDLStoreHeader;
+typedef struct _UIDLStoreRecord	UIDLStoreRecord;
+
+struct _UIDLStoreHeader {
+	guint32 magic;
+	guint32 version;
+	guint32 n_slots;
+	guint32 n_live;
+	guint32 n_used;		/* live records and tombstones */
+	guint32 reserved;
+};
+
+struct _UIDLStoreRecord {
+	gint64	recv_time;
+	guint32	hash;
+	guint16	len;
+	guint8	partial_recv;
+	guint8	deleted;
+};
+
+struct _UIDLStore {
+	gchar *path;
+	gint fd;
+	gchar *map;
+	gsize map_len;
+	gsize file_len;
+	UIDLStoreHeader header;	/* in host byte order */
+	gboolean header_dirty;
+	/* per slot, whether the UID was looked up or set since opening */
+	guint8 *seen;
+};
+
+#define RECORD_SIZE(len) \
+	((sizeof(UIDLStoreRecord) + (len) + 7) & ~(gsize)7)
+#define SLOTS_OFFSET	sizeof(UIDLStoreHeader)
+
+static guint32 uidl_hash(const gchar *uidl, gsize len)
+{
+	guint32 h = 2166136261u;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (guchar)uidl[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static gboolean uidl_store_map(UIDLStore *store)
+{
+	GStatBuf st;
+
+	if (store->map != NULL)
+		munmap(store->map, store->map_len);
+	store->map = NULL;
+	store->map_len = 0;
+
+	if (fstat(store->fd, &st) < 0) {
+		FILE_OP_ERROR(store->path, "fstat");
+		return FALSE;
+	}
+	store->file_len = st.st_size;
+	store->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, store->fd, 0);
+	if (store->map == MAP_FAILED) {
+		FILE_OP_ERROR(store->path, "mmap");
+		store->map = NULL;
+		return FALSE;
+	}
+	store->map_len = st.st_size;
+	return TRUE;
+}
+
+static guint32 uidl_store_slot(UIDLStore *store, guint32 i)
+{
+	const guint32 *slots = (const guint32 *)(store->map + SLOTS_OFFSET);
+
+	return GUINT32_FROM_LE(slots[i]);
+}
+
+/* Returns the record at off, remapping the file if it was appended
+ * after the file was last mapped. */
+static const UIDLStoreRecord *uidl_store_record(UIDLStore *store, guint32 off)
+{
+	if (off + sizeof(UIDLStoreRecord) > store->map_len &&
+	    !uidl_store_map(store))
+		return NULL;
+	if (off + sizeof(UIDLStoreRecord) > store->map_len)
+		return NULL;
+	return (const UIDLStoreRecord *)(store->map + off);
+}
+
+/* Probes for uidl. Returns its slot with *found set, or else the empty
+ * slot where it would go; -1 on error. */
+static gint64 uidl_store_find(UIDLStore *store, const gchar *uidl, gsize len,
+			      guint32 hash, gboolean *found)
+{
+	guint32 mask = store->header.n_slots - 1;
+	guint32 i, n;
+
+	*found = FALSE;
+	for (i = hash & mask, n = 0; n < store->header.n_slots;
+	     i = (i + 1) & mask, n++) {
+		const UIDLStoreRecord *rec;
+		guint32 off = uidl_store_slot(store, i);
+
+		if (off == 0)
+			return i;
+		if ((rec = uidl_store_record(store, off)) == NULL)
+			return -1;
+		if (rec->deleted ||
+		    GUINT32_FROM_LE(rec->hash) != hash ||
+		    GUINT16_FROM_LE(rec->len) != len ||
+		    off + sizeof(UIDLStoreRecord) + len > store->map_len ||
+		    memcmp(rec + 1, uidl, len) != 0)
+			continue;
+		*found = TRUE;
+		return i;
+	}
+	return -1;
+}
+
+static gint uidl_store_pwrite(UIDLStore *store, gconstpointer data,
+			      gsize len, goffset off)
+{
+	if (pwrite(store->fd, data, len, off) != (gssize)len) {
+		FILE_OP_ERROR(store->path, "pwrite");
+		return -1;
+	}
+	return 0;
+}
+
+static gint uidl_store_write_header(UIDLStore *store)
+{
+	UIDLStoreHeader header;
+
+	header.magic = GUINT32_TO_LE(store->header.magic);
+	header.version = GUINT32_TO_LE(store->header.version);
+	header.n_slots = GUINT32_TO_LE(store->header.n_slots);
+	header.n_live = GUINT32_TO_LE(store->header.n_live);
+	header.n_used = GUINT32_TO_LE(store->header.n_used);
+	header.reserved = 0;
+
+	if (uidl_store_pwrite(store, &header, sizeof(header), 0) < 0)
+		return -1;
+	store->header_dirty = FALSE;
+	return 0;
+}
+
+static gboolean uidl_store_read_header(UIDLStore *store)
+{
+	const UIDLStoreHeader *header = (const UIDLStoreHeader *)store->map;
+
+	if (store->map_len < sizeof(UIDLStoreHeader))
+		return FALSE;
+
+	store->header.magic = GUINT32_FROM_LE(header->magic);
+	store->header.version = GUINT32_FROM_LE(header->version);
+	store->header.n_slots = GUINT32_FROM_LE(header->n_slots);
+	store->header.n_live = GUINT32_FROM_LE(header->n_live);
+	store->header.n_used = GUINT32_FROM_LE(header->n_used);
+
+	if (store->header.magic != UIDL_STORE_MAGIC ||
+	    store->header.version != UIDL_STORE_VERSION ||
+	    store->header.n_slots < UIDL_STORE_MIN_SLOTS ||
+	    (store->header.n_slots & (store->header.n_slots - 1)) != 0 ||
+	    SLOTS_OFFSET + (gsize)store->header.n_slots * 4 > store->map_len)
+		return FALSE;
+	return TRUE;
+}
+
+/* Counts the used slots and live records, which the header on disk does
+ * not have right if the store was not closed. */
+static void uidl_store_count(UIDLStore *store)
+{
+	guint32 i, n_live = 0, n_used = 0;
+
+	for (i = 0; i < store->header.n_slots; i++) {
+		const UIDLStoreRecord *rec;
+		guint32 off = uidl_store_slot(store, i);
+
+		if (off == 0)
+			continue;
+		n_used++;
+		if ((rec = uidl_store_record(store, off)) != NULL && !rec->deleted)
+			n_live++;
+	}
+
+	if (n_live != store->header.n_live || n_used != store->header.n_used) {
+		store->header.n_live = n_live;
+		store->header.n_used = n_used;
+		store->header_dirty = TRUE;
+	}
+}
+
+/* Writes the live records into a new file with n_slots slots, which
+ * then replaces the current one. */
+static gint uidl_store_rebuild(UIDLStore *store, guint32 n_slots)
+{
+	UIDLStoreHeader header;
+	GByteArray *records;
+	guint32 *slots;
+	guint8 *seen;
+	guint32 base = SLOTS_OFFSET + n_slots * 4;
+	guint32 mask = n_slots - 1;
+	guint32 i, j, live = 0;
+	gchar *tmp_path;
+	FILE *fp;
+	gint fd;
+
+	records = g_byte_array_new();
+	slots = g_new0(guint32, n_slots);
+	seen = g_new0(guint8, n_slots);
+
+	for (i = 0; store->map != NULL && i < store->header.n_slots; i++) {
+		const UIDLStoreRecord *rec;
+		guint32 off = uidl_store_slot(store, i);
+		gsize size;
+
+		if (off == 0 || (rec = uidl_store_record(store, off)) == NULL ||
+		    rec->deleted)
+			continue;
+		size = RECORD_SIZE(GUINT16_FROM_LE(rec->len));
+		if (off + size > store->map_len)
+			continue;
+
+		for (j = GUINT32_FROM_LE(rec->hash) & mask; slots[j] != 0;
+		     j = (j + 1) & mask)
+			;
+		slots[j] = GUINT32_TO_LE(base + records->len);
+		seen[j] = store->seen[i];
+		g_byte_array_append(records, (const guint8 *)rec, size);
+		live++;
+	}
+
+	header.magic = GUINT32_TO_LE(UIDL_STORE_MAGIC);
+	header.version = GUINT32_TO_LE(UIDL_STORE_VERSION);
+	header.n_slots = GUINT32_TO_LE(n_slots);
+	header.n_live = GUINT32_TO_LE(live);
+	header.n_used = GUINT32_TO_LE(live);
+	header.reserved = 0;
+
+	tmp_path = g_strconcat(store->path, ".tmp", NULL);
+	if ((fp = g_fopen(tmp_path, "wb")) == NULL) {
+		FILE_OP_ERROR(tmp_path, "g_fopen");
+		goto err;
+	}
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(slots, 4, n_slots, fp) != n_slots ||
+	    (records->len > 0 &&
+	     fwrite(records->data, records->len, 1, fp) != 1)) {
+		FILE_OP_ERROR(tmp_path, "fwrite");
+		fclose(fp);
+		unlink(tmp_path);
+		goto err;
+	}
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(tmp_path, "fclose");
+		unlink(tmp_path);
+		goto err;
+	}
+	if (g_rename(tmp_path, store->path) < 0) {
+		FILE_OP_ERROR(store->path, "rename");
+		unlink(tmp_path);
+		goto err;
+	}
+	if ((fd = g_open(store->path, O_RDWR, 0)) < 0) {
+		FILE_OP_ERROR(store->path, "g_open");
+		goto err;
+	}
+
+	close(store->fd);
+	store->fd = fd;
+	if (!uidl_store_map(store))
+		goto err;
+	store->header.magic = UIDL_STORE_MAGIC;
+	store->header.version = UIDL_STORE_VERSION;
+	store->header.n_slots = n_slots;
+	store->header.n_live = live;
+	store->header.n_used = live;
+	store->header_dirty = FALSE;
+	g_free(store->seen);
+	store->seen = seen;
+
+	g_free(tmp_path);
+	g_free(slots);
+	g_byte_array_free(records, TRUE);
+	return 0;
+
+err:
+	g_free(tmp_path);
+	g_free(seen);
+	g_free(slots);
+	g_byte_array_free(records, TRUE);
+	return -1;
+}
+
+/* The table size that keeps it at most a quarter full with n records. */
+static guint32 uidl_store_size_for(guint32 n)
+{
+	guint32 n_slots = UIDL_STORE_MIN_SLOTS;
+
+	while (n_slots < n * 4)
+		n_slots *= 2;
+	return n_slots;
+}
+
+/*!
+ *\brief	Open the UIDL store at path, creating an empty one if there
+ *		is none or the file is not usable.
+ *
+ *\param	created Set when a new store had to be made, so that the
+ *		caller can fill it from older data
+ */
+UIDLStore *uidl_store_open(const gchar *path, gboolean *created)
+{
+	UIDLStore *store;
+	gchar *dir;
+
+	cm_return_val_if_fail(path != NULL, NULL);
+
+	*created = FALSE;
+
+	dir = g_path_get_dirname(path);
+	if (!is_dir_exist(dir))
+		make_dir_hier(dir);
+	g_free(dir);
+
+	store = g_new0(UIDLStore, 1);
+	store->path = g_strdup(path);
+
+	if ((store->fd = g_open(path, O_RDWR, 0)) >= 0 &&
+	    uidl_store_map(store) && uidl_store_read_header(store)) {
+		store->seen = g_new0(guint8, store->header.n_slots);
+		uidl_store_count(store);
+		return store;
+	}
+
+	if (store->fd < 0 && errno != ENOENT)
+		FILE_OP_ERROR(path, "g_open");
+	else if (store->fd >= 0)
+		g_warning("UIDL store %s is damaged, starting a new one", path);
+	if (store->map != NULL)
+		munmap(store->map, store->map_len);
+	store->map = NULL;
+	store->map_len = 0;
+	store->header.n_slots = 0;
+
+	/* uidl_store_rebuild() needs an fd to replace */
+	if (store->fd < 0 &&
+	    (store->fd = g_open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+		FILE_OP_ERROR(path, "g_open");
+		g_free(store->path);
+		g_free(store);
+		return NULL;
+	}
+	if (uidl_store_rebuild(store, UIDL_STORE_MIN_SLOTS) < 0) {
+		uidl_store_close(store);
+		return NULL;
+	}
+
+	*created = TRUE;
+	return store;
+}
+
+void uidl_store_close(UIDLStore *store)
+{
+	if (store == NULL)
+		return;
+
+	if (store->header_dirty)
+		uidl_store_write_header(store);
+	if (store->map != NULL)
+		munmap(store->map, store->map_len);
+	if (store->fd >= 0)
+		close(store->fd);
+	g_free(store->seen);
+	g_free(store->path);
+	g_free(store);
+}
+
+gboolean uidl_store_lookup(UIDLStore *store, const gchar *uidl,
+			   time_t *recv_time, gint *partial_recv)
+{
+	const UIDLStoreRecord *rec;
+	gsize len = strlen(uidl);
+	gboolean found;
+	gint64 slot;
+
+	slot = uidl_store_find(store, uidl, len, uidl_hash(uidl, len), &found);
+	if (slot < 0 || !found)
+		return FALSE;
+
+	rec = uidl_store_record(store, uidl_store_slot(store, slot));
+	store->seen[slot] = TRUE;
+	*recv_time = (time_t)GINT64_FROM_LE(rec->recv_time);
+	*partial_recv = rec->partial_recv;
+	return TRUE;
+}
+
+gint uidl_store_set(UIDLStore *store, const gchar *uidl, time_t recv_time,
+		    gint partial_recv)
+{
+	UIDLStoreRecord rec;
+	gsize len = strlen(uidl);
+	guint32 hash = uidl_hash(uidl, len);
+	gboolean found;
+	gint64 slot;
+	guint32 off, off_le;
+	gchar *buf;
+	gint ret;
+
+	cm_return_val_if_fail(len > 0 && len <= G_MAXUINT16, -1);
+
+	slot = uidl_store_find(store, uidl, len, hash, &found);
+	if (slot < 0)
+		return -1;
+
+	rec.recv_time = GINT64_TO_LE((gint64)recv_time);
+	rec.hash = GUINT32_TO_LE(hash);
+	rec.len = GUINT16_TO_LE(len);
+	rec.partial_recv = partial_recv;
+	rec.deleted = FALSE;
+
+	if (found) {
+		const UIDLStoreRecord *old;
+
+		off = uidl_store_slot(store, slot);
+		store->seen[slot] = TRUE;
+		/* most messages are the same as when the session began */
+		old = uidl_store_record(store, off);
+		if (old != NULL && old->recv_time == rec.recv_time &&
+		    old->partial_recv == rec.partial_recv)
+			return 0;
+		/* the fixed part only, in place */
+		return uidl_store_pwrite(store, &rec, sizeof(rec), off);
+	}
+
+	if ((store->header.n_used + 1) * 2 > store->header.n_slots) {
+		if (uidl_store_rebuild(store,
+			uidl_store_size_for(store->header.n_live + 1)) < 0)
+			return -1;
+		slot = uidl_store_find(store, uidl, len, hash, &found);
+		if (slot < 0)
+			return -1;
+	}
+
+	off = store->file_len;
+	buf = g_malloc0(RECORD_SIZE(len));
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + sizeof(rec), uidl, len);
+	ret = uidl_store_pwrite(store, buf, RECORD_SIZE(len), off);
+	g_free(buf);
+	if (ret < 0)
+		return -1;
+	store->file_len += RECORD_SIZE(len);
+
+	off_le = GUINT32_TO_LE(off);
+	if (uidl_store_pwrite(store, &off_le, 4, SLOTS_OFFSET + slot * 4) < 0)
+		return -1;
+
+	store->seen[slot] = TRUE;
+	store->header.n_live++;
+	store->header.n_used++;
+	store->header_dirty = TRUE;
+	return 0;
+}
+
+static gint uidl_store_delete_slot(UIDLStore *store, guint32 slot)
+{
+	guint8 deleted = TRUE;
+	guint32 off = uidl_store_slot(store, slot);
+
+	if (uidl_store_pwrite(store, &deleted, 1,
+			      off + G_STRUCT_OFFSET(UIDLStoreRecord, deleted)) < 0)
+		return -1;
+	store->header.n_live--;
+	store->header_dirty = TRUE;
+	return 0;
+}
+
+gint uidl_store_remove(UIDLStore *store, const gchar *uidl)
+{
+	gsize len = strlen(uidl);
+	gboolean found;
+	gint64 slot;
+
+	slot = uidl_store_find(store, uidl, len, uidl_hash(uidl, len), &found);
+	if (slot < 0)
+		return -1;
+	if (!found)
+		return 0;
+	return uidl_store_delete_slot(store, slot);
+}
+
+/*!
+ *\brief	Delete every UID that was neither looked up nor set since
+ *		the store was opened, i.e. that the server no longer has.
+ *		The file is compacted once tombstones outnumber records.
+ */
+gint uidl_store_prune(UIDLStore *store)
+{
+	guint32 i;
+
+	for (i = 0; i < store->header.n_slots; i++) {
+		const UIDLStoreRecord *rec;
+		guint32 off = uidl_store_slot(store, i);
+
+		if (off == 0 || store->seen[i])
+			continue;
+		if ((rec = uidl_store_record(store, off)) == NULL)
+			return -1;
+		if (!rec->deleted && uidl_store_delete_slot(store, i) < 0)
+			return -1;
+	}
+
+	if (store->header.n_used - store->header.n_live > store->header.n_live &&
+	    store->header.n_used > UIDL_STORE_MIN_SLOTS / 8)
+		return uidl_store_rebuild(store,
+			uidl_store_size_for(store->header.n_live));
+
+	if (store->header_dirty)
+		return uidl_store_write_header(store);
+	return 0;
+}
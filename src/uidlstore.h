@@ -0,0 +1,43 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2026 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UIDLSTORE_H__
+#define __UIDLSTORE_H__
+
+#include <glib.h>
+#include <time.h>
+
+typedef struct _UIDLStore	UIDLStore;
+
+UIDLStore *uidl_store_open	(const gchar	*path,
+				 gboolean	*created);
+void uidl_store_close		(UIDLStore	*store);
+
+gboolean uidl_store_lookup	(UIDLStore	*store,
+				 const gchar	*uidl,
+				 time_t		*recv_time,
+				 gint		*partial_recv);
+gint uidl_store_set		(UIDLStore	*store,
+				 const gchar	*uidl,
+				 time_t		 recv_time,
+				 gint		 partial_recv);
+gint uidl_store_remove		(UIDLStore	*store,
+				 const gchar	*uidl);
+gint uidl_store_prune		(UIDLStore	*store);
+
+#endif /* __UIDLSTORE_H__ */